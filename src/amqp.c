@@ -31,8 +31,11 @@
 #include "plugin.h"
 #include "utils_cmd_putval.h"
 #include "utils_format_json.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
 
 #include <pthread.h>
+#include <poll.h>
 
 #include <amqp.h>
 #include <amqp_framing.h>
@@ -47,9 +50,38 @@
 
 #define CAMQP_CHANNEL 1
 
+#define CAMQP_DEFAULT_QUEUE_LIMIT 1024
+
 /*
  * Data types
  */
+/* A complete message waiting to be sent by the publisher thread. */
+struct camqp_message_s;
+typedef struct camqp_message_s camqp_message_t;
+struct camqp_message_s
+{
+    char   *routing_key;
+    char   *body;
+    size_t  body_len;
+    size_t  values_num;
+
+    camqp_message_t *next;
+};
+
+/* Values accumulated for one routing key. The buffer is handed over to a
+ * message once "batch_size" values have been collected or the batch timed
+ * out. */
+struct camqp_batch_s
+{
+    char    *routing_key;
+    char    *buffer;
+    size_t   buffer_size;
+    size_t   buffer_fill;
+    size_t   values_num;
+    cdtime_t init_time;
+};
+typedef struct camqp_batch_s camqp_batch_t;
+
 struct camqp_config_s
 {
     _Bool   publish;
@@ -68,10 +100,29 @@ struct camqp_config_s
     uint8_t delivery_mode;
     _Bool   store_rates;
     int     format;
+    _Bool   confirm;
+
+    /* publish only, batching. Only used if "batch_size" is greater than one. */
+    size_t   batch_size;
+    cdtime_t batch_timeout;
+    size_t   queue_limit;
+    c_avl_tree_t    *batches;
+    camqp_message_t *queue_head;
+    camqp_message_t *queue_tail;
+    size_t   queue_length;
+    uint64_t queue_dropped;
+    c_complain_t queue_complaint;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t  queue_cond;
+    pthread_t publisher_thread;
+    _Bool   publisher_running;
 
     /* subscribe only */
     char   *exchange_type;
     char   *queue;
+    char   *body_buffer;
+    size_t  body_buffer_size;
+    FILE   *putval_fh;
 
     amqp_connection_state_t connection;
     pthread_mutex_t lock;
@@ -91,6 +142,9 @@ static pthread_t *subscriber_threads     = NULL;
 static size_t     subscriber_threads_num = 0;
 static _Bool      subscriber_threads_running = 1;
 
+static camqp_config_t **publishers     = NULL;
+static size_t           publishers_num = 0;
+
 #define CONF(c,f) (((c)->f != NULL) ? (c)->f : def_##f)
 
 /*
@@ -130,6 +184,42 @@ static void camqp_config_free (void *ptr) /* {{{ */
     sfree (conf->queue);
     sfree (conf->routing_key);
 
+    if (conf->batches != NULL)
+    {
+        void *key;
+        void *value;
+
+        while (c_avl_pick (conf->batches, &key, &value) == 0)
+        {
+            camqp_batch_t *batch = value;
+
+            sfree (batch->routing_key);
+            sfree (batch->buffer);
+            sfree (batch);
+        }
+        c_avl_destroy (conf->batches);
+        conf->batches = NULL;
+    }
+
+    while (conf->queue_head != NULL)
+    {
+        camqp_message_t *msg = conf->queue_head;
+
+        conf->queue_head = msg->next;
+        sfree (msg->routing_key);
+        sfree (msg->body);
+        sfree (msg);
+    }
+    conf->queue_tail = NULL;
+
+    sfree (conf->body_buffer);
+    if ((conf->putval_fh != NULL) && (conf->putval_fh != stderr))
+        fclose (conf->putval_fh);
+
+    pthread_cond_destroy (&conf->queue_cond);
+    pthread_mutex_destroy (&conf->queue_lock);
+    pthread_mutex_destroy (&conf->lock);
+
     sfree (conf);
 } /* }}} void camqp_config_free */
 
@@ -435,6 +525,21 @@ static int camqp_connect (camqp_config_t *conf) /* {{{ */
         return (1);
     }
 
+#if HAVE_AMQP_CONFIRM_SELECT
+    if (conf->publish && conf->confirm)
+    {
+        amqp_confirm_select (conf->connection, CAMQP_CHANNEL);
+        if (camqp_is_error (conf))
+        {
+            char errbuf[1024];
+            ERROR ("amqp plugin: amqp_confirm_select failed: %s",
+                    camqp_strerror (conf, errbuf, sizeof (errbuf)));
+            camqp_close_connection (conf);
+            return (1);
+        }
+    }
+#endif
+
     INFO ("amqp plugin: Successfully opened connection to vhost \"%s\" "
             "on %s:%i.", CONF(conf, vhost), CONF(conf, host), conf->port);
 
@@ -469,23 +574,94 @@ static int camqp_shutdown (void) /* {{{ */
 
     DEBUG ("amqp plugin: All subscriber threads exited.");
 
+    /* The publisher threads send all pending messages before exiting. The
+     * configurations themselves are freed together with the write
+     * callbacks. */
+    for (i = 0; i < publishers_num; i++)
+    {
+        camqp_config_t *conf = publishers[i];
+
+        pthread_mutex_lock (&conf->queue_lock);
+        conf->publisher_running = 0;
+        pthread_cond_broadcast (&conf->queue_cond);
+        pthread_mutex_unlock (&conf->queue_lock);
+
+        pthread_join (conf->publisher_thread, /* retval = */ NULL);
+    }
+
+    publishers_num = 0;
+    sfree (publishers);
+
+    DEBUG ("amqp plugin: All publisher threads exited.");
+
     return (0);
 } /* }}} int camqp_shutdown */
 
 /*
  * Subscribing code
  */
+/* Dispatches all PUTVAL commands in a "text/collectd" body. Batching
+ * publishers send many newline separated commands in one message. */
+static int camqp_dispatch_commands (camqp_config_t *conf, char *body) /* {{{ */
+{
+    char *line;
+    char *saveptr;
+    int errors;
+
+    /* handle_putval() reports success for each line. Send those messages to
+     * nowhere and log failures ourselves. */
+    if (conf->putval_fh == NULL)
+    {
+        conf->putval_fh = fopen ("/dev/null", "w");
+        if (conf->putval_fh == NULL)
+            conf->putval_fh = stderr;
+    }
+
+    errors = 0;
+    saveptr = NULL;
+    for (line = strtok_r (body, "\r\n", &saveptr);
+            line != NULL;
+            line = strtok_r (NULL, "\r\n", &saveptr))
+    {
+        int status;
+
+        status = handle_putval (conf->putval_fh, line);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: handle_putval failed with status %i "
+                    "for line \"%s\".", status, line);
+            errors++;
+        }
+    }
+
+    return ((errors == 0) ? 0 : -1);
+} /* }}} int camqp_dispatch_commands */
+
 static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         size_t body_size, const char *content_type)
 {
-    char body[body_size + 1];
     char *body_ptr;
     size_t received;
     amqp_frame_t frame;
     int status;
 
-    memset (body, 0, sizeof (body));
-    body_ptr = &body[0];
+    /* The receive buffer is kept around between messages, so that batched
+     * messages don't cause an allocation each. */
+    if (conf->body_buffer_size < (body_size + 1))
+    {
+        char *tmp;
+
+        tmp = realloc (conf->body_buffer, body_size + 1);
+        if (tmp == NULL)
+        {
+            ERROR ("amqp plugin: realloc failed.");
+            return (ENOMEM);
+        }
+        conf->body_buffer = tmp;
+        conf->body_buffer_size = body_size + 1;
+    }
+
+    body_ptr = conf->body_buffer;
     received = 0;
 
     while (received < body_size)
@@ -519,14 +695,11 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         body_ptr += frame.payload.body_fragment.len;
         received += frame.payload.body_fragment.len;
     } /* while (received < body_size) */
+    conf->body_buffer[received] = 0;
 
     if (strcasecmp ("text/collectd", content_type) == 0)
     {
-        status = handle_putval (stderr, body);
-        if (status != 0)
-            ERROR ("amqp plugin: handle_putval failed with status %i.",
-                    status);
-        return (status);
+        return (camqp_dispatch_commands (conf, conf->body_buffer));
     }
     else if (strcasecmp ("application/json", content_type) == 0)
     {
@@ -680,11 +853,103 @@ static int camqp_subscribe_init (camqp_config_t *conf) /* {{{ */
 /*
  * Publishing code
  */
+#if HAVE_AMQP_CONFIRM_SELECT
+/* Waits for the broker to acknowledge the last published message. Since only
+ * one message is in flight at any time, the delivery tag doesn't need to be
+ * checked. Waits for at most one interval, so a stalled broker doesn't block
+ * the publisher thread forever. */
+static int camqp_wait_confirm (camqp_config_t *conf) /* {{{ */
+{
+    amqp_frame_t frame;
+    cdtime_t deadline;
+    int status;
+
+    deadline = cdtime () + interval_g;
+
+    while (42)
+    {
+        /* amqp_simple_wait_frame() blocks until a complete frame has been
+         * read. Only call it if data is buffered already or the socket is
+         * readable. */
+        if (!amqp_frames_enqueued (conf->connection)
+                && !amqp_data_in_buffer (conf->connection))
+        {
+            struct pollfd pfd;
+            cdtime_t now;
+
+            now = cdtime ();
+            if (now >= deadline)
+            {
+                ERROR ("amqp plugin: Timed out waiting for a publisher "
+                        "confirm.");
+                camqp_close_connection (conf);
+                return (ETIMEDOUT);
+            }
+
+            memset (&pfd, 0, sizeof (pfd));
+            pfd.fd = amqp_get_sockfd (conf->connection);
+            pfd.events = POLLIN;
+
+            status = poll (&pfd, 1,
+                    (int) CDTIME_T_TO_MS (deadline - now) + 1);
+            if ((status < 0) && (errno == EINTR))
+                continue;
+            else if (status < 0)
+            {
+                char errbuf[1024];
+                status = errno;
+                ERROR ("amqp plugin: poll failed: %s",
+                        sstrerror (status, errbuf, sizeof (errbuf)));
+                camqp_close_connection (conf);
+                return (status);
+            }
+            else if (status == 0)
+                continue; /* check the deadline */
+        }
+
+        status = amqp_simple_wait_frame (conf->connection, &frame);
+        if (status < 0)
+        {
+            char errbuf[1024];
+            status = (-1) * status;
+            ERROR ("amqp plugin: amqp_simple_wait_frame failed: %s",
+                    sstrerror (status, errbuf, sizeof (errbuf)));
+            camqp_close_connection (conf);
+            return (status);
+        }
+
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+            continue;
+
+        if (frame.payload.method.id == AMQP_BASIC_ACK_METHOD)
+            return (0);
+        else if (frame.payload.method.id == AMQP_BASIC_NACK_METHOD)
+        {
+            WARNING ("amqp plugin: The broker rejected a message.");
+            return (-1);
+        }
+        else if ((frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD)
+                || (frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD))
+        {
+            ERROR ("amqp plugin: The broker closed the channel while "
+                    "waiting for a publisher confirm.");
+            camqp_close_connection (conf);
+            return (-1);
+        }
+        /* else: e.g. "basic.return"; keep waiting */
+    }
+
+    /* not reached */
+    return (-1);
+} /* }}} int camqp_wait_confirm */
+#endif
+
 /* XXX: You must hold "conf->lock" when calling this function! */
 static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
-        const char *buffer, const char *routing_key)
+        const char *buffer, size_t buffer_len, const char *routing_key)
 {
     amqp_basic_properties_t props;
+    amqp_bytes_t body;
     int status;
 
     status = camqp_connect (conf);
@@ -704,6 +969,9 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
     props.delivery_mode = conf->delivery_mode;
     props.app_id = amqp_cstring_bytes("collectd");
 
+    body.len = buffer_len;
+    body.bytes = (void *) buffer;
+
     status = amqp_basic_publish(conf->connection,
                 /* channel = */ 1,
                 amqp_cstring_bytes(CONF(conf, exchange)),
@@ -711,17 +979,376 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
                 /* mandatory = */ 0,
                 /* immediate = */ 0,
                 &props,
-                amqp_cstring_bytes(buffer));
+                body);
     if (status != 0)
     {
         ERROR ("amqp plugin: amqp_basic_publish failed with status %i.",
                 status);
         camqp_close_connection (conf);
+        return (status);
     }
 
+#if HAVE_AMQP_CONFIRM_SELECT
+    if (conf->confirm)
+        status = camqp_wait_confirm (conf);
+#endif
+
     return (status);
 } /* }}} int camqp_write_locked */
 
+static void camqp_message_free (camqp_message_t *msg) /* {{{ */
+{
+    if (msg == NULL)
+        return;
+
+    sfree (msg->routing_key);
+    sfree (msg->body);
+    sfree (msg);
+} /* }}} void camqp_message_free */
+
+/* XXX: You must hold "conf->queue_lock" when calling this function! */
+static void camqp_queue_append (camqp_config_t *conf, /* {{{ */
+        camqp_message_t *msg)
+{
+    /* The queue is full: Drop the oldest message, the most recent values are
+     * the most interesting ones. */
+    while ((conf->queue_limit > 0)
+            && (conf->queue_length >= conf->queue_limit)
+            && (conf->queue_head != NULL))
+    {
+        camqp_message_t *old = conf->queue_head;
+
+        conf->queue_head = old->next;
+        if (conf->queue_head == NULL)
+            conf->queue_tail = NULL;
+        conf->queue_length--;
+        conf->queue_dropped += old->values_num;
+
+        c_complain (LOG_WARNING, &conf->queue_complaint,
+                "amqp plugin: Publish \"%s\": The send queue is full. "
+                "%"PRIu64" values have been dropped so far.",
+                conf->name, conf->queue_dropped);
+
+        camqp_message_free (old);
+    }
+
+    msg->next = NULL;
+    if (conf->queue_tail == NULL)
+        conf->queue_head = msg;
+    else
+        conf->queue_tail->next = msg;
+    conf->queue_tail = msg;
+    conf->queue_length++;
+
+    pthread_cond_signal (&conf->queue_cond);
+} /* }}} void camqp_queue_append */
+
+/* Moves the accumulated values of "batch" into a message and appends it to
+ * the send queue.
+ * XXX: You must hold "conf->queue_lock" when calling this function! */
+static int camqp_batch_seal (camqp_config_t *conf, /* {{{ */
+        camqp_batch_t *batch)
+{
+    camqp_message_t *msg;
+
+    if (batch->values_num == 0)
+        return (0);
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        /* There is always room for the closing bracket, see
+         * camqp_batch_append(). */
+        batch->buffer[batch->buffer_fill] = ']';
+        batch->buffer_fill++;
+        batch->buffer[batch->buffer_fill] = 0;
+    }
+
+    msg = malloc (sizeof (*msg));
+    if (msg == NULL)
+    {
+        ERROR ("amqp plugin: malloc failed.");
+        return (ENOMEM);
+    }
+    memset (msg, 0, sizeof (*msg));
+
+    msg->routing_key = strdup (batch->routing_key);
+    if (msg->routing_key == NULL)
+    {
+        ERROR ("amqp plugin: strdup failed.");
+        sfree (msg);
+        return (ENOMEM);
+    }
+    msg->body = batch->buffer;
+    msg->body_len = batch->buffer_fill;
+    msg->values_num = batch->values_num;
+
+    batch->buffer = NULL;
+    batch->buffer_size = 0;
+    batch->buffer_fill = 0;
+    batch->values_num = 0;
+
+    camqp_queue_append (conf, msg);
+    return (0);
+} /* }}} int camqp_batch_seal */
+
+/* Seals all batches which are older than "timeout". A timeout of zero seals
+ * all batches.
+ * XXX: You must hold "conf->queue_lock" when calling this function! */
+static void camqp_batch_seal_all (camqp_config_t *conf, /* {{{ */
+        cdtime_t timeout)
+{
+    c_avl_iterator_t *iter;
+    void *key;
+    void *value;
+    cdtime_t now;
+
+    now = cdtime ();
+
+    iter = c_avl_get_iterator (conf->batches);
+    while (c_avl_iterator_next (iter, &key, &value) == 0)
+    {
+        camqp_batch_t *batch = value;
+
+        if (batch->values_num == 0)
+            continue;
+
+        if ((timeout > 0) && ((batch->init_time + timeout) > now))
+            continue;
+
+        camqp_batch_seal (conf, batch);
+    }
+    c_avl_iterator_destroy (iter);
+} /* }}} void camqp_batch_seal_all */
+
+/* Appends one formatted value list to the batch for "routing_key".
+ * XXX: You must hold "conf->queue_lock" when calling this function! */
+static int camqp_batch_append (camqp_config_t *conf, /* {{{ */
+        const char *routing_key, const char *buffer)
+{
+    camqp_batch_t *batch = NULL;
+    size_t buffer_len;
+    size_t required;
+
+    if (c_avl_get (conf->batches, routing_key, (void *) &batch) != 0)
+    {
+        batch = malloc (sizeof (*batch));
+        if (batch == NULL)
+        {
+            ERROR ("amqp plugin: malloc failed.");
+            return (ENOMEM);
+        }
+        memset (batch, 0, sizeof (*batch));
+
+        batch->routing_key = strdup (routing_key);
+        if (batch->routing_key == NULL)
+        {
+            ERROR ("amqp plugin: strdup failed.");
+            sfree (batch);
+            return (ENOMEM);
+        }
+
+        if (c_avl_insert (conf->batches, batch->routing_key, batch) != 0)
+        {
+            ERROR ("amqp plugin: c_avl_insert failed.");
+            sfree (batch->routing_key);
+            sfree (batch);
+            return (-1);
+        }
+    }
+
+    buffer_len = strlen (buffer);
+    /* One byte for the separator (newline or the closing bracket) plus the
+     * terminating null byte. */
+    required = batch->buffer_fill + buffer_len + 2;
+    if (required > batch->buffer_size)
+    {
+        size_t new_size;
+        char *tmp;
+
+        new_size = (batch->buffer_size > 0) ? batch->buffer_size : 4096;
+        while (new_size < required)
+            new_size *= 2;
+
+        tmp = realloc (batch->buffer, new_size);
+        if (tmp == NULL)
+        {
+            ERROR ("amqp plugin: realloc failed.");
+            return (ENOMEM);
+        }
+        batch->buffer = tmp;
+        batch->buffer_size = new_size;
+    }
+
+    if (batch->values_num == 0)
+        batch->init_time = cdtime ();
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        /* "buffer" is a single JSON object with a leading comma, as produced
+         * by format_json_value_list(). The first object of a batch starts
+         * the array instead. */
+        memcpy (batch->buffer + batch->buffer_fill, buffer, buffer_len);
+        if (batch->values_num == 0)
+            batch->buffer[batch->buffer_fill] = '[';
+        batch->buffer_fill += buffer_len;
+    }
+    else
+    {
+        memcpy (batch->buffer + batch->buffer_fill, buffer, buffer_len);
+        batch->buffer_fill += buffer_len;
+        batch->buffer[batch->buffer_fill] = '\n';
+        batch->buffer_fill++;
+    }
+    batch->buffer[batch->buffer_fill] = 0;
+    batch->values_num++;
+
+    if (batch->values_num >= conf->batch_size)
+        return (camqp_batch_seal (conf, batch));
+
+    return (0);
+} /* }}} int camqp_batch_append */
+
+static void *camqp_publish_thread (void *user_data) /* {{{ */
+{
+    camqp_config_t *conf = user_data;
+    cdtime_t next_check = 0;
+    cdtime_t next_retry = 0;
+    _Bool shutdown_failed = 0;
+
+    pthread_mutex_lock (&conf->queue_lock);
+    while (42)
+    {
+        camqp_message_t *msg;
+        cdtime_t timeout;
+        cdtime_t now;
+        int status;
+
+        /* A timeout of zero means "one interval". */
+        timeout = (conf->batch_timeout > 0)
+            ? conf->batch_timeout : interval_g;
+
+        /* Check for timed out batches regularly, even if full batches keep
+         * the thread busy. */
+        now = cdtime ();
+        if (now >= next_check)
+        {
+            camqp_batch_seal_all (conf, timeout);
+            next_check = now + timeout;
+        }
+
+        /* Wait for messages or, after a failure, for the retry time. */
+        if (conf->publisher_running
+                && ((conf->queue_head == NULL) || (now < next_retry)))
+        {
+            struct timespec ts_wait;
+
+            CDTIME_T_TO_TIMESPEC (((conf->queue_head != NULL)
+                        && (next_retry < next_check))
+                    ? next_retry : next_check, &ts_wait);
+            pthread_cond_timedwait (&conf->queue_cond, &conf->queue_lock,
+                    &ts_wait);
+            continue;
+        }
+
+        if (!conf->publisher_running)
+            camqp_batch_seal_all (conf, /* timeout = */ 0);
+
+        if (conf->queue_head == NULL)
+            break;
+
+        msg = conf->queue_head;
+        conf->queue_head = msg->next;
+        if (conf->queue_head == NULL)
+            conf->queue_tail = NULL;
+        conf->queue_length--;
+
+        /* Once sending failed during shutdown, the broker is most likely
+         * unreachable. Drop the remaining messages rather than trying to
+         * connect once per message. */
+        if (shutdown_failed)
+        {
+            conf->queue_dropped += msg->values_num;
+            ERROR ("amqp plugin: Publish \"%s\": Dropping %zu values "
+                    "during shutdown.", conf->name, msg->values_num);
+            camqp_message_free (msg);
+            continue;
+        }
+        pthread_mutex_unlock (&conf->queue_lock);
+
+        /* The send queue is unlocked while talking to the broker, so that
+         * write callbacks don't block on the network. */
+        pthread_mutex_lock (&conf->lock);
+        status = camqp_write_locked (conf, msg->body, msg->body_len,
+                msg->routing_key);
+        pthread_mutex_unlock (&conf->lock);
+
+        pthread_mutex_lock (&conf->queue_lock);
+        if ((status != 0) && conf->publisher_running)
+        {
+            /* Put the message back to the front of the queue and wait for
+             * one interval before trying to reconnect. */
+            msg->next = conf->queue_head;
+            conf->queue_head = msg;
+            if (conf->queue_tail == NULL)
+                conf->queue_tail = msg;
+            conf->queue_length++;
+
+            next_retry = cdtime () + interval_g;
+            continue;
+        }
+        else if (status != 0)
+        {
+            shutdown_failed = 1;
+            conf->queue_dropped += msg->values_num;
+            ERROR ("amqp plugin: Publish \"%s\": Dropping %zu values "
+                    "during shutdown.", conf->name, msg->values_num);
+        }
+
+        camqp_message_free (msg);
+    } /* while (42) */
+    pthread_mutex_unlock (&conf->queue_lock);
+
+    return (NULL);
+} /* }}} void *camqp_publish_thread */
+
+static int camqp_publish_init (camqp_config_t *conf) /* {{{ */
+{
+    camqp_config_t **tmp;
+    int status;
+
+    conf->batches = c_avl_create ((void *) strcmp);
+    if (conf->batches == NULL)
+    {
+        ERROR ("amqp plugin: c_avl_create failed.");
+        return (ENOMEM);
+    }
+
+    tmp = realloc (publishers, sizeof (*publishers) * (publishers_num + 1));
+    if (tmp == NULL)
+    {
+        ERROR ("amqp plugin: realloc failed.");
+        return (ENOMEM);
+    }
+    publishers = tmp;
+
+    conf->publisher_running = 1;
+    status = pthread_create (&conf->publisher_thread, /* attr = */ NULL,
+            camqp_publish_thread, conf);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("amqp plugin: pthread_create failed: %s",
+                sstrerror (status, errbuf, sizeof (errbuf)));
+        conf->publisher_running = 0;
+        return (status);
+    }
+
+    publishers[publishers_num] = conf;
+    publishers_num++;
+
+    return (0);
+} /* }}} int camqp_publish_init */
+
 static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         user_data_t *user_data)
 {
@@ -775,7 +1402,9 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
 
         format_json_initialize (buffer, &bfill, &bfree);
         format_json_value_list (buffer, &bfill, &bfree, ds, vl, conf->store_rates);
-        format_json_finalize (buffer, &bfill, &bfree);
+        /* Batches are finalized in camqp_batch_seal(). */
+        if (conf->batch_size <= 1)
+            format_json_finalize (buffer, &bfill, &bfree);
     }
     else
     {
@@ -783,13 +1412,39 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         return (-1);
     }
 
+    if (conf->batch_size > 1)
+    {
+        pthread_mutex_lock (&conf->queue_lock);
+        status = camqp_batch_append (conf, routing_key, buffer);
+        pthread_mutex_unlock (&conf->queue_lock);
+        return (status);
+    }
+
     pthread_mutex_lock (&conf->lock);
-    status = camqp_write_locked (conf, buffer, routing_key);
+    status = camqp_write_locked (conf, buffer, strlen (buffer), routing_key);
     pthread_mutex_unlock (&conf->lock);
 
     return (status);
 } /* }}} int camqp_write */
 
+static int camqp_flush (cdtime_t timeout, /* {{{ */
+        const char *identifier __attribute__((unused)),
+        user_data_t *user_data)
+{
+    camqp_config_t *conf;
+
+    if (user_data == NULL)
+        return (-EINVAL);
+
+    conf = user_data->data;
+
+    pthread_mutex_lock (&conf->queue_lock);
+    camqp_batch_seal_all (conf, timeout);
+    pthread_mutex_unlock (&conf->queue_lock);
+
+    return (0);
+} /* }}} int camqp_flush */
+
 /*
  * Config handling
  */
@@ -849,6 +1504,18 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     /* publish only */
     conf->delivery_mode = CAMQP_DM_VOLATILE;
     conf->store_rates = 0;
+    conf->confirm = 0;
+    conf->batch_size = 1;
+    conf->batch_timeout = 0;
+    conf->queue_limit = CAMQP_DEFAULT_QUEUE_LIMIT;
+    conf->batches = NULL;
+    conf->queue_head = NULL;
+    conf->queue_tail = NULL;
+    conf->queue_length = 0;
+    conf->queue_dropped = 0;
+    C_COMPLAIN_INIT (&conf->queue_complaint);
+    pthread_mutex_init (&conf->queue_lock, /* attr = */ NULL);
+    pthread_cond_init (&conf->queue_cond, /* attr = */ NULL);
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
@@ -906,6 +1573,26 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             status = cf_util_get_boolean (child, &conf->store_rates);
         else if ((strcasecmp ("Format", child->key) == 0) && publish)
             status = camqp_config_set_format (child, conf);
+        else if ((strcasecmp ("PublisherConfirms", child->key) == 0) && publish)
+            status = cf_util_get_boolean (child, &conf->confirm);
+        else if ((strcasecmp ("BatchSize", child->key) == 0) && publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp >= 1))
+                conf->batch_size = (size_t) tmp;
+            else if (status == 0)
+                WARNING ("amqp plugin: \"BatchSize\" must be at least 1.");
+        }
+        else if ((strcasecmp ("BatchTimeout", child->key) == 0) && publish)
+            status = cf_util_get_cdtime (child, &conf->batch_timeout);
+        else if ((strcasecmp ("QueueLimit", child->key) == 0) && publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if (status == 0)
+                conf->queue_limit = (tmp > 0) ? ((size_t) tmp) : 0;
+        }
         else
             WARNING ("amqp plugin: Ignoring unknown "
                     "configuration option \"%s\".", child->key);
@@ -938,6 +1625,16 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
                 conf->exchange);
     }
 
+#if !HAVE_AMQP_CONFIRM_SELECT
+    if (conf->confirm)
+    {
+        WARNING ("amqp plugin: The option \"PublisherConfirms\" is not "
+                "supported by this version of librabbitmq and will be "
+                "ignored.");
+        conf->confirm = 0;
+    }
+#endif
+
     if (publish)
     {
         char cbname[128];
@@ -951,6 +1648,21 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             camqp_config_free (conf);
             return (status);
         }
+
+        if (conf->batch_size > 1)
+        {
+            user_data_t flush_ud = { conf, NULL };
+
+            status = camqp_publish_init (conf);
+            if (status != 0)
+            {
+                /* Frees "conf". */
+                plugin_unregister_write (cbname);
+                return (status);
+            }
+
+            plugin_register_flush (cbname, camqp_flush, &flush_ud);
+        }
     }
     else
     {
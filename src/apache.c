@@ -28,6 +28,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl.h"
 
 #include <curl/curl.h>
 
@@ -49,6 +50,7 @@ struct apache_s
 	int   verify_host;
 	char *cacert;
 	char *server; /* user specific server type */
+	cdtime_t timeout;
 	char *apache_buffer;
 	char apache_curl_error[CURL_ERROR_SIZE];
 	size_t apache_buffer_size;
@@ -66,6 +68,10 @@ static void apache_free (apache_t *st)
 	if (st == NULL)
 		return;
 
+	/* Only stop this instance's transfer, the engine is shared. */
+	if (st->curl != NULL)
+		ucurl_cancel (st->curl);
+
 	sfree (st->name);
 	sfree (st->host);
 	sfree (st->url);
@@ -280,6 +286,8 @@ static int config_add (oconfig_item_t *ci)
 			status = config_set_string (&st->cacert, child);
 		else if (strcasecmp ("Server", child->key) == 0)
 			status = config_set_string (&st->server, child);
+		else if (strcasecmp ("Timeout", child->key) == 0)
+			status = cf_util_get_cdtime (child, &st->timeout);
 		else
 		{
 			WARNING ("apache plugin: Option `%s' not allowed here.",
@@ -581,7 +589,9 @@ static void submit_scoreboard (char *buf, apache_t *st)
 	}
 }
 
-static int apache_read_host (user_data_t *user_data) /* {{{ */
+/* Called by the curl engine when the status page has been fetched. */
+static void apache_read_done (CURL __attribute__((unused)) *curl, /* {{{ */
+		CURLcode status, void *user_data)
 {
 	int i;
 
@@ -593,31 +603,20 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 	char *fields[4];
 	int   fields_num;
 
-	apache_t *st;
-
-	st = user_data->data;
-
-	assert (st->url != NULL);
-	/* (Assured by `config_add') */
-
-	if (st->curl == NULL)
-	{
-		int status;
-
-		status = init_host (st);
-		if (status != 0)
-			return (-1);
-	}
-	assert (st->curl != NULL);
+	apache_t *st = user_data;
 
-	st->apache_buffer_fill = 0;
-	if (curl_easy_perform (st->curl) != 0)
+	if (status == CURLE_ABORTED_BY_CALLBACK)
+		return;
+	else if (status != CURLE_OK)
 	{
-		ERROR ("apache: curl_easy_perform failed: %s",
+		ERROR ("apache: Fetching the status page failed: %s",
 				st->apache_curl_error);
-		return (-1);
+		return;
 	}
 
+	if (st->apache_buffer_fill == 0)
+		return;
+
 	/* fallback - server_type to apache if not set at this time */
 	if (st->server_type == -1)
 	{
@@ -666,13 +665,54 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 	}
 
 	st->apache_buffer_fill = 0;
+} /* }}} void apache_read_done */
+
+static int apache_read_host (user_data_t *user_data) /* {{{ */
+{
+	apache_t *st;
+	int status;
+
+	st = user_data->data;
+
+	assert (st->url != NULL);
+	/* (Assured by `config_add') */
+
+	if (st->curl == NULL)
+	{
+		status = init_host (st);
+		if (status != 0)
+			return (-1);
+	}
+	assert (st->curl != NULL);
+
+	if (ucurl_busy (st->curl))
+	{
+		WARNING ("apache plugin: Instance `%s': The status page is still "
+				"being fetched. Skipping this interval.", st->name);
+		return (0);
+	}
+
+	st->apache_buffer_fill = 0;
+	status = ucurl_submit (st->curl, st->timeout, apache_read_done, st);
+	if (status != 0)
+	{
+		ERROR ("apache plugin: Instance `%s': ucurl_submit failed.",
+				st->name);
+		return (-1);
+	}
 
 	return (0);
 } /* }}} int apache_read_host */
 
+static int apache_shutdown (void) /* {{{ */
+{
+	return (ucurl_shutdown ());
+} /* }}} int apache_shutdown */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("apache", config);
+	plugin_register_shutdown ("apache", apache_shutdown);
 } /* void module_register */
 
 /* vim: set sw=8 noet fdm=marker : */
@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl.h"
 
 #include <curl/curl.h>
 #include <libxml/parser.h>
@@ -97,6 +98,7 @@ static char *pass        = NULL;
 static char *verify_peer = NULL;
 static char *verify_host = NULL;
 static char *cacert      = NULL;
+static cdtime_t timeout  = 0;
 
 static CURL *curl = NULL;
 
@@ -112,7 +114,8 @@ static const char *config_keys[] =
   "Password",
   "VerifyPeer",
   "VerifyHost",
-  "CACert"
+  "CACert",
+  "Timeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -513,6 +516,14 @@ static int ascent_config (const char *key, const char *value) /* {{{ */
     return (config_set (&verify_host, value));
   else if (strcasecmp (key, "CACert") == 0)
     return (config_set (&cacert, value));
+  else if (strcasecmp (key, "Timeout") == 0)
+  {
+    double tmp = atof (value);
+    if (tmp < 0.0)
+      return (1);
+    timeout = DOUBLE_TO_CDTIME_T (tmp);
+    return (0);
+  }
   else
     return (-1);
 } /* }}} int ascent_config */
@@ -579,6 +590,28 @@ static int ascent_init (void) /* {{{ */
   return (0);
 } /* }}} int ascent_init */
 
+/* Called by the curl engine when the statistics have been fetched. */
+static void ascent_read_done (CURL __attribute__((unused)) *handle, /* {{{ */
+    CURLcode status, void __attribute__((unused)) *user_data)
+{
+  if (status == CURLE_ABORTED_BY_CALLBACK)
+    return;
+  else if (status != CURLE_OK)
+  {
+    ERROR ("ascent plugin: Fetching the statistics failed: %s",
+        ascent_curl_error);
+    return;
+  }
+
+  if (ascent_buffer_fill == 0)
+  {
+    ERROR ("ascent plugin: The server sent an empty response.");
+    return;
+  }
+
+  ascent_xml (ascent_buffer);
+} /* }}} void ascent_read_done */
+
 static int ascent_read (void) /* {{{ */
 {
   int status;
@@ -595,26 +628,42 @@ static int ascent_read (void) /* {{{ */
     return (-1);
   }
 
-  ascent_buffer_fill = 0;
-  if (curl_easy_perform (curl) != 0)
+  if (ucurl_busy (curl))
   {
-    ERROR ("ascent plugin: curl_easy_perform failed: %s",
-        ascent_curl_error);
-    return (-1);
+    WARNING ("ascent plugin: The statistics are still being fetched. "
+        "Skipping this interval.");
+    return (0);
   }
 
-  status = ascent_xml (ascent_buffer);
+  ascent_buffer_fill = 0;
+  status = ucurl_submit (curl, timeout, ascent_read_done,
+      /* user_data = */ NULL);
   if (status != 0)
+  {
+    ERROR ("ascent plugin: ucurl_submit failed.");
     return (-1);
-  else
-    return (0);
+  }
+
+  return (0);
 } /* }}} int ascent_read */
 
+static int ascent_shutdown (void) /* {{{ */
+{
+  ucurl_shutdown ();
+
+  if (curl != NULL)
+    curl_easy_cleanup (curl);
+  curl = NULL;
+
+  return (0);
+} /* }}} int ascent_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("ascent", ascent_config, config_keys, config_keys_num);
   plugin_register_init ("ascent", ascent_init);
   plugin_register_read ("ascent", ascent_read);
+  plugin_register_shutdown ("ascent", ascent_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 ts=8 et fdm=marker : */
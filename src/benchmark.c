@@ -0,0 +1,589 @@
+/**
+ * collectd - src/benchmark.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Synthetic load generator for the dispatch path. A number of threads call
+ * plugin_dispatch_values() as fast as possible, so the values pass through
+ * the value cache, the filter chains and all loaded write plugins exactly
+ * as values read by any other plugin. Throughput and dispatch latency are
+ * measured and appended as one JSON object per run to a result file, so
+ * runs of different builds can be compared.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_latency.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+#if HAVE_MALLOC_H
+# include <malloc.h>
+#endif
+
+#if HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+/* Only declared by glibc if _GNU_SOURCE is defined. Available since Linux
+ * 2.6.26. */
+#if KERNEL_LINUX && !defined(RUSAGE_THREAD)
+# define RUSAGE_THREAD 1
+#endif
+
+/*
+ * Private data types
+ */
+struct bm_thread_s
+{
+  pthread_t thread;
+  size_t index;
+
+  /* The following members are only written by the thread itself and read
+   * after it has finished. */
+  uint64_t values_num;
+  uint64_t errors_num;
+  uint64_t latency_max;
+  latency_histogram_t latency_hist; /* ns */
+
+  uint64_t start;     /* monotonic, ns */
+  uint64_t end;
+  double cpu_time;    /* seconds */
+  double vcsw_num;    /* voluntary context switches */
+  double ivcsw_num;   /* involuntary context switches */
+};
+typedef struct bm_thread_s bm_thread_t;
+
+/*
+ * Private variables
+ */
+static char *bm_type = NULL;
+static size_t bm_instances_num = 100;
+static size_t bm_type_instances_num = 10;
+static size_t bm_threads_num = 4;
+static cdtime_t bm_duration = 0;
+static cdtime_t bm_warmup = 0;
+static char *bm_result_file = NULL;
+static _Bool bm_null_writer = 0;
+static _Bool bm_exit_when_done = 0;
+
+static const data_set_t *bm_ds = NULL;
+
+static pthread_mutex_t bm_lock = PTHREAD_MUTEX_INITIALIZER;
+static bm_thread_t *bm_threads = NULL;
+static size_t bm_threads_running = 0;
+static size_t bm_threads_done = 0;
+static _Bool bm_started = 0;
+static _Bool bm_reported = 0;
+static volatile _Bool bm_stop = 0;
+
+static double bm_heap_start = NAN;
+static uint64_t bm_written = 0;
+
+/*
+ * Private functions
+ */
+static uint64_t bm_monotonic (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec) * 1000000000 + ((uint64_t) ts.tv_nsec));
+} /* }}} uint64_t bm_monotonic */
+
+static double bm_cpu_time (void) /* {{{ */
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return (NAN);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+#else
+  return (NAN);
+#endif
+} /* }}} double bm_cpu_time */
+
+/* Context switches of the calling thread. A thread dispatching values only
+ * gives up the CPU voluntarily when it has to wait, i.e. when it blocks on a
+ * lock or on I/O done by a write plugin. Involuntary switches happen when
+ * there are more runnable threads than CPUs. */
+static void bm_context_switches (double *ret_vcsw, double *ret_ivcsw) /* {{{ */
+{
+#if HAVE_SYS_RESOURCE_H && defined(RUSAGE_THREAD)
+  struct rusage ru;
+
+  if (getrusage (RUSAGE_THREAD, &ru) == 0)
+  {
+    *ret_vcsw = (double) ru.ru_nvcsw;
+    *ret_ivcsw = (double) ru.ru_nivcsw;
+    return;
+  }
+#endif
+  *ret_vcsw = NAN;
+  *ret_ivcsw = NAN;
+} /* }}} void bm_context_switches */
+
+/* Number of bytes allocated from the heap by the entire process. */
+static double bm_heap_in_use (void) /* {{{ */
+{
+#if HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2 ();
+  return (((double) mi.uordblks) + ((double) mi.hblkhd));
+#elif HAVE_MALLINFO
+  struct mallinfo mi = mallinfo ();
+  return (((double) ((unsigned int) mi.uordblks))
+      + ((double) ((unsigned int) mi.hblkhd)));
+#else
+  return (NAN);
+#endif
+} /* }}} double bm_heap_in_use */
+
+/* Prints a number or "null", since JSON can't represent NaN. */
+static void bm_print_number (FILE *fh, const char *key, double value, /* {{{ */
+    _Bool last)
+{
+  if (isnan (value))
+    fprintf (fh, "\"%s\":null%s", key, last ? "" : ",");
+  else
+    fprintf (fh, "\"%s\":%.10g%s", key, value, last ? "" : ",");
+} /* }}} void bm_print_number */
+
+static void bm_report (void) /* {{{ */
+{
+  latency_histogram_t hist;
+  uint64_t values_num = 0;
+  uint64_t errors_num = 0;
+  uint64_t latency_max = 0;
+  uint64_t start = 0;
+  uint64_t end = 0;
+  double wall_time = 0.0;
+  double cpu_time = 0.0;
+  double vcsw_num = 0.0;
+  double ivcsw_num = 0.0;
+  double duration;
+  double heap_bytes;
+  double p50, p90, p99;
+  FILE *fh;
+  size_t i;
+
+  latency_hist_reset (&hist);
+
+  for (i = 0; i < bm_threads_running; i++)
+  {
+    bm_thread_t *t = bm_threads + i;
+
+    values_num += t->values_num;
+    errors_num += t->errors_num;
+    if (latency_max < t->latency_max)
+      latency_max = t->latency_max;
+    latency_hist_merge (&hist, &t->latency_hist);
+
+    if ((start == 0) || (start > t->start))
+      start = t->start;
+    if (end < t->end)
+      end = t->end;
+
+    wall_time += ((double) (t->end - t->start)) / 1e9;
+    cpu_time += t->cpu_time;
+    vcsw_num += t->vcsw_num;
+    ivcsw_num += t->ivcsw_num;
+  }
+
+  duration = ((double) (end - start)) / 1e9;
+  heap_bytes = bm_heap_in_use () - bm_heap_start;
+
+  p50 = latency_hist_percentile (&hist, 50.0);
+  p90 = latency_hist_percentile (&hist, 90.0);
+  p99 = latency_hist_percentile (&hist, 99.0);
+
+  INFO ("benchmark plugin: Dispatched %"PRIu64" value lists in %.3f seconds "
+      "(%.0f/s) using %zu threads. Latency: p50 %.0f ns, p99 %.0f ns, "
+      "max %"PRIu64" ns.",
+      values_num, duration,
+      (duration > 0.0) ? ((double) values_num) / duration : 0.0,
+      bm_threads_running, p50, p99, latency_max);
+
+  if (bm_result_file == NULL)
+    return;
+
+  fh = fopen (bm_result_file, "a");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("benchmark plugin: fopen (%s) failed: %s", bm_result_file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return;
+  }
+
+  fprintf (fh, "{\"version\":\"%s\",\"time\":%.3f,\"type\":\"%s\",",
+      PACKAGE_VERSION, CDTIME_T_TO_DOUBLE (cdtime ()), bm_ds->type);
+  fprintf (fh, "\"instances\":%zu,\"type_instances\":%zu,\"threads\":%zu,",
+      bm_instances_num, bm_type_instances_num, bm_threads_running);
+  fprintf (fh, "\"values\":%"PRIu64",\"errors\":%"PRIu64",",
+      values_num, errors_num);
+  bm_print_number (fh, "duration", duration, /* last = */ 0);
+  bm_print_number (fh, "values_per_second",
+      (duration > 0.0) ? ((double) values_num) / duration : NAN, 0);
+  bm_print_number (fh, "latency_p50_ns", p50, 0);
+  bm_print_number (fh, "latency_p90_ns", p90, 0);
+  bm_print_number (fh, "latency_p99_ns", p99, 0);
+  bm_print_number (fh, "latency_max_ns", (double) latency_max, 0);
+  bm_print_number (fh, "off_cpu_ratio",
+      (wall_time > 0.0) ? 1.0 - (cpu_time / wall_time) : NAN, 0);
+  bm_print_number (fh, "voluntary_switches_per_value",
+      (values_num > 0) ? vcsw_num / ((double) values_num) : NAN, 0);
+  bm_print_number (fh, "involuntary_switches_per_value",
+      (values_num > 0) ? ivcsw_num / ((double) values_num) : NAN, 0);
+  bm_print_number (fh, "heap_bytes_per_value",
+      (values_num > 0) ? heap_bytes / ((double) values_num) : NAN, 0);
+  bm_print_number (fh, "null_writer_values",
+      bm_null_writer ? (double) bm_written : NAN, /* last = */ 1);
+  fprintf (fh, "}\n");
+
+  fclose (fh);
+} /* }}} void bm_report */
+
+static void bm_thread_measure (bm_thread_t *t, _Bool start) /* {{{ */
+{
+  double cpu_time = bm_cpu_time ();
+  double vcsw_num;
+  double ivcsw_num;
+
+  bm_context_switches (&vcsw_num, &ivcsw_num);
+
+  if (start)
+  {
+    t->start = bm_monotonic ();
+    t->cpu_time = -cpu_time;
+    t->vcsw_num = -vcsw_num;
+    t->ivcsw_num = -ivcsw_num;
+    if (t->index == 0)
+      bm_heap_start = bm_heap_in_use ();
+  }
+  else
+  {
+    t->end = bm_monotonic ();
+    t->cpu_time += cpu_time;
+    t->vcsw_num += vcsw_num;
+    t->ivcsw_num += ivcsw_num;
+  }
+} /* }}} void bm_thread_measure */
+
+static void bm_thread_finish (void) /* {{{ */
+{
+  _Bool report = 0;
+
+  pthread_mutex_lock (&bm_lock);
+  bm_threads_done++;
+  if ((bm_threads_done == bm_threads_running) && !bm_reported)
+  {
+    bm_reported = 1;
+    report = 1;
+  }
+  pthread_mutex_unlock (&bm_lock);
+
+  if (!report)
+    return;
+
+  bm_report ();
+
+  /* Don't send a signal if the daemon is already shutting down. */
+  if (bm_exit_when_done && !bm_stop)
+  {
+    INFO ("benchmark plugin: Benchmark finished, shutting down.");
+    kill (getpid (), SIGTERM);
+  }
+} /* }}} void bm_thread_finish */
+
+static void *bm_thread (void *arg) /* {{{ */
+{
+  bm_thread_t *t = arg;
+  value_list_t vl = VALUE_LIST_INIT;
+  size_t identifiers_num;
+  size_t stride;
+  uint64_t warmup_end;
+  uint64_t end;
+  uint64_t round;
+  _Bool measuring;
+  cdtime_t last_time;
+
+  vl.values = calloc (bm_ds->ds_num, sizeof (*vl.values));
+  if (vl.values == NULL)
+  {
+    ERROR ("benchmark plugin: calloc failed.");
+    bm_thread_finish ();
+    return ((void *) 0);
+  }
+  vl.values_len = bm_ds->ds_num;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "benchmark", sizeof (vl.plugin));
+  sstrncpy (vl.type, bm_ds->type, sizeof (vl.type));
+
+  identifiers_num = bm_instances_num * bm_type_instances_num;
+
+  /* bm_start holds the lock until all threads have been created. */
+  pthread_mutex_lock (&bm_lock);
+  stride = bm_threads_running;
+  pthread_mutex_unlock (&bm_lock);
+
+  warmup_end = bm_monotonic ()
+    + (uint64_t) (CDTIME_T_TO_DOUBLE (bm_warmup) * 1e9);
+  end = warmup_end + (uint64_t) (CDTIME_T_TO_DOUBLE (bm_duration) * 1e9);
+  measuring = 0;
+  last_time = 0;
+
+  for (round = 1; !bm_stop; round++)
+  {
+    size_t i;
+
+    /* Every round needs a new timestamp, otherwise the cache would reject
+     * the values as too old. */
+    vl.time = cdtime ();
+    if (vl.time <= last_time)
+      vl.time = last_time + 1;
+    last_time = vl.time;
+
+    for (i = t->index; (i < identifiers_num) && !bm_stop; i += stride)
+    {
+      uint64_t dispatch_start;
+      uint64_t dispatch_end;
+      uint64_t latency;
+      int status;
+      int j;
+
+      ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance), "%zu",
+          i / bm_type_instances_num);
+      ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%zu",
+          i % bm_type_instances_num);
+
+      for (j = 0; j < bm_ds->ds_num; j++)
+      {
+        if (bm_ds->ds[j].type == DS_TYPE_GAUGE)
+          vl.values[j].gauge = (gauge_t) (round % 1000);
+        else if (bm_ds->ds[j].type == DS_TYPE_COUNTER)
+          vl.values[j].counter = (counter_t) round;
+        else if (bm_ds->ds[j].type == DS_TYPE_DERIVE)
+          vl.values[j].derive = (derive_t) round;
+        else /* if (bm_ds->ds[j].type == DS_TYPE_ABSOLUTE) */
+          vl.values[j].absolute = (absolute_t) 1;
+      }
+
+      dispatch_start = bm_monotonic ();
+      status = plugin_dispatch_values (&vl);
+      dispatch_end = bm_monotonic ();
+
+      if (!measuring)
+      {
+        if (dispatch_end < warmup_end)
+          continue;
+        bm_thread_measure (t, /* start = */ 1);
+        measuring = 1;
+        continue;
+      }
+
+      latency = dispatch_end - dispatch_start;
+      t->values_num++;
+      if (status != 0)
+        t->errors_num++;
+      if (t->latency_max < latency)
+        t->latency_max = latency;
+      latency_hist_add (&t->latency_hist, latency);
+
+      if ((bm_duration != 0) && (dispatch_end >= end))
+        break;
+    }
+
+    if ((bm_duration != 0) && measuring && (bm_monotonic () >= end))
+      break;
+  } /* for (round) */
+
+  if (measuring)
+    bm_thread_measure (t, /* start = */ 0);
+  else
+    t->start = t->end = bm_monotonic ();
+
+  sfree (vl.values);
+  bm_thread_finish ();
+  return ((void *) 0);
+} /* }}} void *bm_thread */
+
+static int bm_start (void) /* {{{ */
+{
+  size_t i;
+
+  bm_threads = calloc (bm_threads_num, sizeof (*bm_threads));
+  if (bm_threads == NULL)
+  {
+    ERROR ("benchmark plugin: calloc failed.");
+    return (-1);
+  }
+
+  INFO ("benchmark plugin: Dispatching %zu value lists of type \"%s\" "
+      "using %zu threads.", bm_instances_num * bm_type_instances_num,
+      bm_ds->type, bm_threads_num);
+
+  pthread_mutex_lock (&bm_lock);
+  for (i = 0; i < bm_threads_num; i++)
+  {
+    bm_thread_t *t = bm_threads + i;
+    int status;
+
+    t->index = i;
+    status = pthread_create (&t->thread, /* attr = */ NULL, bm_thread, t);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("benchmark plugin: pthread_create failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      break;
+    }
+    bm_threads_running++;
+  }
+  pthread_mutex_unlock (&bm_lock);
+
+  if (bm_threads_running == 0)
+    return (-1);
+  return (0);
+} /* }}} int bm_start */
+
+static int bm_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+    int tmp = 0;
+
+    if (strcasecmp ("Type", child->key) == 0)
+      status = cf_util_get_string (child, &bm_type);
+    else if ((strcasecmp ("Instances", child->key) == 0)
+        || (strcasecmp ("TypeInstances", child->key) == 0)
+        || (strcasecmp ("Threads", child->key) == 0))
+    {
+      status = cf_util_get_int (child, &tmp);
+      if ((status == 0) && (tmp < 1))
+      {
+        ERROR ("benchmark plugin: The \"%s\" option must be positive.",
+            child->key);
+        status = -1;
+      }
+      if (status != 0)
+        ; /* do nothing */
+      else if (strcasecmp ("Instances", child->key) == 0)
+        bm_instances_num = (size_t) tmp;
+      else if (strcasecmp ("TypeInstances", child->key) == 0)
+        bm_type_instances_num = (size_t) tmp;
+      else
+        bm_threads_num = (size_t) tmp;
+    }
+    else if (strcasecmp ("Duration", child->key) == 0)
+      status = cf_util_get_cdtime (child, &bm_duration);
+    else if (strcasecmp ("Warmup", child->key) == 0)
+      status = cf_util_get_cdtime (child, &bm_warmup);
+    else if (strcasecmp ("ResultFile", child->key) == 0)
+      status = cf_util_get_string (child, &bm_result_file);
+    else if (strcasecmp ("NullWriter", child->key) == 0)
+      status = cf_util_get_boolean (child, &bm_null_writer);
+    else if (strcasecmp ("ExitWhenDone", child->key) == 0)
+      status = cf_util_get_boolean (child, &bm_exit_when_done);
+    else
+    {
+      WARNING ("benchmark plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+    }
+
+    if (status != 0)
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int bm_config */
+
+static int bm_null_write (const data_set_t __attribute__((unused)) *ds, /* {{{ */
+    const value_list_t __attribute__((unused)) *vl,
+    user_data_t __attribute__((unused)) *ud)
+{
+  __sync_add_and_fetch (&bm_written, 1);
+  return (0);
+} /* }}} int bm_null_write */
+
+static int bm_init (void) /* {{{ */
+{
+  bm_ds = plugin_get_ds ((bm_type != NULL) ? bm_type : "gauge");
+  if (bm_ds == NULL)
+  {
+    ERROR ("benchmark plugin: Unknown type \"%s\".",
+        (bm_type != NULL) ? bm_type : "gauge");
+    return (-1);
+  }
+
+  if ((bm_duration == 0) && bm_exit_when_done)
+  {
+    WARNING ("benchmark plugin: \"ExitWhenDone\" requires a \"Duration\". "
+        "The daemon will not exit by itself.");
+    bm_exit_when_done = 0;
+  }
+
+  if (bm_null_writer)
+    plugin_register_write ("benchmark", bm_null_write, /* user_data = */ NULL);
+
+  return (0);
+} /* }}} int bm_init */
+
+/* The load is started from the first read callback rather than from the init
+ * callback, so that all write plugins have been initialized. */
+static int bm_read (void) /* {{{ */
+{
+  if (bm_started)
+    return (0);
+  bm_started = 1;
+
+  return (bm_start ());
+} /* }}} int bm_read */
+
+static int bm_shutdown (void) /* {{{ */
+{
+  size_t i;
+
+  bm_stop = 1;
+
+  for (i = 0; i < bm_threads_running; i++)
+    pthread_join (bm_threads[i].thread, /* return = */ NULL);
+
+  sfree (bm_threads);
+  bm_threads_running = 0;
+  sfree (bm_type);
+  sfree (bm_result_file);
+
+  return (0);
+} /* }}} int bm_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("benchmark", bm_config);
+  plugin_register_init ("benchmark", bm_init);
+  plugin_register_read ("benchmark", bm_read);
+  plugin_register_shutdown ("benchmark", bm_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -39,12 +39,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-
-/* Some versions of libcurl don't include this themselves and then don't have
- * fd_set available. */
-#if HAVE_SYS_SELECT_H
-# include <sys/select.h>
-#endif
+#include "utils_curl.h"
 
 #include <curl/curl.h>
 #include <libxml/parser.h>
@@ -114,6 +109,7 @@ static cb_view_t *views = NULL;
 static size_t     views_num = 0;
 
 static CURL *curl = NULL;
+static cdtime_t timeout = 0;
 
 static char  *bind_buffer = NULL;
 static size_t bind_buffer_size = 0;
@@ -1371,6 +1367,8 @@ static int bind_config (oconfig_item_t *ci) /* {{{ */
       bind_config_add_view (child);
     else if (strcasecmp ("ParseTime", child->key) == 0)
       cf_util_get_boolean (child, &config_parse_time);
+    else if (strcasecmp ("Timeout", child->key) == 0)
+      cf_util_get_cdtime (child, &timeout);
     else
     {
       WARNING ("bind plugin: Unknown configuration option "
@@ -1403,6 +1401,28 @@ static int bind_init (void) /* {{{ */
   return (0);
 } /* }}} int bind_init */
 
+/* Called by the curl engine when the statistics have been fetched. */
+static void bind_read_done (CURL __attribute__((unused)) *handle, /* {{{ */
+    CURLcode status, void __attribute__((unused)) *user_data)
+{
+  if (status == CURLE_ABORTED_BY_CALLBACK)
+    return;
+  else if (status != CURLE_OK)
+  {
+    ERROR ("bind plugin: Fetching the statistics failed: %s",
+        bind_curl_error);
+    return;
+  }
+
+  if (bind_buffer_fill == 0)
+  {
+    ERROR ("bind plugin: The server sent an empty response.");
+    return;
+  }
+
+  bind_xml (bind_buffer);
+} /* }}} void bind_read_done */
+
 static int bind_read (void) /* {{{ */
 {
   int status;
@@ -1413,23 +1433,28 @@ static int bind_read (void) /* {{{ */
     return (-1);
   }
 
-  bind_buffer_fill = 0;
-  if (curl_easy_perform (curl) != 0)
+  if (ucurl_busy (curl))
   {
-    ERROR ("bind plugin: curl_easy_perform failed: %s",
-        bind_curl_error);
-    return (-1);
+    WARNING ("bind plugin: The statistics are still being fetched. "
+        "Skipping this interval.");
+    return (0);
   }
 
-  status = bind_xml (bind_buffer);
+  bind_buffer_fill = 0;
+  status = ucurl_submit (curl, timeout, bind_read_done, /* user_data = */ NULL);
   if (status != 0)
+  {
+    ERROR ("bind plugin: ucurl_submit failed.");
     return (-1);
-  else
-    return (0);
+  }
+
+  return (0);
 } /* }}} int bind_read */
 
 static int bind_shutdown (void) /* {{{ */
 {
+  ucurl_shutdown ();
+
   if (curl != NULL)
   {
     curl_easy_cleanup (curl);
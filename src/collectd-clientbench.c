@@ -0,0 +1,227 @@
+/**
+ * collectd - src/collectd-clientbench.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Submits values to a running collectd through libcollectdclient and reports
+ * the achieved rate. Used to compare the synchronous, asynchronous and bulk
+ * interfaces of the library.
+ */
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <errno.h>
+
+#include "libcollectdclient/client.h"
+
+#define DEFAULT_SOCK LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+
+extern char *optarg;
+extern int   optind;
+
+static int failures = 0;
+
+static void exit_usage (const char *name, int status) {
+  fprintf ((status == 0) ? stdout : stderr,
+      "Usage: %s [options]\n\n"
+
+      "Available options:\n"
+      "  -s <path>     Path to collectd's UNIX socket.\n"
+      "                Default: "DEFAULT_SOCK"\n"
+      "  -m <mode>     One of \"sync\", \"async\" and \"many\".\n"
+      "                Default: async\n"
+      "  -n <number>   Number of values to submit. Default: 100000\n"
+      "  -i <number>   Number of distinct identifiers. Default: 1000\n"
+      "  -b <number>   Number of values per lcc_putval_many() call.\n"
+      "                Default: 1000\n"
+      "  -H <host>     Host name of the submitted values.\n"
+      "                Default: clientbench\n"
+
+      "\n  -h            Display this help and exit.\n"
+      , name);
+  exit (status);
+} /* exit_usage */
+
+static double now (void) {
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((double) tv.tv_sec + ((double) tv.tv_usec) / 1000000.0);
+} /* now */
+
+static void count_failures (lcc_connection_t __attribute__((unused)) *c,
+    int status, const char *message,
+    void __attribute__((unused)) *user_data) {
+  if (status >= 0)
+    return;
+
+  if (failures == 0)
+    fprintf (stderr, "ERROR: %s\n", message);
+  failures++;
+} /* count_failures */
+
+/* Each identifier gets its own time stamp, so values aren't rejected as too
+ * old when the same identifier is used several times per second. */
+static void fill_value_list (lcc_value_list_t *vl, value_t *value,
+    int *type, const char *host, long n, long identifiers, time_t start) {
+  long id = n % identifiers;
+
+  memset (vl, 0, sizeof (*vl));
+  value->gauge = (gauge_t) n;
+  *type = LCC_TYPE_GAUGE;
+  vl->values = value;
+  vl->values_types = type;
+  vl->values_len = 1;
+  vl->time = start + (time_t) (n / identifiers);
+  snprintf (vl->identifier.host, sizeof (vl->identifier.host), "%s", host);
+  snprintf (vl->identifier.plugin, sizeof (vl->identifier.plugin),
+      "clientbench");
+  snprintf (vl->identifier.type, sizeof (vl->identifier.type), "gauge");
+  snprintf (vl->identifier.type_instance,
+      sizeof (vl->identifier.type_instance), "%li", id);
+} /* fill_value_list */
+
+int main (int argc, char **argv) {
+  char address[1024] = "unix:"DEFAULT_SOCK;
+  const char *mode = "async";
+  const char *host = "clientbench";
+  long values_num = 100000;
+  long identifiers = 1000;
+  long batch = 1000;
+
+  lcc_value_list_t *vl;
+  value_t *values;
+  int *types;
+  lcc_connection_t *c;
+  time_t start_time;
+  double start;
+  double duration;
+  long i;
+  int status = 0;
+
+  while (42) {
+    int opt;
+
+    opt = getopt (argc, argv, "s:m:n:i:b:H:h");
+
+    if (opt == -1)
+      break;
+
+    switch (opt) {
+      case 's':
+        snprintf (address, sizeof (address), "unix:%s", optarg);
+        address[sizeof (address) - 1] = '\0';
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      case 'n':
+        values_num = atol (optarg);
+        break;
+      case 'i':
+        identifiers = atol (optarg);
+        break;
+      case 'b':
+        batch = atol (optarg);
+        break;
+      case 'H':
+        host = optarg;
+        break;
+      case 'h':
+        exit_usage (argv[0], 0);
+        break;
+      default:
+        exit_usage (argv[0], 1);
+    }
+  }
+
+  if ((values_num < 1) || (identifiers < 1) || (batch < 1)
+      || ((strcasecmp ("sync", mode) != 0)
+        && (strcasecmp ("async", mode) != 0)
+        && (strcasecmp ("many", mode) != 0)))
+    exit_usage (argv[0], 1);
+
+  vl = calloc ((size_t) batch, sizeof (*vl));
+  values = calloc ((size_t) batch, sizeof (*values));
+  types = calloc ((size_t) batch, sizeof (*types));
+  if ((vl == NULL) || (values == NULL) || (types == NULL)) {
+    fprintf (stderr, "ERROR: calloc failed.\n");
+    return (1);
+  }
+
+  c = NULL;
+  status = lcc_connect (address, &c);
+  if (status != 0) {
+    fprintf (stderr, "ERROR: Failed to connect to daemon at %s: %s.\n",
+        address, strerror (errno));
+    return (1);
+  }
+
+  start_time = time (NULL);
+  start = now ();
+
+  if (strcasecmp ("many", mode) == 0) {
+    for (i = 0; (i < values_num) && (status == 0); i += batch) {
+      long j;
+      long n = ((values_num - i) < batch) ? (values_num - i) : batch;
+
+      for (j = 0; j < n; j++)
+        fill_value_list (vl + j, values + j, types + j, host, i + j,
+            identifiers, start_time);
+      status = lcc_putval_many (c, vl, (size_t) n);
+    }
+  }
+  else {
+    for (i = 0; (i < values_num) && (status == 0); i++) {
+      fill_value_list (vl, values, types, host, i, identifiers, start_time);
+      if (strcasecmp ("sync", mode) == 0)
+        status = lcc_putval (c, vl);
+      else
+        status = lcc_putval_async (c, vl, count_failures, NULL);
+    }
+
+    if ((status == 0) && (lcc_async_flush (c) < 0))
+      status = -1;
+  }
+
+  duration = now () - start;
+
+  if (status != 0)
+    fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+
+  printf ("%s: %li values in %.3f s, %.0f values/s, %i failed\n",
+      mode, values_num, duration, ((double) values_num) / duration, failures);
+
+  LCC_DESTROY (c);
+  free (vl);
+  free (values);
+  free (types);
+
+  return ((status == 0) ? 0 : 1);
+} /* main */
+
+/* vim: set sw=2 ts=2 tw=78 expandtab : */
@@ -0,0 +1,486 @@
+/**
+ * collectd - src/collectd-jsonbench.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Measures how long the curl_json plugin takes to handle a document. Each
+ * document is parsed by yajl twice: once without any callbacks, which is
+ * the cost of the parser alone, and once with the plugin's callbacks, which
+ * match the map keys against the configured key paths and dispatch the
+ * values. The document is passed to the plugin in chunks of
+ * CURL_MAX_WRITE_SIZE bytes, like libcurl does.
+ *
+ * The keys for "foo.json" are read from "foo.keys", one "<path> <type>"
+ * pair per line. The types "gauge", "derive", "counter" and "absolute" are
+ * known. Sample documents are in the bench/curl_json directory, e.g.
+ *
+ *   ./collectd-jsonbench bench/curl_json/nodes-128.json
+ *
+ * The plugin is compiled into this program, so its static functions can be
+ * called. The functions of the daemon it uses are replaced below.
+ */
+
+#include "curl_json.c"
+#include "utils_cache.h"
+
+#include <sys/time.h>
+
+extern char *optarg;
+extern int   optind;
+
+char hostname_g[DATA_MAX_NAME_LEN] = "localhost";
+cdtime_t interval_g = 0;
+
+static _Bool bench_verbose = 0;
+/* Print the dispatched values. Set during the first parse with -v. */
+static _Bool bench_print = 0;
+static int   bench_values_num = 0;
+
+/*
+ * Replacements for the daemon
+ */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  if ((level > LOG_WARNING) && !bench_verbose)
+    return;
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+  fprintf (stderr, "\n");
+} /* }}} void plugin_log */
+
+const data_set_t *plugin_get_ds (const char *name) /* {{{ */
+{
+  static data_source_t dsrc[] = {
+    { "value", DS_TYPE_GAUGE,    NAN, NAN },
+    { "value", DS_TYPE_DERIVE,   0.0, NAN },
+    { "value", DS_TYPE_COUNTER,  0.0, NAN },
+    { "value", DS_TYPE_ABSOLUTE, 0.0, NAN }
+  };
+  static data_set_t ds[] = {
+    { "gauge",    1, dsrc + 0 },
+    { "derive",   1, dsrc + 1 },
+    { "counter",  1, dsrc + 2 },
+    { "absolute", 1, dsrc + 3 }
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (ds); i++)
+    if (strcmp (name, ds[i].type) == 0)
+      return (ds + i);
+
+  return (NULL);
+} /* }}} const data_set_t *plugin_get_ds */
+
+int plugin_dispatch_values (value_list_t *vl) /* {{{ */
+{
+  const data_set_t *ds;
+  double value;
+
+  ds = plugin_get_ds (vl->type);
+  if (ds == NULL)
+    return (-1);
+
+  if (ds->ds[0].type == DS_TYPE_GAUGE)
+    value = (double) vl->values[0].gauge;
+  else if (ds->ds[0].type == DS_TYPE_DERIVE)
+    value = (double) vl->values[0].derive;
+  else if (ds->ds[0].type == DS_TYPE_COUNTER)
+    value = (double) vl->values[0].counter;
+  else
+    value = (double) vl->values[0].absolute;
+
+  if (bench_print)
+    printf ("%s/%s-%s/%s-%s = %g\n", vl->host, vl->plugin,
+        vl->plugin_instance, vl->type, vl->type_instance, value);
+
+  bench_values_num++;
+  return (0);
+} /* }}} int plugin_dispatch_values */
+
+int plugin_register_complex_config (const char *type, /* {{{ */
+    int (*callback) (oconfig_item_t *))
+{
+  return (0);
+} /* }}} int plugin_register_complex_config */
+
+int plugin_register_complex_read (const char *group, /* {{{ */
+    const char *name, plugin_read_cb callback,
+    const struct timespec *interval, user_data_t *user_data)
+{
+  return (0);
+} /* }}} int plugin_register_complex_read */
+
+int plugin_register_shutdown (const char *name, /* {{{ */
+    int (*callback) (void))
+{
+  return (0);
+} /* }}} int plugin_register_shutdown */
+
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string) /* {{{ */
+{
+  char *string;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
+    return (-1);
+
+  string = strdup (ci->values[0].value.string);
+  if (string == NULL)
+    return (-1);
+
+  sfree (*ret_string);
+  *ret_string = string;
+  return (0);
+} /* }}} int cf_util_get_string */
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool) /* {{{ */
+{
+  return (-1);
+} /* }}} int cf_util_get_boolean */
+
+int cf_util_get_cdtime (const oconfig_item_t *ci, /* {{{ */
+    cdtime_t *ret_value)
+{
+  return (-1);
+} /* }}} int cf_util_get_cdtime */
+
+/* Used by the rate functions in common.c. */
+gauge_t *uc_get_rate (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  return (NULL);
+} /* }}} gauge_t *uc_get_rate */
+
+int ucurl_submit (CURL *curl, cdtime_t timeout, /* {{{ */
+    ucurl_callback_t callback, void *user_data)
+{
+  return (-1);
+} /* }}} int ucurl_submit */
+
+_Bool ucurl_busy (CURL *curl) /* {{{ */
+{
+  return (0);
+} /* }}} _Bool ucurl_busy */
+
+int ucurl_cancel (CURL *curl) /* {{{ */
+{
+  return (0);
+} /* }}} int ucurl_cancel */
+
+int ucurl_shutdown (void) /* {{{ */
+{
+  return (0);
+} /* }}} int ucurl_shutdown */
+
+/*
+ * The benchmark
+ */
+static void exit_usage (const char *name, int status) { /* {{{ */
+  fprintf ((status == 0) ? stdout : stderr,
+      "Usage: %s [options] <file.json> [<file.json> ...]\n\n"
+
+      "Available options:\n"
+      "  -n <number>   Number of times each file is parsed. Default: 1000\n"
+      "  -v            Print the dispatched values of the first parse.\n"
+
+      "\n  -h            Display this help and exit.\n"
+      , name);
+  exit (status);
+} /* }}} exit_usage */
+
+static double now (void) { /* {{{ */
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((double) tv.tv_sec + ((double) tv.tv_usec) / 1000000.0);
+} /* }}} now */
+
+static char *read_file (const char *file, size_t *ret_size) { /* {{{ */
+  struct stat statbuf;
+  char *buffer;
+  FILE *fh;
+
+  if (stat (file, &statbuf) != 0)
+    return (NULL);
+
+  buffer = malloc ((size_t) statbuf.st_size + 1);
+  if (buffer == NULL)
+    return (NULL);
+
+  fh = fopen (file, "r");
+  if (fh == NULL)
+  {
+    free (buffer);
+    return (NULL);
+  }
+
+  *ret_size = fread (buffer, 1, (size_t) statbuf.st_size, fh);
+  buffer[*ret_size] = 0;
+  fclose (fh);
+
+  return (buffer);
+} /* }}} char *read_file */
+
+/* Reads "foo.keys" for "foo.json" and adds the keys to "db" the same way
+ * the configuration does. */
+static int read_keys (cj_t *db, const char *file) { /* {{{ */
+  char keys_file[PATH_MAX];
+  char line[1024];
+  size_t len;
+  FILE *fh;
+  int status = 0;
+
+  sstrncpy (keys_file, file, sizeof (keys_file));
+  len = strlen (keys_file);
+  if ((len > 5) && (strcmp (keys_file + len - 5, ".json") == 0))
+    keys_file[len - 5] = 0;
+  if (strlen (keys_file) + 6 > sizeof (keys_file))
+    return (-1);
+  strcat (keys_file, ".keys");
+
+  fh = fopen (keys_file, "r");
+  if (fh == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", keys_file, strerror (errno));
+    return (-1);
+  }
+
+  while ((status == 0) && (fgets (line, sizeof (line), fh) != NULL))
+  {
+    oconfig_value_t path_value;
+    oconfig_value_t type_value;
+    oconfig_item_t type_item;
+    oconfig_item_t key_item;
+    char *fields[2];
+
+    if (strsplit (line, fields, STATIC_ARRAY_SIZE (fields)) != 2)
+      continue;
+
+    memset (&path_value, 0, sizeof (path_value));
+    path_value.type = OCONFIG_TYPE_STRING;
+    path_value.value.string = fields[0];
+
+    memset (&type_value, 0, sizeof (type_value));
+    type_value.type = OCONFIG_TYPE_STRING;
+    type_value.value.string = fields[1];
+
+    memset (&type_item, 0, sizeof (type_item));
+    type_item.key = "Type";
+    type_item.values = &type_value;
+    type_item.values_num = 1;
+
+    memset (&key_item, 0, sizeof (key_item));
+    key_item.key = "Key";
+    key_item.values = &path_value;
+    key_item.values_num = 1;
+    key_item.children = &type_item;
+    key_item.children_num = 1;
+
+    status = cj_config_add_key (db, &key_item);
+  }
+
+  fclose (fh);
+  return (status);
+} /* }}} int read_keys */
+
+/* Parses the document the same way cj_read() and cj_curl_done() do. */
+static int parse_plugin (cj_t *db, char *buffer, size_t size) { /* {{{ */
+  size_t offset;
+  yajl_status status;
+
+  db->depth = 0;
+  db->skip = 0;
+  db->state[0].node = db->root;
+  db->state[0].name[0] = 0;
+
+  db->yajl = yajl_alloc (&ycallbacks,
+#if HAVE_YAJL_V2
+      /* alloc funcs = */ NULL,
+#else
+      /* alloc funcs = */ NULL, NULL,
+#endif
+      /* context = */ (void *) db);
+  if (db->yajl == NULL)
+    return (-1);
+
+  for (offset = 0; offset < size; offset += CURL_MAX_WRITE_SIZE)
+  {
+    size_t len = COUCH_MIN (size - offset, CURL_MAX_WRITE_SIZE);
+
+    if (cj_curl_callback (buffer + offset, 1, len, db) != len)
+      break;
+  }
+
+  if (offset < size)
+    status = yajl_status_error;
+  else
+#if HAVE_YAJL_V2
+    status = yajl_complete_parse (db->yajl);
+#else
+    status = yajl_parse_complete (db->yajl);
+#endif
+
+  yajl_free (db->yajl);
+  db->yajl = NULL;
+
+  return ((status == yajl_status_ok) ? 0 : -1);
+} /* }}} int parse_plugin */
+
+/* Parses the document without any callbacks. */
+static int parse_yajl (char *buffer, size_t size) { /* {{{ */
+  static yajl_callbacks no_callbacks;
+  yajl_handle yajl;
+  yajl_status status;
+
+  yajl = yajl_alloc (&no_callbacks,
+#if HAVE_YAJL_V2
+      /* alloc funcs = */ NULL,
+#else
+      /* alloc funcs = */ NULL, NULL,
+#endif
+      /* context = */ NULL);
+  if (yajl == NULL)
+    return (-1);
+
+  status = yajl_parse (yajl, (unsigned char *) buffer, size);
+#if HAVE_YAJL_V2
+  if (status == yajl_status_ok)
+    status = yajl_complete_parse (yajl);
+#else
+  if ((status == yajl_status_ok)
+      || (status == yajl_status_insufficient_data))
+    status = yajl_parse_complete (yajl);
+#endif
+
+  yajl_free (yajl);
+  return ((status == yajl_status_ok) ? 0 : -1);
+} /* }}} int parse_yajl */
+
+static int bench_file (const char *file, int iterations) { /* {{{ */
+  cj_t db;
+  char *buffer;
+  size_t size = 0;
+  double t0, t1, t2;
+  int values_num = 0;
+  int status;
+  int i;
+
+  memset (&db, 0, sizeof (db));
+  db.instance = "bench";
+  db.url = (char *) file;
+
+  buffer = read_file (file, &size);
+  if (buffer == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", file, strerror (errno));
+    return (-1);
+  }
+
+  if ((read_keys (&db, file) != 0) || (db.root == NULL))
+  {
+    fprintf (stderr, "%s: Reading the keys failed.\n", file);
+    cj_node_free (db.root);
+    free (buffer);
+    return (-1);
+  }
+
+  /* Check the result once, outside of the timed loops. */
+  bench_values_num = 0;
+  bench_print = bench_verbose;
+  status = parse_yajl (buffer, size);
+  if (status == 0)
+    status = parse_plugin (&db, buffer, size);
+  bench_print = 0;
+  if (status != 0)
+  {
+    fprintf (stderr, "%s: Parsing the document failed.\n", file);
+    cj_node_free (db.root);
+    free (buffer);
+    return (-1);
+  }
+  values_num = bench_values_num;
+
+  t0 = now ();
+  for (i = 0; i < iterations; i++)
+    parse_yajl (buffer, size);
+  t1 = now ();
+  for (i = 0; i < iterations; i++)
+    parse_plugin (&db, buffer, size);
+  t2 = now ();
+
+  printf ("%-32s %8zu %10.2f %10.2f %8.1f %7i\n", file, size,
+      1000000.0 * (t1 - t0) / iterations,
+      1000000.0 * (t2 - t1) / iterations,
+      (t2 > t1) ? ((double) size) * iterations / (t2 - t1) / 1048576.0 : 0.0,
+      values_num);
+
+  cj_node_free (db.root);
+  free (buffer);
+
+  if (bench_values_num != values_num * (iterations + 1))
+  {
+    fprintf (stderr, "%s: The number of values differs between parses.\n",
+        file);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int bench_file */
+
+int main (int argc, char **argv) { /* {{{ */
+  int iterations = 1000;
+  int failed = 0;
+  int i;
+
+  while (42) {
+    int c;
+
+    c = getopt (argc, argv, "n:vh");
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        iterations = atoi (optarg);
+        break;
+      case 'v':
+        bench_verbose = 1;
+        break;
+      case 'h':
+        exit_usage (argv[0], 0);
+        break;
+      default:
+        exit_usage (argv[0], 1);
+    }
+  }
+
+  if ((optind >= argc) || (iterations <= 0))
+    exit_usage (argv[0], 1);
+
+  printf ("%-32s %8s %10s %10s %8s %7s\n", "file", "bytes", "yajl/us",
+      "plugin/us", "MB/s", "values");
+  for (i = optind; i < argc; i++)
+    if (bench_file (argv[i], iterations) != 0)
+      failed++;
+
+  return ((failed == 0) ? 0 : 1);
+} /* }}} main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
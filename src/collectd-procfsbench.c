@@ -0,0 +1,212 @@
+/**
+ * collectd - src/collectd-procfsbench.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Compares the stdio based parsing loop the read plugins used to have
+ * (fopen, fgets, strsplit, atoll) with the utils_procfs module on copies of
+ * /proc files. Each line is split into fields and every field is converted
+ * to an integer, which is what the plugins do for most files. Both loops
+ * must come to the same sum, otherwise the file is reported as a mismatch.
+ *
+ * Snapshots taken from a Linux host are in the bench/procfs directory, e.g.
+ *
+ *   ./collectd-procfsbench bench/procfs/stat bench/procfs/interrupts-64cpu
+ *
+ * Passing files below /proc measures the real thing, including the kernel's
+ * time to generate the data. Those files change between reads, so their sums
+ * are not compared.
+ */
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "collectd.h"
+#include "utils_procfs.h"
+
+#include <sys/time.h>
+
+#define FIELDS_MAX 256
+
+extern char *optarg;
+extern int   optind;
+
+static void exit_usage (const char *name, int status) {
+  fprintf ((status == 0) ? stdout : stderr,
+      "Usage: %s [options] <file> [<file> ...]\n\n"
+
+      "Available options:\n"
+      "  -n <number>   Number of times each file is parsed. Default: 10000\n"
+
+      "\n  -h            Display this help and exit.\n"
+      , name);
+  exit (status);
+} /* exit_usage */
+
+static double now (void) {
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((double) tv.tv_sec + ((double) tv.tv_usec) / 1000000.0);
+} /* now */
+
+/* Same as strsplit() in common.c, which can't be linked without the
+ * daemon. */
+static int bench_strsplit (char *string, char **fields, size_t size) {
+  size_t i;
+  char *ptr;
+  char *saveptr;
+
+  i = 0;
+  ptr = string;
+  saveptr = NULL;
+  while ((fields[i] = strtok_r (ptr, " \t\r\n", &saveptr)) != NULL)
+  {
+    ptr = NULL;
+    i++;
+
+    if (i >= size)
+      break;
+  }
+
+  return ((int) i);
+} /* bench_strsplit */
+
+static int64_t parse_stdio (const char *file) {
+  FILE *fh;
+  char buffer[16384];
+  char *fields[FIELDS_MAX];
+  int64_t sum = 0;
+
+  fh = fopen (file, "r");
+  if (fh == NULL)
+    return (-1);
+
+  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  {
+    int fields_num;
+    int i;
+
+    fields_num = bench_strsplit (buffer, fields, FIELDS_MAX);
+    for (i = 0; i < fields_num; i++)
+      sum += (int64_t) atoll (fields[i]);
+  }
+
+  fclose (fh);
+  return (sum);
+} /* parse_stdio */
+
+static int64_t parse_procfs (procfs_file_t *pf) {
+  char *line;
+  char *fields[FIELDS_MAX];
+  int64_t sum = 0;
+
+  if (procfs_read (pf) < 0)
+    return (-1);
+
+  while ((line = procfs_next_line (pf)) != NULL)
+  {
+    int fields_num;
+    int i;
+
+    fields_num = procfs_split (line, fields, FIELDS_MAX);
+    for (i = 0; i < fields_num; i++)
+      sum += procfs_atoll (fields[i]);
+  }
+
+  return (sum);
+} /* parse_procfs */
+
+static int bench_file (const char *file, int iterations) {
+  struct stat statbuf;
+  _Bool compare;
+  procfs_file_t *pf;
+  int64_t sum_stdio = 0;
+  int64_t sum_procfs = 0;
+  double t0, t1, t2;
+  int i;
+
+  /* Files in /proc and /sys have a size of zero. */
+  compare = ((stat (file, &statbuf) == 0) && (statbuf.st_size > 0));
+
+  pf = procfs_open (file);
+  if (pf == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", file, strerror (errno));
+    return (-1);
+  }
+
+  t0 = now ();
+  for (i = 0; i < iterations; i++)
+    sum_stdio = parse_stdio (file);
+  t1 = now ();
+  for (i = 0; i < iterations; i++)
+    sum_procfs = parse_procfs (pf);
+  t2 = now ();
+
+  procfs_close (pf);
+
+  if (!compare)
+    sum_procfs = sum_stdio;
+
+  printf ("%-32s %10.2f %10.2f %7.2fx%s\n", file,
+      1000000.0 * (t1 - t0) / iterations,
+      1000000.0 * (t2 - t1) / iterations,
+      (t2 > t1) ? (t1 - t0) / (t2 - t1) : 0.0,
+      (sum_stdio == sum_procfs) ? "" : "  MISMATCH");
+
+  return ((sum_stdio == sum_procfs) ? 0 : -1);
+} /* bench_file */
+
+int main (int argc, char **argv) {
+  int iterations = 10000;
+  int failed = 0;
+  int i;
+
+  while (42) {
+    int c;
+
+    c = getopt (argc, argv, "n:h");
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        iterations = atoi (optarg);
+        break;
+      case 'h':
+        exit_usage (argv[0], 0);
+        break;
+      default:
+        exit_usage (argv[0], 1);
+    }
+  }
+
+  if ((optind >= argc) || (iterations <= 0))
+    exit_usage (argv[0], 1);
+
+  printf ("%-32s %10s %10s %8s\n", "file", "stdio/us", "procfs/us",
+      "speedup");
+  for (i = optind; i < argc; i++)
+    if (bench_file (argv[i], iterations) != 0)
+      failed++;
+
+  return ((failed == 0) ? 0 : 1);
+} /* main */
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,462 @@
+/**
+ * collectd - src/collectd-tcpconnsbench.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Compares the two ways the tcpconns plugin counts sockets on Linux. The
+ * same synthetic set of sockets is written to a file in the format of
+ * /proc/net/tcp and encoded as a netlink INET_DIAG dump. The file is read
+ * by conn_read_file() and the dump is passed to conn_netlink_handle() in
+ * page-sized chunks, like the kernel sends it. Both must come to the same
+ * counts, otherwise a mismatch is reported.
+ *
+ * The sockets are generated from a fixed seed: "-l" ports are listening,
+ * a tenth of the "-c" connections are established to those ports, a
+ * twentieth are outgoing and the rest are in TIME_WAIT. Without "-p" the
+ * listening ports are counted, as with the default configuration.
+ *
+ * Only the parsing in the plugin is measured. The kernel's time to format
+ * /proc/net/tcp or to filter the sockets is not, so the numbers are lower
+ * than those of a read on a live system.
+ *
+ * The plugin is compiled into this program, so its static functions can be
+ * called. The functions of the daemon it uses are replaced below.
+ */
+
+#include "tcpconns.c"
+#include "utils_cache.h"
+
+#include <sys/time.h>
+
+extern char *optarg;
+extern int   optind;
+
+char hostname_g[DATA_MAX_NAME_LEN] = "localhost";
+cdtime_t interval_g = 0;
+
+/*
+ * Replacements for the daemon
+ */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  if (level > LOG_WARNING)
+    return;
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+  fprintf (stderr, "\n");
+} /* }}} void plugin_log */
+
+int plugin_dispatch_values (value_list_t *vl) /* {{{ */
+{
+  return (0);
+} /* }}} int plugin_dispatch_values */
+
+int plugin_register_config (const char *name, /* {{{ */
+    int (*callback) (const char *key, const char *val),
+    const char **keys, int keys_num)
+{
+  return (0);
+} /* }}} int plugin_register_config */
+
+int plugin_register_init (const char *name, /* {{{ */
+    plugin_init_cb callback)
+{
+  return (0);
+} /* }}} int plugin_register_init */
+
+int plugin_register_read (const char *name, /* {{{ */
+    int (*callback) (void))
+{
+  return (0);
+} /* }}} int plugin_register_read */
+
+int plugin_register_shutdown (const char *name, /* {{{ */
+    plugin_shutdown_cb callback)
+{
+  return (0);
+} /* }}} int plugin_register_shutdown */
+
+/* Used by the rate functions in common.c. */
+gauge_t *uc_get_rate (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  return (NULL);
+} /* }}} gauge_t *uc_get_rate */
+
+#if KERNEL_LINUX && HAVE_LINUX_INET_DIAG_H
+/*
+ * The benchmark
+ */
+/* The kernel sends dumps in messages of at most one page. */
+#define BENCH_CHUNK_SIZE 4096
+
+typedef struct bench_socket_s
+{
+  uint16_t port_local;
+  uint16_t port_remote;
+  uint8_t  state;
+} bench_socket_t;
+
+typedef struct bench_chunk_s
+{
+  char   buffer[BENCH_CHUNK_SIZE];
+  size_t len;
+} bench_chunk_t;
+
+/* Sums of the counters of all ports. */
+typedef struct bench_counts_s
+{
+  int      ports_num;
+  uint64_t local[TCP_STATE_MAX + 1];
+  uint64_t remote[TCP_STATE_MAX + 1];
+} bench_counts_t;
+
+static void exit_usage (const char *name, int status) { /* {{{ */
+  fprintf ((status == 0) ? stdout : stderr,
+      "Usage: %s [options]\n\n"
+
+      "Available options:\n"
+      "  -n <number>   Number of times the sockets are read. Default: 100\n"
+      "  -c <number>   Number of connections. Default: 10000\n"
+      "  -l <number>   Number of listening ports. Default: 20\n"
+      "  -p <port>     Count the connections of this local port, as with\n"
+      "                `LocalPort'. May be given more than once.\n"
+
+      "\n  -h            Display this help and exit.\n"
+      , name);
+  exit (status);
+} /* }}} exit_usage */
+
+static double now (void) { /* {{{ */
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((double) tv.tv_sec + ((double) tv.tv_usec) / 1000000.0);
+} /* }}} now */
+
+static bench_socket_t *generate_sockets (int connections, /* {{{ */
+    int listening, int *ret_num)
+{
+  bench_socket_t *sockets;
+  int sockets_num;
+  int i;
+
+  sockets_num = listening + connections;
+  sockets = calloc ((size_t) sockets_num, sizeof (*sockets));
+  if (sockets == NULL)
+    return (NULL);
+
+  srand (42);
+
+  /* Listening sockets come first, like in /proc/net/tcp. */
+  for (i = 0; i < listening; i++)
+  {
+    sockets[i].port_local = (uint16_t) (8000 + i);
+    sockets[i].port_remote = 0;
+    sockets[i].state = TCP_STATE_LISTEN;
+  }
+
+  for (i = listening; i < sockets_num; i++)
+  {
+    int kind = rand () % 20;
+    uint16_t ephemeral = (uint16_t) (32768 + (rand () % 28232));
+
+    if (kind == 0)
+    {
+      /* Outgoing connection */
+      sockets[i].port_local = ephemeral;
+      sockets[i].port_remote = (uint16_t) ((rand () % 2) ? 443 : 3306);
+      sockets[i].state = 1; /* ESTABLISHED */
+    }
+    else
+    {
+      sockets[i].port_local = (uint16_t) ((listening > 0)
+          ? (8000 + (rand () % listening)) : 80);
+      sockets[i].port_remote = ephemeral;
+      sockets[i].state = (kind < 3) ? 1 /* ESTABLISHED */ : 6 /* TIME_WAIT */;
+    }
+  }
+
+  *ret_num = sockets_num;
+  return (sockets);
+} /* }}} bench_socket_t *generate_sockets */
+
+/* Writes the sockets in the format of /proc/net/tcp, see tcp4_seq_show() in
+ * the kernel. */
+static int write_proc_file (const char *file, /* {{{ */
+    const bench_socket_t *sockets, int sockets_num)
+{
+  FILE *fh;
+  int i;
+
+  fh = fopen (file, "w");
+  if (fh == NULL)
+    return (-1);
+
+  fprintf (fh, "  sl  local_address rem_address   st tx_queue rx_queue "
+      "tr tm->when retrnsmt   uid  timeout inode\n");
+  for (i = 0; i < sockets_num; i++)
+    fprintf (fh, "%4d: %08X:%04X %08X:%04X %02X %08X:%08X %02X:%08lX "
+        "%08X %5u %8d %lu %d %016lx %lu %lu %u %u %d          \n",
+        i, 0x0100007FU, sockets[i].port_local,
+        (sockets[i].port_remote == 0) ? 0U : 0x0200007FU,
+        sockets[i].port_remote, sockets[i].state,
+        0U, 0U, 0, 0UL, 0U, 1000U, 0, 100000UL + i, 1,
+        0xffff880000000000UL + 64 * i, 20UL, 4UL, 30U, 10U, -1);
+
+  fclose (fh);
+  return (0);
+} /* }}} int write_proc_file */
+
+/* Encodes the sockets as a netlink dump, split into chunks of at most
+ * BENCH_CHUNK_SIZE bytes and terminated by NLMSG_DONE. */
+static bench_chunk_t *encode_netlink_dump (uint32_t seq, /* {{{ */
+    const bench_socket_t *sockets, int sockets_num, int *ret_num)
+{
+  bench_chunk_t *chunks;
+  int chunks_max;
+  int chunks_num;
+  size_t msg_size = NLMSG_ALIGN (NLMSG_LENGTH (sizeof (struct inet_diag_msg)));
+  int i;
+
+  chunks_max = 2 + (int) ((sockets_num * msg_size) / (BENCH_CHUNK_SIZE
+        - msg_size));
+  chunks = calloc ((size_t) chunks_max, sizeof (*chunks));
+  if (chunks == NULL)
+    return (NULL);
+
+  chunks_num = 1;
+  for (i = 0; i <= sockets_num; i++)
+  {
+    bench_chunk_t *c = chunks + (chunks_num - 1);
+    struct nlmsghdr *h;
+
+    if (c->len + msg_size > sizeof (c->buffer))
+    {
+      assert (chunks_num < chunks_max);
+      c = chunks + chunks_num;
+      chunks_num++;
+    }
+
+    h = (struct nlmsghdr *) (c->buffer + c->len);
+    h->nlmsg_seq = seq;
+    h->nlmsg_flags = NLM_F_MULTI;
+
+    if (i == sockets_num)
+    {
+      h->nlmsg_type = NLMSG_DONE;
+      h->nlmsg_len = NLMSG_LENGTH (sizeof (int));
+    }
+    else
+    {
+      struct inet_diag_msg *r = NLMSG_DATA (h);
+
+      h->nlmsg_type = TCPDIAG_GETSOCK;
+      h->nlmsg_len = NLMSG_LENGTH (sizeof (*r));
+      r->idiag_family = AF_INET;
+      r->idiag_state = sockets[i].state;
+      r->id.idiag_sport = htons (sockets[i].port_local);
+      r->id.idiag_dport = htons (sockets[i].port_remote);
+      r->id.idiag_src[0] = htonl (0x7F000001);
+      r->id.idiag_dst[0] = (sockets[i].port_remote == 0)
+        ? 0 : htonl (0x7F000002);
+      r->idiag_inode = 100000 + i;
+    }
+
+    c->len += NLMSG_ALIGN (h->nlmsg_len);
+  }
+
+  *ret_num = chunks_num;
+  return (chunks);
+} /* }}} bench_chunk_t *encode_netlink_dump */
+
+static void get_counts (bench_counts_t *counts) { /* {{{ */
+  port_entry_t *pe;
+  int i;
+
+  memset (counts, 0, sizeof (*counts));
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    counts->ports_num++;
+    for (i = 0; i <= TCP_STATE_MAX; i++)
+    {
+      counts->local[i] += pe->count_local[i];
+      counts->remote[i] += pe->count_remote[i];
+    }
+  }
+} /* }}} void get_counts */
+
+static int read_proc (const char *file) { /* {{{ */
+  conn_reset_port_entry ();
+  return (conn_read_file (file));
+} /* }}} int read_proc */
+
+static int read_netlink (bench_chunk_t *chunks, int chunks_num, /* {{{ */
+    uint32_t seq)
+{
+  int status = -1;
+  int i;
+
+  conn_reset_port_entry ();
+
+  /* conn_read_netlink() receives into conn_netlink_buffer; copy each chunk
+   * there so the cost of recv(2)'s copy is included. */
+  for (i = 0; i < chunks_num; i++)
+  {
+    memcpy (conn_netlink_buffer, chunks[i].buffer, chunks[i].len);
+    status = conn_netlink_handle (conn_netlink_buffer,
+        (ssize_t) chunks[i].len, seq);
+    if (status <= 0)
+      break;
+  }
+
+  return (status);
+} /* }}} int read_netlink */
+
+int main (int argc, char **argv) { /* {{{ */
+  int iterations = 100;
+  int connections = 10000;
+  int listening = 20;
+  bench_socket_t *sockets;
+  int sockets_num = 0;
+  bench_chunk_t *chunks;
+  int chunks_num = 0;
+  bench_counts_t counts_proc;
+  bench_counts_t counts_netlink;
+  char file[] = "/tmp/collectd-tcpconnsbench.XXXXXX";
+  uint32_t seq = 1;
+  double t0, t1, t2;
+  int fd;
+  int i;
+
+  while (42) {
+    int c;
+
+    c = getopt (argc, argv, "n:c:l:p:h");
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        iterations = atoi (optarg);
+        break;
+      case 'c':
+        connections = atoi (optarg);
+        break;
+      case 'l':
+        listening = atoi (optarg);
+        break;
+      case 'p':
+        if (conn_config ("LocalPort", optarg) != 0)
+          exit_usage (argv[0], 1);
+        break;
+      case 'h':
+        exit_usage (argv[0], 0);
+        break;
+      default:
+        exit_usage (argv[0], 1);
+    }
+  }
+
+  if ((optind < argc) || (iterations <= 0) || (connections < 0)
+      || (listening < 0) || (listening > 50000))
+    exit_usage (argv[0], 1);
+
+  conn_init ();
+
+  conn_netlink_buffer = malloc (conn_netlink_buffer_size);
+  sockets = generate_sockets (connections, listening, &sockets_num);
+  if ((conn_netlink_buffer == NULL) || (sockets == NULL))
+  {
+    fprintf (stderr, "malloc failed.\n");
+    return (1);
+  }
+
+  chunks = encode_netlink_dump (seq, sockets, sockets_num, &chunks_num);
+  fd = mkstemp (file);
+  if ((chunks == NULL) || (fd < 0))
+  {
+    fprintf (stderr, "Generating the input failed.\n");
+    return (1);
+  }
+  close (fd);
+
+  if (write_proc_file (file, sockets, sockets_num) != 0)
+  {
+    fprintf (stderr, "%s: %s\n", file, strerror (errno));
+    unlink (file);
+    return (1);
+  }
+
+  /* Check the result once, outside of the timed loops. */
+  read_proc (file);
+  get_counts (&counts_proc);
+  read_netlink (chunks, chunks_num, seq);
+  get_counts (&counts_netlink);
+
+  t0 = now ();
+  for (i = 0; i < iterations; i++)
+    read_proc (file);
+  t1 = now ();
+  for (i = 0; i < iterations; i++)
+    read_netlink (chunks, chunks_num, seq);
+  t2 = now ();
+
+  unlink (file);
+
+  printf ("%8s %6s %10s %10s %10s %8s\n", "sockets", "ports", "chunks",
+      "proc/us", "netlink/us", "speedup");
+  printf ("%8i %6i %10i %10.2f %10.2f %7.2fx%s\n",
+      sockets_num, counts_proc.ports_num, chunks_num,
+      1000000.0 * (t1 - t0) / iterations,
+      1000000.0 * (t2 - t1) / iterations,
+      (t2 > t1) ? (t1 - t0) / (t2 - t1) : 0.0,
+      (memcmp (&counts_proc, &counts_netlink, sizeof (counts_proc)) == 0)
+      ? "" : "  MISMATCH");
+
+  for (i = 1; i <= TCP_STATE_MAX; i++)
+  {
+    if ((counts_proc.local[i] == 0) && (counts_proc.remote[i] == 0)
+        && (counts_netlink.local[i] == 0) && (counts_netlink.remote[i] == 0))
+      continue;
+    printf ("  %-12s local %8"PRIu64" / %8"PRIu64
+        "   remote %8"PRIu64" / %8"PRIu64"\n", tcp_state[i],
+        counts_proc.local[i], counts_netlink.local[i],
+        counts_proc.remote[i], counts_netlink.remote[i]);
+  }
+
+  free (chunks);
+  free (sockets);
+  conn_shutdown ();
+
+  return ((memcmp (&counts_proc, &counts_netlink, sizeof (counts_proc)) == 0)
+      ? 0 : 1);
+} /* }}} main */
+
+#else /* !KERNEL_LINUX || !HAVE_LINUX_INET_DIAG_H */
+int main (int argc, char **argv) { /* {{{ */
+  fprintf (stderr, "%s: Only Linux can read sockets via netlink.\n",
+      argv[0]);
+  return (1);
+} /* }}} main */
+#endif
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -99,6 +99,9 @@ static cf_global_option_t cf_global_options[] =
 	{"Interval",    NULL, "10"},
 	{"ReadThreads", NULL, "5"},
 	{"Timeout",     NULL, "2"},
+	{"CacheWindowMax", NULL, "1024"},
+	{"CacheSnapshotFile", NULL, NULL},
+	{"CacheSnapshotInterval", NULL, "0"},
 	{"PreCacheChain",  NULL, "PreCache"},
 	{"PostCacheChain", NULL, "PostCache"}
 };
@@ -29,6 +29,10 @@
 #include "common.h"
 #include "plugin.h"
 
+#if KERNEL_LINUX
+# include "utils_procfs.h"
+#endif
+
 #ifdef HAVE_MACH_KERN_RETURN_H
 # include <mach/kern_return.h>
 #endif
@@ -113,7 +117,7 @@ static int cpu_temp_retry_max     = 1;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+static procfs_file_t *pf_stat = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -354,36 +358,44 @@ static int cpu_read (void)
 	int cpu;
 	derive_t user, nice, syst, idle;
 	derive_t wait, intr, sitr; /* sitr == soft interrupt */
-	FILE *fh;
-	char buf[1024];
+	char *line;
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	if ((pf_stat == NULL)
+			&& ((pf_stat = procfs_open ("/proc/stat")) == NULL))
+	{
+		char errbuf[1024];
+		ERROR ("cpu plugin: procfs_open (/proc/stat) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (procfs_read (pf_stat) < 0)
 	{
 		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
+		ERROR ("cpu plugin: procfs_read (/proc/stat) failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	while ((line = procfs_next_line (pf_stat)) != NULL)
 	{
-		if (strncmp (buf, "cpu", 3))
+		if (strncmp (line, "cpu", 3))
 			continue;
-		if ((buf[3] < '0') || (buf[3] > '9'))
+		if ((line[3] < '0') || (line[3] > '9'))
 			continue;
 
-		numfields = strsplit (buf, fields, 9);
+		numfields = procfs_split (line, fields, 9);
 		if (numfields < 5)
 			continue;
 
-		cpu = atoi (fields[0] + 3);
-		user = atoll (fields[1]);
-		nice = atoll (fields[2]);
-		syst = atoll (fields[3]);
-		idle = atoll (fields[4]);
+		cpu = (int) procfs_atoll (fields[0] + 3);
+		user = procfs_atoll (fields[1]);
+		nice = procfs_atoll (fields[2]);
+		syst = procfs_atoll (fields[3]);
+		idle = procfs_atoll (fields[4]);
 
 		submit (cpu, "user", user);
 		submit (cpu, "nice", nice);
@@ -392,20 +404,18 @@ static int cpu_read (void)
 
 		if (numfields >= 8)
 		{
-			wait = atoll (fields[5]);
-			intr = atoll (fields[6]);
-			sitr = atoll (fields[7]);
+			wait = procfs_atoll (fields[5]);
+			intr = procfs_atoll (fields[6]);
+			sitr = procfs_atoll (fields[7]);
 
 			submit (cpu, "wait", wait);
 			submit (cpu, "interrupt", intr);
 			submit (cpu, "softirq", sitr);
 
 			if (numfields >= 9)
-				submit (cpu, "steal", atoll (fields[8]));
+				submit (cpu, "steal", procfs_atoll (fields[8]));
 		}
 	}
-
-	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT)
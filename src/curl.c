@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_match.h"
+#include "utils_curl.h"
 
 #include <curl/curl.h>
 
@@ -61,6 +62,7 @@ struct web_page_s /* {{{ */
   int   verify_host;
   char *cacert;
   int   response_time;
+  cdtime_t timeout;
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
@@ -462,6 +464,8 @@ static int cc_config_add_page (oconfig_item_t *ci) /* {{{ */
       status = cc_config_set_boolean (child->key, &page->response_time, child);
     else if (strcasecmp ("CACert", child->key) == 0)
       status = cc_config_add_string ("CACert", &page->cacert, child);
+    else if (strcasecmp ("Timeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &page->timeout);
     else if (strcasecmp ("Match", child->key) == 0)
       /* Be liberal with failing matches => don't set `status'. */
       cc_config_add_match (page, child);
@@ -604,36 +608,34 @@ static void cc_submit_response_time (const web_page_t *wp, double seconds) /* {{
   plugin_dispatch_values (&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page (web_page_t *wp) /* {{{ */
+/* Called by the curl engine when the page has been fetched. */
+static void cc_page_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
 {
+  web_page_t *wp = user_data;
   web_match_t *wm;
-  int status;
-  struct timeval start, end;
-
-  if (wp->response_time)
-    gettimeofday (&start, NULL);
 
-  wp->buffer_fill = 0;
-  status = curl_easy_perform (wp->curl);
-  if (status != 0)
+  if (status == CURLE_ABORTED_BY_CALLBACK)
+    return;
+  else if (status != CURLE_OK)
   {
-    ERROR ("curl plugin: curl_easy_perform failed with staus %i: %s",
-        status, wp->curl_errbuf);
-    return (-1);
+    ERROR ("curl plugin: Fetching page `%s' failed with status %i: %s",
+        wp->instance, (int) status, wp->curl_errbuf);
+    return;
   }
 
   if (wp->response_time)
   {
-    double secs = 0;
-    gettimeofday (&end, NULL);
-    secs += end.tv_sec - start.tv_sec;
-    secs += (end.tv_usec - start.tv_usec) / 1000000.0;
+    double secs = 0.0;
+
+    curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME, &secs);
     cc_submit_response_time (wp, secs);
   }
 
   for (wm = wp->matches; wm != NULL; wm = wm->next)
   {
     cu_match_value_t *mv;
+    int status;
 
     status = match_apply (wm->match, wp->buffer);
     if (status != 0)
@@ -651,6 +653,31 @@ static int cc_read_page (web_page_t *wp) /* {{{ */
 
     cc_submit (wp, wm, mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cc_page_done */
+
+static int cc_read_page (web_page_t *wp) /* {{{ */
+{
+  int status;
+
+  if (ucurl_busy (wp->curl))
+  {
+    WARNING ("curl plugin: Page `%s' is still being fetched. "
+        "Skipping this interval.", wp->instance);
+    return (0);
+  }
+
+  wp->buffer_fill = 0;
+  if (wp->buffer != NULL)
+    wp->buffer[0] = 0;
+
+  /* The page is fetched asynchronously; cc_page_done parses it. */
+  status = ucurl_submit (wp->curl, wp->timeout, cc_page_done, wp);
+  if (status != 0)
+  {
+    ERROR ("curl plugin: ucurl_submit failed for page `%s'.",
+        wp->instance);
+    return (-1);
+  }
 
   return (0);
 } /* }}} int cc_read_page */
@@ -667,6 +694,9 @@ static int cc_read (void) /* {{{ */
 
 static int cc_shutdown (void) /* {{{ */
 {
+  /* Make sure no transfer is using the handles anymore. */
+  ucurl_shutdown ();
+
   cc_web_page_free (pages_g);
   pages_g = NULL;
 
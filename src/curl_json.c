@@ -25,9 +25,10 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 #include "utils_complain.h"
 
+#include "utils_curl.h"
+
 #include <curl/curl.h>
 #include <yajl/yajl_parse.h>
 #if HAVE_YAJL_YAJL_VERSION_H
@@ -39,8 +40,6 @@
 #endif
 
 #define CJ_DEFAULT_HOST "localhost"
-#define CJ_KEY_MAGIC 0x43484b59UL /* CHKY */
-#define CJ_IS_KEY(key) ((key)->magic == CJ_KEY_MAGIC)
 #define CJ_ANY "*"
 #define COUCH_MIN(x,y) ((x) < (y) ? (x) : (y))
 
@@ -51,7 +50,34 @@ struct cj_key_s /* {{{ */
   char *path;
   char *type;
   char *instance;
-  unsigned long magic;
+  /* Type of the first data source of `type', looked up on first use.
+   * Less than zero if not yet known. */
+  int ds_type;
+};
+/* }}} */
+
+/* The configured key paths are compiled into a tree of nodes that mirrors
+ * the structure of the expected JSON document, e.g.
+ * "httpd/requests/count",
+ * "httpd/requests/current" ->
+ * { "httpd": { "requests": { "count": $key, "current": $key } } }
+ *
+ * Each node holds the key to submit if a number is found at its position
+ * and the nodes for the map keys below it, sorted by name so map keys can
+ * be looked up in place with a binary search. */
+struct cj_node_s;
+typedef struct cj_node_s cj_node_t;
+struct cj_node_s /* {{{ */
+{
+  char *name;
+  size_t name_len;
+
+  cj_key_t *key;
+
+  cj_node_t **children;
+  size_t children_num;
+  /* Child matching any map key ("*"). */
+  cj_node_t *any;
 };
 /* }}} */
 
@@ -67,19 +93,21 @@ struct cj_s /* {{{ */
   _Bool verify_peer;
   _Bool verify_host;
   char *cacert;
+  cdtime_t timeout;
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
 
   yajl_handle yajl;
-  c_avl_tree_t *tree;
-  cj_key_t *key;
+  cj_node_t *root;
   int depth;
+  /* Nesting level within a map or array that contains no configured
+   * keys. All callbacks return early while this is non-zero. */
+  int skip;
   struct {
-    union {
-      c_avl_tree_t *tree;
-      cj_key_t *key;
-    };
+    /* Node matching the current map key at this depth, or NULL. */
+    const cj_node_t *node;
+    /* The current map key, only set if `node' is not NULL. */
     char name[DATA_MAX_NAME_LEN];
   } state[YAJL_MAX_DEPTH];
 };
@@ -92,7 +120,6 @@ typedef unsigned int yajl_len_t;
 #endif
 
 static int cj_read (user_data_t *ud);
-static int cj_curl_perform (cj_t *db, CURL *curl);
 static void cj_submit (cj_t *db, cj_key_t *key, value_t *value);
 
 static size_t cj_curl_callback (void *buf, /* {{{ */
@@ -111,16 +138,11 @@ static size_t cj_curl_callback (void *buf, /* {{{ */
   if (db == NULL)
     return (0);
 
+  /* The document may arrive in several chunks, so the parse is only
+   * completed by cj_curl_done(). */
   status = yajl_parse(db->yajl, (unsigned char *) buf, len);
   if (status == yajl_status_ok)
-  {
-#if HAVE_YAJL_V2
-    status = yajl_complete_parse(db->yajl);
-#else
-    status = yajl_parse_complete(db->yajl);
-#endif
     return (len);
-  }
 #if !HAVE_YAJL_V2
   else if (status == yajl_status_insufficient_data)
     return (len);
@@ -143,6 +165,9 @@ static int cj_get_type (cj_key_t *key)
 {
   const data_set_t *ds;
 
+  if (key->ds_type >= 0)
+    return (key->ds_type);
+
   ds = plugin_get_ds (key->type);
   if (ds == NULL)
   {
@@ -169,41 +194,166 @@ static int cj_get_type (cj_key_t *key)
         key->type);
   }
 
+  key->ds_type = ds->ds[0].type;
   return ds->ds[0].type;
 }
 
+/* Compares the (not null terminated) map key "name" with a node's name.
+ * Used both for sorting the children and for looking them up. */
+static int cj_node_compare (const char *name, size_t name_len, /* {{{ */
+    const cj_node_t *node)
+{
+  int status;
+
+  status = memcmp (name, node->name, COUCH_MIN (name_len, node->name_len));
+  if (status != 0)
+    return (status);
+
+  if (name_len < node->name_len)
+    return (-1);
+  else if (name_len > node->name_len)
+    return (1);
+  return (0);
+} /* }}} int cj_node_compare */
+
+/* Returns the child of "node" matching "name" or, failing that, the "*"
+ * child. Sets "ret_pos" to the position "name" would be inserted at. */
+static cj_node_t *cj_node_find (const cj_node_t *node, /* {{{ */
+    const char *name, size_t name_len, size_t *ret_pos)
+{
+  size_t lo = 0;
+  size_t hi = node->children_num;
+
+  while (lo < hi)
+  {
+    size_t mid = lo + ((hi - lo) / 2);
+    int status;
+
+    status = cj_node_compare (name, name_len, node->children[mid]);
+    if (status == 0)
+    {
+      if (ret_pos != NULL)
+        *ret_pos = mid;
+      return (node->children[mid]);
+    }
+    else if (status < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  if (ret_pos != NULL)
+    *ret_pos = lo;
+  return (node->any);
+} /* }}} cj_node_t *cj_node_find */
+
+/* Parses a number as sent by the JSON parser without copying it. JSON
+ * numbers are plain decimals, so counters and derives can be converted
+ * directly; only gauges go through strtod(3). */
+static int cj_parse_number (const char *number, size_t len, /* {{{ */
+    int type, value_t *ret_value)
+{
+  if (type == DS_TYPE_GAUGE)
+  {
+    char buffer[64];
+    char *endptr = NULL;
+
+    if ((len == 0) || (len >= sizeof (buffer)))
+      return (-1);
+    memcpy (buffer, number, len);
+    buffer[len] = 0;
+
+    ret_value->gauge = (gauge_t) strtod (buffer, &endptr);
+    if (endptr == buffer)
+      return (-1);
+    return (0);
+  }
+  else
+  {
+    uint64_t u = 0;
+    _Bool negative = 0;
+    size_t i = 0;
+
+    if ((len > 0) && (number[0] == '-'))
+    {
+      negative = 1;
+      i++;
+    }
+
+    if ((i >= len) || (number[i] < '0') || (number[i] > '9'))
+      return (-1);
+
+    /* Anything after the integer part, e.g. a fraction, is ignored. */
+    for (; (i < len) && (number[i] >= '0') && (number[i] <= '9'); i++)
+      u = (10 * u) + (uint64_t) (number[i] - '0');
+
+    if (type == DS_TYPE_COUNTER)
+      ret_value->counter = (counter_t) (negative ? -u : u);
+    else if (type == DS_TYPE_DERIVE)
+      ret_value->derive = negative ? -((derive_t) u) : (derive_t) u;
+    else if (type == DS_TYPE_ABSOLUTE)
+      ret_value->absolute = (absolute_t) (negative ? -u : u);
+    else
+      return (-1);
+
+    return (0);
+  }
+} /* }}} int cj_parse_number */
+
 /* yajl callbacks */
 #define CJ_CB_ABORT    0
 #define CJ_CB_CONTINUE 1
 
-/* "number" may not be null terminated, so copy it into a buffer before
- * parsing. */
-static int cj_cb_number (void *ctx,
-    const char *number, yajl_len_t number_len)
+static void cj_submit_number (cj_t *db, cj_key_t *key, /* {{{ */
+    const char *number, size_t number_len, _Bool is_string)
 {
-  char buffer[number_len + 1];
-
-  cj_t *db = (cj_t *)ctx;
-  cj_key_t *key = db->state[db->depth].key;
   value_t vt;
   int type;
   int status;
 
-  if ((key == NULL) || !CJ_IS_KEY (key))
-    return (CJ_CB_CONTINUE);
+  type = cj_get_type (key);
+  if (type < 0)
+    return;
 
-  memcpy (buffer, number, number_len);
-  buffer[sizeof (buffer) - 1] = 0;
+  if (is_string)
+  {
+    /* Strings are parsed like any other configured string, e.g. allowing
+     * leading blanks or hexadecimal numbers. */
+    char buffer[number_len + 1];
+
+    memcpy (buffer, number, number_len);
+    buffer[number_len] = 0;
+    status = parse_value (buffer, &vt, type);
+  }
+  else
+    status = cj_parse_number (number, number_len, type, &vt);
 
-  type = cj_get_type (key);
-  status = parse_value (buffer, &vt, type);
   if (status != 0)
   {
-    NOTICE ("curl_json plugin: Unable to parse number: \"%s\"", buffer);
-    return (CJ_CB_CONTINUE);
+    NOTICE ("curl_json plugin: Unable to parse number: \"%.*s\"",
+        (int) number_len, number);
+    return;
   }
 
   cj_submit (db, key, &vt);
+} /* }}} void cj_submit_number */
+
+/* "number" is not null terminated. */
+static int cj_cb_number (void *ctx,
+    const char *number, yajl_len_t number_len)
+{
+  cj_t *db = (cj_t *)ctx;
+  const cj_node_t *node;
+
+  if (db->skip > 0)
+    return (CJ_CB_CONTINUE);
+
+  node = db->state[db->depth].node;
+  if ((node == NULL) || (node->key == NULL))
+    return (CJ_CB_CONTINUE);
+
+  cj_submit_number (db, node->key, number, (size_t) number_len,
+      /* is_string = */ 0);
   return (CJ_CB_CONTINUE);
 } /* int cj_cb_number */
 
@@ -211,25 +361,27 @@ static int cj_cb_map_key (void *ctx, const unsigned char *val,
     yajl_len_t len)
 {
   cj_t *db = (cj_t *)ctx;
-  c_avl_tree_t *tree;
+  const cj_node_t *parent;
+  const cj_node_t *node;
 
-  tree = db->state[db->depth-1].tree;
+  if (db->skip > 0)
+    return (CJ_CB_CONTINUE);
 
-  if (tree != NULL)
+  parent = db->state[db->depth-1].node;
+  if (parent == NULL)
   {
-    cj_key_t *value;
-    char *name;
+    db->state[db->depth].node = NULL;
+    return (CJ_CB_CONTINUE);
+  }
 
-    name = db->state[db->depth].name;
+  /* Keys are only copied if they match the configuration. */
+  node = cj_node_find (parent, (const char *) val, (size_t) len, NULL);
+  db->state[db->depth].node = node;
+  if (node != NULL)
+  {
     len = COUCH_MIN(len, sizeof (db->state[db->depth].name)-1);
-    sstrncpy (name, (char *)val, len+1);
-
-    if (c_avl_get (tree, name, (void *) &value) == 0)
-      db->state[db->depth].key = value;
-    else if (c_avl_get (tree, CJ_ANY, (void *) &value) == 0)
-      db->state[db->depth].key = value;
-    else
-      db->state[db->depth].key = NULL;
+    memcpy (db->state[db->depth].name, val, len);
+    db->state[db->depth].name[len] = 0;
   }
 
   return (CJ_CB_CONTINUE);
@@ -239,49 +391,78 @@ static int cj_cb_string (void *ctx, const unsigned char *val,
     yajl_len_t len)
 {
   cj_t *db = (cj_t *)ctx;
-  char str[len + 1];
+  const cj_node_t *node;
 
-  /* Create a null-terminated version of the string. */
-  memcpy (str, val, len);
-  str[len] = 0;
+  if (db->skip > 0)
+    return (CJ_CB_CONTINUE);
 
   /* No configuration for this string -> simply return. */
-  if (db->state[db->depth].key == NULL)
+  node = db->state[db->depth].node;
+  if (node == NULL)
     return (CJ_CB_CONTINUE);
 
-  if (!CJ_IS_KEY (db->state[db->depth].key))
+  if (node->key == NULL)
   {
-    NOTICE ("curl_json plugin: Found string \"%s\", but the configuration "
-        "expects a map here.", str);
+    NOTICE ("curl_json plugin: Found string \"%.*s\", but the configuration "
+        "expects a map here.", (int) len, (const char *) val);
     return (CJ_CB_CONTINUE);
   }
 
   /* Handle the string as if it was a number. */
-  return (cj_cb_number (ctx, (const char *) val, len));
+  cj_submit_number (db, node->key, (const char *) val, (size_t) len,
+      /* is_string = */ 1);
+  return (CJ_CB_CONTINUE);
 } /* int cj_cb_string */
 
-static int cj_cb_start (void *ctx)
+/* Enters a map or array. If nothing below it is configured, the whole
+ * subtree is skipped. Arrays are always skipped because key paths can't
+ * address array elements. */
+static int cj_cb_start (void *ctx, _Bool is_map)
 {
   cj_t *db = (cj_t *)ctx;
+  const cj_node_t *node;
+
+  if (db->skip > 0)
+  {
+    db->skip++;
+    return (CJ_CB_CONTINUE);
+  }
+
+  node = db->state[db->depth].node;
+  if (!is_map || (node == NULL)
+      || ((node->children_num == 0) && (node->any == NULL)))
+  {
+    db->skip = 1;
+    return (CJ_CB_CONTINUE);
+  }
+
   if (++db->depth >= YAJL_MAX_DEPTH)
   {
     ERROR ("curl_json plugin: %s depth exceeds max, aborting.", db->url);
     return (CJ_CB_ABORT);
   }
+  db->state[db->depth].node = NULL;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_end (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].tree = NULL;
+
+  if (db->skip > 0)
+  {
+    db->skip--;
+    return (CJ_CB_CONTINUE);
+  }
+
+  db->state[db->depth].node = NULL;
   --db->depth;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_start_map (void *ctx)
 {
-  return cj_cb_start (ctx);
+  return cj_cb_start (ctx, /* is_map = */ 1);
 }
 
 static int cj_cb_end_map (void *ctx)
@@ -291,7 +472,7 @@ static int cj_cb_end_map (void *ctx)
 
 static int cj_cb_start_array (void * ctx)
 {
-  return cj_cb_start (ctx);
+  return cj_cb_start (ctx, /* is_map = */ 0);
 }
 
 static int cj_cb_end_array (void * ctx)
@@ -327,25 +508,22 @@ static void cj_key_free (cj_key_t *key) /* {{{ */
   sfree (key);
 } /* }}} void cj_key_free */
 
-static void cj_tree_free (c_avl_tree_t *tree) /* {{{ */
+static void cj_node_free (cj_node_t *node) /* {{{ */
 {
-  char *name;
-  void *value;
-
-  while (c_avl_pick (tree, (void *) &name, (void *) &value) == 0)
-  {
-    cj_key_t *key = (cj_key_t *)value;
+  size_t i;
 
-    if (CJ_IS_KEY(key))
-      cj_key_free (key);
-    else
-      cj_tree_free ((c_avl_tree_t *)value);
+  if (node == NULL)
+    return;
 
-    sfree (name);
-  }
+  for (i = 0; i < node->children_num; i++)
+    cj_node_free (node->children[i]);
+  sfree (node->children);
+  cj_node_free (node->any);
 
-  c_avl_destroy (tree);
-} /* }}} void cj_tree_free */
+  cj_key_free (node->key);
+  sfree (node->name);
+  sfree (node);
+} /* }}} void cj_node_free */
 
 static void cj_free (void *arg) /* {{{ */
 {
@@ -358,13 +536,20 @@ static void cj_free (void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  /* Only stop this instance's transfer, the engine is shared. */
   if (db->curl != NULL)
+  {
+    ucurl_cancel (db->curl);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
 
-  if (db->tree != NULL)
-    cj_tree_free (db->tree);
-  db->tree = NULL;
+  if (db->yajl != NULL)
+    yajl_free (db->yajl);
+  db->yajl = NULL;
+
+  cj_node_free (db->root);
+  db->root = NULL;
 
   sfree (db->instance);
   sfree (db->host);
@@ -380,10 +565,68 @@ static void cj_free (void *arg) /* {{{ */
 
 /* Configuration handling functions {{{ */
 
-static c_avl_tree_t *cj_avl_create(void)
+static cj_node_t *cj_node_create (const char *name, size_t name_len) /* {{{ */
 {
-  return c_avl_create ((int (*) (const void *, const void *)) strcmp);
-}
+  cj_node_t *node;
+
+  node = (cj_node_t *) malloc (sizeof (*node));
+  if (node == NULL)
+    return (NULL);
+  memset (node, 0, sizeof (*node));
+
+  node->name = (char *) malloc (name_len + 1);
+  if (node->name == NULL)
+  {
+    sfree (node);
+    return (NULL);
+  }
+  memcpy (node->name, name, name_len);
+  node->name[name_len] = 0;
+  node->name_len = name_len;
+
+  return (node);
+} /* }}} cj_node_t *cj_node_create */
+
+/* Returns the child of "parent" named "name", creating it if necessary. */
+static cj_node_t *cj_node_get_child (cj_node_t *parent, /* {{{ */
+    const char *name, size_t name_len)
+{
+  cj_node_t **tmp;
+  cj_node_t *child;
+  size_t pos = 0;
+
+  if ((name_len == strlen (CJ_ANY))
+      && (memcmp (name, CJ_ANY, name_len) == 0))
+  {
+    if (parent->any == NULL)
+      parent->any = cj_node_create (name, name_len);
+    return (parent->any);
+  }
+
+  child = cj_node_find (parent, name, name_len, &pos);
+  if ((child != NULL) && (child != parent->any))
+    return (child);
+
+  child = cj_node_create (name, name_len);
+  if (child == NULL)
+    return (NULL);
+
+  tmp = (cj_node_t **) realloc (parent->children,
+      (parent->children_num + 1) * sizeof (*parent->children));
+  if (tmp == NULL)
+  {
+    cj_node_free (child);
+    return (NULL);
+  }
+  parent->children = tmp;
+
+  memmove (parent->children + pos + 1, parent->children + pos,
+      (parent->children_num - pos) * sizeof (*parent->children));
+  parent->children[pos] = child;
+  parent->children_num++;
+
+  return (child);
+} /* }}} cj_node_t *cj_node_get_child */
 
 static int cj_config_add_key (cj_t *db, /* {{{ */
                                    oconfig_item_t *ci)
@@ -407,7 +650,7 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
   memset (key, 0, sizeof (*key));
-  key->magic = CJ_KEY_MAGIC;
+  key->ds_type = -1;
 
   if (strcasecmp ("Key", ci->key) == 0)
   {
@@ -455,60 +698,62 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     break;
   } /* while (status == 0) */
 
-  /* store path in a tree that will match the json map structure, example:
-   * "httpd/requests/count",
-   * "httpd/requests/current" ->
-   * { "httpd": { "requests": { "count": $key, "current": $key } } }
-   */
+  /* Add the path to the tree of nodes, see the comment at cj_node_t. */
   if (status == 0)
   {
     char *ptr;
     char *name;
-    char ent[PATH_MAX];
-    c_avl_tree_t *tree;
+    cj_node_t *node;
 
-    if (db->tree == NULL)
-      db->tree = cj_avl_create();
+    if (db->root == NULL)
+      db->root = cj_node_create ("", 0);
 
-    tree = db->tree;
-    name = key->path;
+    node = db->root;
     ptr = key->path;
     if (*ptr == '/')
       ++ptr;
 
     name = ptr;
-    while (*ptr)
+    while ((node != NULL) && (*ptr != 0))
     {
       if (*ptr == '/')
       {
-        c_avl_tree_t *value;
-        int len;
-
-        len = ptr-name;
-        if (len == 0)
+        if (ptr == name)
           break;
-        sstrncpy (ent, name, len+1);
-
-        if (c_avl_get (tree, ent, (void *) &value) != 0)
-        {
-          value = cj_avl_create ();
-          c_avl_insert (tree, strdup (ent), value);
-        }
 
-        tree = value;
-        name = ptr+1;
+        node = cj_node_get_child (node, name, (size_t) (ptr - name));
+        name = ptr + 1;
       }
       ++ptr;
     }
-    if (*name)
-      c_avl_insert (tree, strdup(name), key);
-    else
+
+    if ((node == NULL) || (*name == 0) || (*ptr != 0))
     {
       ERROR ("curl_json plugin: invalid key: %s", key->path);
       status = -1;
     }
+    else
+    {
+      node = cj_node_get_child (node, name, strlen (name));
+      if (node == NULL)
+      {
+        ERROR ("curl_json plugin: cj_node_get_child failed.");
+        status = -1;
+      }
+      else if (node->key != NULL)
+      {
+        ERROR ("curl_json plugin: Key \"%s\" has been configured twice.",
+            key->path);
+        status = -1;
+      }
+      else
+        node->key = key;
+    }
   }
 
+  if (status != 0)
+    cj_key_free (key);
+
   return (status);
 } /* }}} int cj_config_add_key */
 
@@ -615,6 +860,8 @@ static int cj_config_add_url (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean (child, &db->verify_host);
     else if (strcasecmp ("CACert", child->key) == 0)
       status = cf_util_get_string (child, &db->cacert);
+    else if (strcasecmp ("Timeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &db->timeout);
     else if (strcasecmp ("Key", child->key) == 0)
       status = cj_config_add_key (db, child);
     else
@@ -629,7 +876,7 @@ static int cj_config_add_url (oconfig_item_t *ci) /* {{{ */
 
   if (status == 0)
   {
-    if (db->tree == NULL)
+    if (db->root == NULL)
     {
       WARNING ("curl_json plugin: No (valid) `Key' block "
                "within `URL' block `%s'.", db->url);
@@ -745,79 +992,67 @@ static void cj_submit (cj_t *db, cj_key_t *key, value_t *value) /* {{{ */
   plugin_dispatch_values (&vl);
 } /* }}} int cj_submit */
 
-static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
+/* Called by the curl engine when the transfer has finished. The document
+ * has been parsed while it was received, so only the end of the document
+ * needs to be handled here. */
+static void cj_curl_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
 {
-  int status;
+  cj_t *db = user_data;
+  yajl_status ystatus;
   long rc;
   char *url;
-  yajl_handle yprev = db->yajl;
-
-  db->yajl = yajl_alloc (&ycallbacks,
-#if HAVE_YAJL_V2
-      /* alloc funcs = */ NULL,
-#else
-      /* alloc funcs = */ NULL, NULL,
-#endif
-      /* context = */ (void *)db);
-  if (db->yajl == NULL)
-  {
-    ERROR ("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
-    return (-1);
-  }
 
   url = NULL;
   curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
 
-  status = curl_easy_perform (curl);
-  if (status != 0)
+  if (status == CURLE_ABORTED_BY_CALLBACK)
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, (url != NULL) ? url : "<null>");
-    yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
+    /* The transfer has been cancelled. */
   }
-
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rc);
-
-  /* The response code is zero if a non-HTTP transport was used. */
-  if ((rc != 0) && (rc != 200))
+  else if (status != CURLE_OK)
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with "
-        "response code %ld (%s)", rc, url);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
+    ERROR ("curl_json plugin: Transfer failed with status %i: %s (%s)",
+           (int) status, db->curl_errbuf, (url != NULL) ? url : "<null>");
   }
+  else
+  {
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rc);
 
+    /* The response code is zero if a non-HTTP transport was used. */
+    if ((rc != 0) && (rc != 200))
+    {
+      ERROR ("curl_json plugin: Transfer failed with "
+          "response code %ld (%s)", rc, url);
+    }
+    else
+    {
 #if HAVE_YAJL_V2
-    status = yajl_complete_parse(db->yajl);
+      ystatus = yajl_complete_parse(db->yajl);
 #else
-    status = yajl_parse_complete(db->yajl);
+      ystatus = yajl_parse_complete(db->yajl);
 #endif
-  if (status != yajl_status_ok)
-  {
-    unsigned char *errmsg;
+      if (ystatus != yajl_status_ok)
+      {
+        unsigned char *errmsg;
 
-    errmsg = yajl_get_error (db->yajl, /* verbose = */ 0,
-        /* jsonText = */ NULL, /* jsonTextLen = */ 0);
-    ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
-        (char *) errmsg);
-    yajl_free_error (db->yajl, errmsg);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
+        errmsg = yajl_get_error (db->yajl, /* verbose = */ 0,
+            /* jsonText = */ NULL, /* jsonTextLen = */ 0);
+        ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
+            (char *) errmsg);
+        yajl_free_error (db->yajl, errmsg);
+      }
+    }
   }
 
   yajl_free (db->yajl);
-  db->yajl = yprev;
-  return (0);
-} /* }}} int cj_curl_perform */
+  db->yajl = NULL;
+} /* }}} void cj_curl_done */
 
 static int cj_read (user_data_t *ud) /* {{{ */
 {
   cj_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -827,17 +1062,54 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db = (cj_t *) ud->data;
 
+  /* The parser state belongs to the running transfer. */
+  if (ucurl_busy (db->curl))
+  {
+    WARNING ("curl_json plugin: `%s' is still being fetched. "
+        "Skipping this interval.", db->url);
+    return (0);
+  }
+
   db->depth = 0;
-  memset (&db->state, 0, sizeof(db->state));
-  db->state[db->depth].tree = db->tree;
-  db->key = NULL;
+  db->skip = 0;
+  db->state[0].node = db->root;
+  db->state[0].name[0] = 0;
+
+  db->yajl = yajl_alloc (&ycallbacks,
+#if HAVE_YAJL_V2
+      /* alloc funcs = */ NULL,
+#else
+      /* alloc funcs = */ NULL, NULL,
+#endif
+      /* context = */ (void *)db);
+  if (db->yajl == NULL)
+  {
+    ERROR ("curl_json plugin: yajl_alloc failed.");
+    return (-1);
+  }
 
-  return cj_curl_perform (db, db->curl);
+  /* The document is parsed by cj_curl_callback while it is received. */
+  status = ucurl_submit (db->curl, db->timeout, cj_curl_done, db);
+  if (status != 0)
+  {
+    ERROR ("curl_json plugin: ucurl_submit failed for `%s'.", db->url);
+    yajl_free (db->yajl);
+    db->yajl = NULL;
+    return (-1);
+  }
+
+  return (0);
 } /* }}} int cj_read */
 
+static int cj_shutdown (void) /* {{{ */
+{
+  return (ucurl_shutdown ());
+} /* }}} int cj_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_json", cj_config);
+  plugin_register_shutdown ("curl_json", cj_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
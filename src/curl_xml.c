@@ -24,9 +24,12 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_llist.h"
+#include "utils_curl.h"
 
 #include <libxml/parser.h>
+#include <libxml/pattern.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 #include <libxml/xpath.h>
 
 #include <curl/curl.h>
@@ -40,6 +43,7 @@ struct cx_values_s /* {{{ */
 {
   char path[DATA_MAX_NAME_LEN];
   size_t path_len;
+  xmlXPathCompExprPtr comp;
 };
 typedef struct cx_values_s cx_values_t;
 /* }}} */
@@ -54,6 +58,10 @@ struct cx_xpath_s /* {{{ */
   char *instance;
   int is_table;
   unsigned long magic;
+
+  /* Compiled versions of `path' and `instance'. */
+  xmlXPathCompExprPtr path_comp;
+  xmlXPathCompExprPtr instance_comp;
 };
 typedef struct cx_xpath_s cx_xpath_t;
 /* }}} */
@@ -70,6 +78,10 @@ struct cx_s /* {{{ */
   _Bool verify_peer;
   _Bool verify_host;
   char *cacert;
+  cdtime_t timeout;
+  /* Only keep the subtrees matched by the XPath blocks in memory. */
+  _Bool streaming;
+  _Bool collect_statistics;
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
@@ -125,9 +137,19 @@ static size_t cx_curl_callback (void *buf, /* {{{ */
 
 static void cx_xpath_free (cx_xpath_t *xpath) /* {{{ */
 {
+  int i;
+
   if (xpath == NULL)
     return;
 
+  if (xpath->path_comp != NULL)
+    xmlXPathFreeCompExpr (xpath->path_comp);
+  if (xpath->instance_comp != NULL)
+    xmlXPathFreeCompExpr (xpath->instance_comp);
+  for (i = 0; i < xpath->values_len; i++)
+    if (xpath->values[i].comp != NULL)
+      xmlXPathFreeCompExpr (xpath->values[i].comp);
+
   sfree (xpath->path);
   sfree (xpath->type);
   sfree (xpath->instance_prefix);
@@ -168,8 +190,12 @@ static void cx_free (void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  /* Only stop this instance's transfer, the engine is shared. */
   if (db->curl != NULL)
+  {
+    ucurl_cancel (db->curl);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
 
   if (db->list != NULL)
@@ -207,12 +233,11 @@ static int cx_check_type (const data_set_t *ds, cx_xpath_t *xpath) /* {{{ */
 } /* }}} cx_check_type */
 
 static xmlXPathObjectPtr cx_evaluate_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */ 
-           xmlChar *expr)
+           xmlXPathCompExprPtr comp, const char *expr)
 {
   xmlXPathObjectPtr xpath_obj;
 
-  /* XXX: When to free this? */
-  xpath_obj = xmlXPathEvalExpression(BAD_CAST expr, xpath_ctx);
+  xpath_obj = xmlXPathCompiledEval (comp, xpath_ctx);
   if (xpath_obj == NULL)
   {
      WARNING ("curl_xml plugin: "
@@ -242,7 +267,8 @@ static int cx_handle_single_value_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */
   int tmp_size;
   char *node_value;
 
-  values_node_obj = cx_evaluate_xpath (xpath_ctx, BAD_CAST xpath->values[index].path);
+  values_node_obj = cx_evaluate_xpath (xpath_ctx, xpath->values[index].comp,
+      xpath->values[index].path);
   if (values_node_obj == NULL)
     return (-1); /* Error already logged. */
 
@@ -279,6 +305,12 @@ static int cx_handle_single_value_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */
   }
 
   node_value = (char *) xmlNodeGetContent(values_node->nodeTab[0]);
+  if (node_value == NULL)
+  {
+    xmlXPathFreeObject (values_node_obj);
+    return (-1);
+  }
+
   switch (ds->ds[index].type)
   {
     case DS_TYPE_COUNTER:
@@ -299,6 +331,7 @@ static int cx_handle_single_value_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */
   }
 
   /* free up object */
+  xmlFree (node_value);
   xmlXPathFreeObject (values_node_obj);
 
   /* We have reached here which means that
@@ -358,7 +391,8 @@ static int cx_handle_instance_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */
   {
     int tmp_size;
 
-    instance_node_obj = cx_evaluate_xpath (xpath_ctx, BAD_CAST xpath->instance);
+    instance_node_obj = cx_evaluate_xpath (xpath_ctx, xpath->instance_comp,
+        xpath->instance);
     if (instance_node_obj == NULL)
       return (-1); /* error is logged already */
 
@@ -394,23 +428,24 @@ static int cx_handle_instance_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */
     }
   } /* if (xpath->instance != NULL) */
 
-  if (xpath->instance_prefix != NULL)
+  if ((instance_node != NULL) && (instance_node->nodeNr > 0))
   {
-    if (instance_node != NULL)
-      ssnprintf (vl->type_instance, sizeof (vl->type_instance),"%s%s",
-          xpath->instance_prefix, (char *) xmlNodeGetContent(instance_node->nodeTab[0]));
-    else
-      sstrncpy (vl->type_instance, xpath->instance_prefix,
-          sizeof (vl->type_instance));
+    char *content;
+
+    content = (char *) xmlNodeGetContent (instance_node->nodeTab[0]);
+    ssnprintf (vl->type_instance, sizeof (vl->type_instance), "%s%s",
+        (xpath->instance_prefix != NULL) ? xpath->instance_prefix : "",
+        (content != NULL) ? content : "");
+    if (content != NULL)
+      xmlFree (content);
   }
-  else
+  else if (xpath->instance_prefix != NULL)
   {
-    /* If instance_prefix and instance_node are NULL, then
-     * don't set the type_instance */
-    if (instance_node != NULL)
-      sstrncpy (vl->type_instance, (char *) xmlNodeGetContent(instance_node->nodeTab[0]),
-          sizeof (vl->type_instance));
+    sstrncpy (vl->type_instance, xpath->instance_prefix,
+        sizeof (vl->type_instance));
   }
+  /* If instance_prefix and instance_node are NULL, then
+   * don't set the type_instance */
 
   /* Free `instance_node_obj' this late, because `instance_node' points to
    * somewhere inside this structure. */
@@ -432,7 +467,7 @@ static int  cx_handle_base_xpath (char const *plugin_instance, /* {{{ */
 
   value_list_t vl = VALUE_LIST_INIT;
 
-  base_node_obj = cx_evaluate_xpath (xpath_ctx, BAD_CAST base_xpath); 
+  base_node_obj = cx_evaluate_xpath (xpath_ctx, xpath->path_comp, base_xpath);
   if (base_node_obj == NULL)
     return -1; /* error is logged already */
 
@@ -455,6 +490,7 @@ static int  cx_handle_base_xpath (char const *plugin_instance, /* {{{ */
     ERROR ("curl_xml plugin: "
              "InstanceFrom is must in xpath block since the base xpath expression \"%s\" "
              "returned multiple results. Skipping the xpath block...", base_xpath);
+    xmlXPathFreeObject (base_node_obj);
     return -1;
   }
 
@@ -515,14 +551,83 @@ static int cx_handle_parsed_xml(xmlDocPtr doc, /* {{{ */
   return status;
 } /* }}} cx_handle_parsed_xml */
 
+/* Parses the document with a text reader, keeping only the subtrees
+ * matched by the XPath blocks. The patterns have been checked by
+ * cx_check_streaming. */
+static xmlDocPtr cx_read_preserved (cx_t *db) /* {{{ */
+{
+  xmlTextReaderPtr reader;
+  xmlDocPtr doc;
+  llentry_t *le;
+  int status;
+
+  reader = xmlReaderForMemory (db->buffer, (int) db->buffer_fill, db->url,
+      /* encoding = */ NULL, /* options = */ 0);
+  if (reader == NULL)
+  {
+    ERROR ("curl_xml plugin: xmlReaderForMemory failed.");
+    return (NULL);
+  }
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+    xmlTextReaderPreservePattern (reader, BAD_CAST le->key,
+        /* namespaces = */ NULL);
+
+  while ((status = xmlTextReaderRead (reader)) == 1)
+    /* do nothing */;
+
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document from %s.",
+        db->url);
+    xmlFreeTextReader (reader);
+    return (NULL);
+  }
+
+  /* The caller owns the document from now on. */
+  doc = xmlTextReaderCurrentDoc (reader);
+  xmlFreeTextReader (reader);
+
+  return (doc);
+} /* }}} xmlDocPtr cx_read_preserved */
+
+static void cx_submit_statistics (cx_t *db, cdtime_t parse_time) /* {{{ */
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, (db->host != NULL) ? db->host : hostname_g,
+      sizeof (vl.host));
+  sstrncpy (vl.plugin, "curl_xml", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, db->instance, sizeof (vl.plugin_instance));
+
+  values[0].gauge = CDTIME_T_TO_DOUBLE (parse_time);
+  sstrncpy (vl.type, "response_time", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "parse", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  values[0].gauge = (gauge_t) db->buffer_fill;
+  sstrncpy (vl.type, "bytes", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "document", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+} /* }}} void cx_submit_statistics */
+
 static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
 {
   int status;
   xmlDocPtr doc;
   xmlXPathContextPtr xpath_ctx;
+  cdtime_t start;
+
+  start = cdtime ();
 
   /* Load the XML */
-  doc = xmlParseDoc(xml);
+  if (db->streaming)
+    doc = cx_read_preserved (db);
+  else
+    doc = xmlParseDoc(xml);
   if (doc == NULL)
   {
     ERROR ("curl_xml plugin: Failed to parse the xml document  - %s", xml);
@@ -541,48 +646,51 @@ static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
   /* Cleanup */
   xmlXPathFreeContext(xpath_ctx);
   xmlFreeDoc(doc);
+
+  if (db->collect_statistics)
+    cx_submit_statistics (db, cdtime () - start);
+
   return status;
 } /* }}} cx_parse_stats_xml */
 
-static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
+/* Called by the curl engine when the document has been received. */
+static void cx_curl_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
 {
-  int status;
+  cx_t *db = user_data;
   long rc;
-  char *ptr;
   char *url;
 
-  db->buffer_fill = 0; 
-  status = curl_easy_perform (curl);
+  if (status == CURLE_ABORTED_BY_CALLBACK)
+    return;
 
+  url = NULL;
   curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rc);
 
   /* The response code is zero if a non-HTTP transport was used. */
   if ((rc != 0) && (rc != 200))
   {
-    ERROR ("curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
+    ERROR ("curl_xml plugin: Transfer failed with response code %ld (%s)",
            rc, url);
-    return (-1);
+    return;
   }
 
-  if (status != 0)
+  if (status != CURLE_OK)
   {
-    ERROR ("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, url);
-    return (-1);
+    ERROR ("curl_xml plugin: Transfer failed with status %i: %s (%s)",
+           (int) status, db->curl_errbuf, url);
+    return;
   }
 
-  ptr = db->buffer;
-
-  status = cx_parse_stats_xml(BAD_CAST ptr, db);
+  cx_parse_stats_xml(BAD_CAST db->buffer, db);
   db->buffer_fill = 0;
-
-  return status;
-} /* }}} int cx_curl_perform */
+} /* }}} void cx_curl_done */
 
 static int cx_read (user_data_t *ud) /* {{{ */
 {
   cx_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -592,7 +700,22 @@ static int cx_read (user_data_t *ud) /* {{{ */
 
   db = (cx_t *) ud->data;
 
-  return cx_curl_perform (db, db->curl);
+  if (ucurl_busy (db->curl))
+  {
+    WARNING ("curl_xml plugin: `%s' is still being fetched. "
+        "Skipping this interval.", db->url);
+    return (0);
+  }
+
+  db->buffer_fill = 0;
+  status = ucurl_submit (db->curl, db->timeout, cx_curl_done, db);
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: ucurl_submit failed for `%s'.", db->url);
+    return (-1);
+  }
+
+  return (0);
 } /* }}} int cx_read */
 
 /* Configuration handling functions {{{ */
@@ -628,6 +751,18 @@ static int cx_config_add_values (const char *name, cx_xpath_t *xpath, /* {{{ */
   {
     xpath->values[i].path_len = sizeof (ci->values[i].value.string);
     sstrncpy (xpath->values[i].path, ci->values[i].value.string, sizeof (xpath->values[i].path));
+    xpath->values[i].comp = NULL;
+  }
+
+  for (i = 0; i < ci->values_num; i++)
+  {
+    xpath->values[i].comp = xmlXPathCompile (BAD_CAST xpath->values[i].path);
+    if (xpath->values[i].comp == NULL)
+    {
+      ERROR ("curl_xml plugin: Unable to compile the XPath expression "
+          "\"%s\".", xpath->values[i].path);
+      return (-1);
+    }
   }
 
   return (0); 
@@ -692,6 +827,35 @@ static int cx_config_add_xpath (cx_t *db, /* {{{ */
     status = -1;
   }
 
+  /* Compile the expressions once instead of on every read. */
+  if (status == 0)
+  {
+    xpath->path_comp = xmlXPathCompile (BAD_CAST xpath->path);
+    if (xpath->path_comp == NULL)
+    {
+      ERROR ("curl_xml plugin: Unable to compile the XPath expression "
+          "\"%s\".", xpath->path);
+      status = -1;
+    }
+  }
+
+  if ((status == 0) && (xpath->instance != NULL))
+  {
+    xpath->instance_comp = xmlXPathCompile (BAD_CAST xpath->instance);
+    if (xpath->instance_comp == NULL)
+    {
+      ERROR ("curl_xml plugin: Unable to compile the XPath expression "
+          "\"%s\".", xpath->instance);
+      status = -1;
+    }
+  }
+
+  if (status != 0)
+  {
+    cx_xpath_free (xpath);
+    return (status);
+  }
+
   if (status == 0)
   {
     char *name;
@@ -774,6 +938,30 @@ static int cx_init_curl (cx_t *db) /* {{{ */
   return (0);
 } /* }}} int cx_init_curl */
 
+/* Streaming is only possible if all base XPath expressions are simple
+ * enough to be used as patterns, e.g. "/stats/server/counter". */
+static void cx_check_streaming (cx_t *db) /* {{{ */
+{
+  llentry_t *le;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    xmlPatternPtr pattern;
+
+    pattern = xmlPatterncompile (BAD_CAST le->key, /* dict = */ NULL,
+        XML_PATTERN_XPATH, /* namespaces = */ NULL);
+    if (pattern == NULL)
+    {
+      WARNING ("curl_xml plugin: The XPath expression \"%s\" is too complex "
+          "to be used with `Streaming'. Streaming will be disabled for `%s'.",
+          le->key, db->url);
+      db->streaming = 0;
+      return;
+    }
+    xmlFreePattern (pattern);
+  }
+} /* }}} void cx_check_streaming */
+
 static int cx_config_add_url (oconfig_item_t *ci) /* {{{ */
 {
   cx_t *db;
@@ -831,6 +1019,12 @@ static int cx_config_add_url (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean (child, &db->verify_host);
     else if (strcasecmp ("CACert", child->key) == 0)
       status = cf_util_get_string (child, &db->cacert);
+    else if (strcasecmp ("Timeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &db->timeout);
+    else if (strcasecmp ("Streaming", child->key) == 0)
+      status = cf_util_get_boolean (child, &db->streaming);
+    else if (strcasecmp ("CollectStatistics", child->key) == 0)
+      status = cf_util_get_boolean (child, &db->collect_statistics);
     else if (strcasecmp ("xpath", child->key) == 0)
       status = cx_config_add_xpath (db, child);
     else
@@ -851,6 +1045,8 @@ static int cx_config_add_url (oconfig_item_t *ci) /* {{{ */
                "within `URL' block `%s'.", db->url);
       status = -1;
     }
+    if ((status == 0) && db->streaming)
+      cx_check_streaming (db);
     if (status == 0)
       status = cx_init_curl (db);
   }
@@ -926,9 +1122,15 @@ static int cx_config (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int cx_config */
 
+static int cx_shutdown (void) /* {{{ */
+{
+  return (ucurl_shutdown ());
+} /* }}} int cx_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_xml", cx_config);
+  plugin_register_shutdown ("curl_xml", cx_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
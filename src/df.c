@@ -28,12 +28,19 @@
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#include <pthread.h>
+
+#if HAVE_POLL_H
+# include <poll.h>
+#endif
+
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
 #  include <sys/statvfs.h>
 # endif
 # define STATANYFS statvfs
 # define STATANYFS_STR "statvfs"
+# define STATANYFS_T struct statvfs
 # define BLOCKSIZE(s) ((s).f_frsize ? (s).f_frsize : (s).f_bsize)
 #elif HAVE_STATFS
 # if HAVE_SYS_STATFS_H
@@ -41,11 +48,44 @@
 # endif
 # define STATANYFS statfs
 # define STATANYFS_STR "statfs"
+# define STATANYFS_T struct statfs
 # define BLOCKSIZE(s) (s).f_bsize
 #else
 # error "No applicable input method."
 #endif
 
+#define DF_DEFAULT_THREADS 4
+
+/*
+ * A mount point which is read by the worker threads. The mount points are
+ * kept across reads and only rebuilt when the mount table changes, so that
+ * a mount point which hangs in STATANYFS keeps its state. All fields
+ * except the configuration part are protected by df_lock.
+ */
+typedef struct df_mount_s df_mount_t;
+struct df_mount_s
+{
+	char *dir;
+	char  name[DATA_MAX_NAME_LEN]; /* plugin instance */
+
+	int refcount;   /* mount list + queued or running job */
+	int seq;        /* position in the mount table while refreshing */
+	unsigned int generation;
+
+	_Bool busy;     /* queued or being read by a worker */
+	_Bool running;  /* being read by a worker */
+	_Bool waited;   /* the current read waits for the result */
+	_Bool done;     /* a result is available */
+	_Bool stale;    /* didn't answer within the timeout */
+	_Bool blocking; /* stale while a worker is waiting for it */
+
+	int         status; /* errno of STATANYFS, zero on success */
+	STATANYFS_T statbuf;
+	cdtime_t    latency;
+
+	df_mount_t *queue_next;
+};
+
 static const char *config_keys[] =
 {
 	"Device",
@@ -54,7 +94,10 @@ static const char *config_keys[] =
 	"IgnoreSelected",
 	"ReportByDevice",
 	"ReportReserved",
-	"ReportInodes"
+	"ReportInodes",
+	"ReportLatency",
+	"Threads",
+	"Timeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -64,6 +107,32 @@ static ignorelist_t *il_fstype = NULL;
 
 static _Bool by_device = 0;
 static _Bool report_inodes = 0;
+static _Bool report_latency = 0;
+
+static size_t   df_threads_max = DF_DEFAULT_THREADS;
+static cdtime_t df_timeout = 0;
+
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  df_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  df_done_cond = PTHREAD_COND_INITIALIZER;
+
+static df_mount_t *df_queue_head = NULL;
+static df_mount_t *df_queue_tail = NULL;
+static size_t      df_waiting = 0;
+static size_t      df_threads_num = 0;
+static size_t      df_threads_blocked = 0;
+static _Bool       df_shutdown_flag = 0;
+
+/* Sorted by directory. Only changed by the read callback. */
+static df_mount_t **df_mounts = NULL;
+static size_t       df_mounts_num = 0;
+static _Bool        df_mounts_valid = 0;
+static unsigned int df_generation = 0;
+
+#if KERNEL_LINUX && HAVE_POLL_H
+/* Signals POLLPRI when the mount table has been changed. */
+static int df_mounts_fd = -1;
+#endif
 
 static int df_init (void)
 {
@@ -131,6 +200,37 @@ static int df_config (const char *key, const char *value)
 
 		return (0);
 	}
+	else if (strcasecmp (key, "ReportLatency") == 0)
+	{
+		if (IS_TRUE (value))
+			report_latency = 1;
+		else
+			report_latency = 0;
+
+		return (0);
+	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			WARNING ("df plugin: Invalid number of threads: %s", value);
+			return (1);
+		}
+		df_threads_max = (size_t) tmp;
+		return (0);
+	}
+	else if (strcasecmp (key, "Timeout") == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			WARNING ("df plugin: Invalid timeout: %s", value);
+			return (1);
+		}
+		df_timeout = DOUBLE_TO_CDTIME_T (tmp);
+		return (0);
+	}
 
 
 	return (-1);
@@ -161,16 +261,205 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+/* Must be called with df_lock held. */
+static void df_mount_release (df_mount_t *m) /* {{{ */
 {
-#if HAVE_STATVFS
-	struct statvfs statbuf;
-#elif HAVE_STATFS
-	struct statfs statbuf;
+	assert (m->refcount > 0);
+
+	m->refcount--;
+	if (m->refcount > 0)
+		return;
+
+	sfree (m->dir);
+	sfree (m);
+} /* }}} void df_mount_release */
+
+static void *df_worker (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&df_lock);
+	while (!df_shutdown_flag)
+	{
+		df_mount_t *m;
+		STATANYFS_T statbuf;
+		cdtime_t start;
+		int status;
+
+		if (df_queue_head == NULL)
+		{
+			pthread_cond_wait (&df_work_cond, &df_lock);
+			continue;
+		}
+
+		m = df_queue_head;
+		df_queue_head = m->queue_next;
+		if (df_queue_head == NULL)
+			df_queue_tail = NULL;
+		m->queue_next = NULL;
+		m->running = 1;
+
+		pthread_mutex_unlock (&df_lock);
+
+		/* This may block for a long time, e.g. on an unreachable NFS
+		 * server. */
+		memset (&statbuf, 0, sizeof (statbuf));
+		start = cdtime ();
+		status = 0;
+		if (STATANYFS (m->dir, &statbuf) < 0)
+			status = errno;
+
+		pthread_mutex_lock (&df_lock);
+
+		m->statbuf = statbuf;
+		m->status = status;
+		m->latency = cdtime () - start;
+		m->busy = 0;
+		m->running = 0;
+		if (m->blocking)
+		{
+			m->blocking = 0;
+			df_threads_blocked--;
+		}
+
+		if (m->waited)
+		{
+			m->waited = 0;
+			m->done = 1;
+			df_waiting--;
+			pthread_cond_broadcast (&df_done_cond);
+		}
+		else if (m->stale)
+		{
+			/* The result is too old to be dispatched; the mount point
+			 * will be read again during the next interval. */
+			INFO ("df plugin: %s is responding again after %.3f seconds.",
+					m->dir, CDTIME_T_TO_DOUBLE (m->latency));
+			m->stale = 0;
+		}
+
+		df_mount_release (m);
+	}
+
+	df_threads_num--;
+	pthread_mutex_unlock (&df_lock);
+	return (NULL);
+} /* }}} void *df_worker */
+
+/* Makes sure "df_threads_max" threads are available, not counting threads
+ * blocked by stale mount points. Must be called with df_lock held. */
+static void df_start_threads (void) /* {{{ */
+{
+	while (((df_threads_num - df_threads_blocked) < df_threads_max)
+			&& (df_threads_num < (4 * df_threads_max)))
+	{
+		pthread_t thread;
+		int status;
+
+		status = pthread_create (&thread, /* attr = */ NULL,
+				df_worker, /* arg = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("df plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+		pthread_detach (thread);
+		df_threads_num++;
+	}
+} /* }}} void df_start_threads */
+
+/* Returns true if the mount table may have changed since the last call. */
+static _Bool df_mounts_changed (void) /* {{{ */
+{
+#if KERNEL_LINUX && HAVE_POLL_H
+	struct pollfd pfd;
+
+	if (df_mounts_fd < 0)
+	{
+		df_mounts_fd = open ("/proc/self/mounts", O_RDONLY);
+		/* Without the file, changes can't be detected. */
+		return (1);
+	}
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = df_mounts_fd;
+	pfd.events = POLLPRI;
+
+	if (poll (&pfd, 1, /* timeout = */ 0) < 0)
+		return (1);
+
+	return ((pfd.revents & (POLLPRI | POLLERR)) != 0);
+#else
+	return (1);
 #endif
-	/* struct STATANYFS statbuf; */
+} /* }}} _Bool df_mounts_changed */
+
+static int df_mount_compare (const void *a, const void *b) /* {{{ */
+{
+	const df_mount_t *m0 = *((df_mount_t * const *) a);
+	const df_mount_t *m1 = *((df_mount_t * const *) b);
+	int status;
+
+	status = strcmp (m0->dir, m1->dir);
+	if (status != 0)
+		return (status);
+
+	return (m0->seq - m1->seq);
+} /* }}} int df_mount_compare */
+
+/* Returns the name used as plugin instance, or non-zero if the mount point
+ * should not be reported. */
+static int df_mount_name (char *buffer, size_t buffer_size, /* {{{ */
+		cu_mount_t *mnt_ptr)
+{
+	if (by_device)
+	{
+		/* eg, /dev/hda1  -- strip off the "/dev/" */
+		if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
+			sstrncpy (buffer, mnt_ptr->spec_device + strlen ("/dev/"), buffer_size);
+		else
+			sstrncpy (buffer, mnt_ptr->spec_device, buffer_size);
+
+		if (strlen (buffer) < 1)
+		{
+			DEBUG ("df: no device name name for mountpoint %s, skipping", mnt_ptr->dir);
+			return (-1);
+		}
+	}
+	else
+	{
+		if (strcmp (mnt_ptr->dir, "/") == 0)
+		{
+			if (strcmp (mnt_ptr->type, "rootfs") == 0)
+				return (-1);
+			sstrncpy (buffer, "root", buffer_size);
+		}
+		else
+		{
+			int i, len;
+
+			sstrncpy (buffer, mnt_ptr->dir + 1, buffer_size);
+			len = strlen (buffer);
+
+			for (i = 0; i < len; i++)
+				if (buffer[i] == '/')
+					buffer[i] = '-';
+		}
+	}
+
+	return (0);
+} /* }}} int df_mount_name */
+
+/* Rebuilds df_mounts from the mount table. Mount points which are already
+ * known are kept, including their state. */
+static int df_mounts_refresh (void) /* {{{ */
+{
 	cu_mount_t *mnt_list;
 	cu_mount_t *mnt_ptr;
+	df_mount_t **mounts;
+	size_t mounts_num;
+	size_t mnt_num;
+	size_t i;
 
 	mnt_list = NULL;
 	if (cu_mount_getlist (&mnt_list) == NULL)
@@ -179,13 +468,27 @@ static int df_read (void)
 		return (-1);
 	}
 
+	mnt_num = 0;
+	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+		mnt_num++;
+
+	mounts = calloc (mnt_num + 1, sizeof (*mounts));
+	if (mounts == NULL)
+	{
+		ERROR ("df plugin: calloc failed.");
+		cu_mount_freelist (mnt_list);
+		return (-1);
+	}
+	mounts_num = 0;
+
+	pthread_mutex_lock (&df_lock);
+	df_generation++;
+
 	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
 	{
-		unsigned long long blocksize;
-		char disk_name[256];
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		char name[DATA_MAX_NAME_LEN];
+		df_mount_t **found;
+		df_mount_t *m;
 
 		if (ignorelist_match (il_device,
 					(mnt_ptr->spec_device != NULL)
@@ -197,125 +500,313 @@ static int df_read (void)
 		if (ignorelist_match (il_fstype, mnt_ptr->type))
 			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
-		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			continue;
-		}
-
-		if (!statbuf.f_blocks)
+		if (df_mount_name (name, sizeof (name), mnt_ptr) != 0)
 			continue;
 
-		if (by_device) 
+		/* The old list is sorted by directory and each directory is in
+		 * it only once. */
+		found = NULL;
+		if (df_mounts_num > 0)
 		{
-			/* eg, /dev/hda1  -- strip off the "/dev/" */
-			if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
-				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), sizeof (disk_name));
-			else
-				sstrncpy (disk_name, mnt_ptr->spec_device, sizeof (disk_name));
+			size_t lo = 0;
+			size_t hi = df_mounts_num;
 
-			if (strlen(disk_name) < 1) 
+			while (lo < hi)
 			{
-				DEBUG("df: no device name name for mountpoint %s, skipping", mnt_ptr->dir);
+				size_t mid = (lo + hi) / 2;
+				int cmp = strcmp (mnt_ptr->dir, df_mounts[mid]->dir);
+
+				if (cmp == 0)
+				{
+					found = df_mounts + mid;
+					break;
+				}
+				else if (cmp < 0)
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+		}
+
+		if (found != NULL)
+		{
+			m = *found;
+			/* Mounted more than once; handled below. */
+			if (m->generation == df_generation)
+			{
+				m->seq = (int) mounts_num;
+				sstrncpy (m->name, name, sizeof (m->name));
 				continue;
 			}
-		} 
-		else 
+		}
+		else
 		{
-			if (strcmp (mnt_ptr->dir, "/") == 0)
+			m = malloc (sizeof (*m));
+			if (m == NULL)
 			{
-				if (strcmp (mnt_ptr->type, "rootfs") == 0)
-					continue;
-				sstrncpy (disk_name, "root", sizeof (disk_name));
+				ERROR ("df plugin: malloc failed.");
+				continue;
 			}
-			else
+			memset (m, 0, sizeof (*m));
+
+			m->dir = strdup (mnt_ptr->dir);
+			if (m->dir == NULL)
 			{
-				int i, len;
+				ERROR ("df plugin: strdup failed.");
+				sfree (m);
+				continue;
+			}
+			m->refcount = 1;
+		}
 
-				sstrncpy (disk_name, mnt_ptr->dir + 1, sizeof (disk_name));
-				len = strlen (disk_name);
+		m->generation = df_generation;
+		m->seq = (int) mounts_num;
+		sstrncpy (m->name, name, sizeof (m->name));
+		mounts[mounts_num] = m;
+		mounts_num++;
+	}
 
-				for (i = 0; i < len; i++)
-					if (disk_name[i] == '/')
-						disk_name[i] = '-';
-			}
+	/* Release mount points which are gone. */
+	for (i = 0; i < df_mounts_num; i++)
+		if (df_mounts[i]->generation != df_generation)
+			df_mount_release (df_mounts[i]);
+	sfree (df_mounts);
+
+	/* If a directory is mounted more than once, STATANYFS sees the last
+	 * mount, so drop the earlier ones. */
+	qsort (mounts, mounts_num, sizeof (*mounts), df_mount_compare);
+	df_mounts_num = 0;
+	for (i = 0; i < mounts_num; i++)
+	{
+		if ((i + 1 < mounts_num)
+				&& (strcmp (mounts[i]->dir, mounts[i + 1]->dir) == 0))
+		{
+			df_mount_release (mounts[i]);
+			continue;
 		}
+		mounts[df_mounts_num] = mounts[i];
+		df_mounts_num++;
+	}
+	df_mounts = mounts;
 
-		blocksize = BLOCKSIZE(statbuf);
+	pthread_mutex_unlock (&df_lock);
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
+	cu_mount_freelist (mnt_list);
+	return (0);
+} /* }}} int df_mounts_refresh */
+
+static void df_submit_mount (df_mount_t *m) /* {{{ */
+{
+	STATANYFS_T statbuf = m->statbuf;
+	unsigned long long blocksize;
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
+
+	if (m->status != 0)
+	{
+		char errbuf[1024];
+		ERROR (STATANYFS_STR"(%s) failed: %s",
+				m->dir,
+				sstrerror (m->status, errbuf,
+					sizeof (errbuf)));
+		return;
+	}
+
+	if (!statbuf.f_blocks)
+		return;
+
+	blocksize = BLOCKSIZE(statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
 #if HAVE_STATVFS
-		/* Cast and temporary variable are needed to avoid
-		 * compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		int64_t signed_bavail = (int64_t) statbuf.f_bavail;
-		if (signed_bavail < 0)
-			statbuf.f_bavail = 0;
+	/* Cast and temporary variable are needed to avoid
+	 * compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	int64_t signed_bavail = (int64_t) statbuf.f_bavail;
+	if (signed_bavail < 0)
+		statbuf.f_bavail = 0;
 #elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
+	if (statbuf.f_bavail < 0)
+		statbuf.f_bavail = 0;
 #endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
-
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
-
-		df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-		df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-		df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
-
-		/* inode handling */
-		if (report_inodes)
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf.f_bfree < statbuf.f_bavail)
+		statbuf.f_bfree = statbuf.f_bavail;
+	if (statbuf.f_blocks < statbuf.f_bfree)
+		statbuf.f_blocks = statbuf.f_bfree;
+
+	blk_free     = (uint64_t) statbuf.f_bavail;
+	blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
+	blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+
+	df_submit_one (m->name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+	df_submit_one (m->name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+	df_submit_one (m->name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+
+	/* inode handling */
+	if (report_inodes)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf.f_ffree < statbuf.f_favail)
+			statbuf.f_ffree = statbuf.f_favail;
+		if (statbuf.f_files < statbuf.f_ffree)
+			statbuf.f_files = statbuf.f_ffree;
+
+		inode_free = (uint64_t) statbuf.f_favail;
+		inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
+		inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+
+		df_submit_one (m->name, "df_inodes", "free",
+				(gauge_t) inode_free);
+		df_submit_one (m->name, "df_inodes", "reserved",
+				(gauge_t) inode_reserved);
+		df_submit_one (m->name, "df_inodes", "used",
+				(gauge_t) inode_used);
+	}
+
+	if (report_latency)
+		df_submit_one (m->name, "response_time", NULL,
+				CDTIME_T_TO_DOUBLE (m->latency));
+} /* }}} void df_submit_mount */
+
+static int df_read (void)
+{
+	cdtime_t timeout;
+	cdtime_t deadline;
+	struct timespec ts;
+	size_t i;
+
+	if (!df_mounts_valid || df_mounts_changed ())
+	{
+		df_mounts_valid = (df_mounts_refresh () == 0);
+		if (!df_mounts_valid && (df_mounts == NULL))
+			return (-1);
+	}
+
+	pthread_mutex_lock (&df_lock);
+
+	df_start_threads ();
+
+	/* Queue all mount points which are not still being read from an
+	 * earlier interval. */
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts[i];
+
+		if (m->busy)
+			continue;
+
+		m->busy = 1;
+		m->waited = 1;
+		m->done = 0;
+		m->refcount++;
+		df_waiting++;
+
+		if (df_queue_tail == NULL)
+			df_queue_head = m;
+		else
+			df_queue_tail->queue_next = m;
+		df_queue_tail = m;
+	}
+	pthread_cond_broadcast (&df_work_cond);
+
+	timeout = (df_timeout > 0) ? df_timeout : (interval_g / 2);
+	deadline = cdtime () + timeout;
+	CDTIME_T_TO_TIMESPEC (deadline, &ts);
+
+	while (df_waiting > 0)
+		if (pthread_cond_timedwait (&df_done_cond, &df_lock, &ts) == ETIMEDOUT)
+			break;
+
+	/* Mount points which didn't answer in time are skipped until they do. */
+	for (i = 0; (df_waiting > 0) && (i < df_mounts_num); i++)
+	{
+		df_mount_t *m = df_mounts[i];
+
+		if (!m->waited)
+			continue;
+
+		m->waited = 0;
+		df_waiting--;
+
+		if (!m->stale)
+			WARNING ("df plugin: "STATANYFS_STR"(%s) did not return within "
+					"%.3f seconds. Ignoring the mount point until it does.",
+					m->dir, CDTIME_T_TO_DOUBLE (timeout));
+		m->stale = 1;
+
+		if (m->running && !m->blocking)
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
-
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
-
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
-			
-			df_submit_one (disk_name, "df_inodes", "free",
-					(gauge_t) inode_free);
-			df_submit_one (disk_name, "df_inodes", "reserved",
-					(gauge_t) inode_reserved);
-			df_submit_one (disk_name, "df_inodes", "used",
-					(gauge_t) inode_used);
+			m->blocking = 1;
+			df_threads_blocked++;
 		}
 	}
 
-	cu_mount_freelist (mnt_list);
+	pthread_mutex_unlock (&df_lock);
+
+	/* Finished mount points are not touched by the workers until they are
+	 * queued again, so the results can be read without the lock. */
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts[i];
+
+		if (!m->done)
+			continue;
+
+		df_submit_mount (m);
+		m->done = 0;
+	}
 
 	return (0);
 } /* int df_read */
 
+static int df_shutdown (void)
+{
+	size_t i;
+
+	pthread_mutex_lock (&df_lock);
+
+	/* Threads blocked in STATANYFS can't be stopped; they exit once the
+	 * call returns. */
+	df_shutdown_flag = 1;
+	pthread_cond_broadcast (&df_work_cond);
+
+	for (i = 0; i < df_mounts_num; i++)
+		df_mount_release (df_mounts[i]);
+	sfree (df_mounts);
+	df_mounts_num = 0;
+
+	pthread_mutex_unlock (&df_lock);
+
+#if KERNEL_LINUX && HAVE_POLL_H
+	if (df_mounts_fd >= 0)
+	{
+		close (df_mounts_fd);
+		df_mounts_fd = -1;
+	}
+#endif
+
+	return (0);
+} /* int df_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("df", df_config,
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown);
 } /* void module_register */
@@ -73,6 +73,11 @@
 # include <libperfstat.h>
 #endif
 
+#if KERNEL_LINUX
+# include "utils_procfs.h"
+# include "utils_hashtable.h"
+#endif
+
 #if HAVE_IOKIT_IOKITLIB_H
 static mach_port_t io_master_port = MACH_PORT_NULL;
 /* #endif HAVE_IOKIT_IOKITLIB_H */
@@ -99,10 +104,20 @@ typedef struct diskstats
 	derive_t avg_read_time;
 	derive_t avg_write_time;
 
-	struct diskstats *next;
+	/* The ignorelist verdict for `name' and the read during which the
+	 * device has last been seen. */
+	_Bool ignored;
+	unsigned int generation;
 } diskstats_t;
 
-static diskstats_t *disklist;
+/* Per-device state, keyed by device name. Devices that disappear from
+ * /proc/diskstats are removed after each read. */
+static c_hashtable_t *disk_table = NULL;
+static unsigned int disk_generation = 0;
+
+/* /proc/diskstats or, on Linux 2.4, /proc/partitions. */
+static procfs_file_t *pf_disk = NULL;
+static int pf_disk_fieldshift = 0;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -210,17 +225,13 @@ static int disk_init (void)
 	return (0);
 } /* int disk_init */
 
-static void disk_submit (const char *plugin_instance,
+static void disk_dispatch (const char *plugin_instance,
 		const char *type,
 		derive_t read, derive_t write)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	/* Both `ignorelist' and `plugin_instance' may be NULL. */
-	if (ignorelist_match (ignorelist, plugin_instance) != 0)
-	  return;
-
 	values[0].derive = read;
 	values[1].derive = write;
 
@@ -233,7 +244,80 @@ static void disk_submit (const char *plugin_instance,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void disk_dispatch */
+
+#if !KERNEL_LINUX
+/* On Linux, the ignorelist verdict is cached in the per-device state. */
+static void disk_submit (const char *plugin_instance,
+		const char *type,
+		derive_t read, derive_t write)
+{
+	/* Both `ignorelist' and `plugin_instance' may be NULL. */
+	if (ignorelist_match (ignorelist, plugin_instance) != 0)
+	  return;
+
+	disk_dispatch (plugin_instance, type, read, write);
 } /* void disk_submit */
+#endif /* !KERNEL_LINUX */
+
+#if KERNEL_LINUX
+/* Returns the state of the device `name', creating it if necessary. */
+static diskstats_t *disk_get (const char *name)
+{
+	diskstats_t *ds;
+
+	if (disk_table == NULL)
+	{
+		disk_table = c_ht_create ();
+		if (disk_table == NULL)
+			return (NULL);
+	}
+
+	if (c_ht_get (disk_table, name, (void *) &ds) == 0)
+		return (ds);
+
+	if ((ds = (diskstats_t *) calloc (1, sizeof (diskstats_t))) == NULL)
+		return (NULL);
+
+	if ((ds->name = strdup (name)) == NULL)
+	{
+		free (ds);
+		return (NULL);
+	}
+
+	/* Both `ignorelist' and `name' may be NULL. */
+	ds->ignored = (ignorelist_match (ignorelist, name) != 0);
+
+	if (c_ht_insert (disk_table, ds->name, ds) != 0)
+	{
+		free (ds->name);
+		free (ds);
+		return (NULL);
+	}
+
+	return (ds);
+} /* diskstats_t *disk_get */
+
+static int disk_vanished (char *name, void *value,
+		void __attribute__((unused)) *user_data)
+{
+	diskstats_t *ds = value;
+
+	if (ds->generation == disk_generation)
+		return (0);
+
+	DEBUG ("disk plugin: Device %s has vanished.", name);
+	free (ds->name);
+	free (ds);
+	return (1);
+} /* int disk_vanished */
+
+/* Removes the devices that were not seen during the current read. */
+static void disk_table_gc (void)
+{
+	c_ht_sweep (disk_table, disk_vanished, /* user_data = */ NULL);
+} /* void disk_table_gc */
+#endif /* KERNEL_LINUX */
 
 #if HAVE_IOKIT_IOKITLIB_H
 static signed long long dict_get_value (CFDictionaryRef dict, const char *key)
@@ -419,9 +503,8 @@ static int disk_read (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-	
+	char *line;
+
 	char *fields[32];
 	int numfields;
 	int fieldshift = 0;
@@ -439,79 +522,82 @@ static int disk_read (void)
 	derive_t write_time    = 0;
 	int is_disk = 0;
 
-	diskstats_t *ds, *pre_ds;
+	diskstats_t *ds;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
+	if (pf_disk == NULL)
 	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
+		pf_disk = procfs_open ("/proc/diskstats");
+		pf_disk_fieldshift = 0;
+	}
+	if (pf_disk == NULL)
+	{
+		pf_disk = procfs_open ("/proc/partitions");
+		if (pf_disk == NULL)
 		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
+			ERROR ("disk plugin: procfs_open (/proc/{diskstats,partitions}) failed.");
 			return (-1);
 		}
 
 		/* Kernel is 2.4.* */
-		fieldshift = 1;
+		pf_disk_fieldshift = 1;
+	}
+	fieldshift = pf_disk_fieldshift;
+
+	if (procfs_read (pf_disk) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("disk plugin: procfs_read failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	disk_generation++;
+
+	while ((line = procfs_next_line (pf_disk)) != NULL)
 	{
 		char *disk_name;
 
-		numfields = strsplit (buffer, fields, 32);
+		numfields = procfs_split (line, fields, 32);
 
 		if ((numfields != (14 + fieldshift)) && (numfields != 7))
 			continue;
 
-		minor = atoll (fields[1]);
+		minor = procfs_atoll (fields[1]);
 
 		disk_name = fields[2 + fieldshift];
 
-		for (ds = disklist, pre_ds = disklist; ds != NULL; pre_ds = ds, ds = ds->next)
-			if (strcmp (disk_name, ds->name) == 0)
-				break;
-
+		ds = disk_get (disk_name);
 		if (ds == NULL)
-		{
-			if ((ds = (diskstats_t *) calloc (1, sizeof (diskstats_t))) == NULL)
-				continue;
-
-			if ((ds->name = strdup (disk_name)) == NULL)
-			{
-				free (ds);
-				continue;
-			}
+			continue;
 
-			if (pre_ds == NULL)
-				disklist = ds;
-			else
-				pre_ds->next = ds;
-		}
+		ds->generation = disk_generation;
+		if (ds->ignored)
+			continue;
 
 		is_disk = 0;
 		if (numfields == 7)
 		{
 			/* Kernel 2.6, Partition */
-			read_ops      = atoll (fields[3]);
-			read_sectors  = atoll (fields[4]);
-			write_ops     = atoll (fields[5]);
-			write_sectors = atoll (fields[6]);
+			read_ops      = procfs_atoll (fields[3]);
+			read_sectors  = procfs_atoll (fields[4]);
+			write_ops     = procfs_atoll (fields[5]);
+			write_sectors = procfs_atoll (fields[6]);
 		}
 		else if (numfields == (14 + fieldshift))
 		{
-			read_ops  =  atoll (fields[3 + fieldshift]);
-			write_ops =  atoll (fields[7 + fieldshift]);
+			read_ops  =  procfs_atoll (fields[3 + fieldshift]);
+			write_ops =  procfs_atoll (fields[7 + fieldshift]);
 
-			read_sectors  = atoll (fields[5 + fieldshift]);
-			write_sectors = atoll (fields[9 + fieldshift]);
+			read_sectors  = procfs_atoll (fields[5 + fieldshift]);
+			write_sectors = procfs_atoll (fields[9 + fieldshift]);
 
 			if ((fieldshift == 0) || (minor == 0))
 			{
 				is_disk = 1;
-				read_merged  = atoll (fields[4 + fieldshift]);
-				read_time    = atoll (fields[6 + fieldshift]);
-				write_merged = atoll (fields[8 + fieldshift]);
-				write_time   = atoll (fields[10+ fieldshift]);
+				read_merged  = procfs_atoll (fields[4 + fieldshift]);
+				read_time    = procfs_atoll (fields[6 + fieldshift]);
+				write_merged = procfs_atoll (fields[8 + fieldshift]);
+				write_time   = procfs_atoll (fields[10+ fieldshift]);
 			}
 		}
 		else
@@ -611,25 +697,25 @@ static int disk_read (void)
 		}
 
 		if ((ds->read_bytes != 0) || (ds->write_bytes != 0))
-			disk_submit (disk_name, "disk_octets",
+			disk_dispatch (ds->name, "disk_octets",
 					ds->read_bytes, ds->write_bytes);
 
 		if ((ds->read_ops != 0) || (ds->write_ops != 0))
-			disk_submit (disk_name, "disk_ops",
+			disk_dispatch (ds->name, "disk_ops",
 					read_ops, write_ops);
 
 		if ((ds->avg_read_time != 0) || (ds->avg_write_time != 0))
-			disk_submit (disk_name, "disk_time",
+			disk_dispatch (ds->name, "disk_time",
 					ds->avg_read_time, ds->avg_write_time);
 
 		if (is_disk)
 		{
-			disk_submit (disk_name, "disk_merged",
+			disk_dispatch (ds->name, "disk_merged",
 					read_merged, write_merged);
 		} /* if (is_disk) */
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
+	} /* while (procfs_next_line) */
 
-	fclose (fh);
+	disk_table_gc ();
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -35,16 +35,63 @@
 #include <pcap.h>
 #include <pcap-bpf.h>
 
+#if KERNEL_LINUX && HAVE_LINUX_IF_PACKET_H
+# include <sys/socket.h>
+# include <sys/mman.h>
+# include <net/if.h>
+# include <arpa/inet.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
+# include <linux/filter.h>
+/* TPACKET_V3 has been added in Linux 3.2. */
+# ifdef TPACKET3_HDRLEN
+#  define DNS_HAVE_RING 1
+# endif
+#endif
+#ifndef DNS_HAVE_RING
+# define DNS_HAVE_RING 0
+#endif
+
 /*
  * Private data types
  */
-struct counter_list_s
+#define RCODE_MAX 16
+
+/* Counters of one capture thread. They are only written by the thread owning
+ * them and summed up by dns_read() without locking, so the threads don't
+ * contend with each other. */
+struct dns_counters_s;
+typedef struct dns_counters_s dns_counters_t;
+struct dns_counters_s
 {
-	unsigned int key;
-	unsigned int value;
-	struct counter_list_s *next;
+	derive_t queries;
+	derive_t responses;
+	derive_t qtype[T_MAX];
+	derive_t opcode[OP_MAX];
+	derive_t rcode[RCODE_MAX];
+
+	dns_counters_t *next;
 };
-typedef struct counter_list_s counter_list_t;
+
+#if DNS_HAVE_RING
+/* A TPACKET_V3 receive ring: The kernel fills blocks of packets in memory
+ * shared with the plugin, so there is no system call per packet. */
+struct dns_ring_s
+{
+	int fd;
+	uint8_t *map;
+	struct tpacket_req3 req;
+	pthread_t thread;
+	_Bool thread_running;
+};
+typedef struct dns_ring_s dns_ring_t;
+
+# define DNS_RING_BLOCK_SIZE (1 << 20)
+# define DNS_RING_BLOCK_NUM  8
+# define DNS_RING_FRAME_SIZE 2048
+/* Time after which a block is handed to the plugin, even if it's not full. */
+# define DNS_RING_BLOCK_TIMEOUT_MS 100
+#endif /* DNS_HAVE_RING */
 
 /*
  * Private variables
@@ -53,90 +100,38 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSource",
-	"SelectNumericQueryTypes"
+	"SelectNumericQueryTypes",
+	"CaptureThreads",
+	"PcapFile"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int select_numeric_qtype = 1;
+static int capture_threads = 1;
+static char *pcap_file = NULL;
 
 #define PCAP_SNAPLEN 1460
 static char   *pcap_device = NULL;
 
-static derive_t       tr_queries;
-static derive_t       tr_responses;
-static counter_list_t *qtype_list;
-static counter_list_t *opcode_list;
-static counter_list_t *rcode_list;
+static dns_counters_t  *counters_list = NULL;
+static pthread_mutex_t  counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t    counters_key;
+/* Sum of all counters, only used by dns_read(). */
+static dns_counters_t   counters_sum;
 
 static pthread_t       listen_thread;
 static int             listen_thread_init = 0;
-/* The `traffic' mutex if for `tr_queries' and `tr_responses' */
-static pthread_mutex_t traffic_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t qtype_mutex   = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t opcode_mutex  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rcode_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static pcap_t         *listen_pcap_obj = NULL;
+
+#if DNS_HAVE_RING
+static dns_ring_t     *rings = NULL;
+static size_t          rings_num = 0;
+static int             lo_ifindex = 0;
+#endif
+static _Bool           listen_shutdown = 0;
 
 /*
  * Private functions
  */
-static counter_list_t *counter_list_search (counter_list_t **list, unsigned int key)
-{
-	counter_list_t *entry;
-
-	for (entry = *list; entry != NULL; entry = entry->next)
-		if (entry->key == key)
-			break;
-
-	return (entry);
-}
-
-static counter_list_t *counter_list_create (counter_list_t **list,
-		unsigned int key, unsigned int value)
-{
-	counter_list_t *entry;
-
-	entry = (counter_list_t *) malloc (sizeof (counter_list_t));
-	if (entry == NULL)
-		return (NULL);
-
-	memset (entry, 0, sizeof (counter_list_t));
-	entry->key = key;
-	entry->value = value;
-
-	if (*list == NULL)
-	{
-		*list = entry;
-	}
-	else
-	{
-		counter_list_t *last;
-
-		last = *list;
-		while (last->next != NULL)
-			last = last->next;
-
-		last->next = entry;
-	}
-
-	return (entry);
-}
-
-static void counter_list_add (counter_list_t **list,
-		unsigned int key, unsigned int increment)
-{
-	counter_list_t *entry;
-
-	entry = counter_list_search (list, key);
-
-	if (entry != NULL)
-	{
-		entry->value += increment;
-	}
-	else
-	{
-		counter_list_create (list, key, increment);
-	}
-}
-
 static int dns_config (const char *key, const char *value)
 {
 	if (strcasecmp (key, "Interface") == 0)
@@ -158,6 +153,23 @@ static int dns_config (const char *key, const char *value)
 		else
 			select_numeric_qtype = 1;
 	}
+	else if (strcasecmp (key, "CaptureThreads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			ERROR ("dns plugin: CaptureThreads must be at least one.");
+			return (1);
+		}
+		capture_threads = tmp;
+	}
+	else if (strcasecmp (key, "PcapFile") == 0)
+	{
+		if (pcap_file != NULL)
+			free (pcap_file);
+		if ((pcap_file = strdup (value)) == NULL)
+			return (1);
+	}
 	else
 	{
 		return (-1);
@@ -166,106 +178,168 @@ static int dns_config (const char *key, const char *value)
 	return (0);
 }
 
-static void dns_child_callback (const rfc1035_header_t *dns)
+/* Creates the counters of the calling thread. */
+static dns_counters_t *dns_counters_create (void)
 {
-	if (dns->qr == 0)
+	dns_counters_t *c;
+
+	c = calloc (1, sizeof (*c));
+	if (c == NULL)
 	{
-		/* This is a query */
-		int skip = 0;
-		if (!select_numeric_qtype)
-		{
-			const char *str = qtype_str(dns->qtype);
-			if ((str == NULL) || (str[0] == '#'))
-				skip = 1;
-		}
+		ERROR ("dns plugin: calloc failed.");
+		return (NULL);
+	}
 
-		pthread_mutex_lock (&traffic_mutex);
-		tr_queries += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
+	pthread_mutex_lock (&counters_lock);
+	c->next = counters_list;
+	counters_list = c;
+	pthread_mutex_unlock (&counters_lock);
 
-		if (skip == 0)
-		{
-			pthread_mutex_lock (&qtype_mutex);
-			counter_list_add (&qtype_list, dns->qtype,  1);
-			pthread_mutex_unlock (&qtype_mutex);
-		}
+	pthread_setspecific (counters_key, c);
+	return (c);
+} /* dns_counters_t *dns_counters_create */
+
+static void dns_child_callback (const rfc1035_header_t *dns)
+{
+	dns_counters_t *c;
+
+	c = pthread_getspecific (counters_key);
+	if (c == NULL)
+		return;
+
+	if (dns->qr == 0)
+	{
+		/* This is a query. Unknown query types are counted anyway and
+		 * skipped by dns_read() if "SelectNumericQueryTypes" is false. */
+		c->queries += dns->length;
+		c->qtype[dns->qtype]++;
 	}
 	else
 	{
 		/* This is a reply */
-		pthread_mutex_lock (&traffic_mutex);
-		tr_responses += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
-
-		pthread_mutex_lock (&rcode_mutex);
-		counter_list_add (&rcode_list,  dns->rcode,  1);
-		pthread_mutex_unlock (&rcode_mutex);
+		c->responses += dns->length;
+		c->rcode[dns->rcode]++;
 	}
 
 	/* FIXME: Are queries, replies or both interesting? */
-	pthread_mutex_lock (&opcode_mutex);
-	counter_list_add (&opcode_list, dns->opcode, 1);
-	pthread_mutex_unlock (&opcode_mutex);
+	c->opcode[dns->opcode]++;
 }
 
+static void dns_child_init (void)
+{
+	/* Don't block any signals */
+	sigset_t sigmask;
+	sigemptyset (&sigmask);
+	pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
+} /* void dns_child_init */
+
+/* Counts the packets read from a file, see dns_child_loop(). */
+static void dns_handle_pcap_file (u_char *udata,
+		const struct pcap_pkthdr *hdr, const u_char *pkt)
+{
+	uint64_t *packets_num = (uint64_t *) udata;
+
+	(*packets_num)++;
+	handle_pcap (udata, hdr, pkt);
+} /* void dns_handle_pcap_file */
+
+/* Captures packets with libpcap or, if "PcapFile" is set, reads them from a
+ * file. Reading a file allows to measure the throughput of the plugin with
+ * reproducible input. */
 static void *dns_child_loop (__attribute__((unused)) void *dummy)
 {
 	pcap_t *pcap_obj;
 	char    pcap_error[PCAP_ERRBUF_SIZE];
 	struct  bpf_program fp;
+	uint64_t packets_num = 0;
+	cdtime_t start;
 
 	int status;
 
-	/* Don't block any signals */
+	dns_child_init ();
+	if (dns_counters_create () == NULL)
+		return (NULL);
+
+	if (pcap_file != NULL)
 	{
-		sigset_t sigmask;
-		sigemptyset (&sigmask);
-		pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
+		DEBUG ("dns plugin: Opening file `%s'..", pcap_file);
+		pcap_obj = pcap_open_offline (pcap_file, pcap_error);
+		if (pcap_obj == NULL)
+		{
+			ERROR ("dns plugin: Opening file `%s' failed: %s",
+					pcap_file, pcap_error);
+			return (NULL);
+		}
 	}
-
-	/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
-	DEBUG ("dns plugin: Creating PCAP object..");
-	pcap_obj = pcap_open_live ((pcap_device != NULL) ? pcap_device : "any",
-			PCAP_SNAPLEN,
-			0 /* Not promiscuous */,
-			(int) CDTIME_T_TO_MS (interval_g / 2),
-			pcap_error);
-	if (pcap_obj == NULL)
+	else
 	{
-		ERROR ("dns plugin: Opening interface `%s' "
-				"failed: %s",
-				(pcap_device != NULL) ? pcap_device : "any",
+		/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
+		DEBUG ("dns plugin: Creating PCAP object..");
+		pcap_obj = pcap_open_live ((pcap_device != NULL) ? pcap_device : "any",
+				PCAP_SNAPLEN,
+				0 /* Not promiscuous */,
+				(int) CDTIME_T_TO_MS (interval_g / 2),
 				pcap_error);
-		return (NULL);
+		if (pcap_obj == NULL)
+		{
+			ERROR ("dns plugin: Opening interface `%s' "
+					"failed: %s",
+					(pcap_device != NULL) ? pcap_device : "any",
+					pcap_error);
+			return (NULL);
+		}
 	}
 
 	memset (&fp, 0, sizeof (fp));
 	if (pcap_compile (pcap_obj, &fp, "udp port 53", 1, 0) < 0)
 	{
 		ERROR ("dns plugin: pcap_compile failed");
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
 	if (pcap_setfilter (pcap_obj, &fp) < 0)
 	{
 		ERROR ("dns plugin: pcap_setfilter failed");
+		pcap_freecode (&fp);
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
+	pcap_freecode (&fp);
 
 	DEBUG ("dns plugin: PCAP object created.");
 
 	dnstop_set_pcap_obj (pcap_obj);
 	dnstop_set_callback (dns_child_callback);
+	listen_pcap_obj = pcap_obj;
+
+	start = cdtime ();
+	if (pcap_file != NULL)
+		status = pcap_loop (pcap_obj,
+				-1 /* until the end of the file */,
+				dns_handle_pcap_file /* callback */,
+				(u_char *) &packets_num);
+	else
+		status = pcap_loop (pcap_obj,
+				-1 /* loop forever */,
+				handle_pcap /* callback */,
+				NULL /* Whatever this means.. */);
 
-	status = pcap_loop (pcap_obj,
-			-1 /* loop forever */,
-			handle_pcap /* callback */,
-			NULL /* Whatever this means.. */);
-	if (status < 0)
+	if (status == -1)
 		ERROR ("dns plugin: Listener thread is exiting "
 				"abnormally: %s", pcap_geterr (pcap_obj));
+	else if (pcap_file != NULL)
+	{
+		double duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+
+		INFO ("dns plugin: Read %"PRIu64" packets from `%s' in %.3f "
+				"seconds (%.0f packets per second).",
+				packets_num, pcap_file, duration,
+				(duration > 0.0) ? (((double) packets_num) / duration) : 0.0);
+	}
 
 	DEBUG ("dns plugin: Child is exiting.");
 
+	listen_pcap_obj = NULL;
 	pcap_close (pcap_obj);
 	listen_thread_init = 0;
 	pthread_exit (NULL);
@@ -273,19 +347,315 @@ static void *dns_child_loop (__attribute__((unused)) void *dummy)
 	return (NULL);
 } /* static void dns_child_loop (void) */
 
+#if DNS_HAVE_RING
+/* Attaches the filter "udp port 53" to the socket. The packets of a
+ * SOCK_DGRAM packet socket start with the network header, so the filter is
+ * compiled for raw IP packets. */
+static int dns_ring_attach_filter (int fd)
+{
+	pcap_t *pcap_obj;
+	struct bpf_program fp;
+	struct sock_fprog prog;
+	int status;
+
+	pcap_obj = pcap_open_dead (DLT_RAW, PCAP_SNAPLEN);
+	if (pcap_obj == NULL)
+		return (-1);
+
+	memset (&fp, 0, sizeof (fp));
+	if (pcap_compile (pcap_obj, &fp, "udp port 53", 1, 0) < 0)
+	{
+		ERROR ("dns plugin: pcap_compile failed: %s",
+				pcap_geterr (pcap_obj));
+		pcap_close (pcap_obj);
+		return (-1);
+	}
+
+	/* "struct bpf_insn" and "struct sock_filter" are the same. */
+	memset (&prog, 0, sizeof (prog));
+	prog.len = (unsigned short) fp.bf_len;
+	prog.filter = (struct sock_filter *) fp.bf_insns;
+
+	status = setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			&prog, sizeof (prog));
+
+	pcap_freecode (&fp);
+	pcap_close (pcap_obj);
+	return (status);
+} /* int dns_ring_attach_filter */
+
+static void dns_ring_close (dns_ring_t *ring)
+{
+	if (ring->map != NULL)
+		munmap (ring->map, ring->req.tp_block_size * ring->req.tp_block_nr);
+	ring->map = NULL;
+
+	if (ring->fd >= 0)
+		close (ring->fd);
+	ring->fd = -1;
+} /* void dns_ring_close */
+
+static int dns_ring_open (dns_ring_t *ring, int ifindex, int fanout_id)
+{
+	struct sockaddr_ll addr;
+	char errbuf[1024];
+	int version = TPACKET_V3;
+
+	memset (ring, 0, sizeof (*ring));
+	ring->map = NULL;
+
+	/* Don't receive any packets before the filter is attached, see the
+	 * call to bind() below. */
+	ring->fd = socket (AF_PACKET, SOCK_DGRAM, /* protocol = */ 0);
+	if (ring->fd < 0)
+	{
+		ERROR ("dns plugin: socket(AF_PACKET) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (setsockopt (ring->fd, SOL_PACKET, PACKET_VERSION,
+				&version, sizeof (version)) != 0)
+	{
+		ERROR ("dns plugin: Enabling TPACKET_V3 failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (ring);
+		return (-1);
+	}
+
+	if (dns_ring_attach_filter (ring->fd) != 0)
+	{
+		ERROR ("dns plugin: Attaching the packet filter failed.");
+		dns_ring_close (ring);
+		return (-1);
+	}
+
+	ring->req.tp_block_size = DNS_RING_BLOCK_SIZE;
+	ring->req.tp_block_nr = DNS_RING_BLOCK_NUM;
+	ring->req.tp_frame_size = DNS_RING_FRAME_SIZE;
+	ring->req.tp_frame_nr = (DNS_RING_BLOCK_SIZE / DNS_RING_FRAME_SIZE)
+		* DNS_RING_BLOCK_NUM;
+	ring->req.tp_retire_blk_tov = DNS_RING_BLOCK_TIMEOUT_MS;
+	if (setsockopt (ring->fd, SOL_PACKET, PACKET_RX_RING,
+				&ring->req, sizeof (ring->req)) != 0)
+	{
+		ERROR ("dns plugin: Creating the receive ring failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (ring);
+		return (-1);
+	}
+
+	ring->map = mmap (NULL, ring->req.tp_block_size * ring->req.tp_block_nr,
+			PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED)
+	{
+		ring->map = NULL;
+		ERROR ("dns plugin: Mapping the receive ring failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (ring);
+		return (-1);
+	}
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons (ETH_P_ALL);
+	addr.sll_ifindex = ifindex;
+	if (bind (ring->fd, (struct sockaddr *) &addr, sizeof (addr)) != 0)
+	{
+		ERROR ("dns plugin: Binding the packet socket failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (ring);
+		return (-1);
+	}
+
+	if (fanout_id >= 0)
+	{
+#ifdef PACKET_FANOUT
+		/* Packets of the same flow always go to the same socket. */
+		int fanout = (fanout_id & 0xffff) | (PACKET_FANOUT_HASH << 16);
+
+		if (setsockopt (ring->fd, SOL_PACKET, PACKET_FANOUT,
+					&fanout, sizeof (fanout)) != 0)
+		{
+			ERROR ("dns plugin: Joining the fanout group failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			dns_ring_close (ring);
+			return (-1);
+		}
+#else
+		ERROR ("dns plugin: PACKET_FANOUT is not supported.");
+		dns_ring_close (ring);
+		return (-1);
+#endif
+	}
+
+	return (0);
+} /* int dns_ring_open */
+
+static void dns_ring_handle_block (struct tpacket_block_desc *block)
+{
+	struct tpacket3_hdr *hdr;
+	uint32_t i;
+
+	hdr = (struct tpacket3_hdr *) (((uint8_t *) block)
+			+ block->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < block->hdr.bh1.num_pkts; i++)
+	{
+		struct sockaddr_ll *addr;
+		uint16_t proto;
+
+		addr = (struct sockaddr_ll *) (((uint8_t *) hdr)
+				+ TPACKET_ALIGN (sizeof (*hdr)));
+		proto = ntohs (addr->sll_protocol);
+
+		/* Packets sent via the loopback interface are seen twice, skip the
+		 * outgoing copy like libpcap does. */
+		if (((addr->sll_pkttype != PACKET_OUTGOING)
+					|| (addr->sll_ifindex != lo_ifindex))
+				&& ((proto == ETH_P_IP) || (proto == ETH_P_IPV6)))
+			handle_ip_packet (((u_char *) hdr) + hdr->tp_mac,
+					(int) hdr->tp_snaplen);
+
+		hdr = (struct tpacket3_hdr *) (((uint8_t *) hdr)
+				+ hdr->tp_next_offset);
+	}
+} /* void dns_ring_handle_block */
+
+static void *dns_ring_loop (void *arg)
+{
+	dns_ring_t *ring = arg;
+	unsigned int block_index = 0;
+
+	dns_child_init ();
+	if (dns_counters_create () == NULL)
+		return (NULL);
+
+	while (!listen_shutdown)
+	{
+		struct tpacket_block_desc *block;
+
+		block = (struct tpacket_block_desc *) (ring->map
+				+ block_index * ring->req.tp_block_size);
+
+		if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			struct pollfd pfd;
+
+			memset (&pfd, 0, sizeof (pfd));
+			pfd.fd = ring->fd;
+			pfd.events = POLLIN | POLLERR;
+
+			/* Wake up once per second to check "listen_shutdown". */
+			poll (&pfd, 1, 1000);
+			continue;
+		}
+
+		/* Don't read the packets before the block status. */
+		__sync_synchronize ();
+		dns_ring_handle_block (block);
+		__sync_synchronize ();
+
+		/* Hand the block back to the kernel. */
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		block_index = (block_index + 1) % ring->req.tp_block_nr;
+	}
+
+	return (NULL);
+} /* void *dns_ring_loop */
+
+/* Starts capturing with one receive ring per capture thread. If more than one
+ * thread is used, the packets are distributed among them with
+ * PACKET_FANOUT. Returns non-zero if no ring could be created, so the caller
+ * can fall back to libpcap. */
+static int dns_ring_start (void)
+{
+	int ifindex = 0;
+	size_t i;
+
+	if ((pcap_device != NULL) && (strcmp ("any", pcap_device) != 0))
+	{
+		ifindex = (int) if_nametoindex (pcap_device);
+		if (ifindex == 0)
+		{
+			ERROR ("dns plugin: Unknown interface `%s'.", pcap_device);
+			return (-1);
+		}
+	}
+	lo_ifindex = (int) if_nametoindex ("lo");
+
+	rings = calloc ((size_t) capture_threads, sizeof (*rings));
+	if (rings == NULL)
+		return (-1);
+
+	for (i = 0; i < (size_t) capture_threads; i++)
+	{
+		int status;
+
+		status = dns_ring_open (rings + i, ifindex,
+				(capture_threads > 1) ? ((int) getpid ()) : -1);
+		if (status != 0)
+			break;
+		rings_num++;
+	}
+
+	if (rings_num != (size_t) capture_threads)
+	{
+		for (i = 0; i < rings_num; i++)
+			dns_ring_close (rings + i);
+		sfree (rings);
+		rings_num = 0;
+		return (-1);
+	}
+
+	for (i = 0; i < rings_num; i++)
+	{
+		int status;
+
+		status = pthread_create (&rings[i].thread, NULL, dns_ring_loop,
+				rings + i);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			continue;
+		}
+		rings[i].thread_running = 1;
+	}
+
+	return (0);
+} /* int dns_ring_start */
+#endif /* DNS_HAVE_RING */
+
 static int dns_init (void)
 {
 	/* clean up an old thread */
 	int status;
 
-	pthread_mutex_lock (&traffic_mutex);
-	tr_queries   = 0;
-	tr_responses = 0;
-	pthread_mutex_unlock (&traffic_mutex);
-
 	if (listen_thread_init != 0)
 		return (-1);
 
+	pthread_key_create (&counters_key, /* destructor = */ NULL);
+
+	dnstop_set_callback (dns_child_callback);
+
+#if DNS_HAVE_RING
+	if (pcap_file == NULL)
+	{
+		if (dns_ring_start () == 0)
+		{
+			listen_thread_init = 1;
+			return (0);
+		}
+		NOTICE ("dns plugin: Capturing with a receive ring failed. "
+				"Falling back to libpcap.");
+	}
+#endif
+
+	if ((capture_threads > 1) && (pcap_file == NULL))
+		WARNING ("dns plugin: Using more than one capture thread "
+				"requires Linux' PACKET_FANOUT. Using one thread.");
+
 	status = pthread_create (&listen_thread, NULL, dns_child_loop,
 			(void *) 0);
 	if (status != 0)
@@ -301,6 +671,34 @@ static int dns_init (void)
 	return (0);
 } /* int dns_init */
 
+static int dns_shutdown (void)
+{
+	listen_shutdown = 1;
+
+#if DNS_HAVE_RING
+	if (rings_num > 0)
+	{
+		size_t i;
+
+		for (i = 0; i < rings_num; i++)
+		{
+			if (rings[i].thread_running)
+				pthread_join (rings[i].thread, NULL);
+			dns_ring_close (rings + i);
+		}
+		sfree (rings);
+		rings_num = 0;
+	}
+#endif
+
+	/* The libpcap thread is not joined: It may be blocked until the next
+	 * packet arrives. */
+	if (listen_pcap_obj != NULL)
+		pcap_breakloop (listen_pcap_obj);
+
+	return (0);
+} /* int dns_shutdown */
+
 static void submit_derive (const char *type, const char *type_instance,
 		derive_t value)
 {
@@ -338,67 +736,63 @@ static void submit_octets (derive_t queries, derive_t responses)
 
 static int dns_read (void)
 {
-	unsigned int keys[T_MAX];
-	unsigned int values[T_MAX];
-	int len;
+	dns_counters_t *sum = &counters_sum;
+	dns_counters_t *c;
 	int i;
 
-	counter_list_t *ptr;
-
-	pthread_mutex_lock (&traffic_mutex);
-	values[0] = tr_queries;
-	values[1] = tr_responses;
-	pthread_mutex_unlock (&traffic_mutex);
+	memset (sum, 0, sizeof (*sum));
 
-	if ((values[0] != 0) || (values[1] != 0))
-		submit_octets (values[0], values[1]);
-
-	pthread_mutex_lock (&qtype_mutex);
-	for (ptr = qtype_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	pthread_mutex_lock (&counters_lock);
+	for (c = counters_list; c != NULL; c = c->next)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		sum->queries += c->queries;
+		sum->responses += c->responses;
+		for (i = 0; i < T_MAX; i++)
+			sum->qtype[i] += c->qtype[i];
+		for (i = 0; i < OP_MAX; i++)
+			sum->opcode[i] += c->opcode[i];
+		for (i = 0; i < RCODE_MAX; i++)
+			sum->rcode[i] += c->rcode[i];
 	}
-	pthread_mutex_unlock (&qtype_mutex);
+	pthread_mutex_unlock (&counters_lock);
 
-	for (i = 0; i < len; i++)
-	{
-		DEBUG ("dns plugin: qtype = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_qtype", qtype_str (keys[i]), values[i]);
-	}
+	if ((sum->queries != 0) || (sum->responses != 0))
+		submit_octets (sum->queries, sum->responses);
 
-	pthread_mutex_lock (&opcode_mutex);
-	for (ptr = opcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < T_MAX; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
-	}
-	pthread_mutex_unlock (&opcode_mutex);
+		const char *str;
 
-	for (i = 0; i < len; i++)
-	{
-		DEBUG ("dns plugin: opcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_opcode", opcode_str (keys[i]), values[i]);
+		if (sum->qtype[i] == 0)
+			continue;
+
+		str = qtype_str (i);
+		if (!select_numeric_qtype && ((str == NULL) || (str[0] == '#')))
+			continue;
+
+		DEBUG ("dns plugin: qtype = %i; counter = %"PRIi64";",
+				i, sum->qtype[i]);
+		submit_derive ("dns_qtype", str, sum->qtype[i]);
 	}
 
-	pthread_mutex_lock (&rcode_mutex);
-	for (ptr = rcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < OP_MAX; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		if (sum->opcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: opcode = %i; counter = %"PRIi64";",
+				i, sum->opcode[i]);
+		submit_derive ("dns_opcode", opcode_str (i), sum->opcode[i]);
 	}
-	pthread_mutex_unlock (&rcode_mutex);
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < RCODE_MAX; i++)
 	{
-		DEBUG ("dns plugin: rcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_rcode", rcode_str (keys[i]), values[i]);
+		if (sum->rcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: rcode = %i; counter = %"PRIi64";",
+				i, sum->rcode[i]);
+		submit_derive ("dns_rcode", rcode_str (i), sum->rcode[i]);
 	}
 
 	return (0);
@@ -409,4 +803,5 @@ void module_register (void)
 	plugin_register_config ("dns", dns_config, config_keys, config_keys_num);
 	plugin_register_init ("dns", dns_init);
 	plugin_register_read ("dns", dns_read);
+	plugin_register_shutdown ("dns", dns_shutdown);
 } /* void module_register */
@@ -23,6 +23,7 @@
 #include "configfile.h"
 #include "plugin.h"
 #include "utils_complain.h"
+#include "utils_stats.h"
 #include "common.h"
 #include "filter_chain.h"
 
@@ -71,6 +72,7 @@ struct fc_chain_s /* {{{ */
   fc_rule_t   *rules;
   fc_target_t *targets;
   fc_chain_t  *next;
+  int stats_id;
 }; /* }}} */
 
 /*
@@ -458,6 +460,7 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
   chain->rules = NULL;
   chain->targets = NULL;
   chain->next = NULL;
+  chain->stats_id = ustats_register ("chain", chain->name);
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -604,21 +607,32 @@ static int fc_bit_return_invoke (const data_set_t __attribute__((unused)) *ds, /
   return (FC_TARGET_RETURN);
 } /* }}} int fc_bit_return_invoke */
 
+/* The `write' target resolves the plugin names when the configuration is read
+ * and complains about each plugin separately, so one failing plugin doesn't
+ * hide messages about the others. The array is terminated by an element
+ * whose handle is NULL. */
+struct fc_writer_s
+{
+  plugin_write_handle_t *handle;
+  c_complain_t complaint;
+};
+typedef struct fc_writer_s fc_writer_t;
+
 static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
     void **user_data)
 {
   int i;
 
-  char **plugin_list;
-  size_t plugin_list_len;
+  fc_writer_t *writers;
+  size_t writers_len;
 
-  plugin_list = NULL;
-  plugin_list_len = 0;
+  writers = NULL;
+  writers_len = 0;
 
   for (i = 0; i < ci->children_num; i++)
   {
     oconfig_item_t *child = ci->children + i;
-    char **temp;
+    fc_writer_t *temp;
     int j;
 
     if (strcasecmp ("Plugin", child->key) != 0)
@@ -638,44 +652,46 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
         continue;
       }
 
-      temp = (char **) realloc (plugin_list, (plugin_list_len + 2)
-          * (sizeof (*plugin_list)));
+      temp = (fc_writer_t *) realloc (writers, (writers_len + 2)
+          * (sizeof (*writers)));
       if (temp == NULL)
       {
         ERROR ("fc_bit_write_create: realloc failed.");
         continue;
       }
-      plugin_list = temp;
+      writers = temp;
+      memset (writers + writers_len, 0, 2 * sizeof (*writers));
 
-      plugin_list[plugin_list_len] = fc_strdup (child->values[j].value.string);
-      if (plugin_list[plugin_list_len] == NULL)
+      writers[writers_len].handle =
+        plugin_write_handle_create (child->values[j].value.string);
+      if (writers[writers_len].handle == NULL)
       {
-        ERROR ("fc_bit_write_create: fc_strdup failed.");
+        ERROR ("fc_bit_write_create: plugin_write_handle_create failed.");
         continue;
       }
-      plugin_list_len++;
-      plugin_list[plugin_list_len] = NULL;
+      C_COMPLAIN_INIT (&writers[writers_len].complaint);
+      writers_len++;
     } /* for (j = 0; j < child->values_num; j++) */
   } /* for (i = 0; i < ci->children_num; i++) */
 
-  *user_data = plugin_list;
+  *user_data = writers;
 
   return (0);
 } /* }}} int fc_bit_write_create */
 
 static int fc_bit_write_destroy (void **user_data) /* {{{ */
 {
-  char **plugin_list;
+  fc_writer_t *writers;
   size_t i;
 
   if ((user_data == NULL) || (*user_data == NULL))
     return (0);
 
-  plugin_list = *user_data;
+  writers = *user_data;
 
-  for (i = 0; plugin_list[i] != NULL; i++)
-    free (plugin_list[i]);
-  free (plugin_list);
+  for (i = 0; writers[i].handle != NULL; i++)
+    plugin_write_handle_destroy (writers[i].handle);
+  free (writers);
 
   return (0);
 } /* }}} int fc_bit_write_destroy */
@@ -684,14 +700,14 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
     value_list_t *vl, notification_meta_t __attribute__((unused)) **meta,
     void **user_data)
 {
-  char **plugin_list;
+  fc_writer_t *writers;
   int status;
 
-  plugin_list = NULL;
+  writers = NULL;
   if (user_data != NULL)
-    plugin_list = *user_data;
+    writers = *user_data;
 
-  if ((plugin_list == NULL) || (plugin_list[0] == NULL))
+  if ((writers == NULL) || (writers[0].handle == NULL))
   {
     static c_complain_t enoent_complaint = C_COMPLAIN_INIT_STATIC;
 
@@ -723,15 +739,22 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
   {
     size_t i;
 
-    for (i = 0; plugin_list[i] != NULL; i++)
+    for (i = 0; writers[i].handle != NULL; i++)
     {
-      status = plugin_write (plugin_list[i], ds, vl);
+      fc_writer_t *w = writers + i;
+
+      status = plugin_write_handle (w->handle, ds, vl);
       if (status != 0)
-      {
-        INFO ("Filter subsystem: Built-in target `write': Dispatching value to "
-            "the `%s' plugin failed with status %i.", plugin_list[i], status);
-      }
-    } /* for (i = 0; plugin_list[i] != NULL; i++) */
+        c_complain (LOG_INFO, &w->complaint,
+            "Filter subsystem: Built-in target `write': Dispatching value to "
+            "the `%s' plugin failed with status %i.",
+            plugin_write_handle_name (w->handle), status);
+      else
+        c_release (LOG_INFO, &w->complaint,
+            "Filter subsystem: Built-in target `write': Dispatching value to "
+            "the `%s' plugin succeeded again.",
+            plugin_write_handle_name (w->handle));
+    } /* for (i = 0; writers[i].handle != NULL; i++) */
   }
 
   return (FC_TARGET_CONTINUE);
@@ -858,16 +881,13 @@ fc_chain_t *fc_chain_get_by_name (const char *chain_name) /* {{{ */
   return (NULL);
 } /* }}} int fc_chain_get_by_name */
 
-int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
-    fc_chain_t *chain)
+static int fc_process_chain_internal (const data_set_t *ds, /* {{{ */
+    value_list_t *vl, fc_chain_t *chain)
 {
   fc_rule_t *rule;
   fc_target_t *target;
   int status;
 
-  if (chain == NULL)
-    return (-1);
-
   DEBUG ("fc_process_chain (chain = %s);", chain->name);
 
   status = FC_TARGET_CONTINUE;
@@ -1010,6 +1030,28 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
       chain->name);
 
   return (FC_TARGET_CONTINUE);
+} /* }}} int fc_process_chain_internal */
+
+int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
+    fc_chain_t *chain)
+{
+  cdtime_t start;
+  int status;
+
+  if (chain == NULL)
+    return (-1);
+
+  if (!ustats_enabled)
+    return (fc_process_chain_internal (ds, vl, chain));
+
+  /* Includes the time spent in chains jumped to and in write plugins called
+   * by targets. */
+  start = cdtime ();
+  status = fc_process_chain_internal (ds, vl, chain);
+  ustats_add (chain->stats_id, cdtime () - start,
+      /* failed = */ status < 0);
+
+  return (status);
 } /* }}} int fc_process_chain */
 
 /* Iterate over all rules in the chain and execute all targets for which all
@@ -58,6 +58,11 @@
 # include <libperfstat.h>
 #endif
 
+#if KERNEL_LINUX
+# include "utils_procfs.h"
+# include "utils_hashtable.h"
+#endif
+
 /*
  * Various people have reported problems with `getifaddrs' and varying versions
  * of `glibc'. That's why it's disabled by default. Since more statistics are
@@ -93,6 +98,23 @@ static int config_keys_num = 2;
 
 static ignorelist_t *ignorelist = NULL;
 
+#if !HAVE_GETIFADDRS && KERNEL_LINUX
+static procfs_file_t *pf_net_dev = NULL;
+
+/* Per-device ignorelist verdicts, keyed by device name, so the ignorelist
+ * is only consulted once per device. Devices that disappear from
+ * /proc/net/dev are removed after each read. */
+typedef struct ifstats_s
+{
+	char *name;
+	_Bool ignored;
+	unsigned int generation;
+} ifstats_t;
+
+static c_hashtable_t *if_table = NULL;
+static unsigned int if_generation = 0;
+#endif
+
 #ifdef HAVE_LIBKSTAT
 #define MAX_NUMIF 256
 extern kstat_ctl_t *kc;
@@ -154,16 +176,13 @@ static int interface_init (void)
 } /* int interface_init */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit (const char *dev, const char *type,
+static void if_dispatch (const char *dev, const char *type,
 		derive_t rx,
 		derive_t tx)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, dev) != 0)
-		return;
-
 	values[0].derive = rx;
 	values[1].derive = tx;
 
@@ -175,7 +194,76 @@ static void if_submit (const char *dev, const char *type,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void if_dispatch */
+
+#if HAVE_GETIFADDRS || !KERNEL_LINUX
+static void if_submit (const char *dev, const char *type,
+		derive_t rx,
+		derive_t tx)
+{
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	if_dispatch (dev, type, rx, tx);
 } /* void if_submit */
+/* #endif HAVE_GETIFADDRS || !KERNEL_LINUX */
+
+#else /* !HAVE_GETIFADDRS && KERNEL_LINUX */
+/* Returns the state of the device `name', creating it if necessary. */
+static ifstats_t *if_get (const char *name)
+{
+	ifstats_t *ifs;
+
+	if (if_table == NULL)
+	{
+		if_table = c_ht_create ();
+		if (if_table == NULL)
+			return (NULL);
+	}
+
+	if (c_ht_get (if_table, name, (void *) &ifs) == 0)
+		return (ifs);
+
+	if ((ifs = (ifstats_t *) calloc (1, sizeof (*ifs))) == NULL)
+		return (NULL);
+
+	if ((ifs->name = strdup (name)) == NULL)
+	{
+		free (ifs);
+		return (NULL);
+	}
+
+	ifs->ignored = (ignorelist_match (ignorelist, name) != 0);
+
+	if (c_ht_insert (if_table, ifs->name, ifs) != 0)
+	{
+		free (ifs->name);
+		free (ifs);
+		return (NULL);
+	}
+
+	return (ifs);
+} /* ifstats_t *if_get */
+
+static int if_vanished (char __attribute__((unused)) *name, void *value,
+		void __attribute__((unused)) *user_data)
+{
+	ifstats_t *ifs = value;
+
+	if (ifs->generation == if_generation)
+		return (0);
+
+	free (ifs->name);
+	free (ifs);
+	return (1);
+} /* int if_vanished */
+
+/* Removes the devices that were not seen during the current read. */
+static void if_table_gc (void)
+{
+	c_ht_sweep (if_table, if_vanished, /* user_data = */ NULL);
+} /* void if_table_gc */
+#endif /* !HAVE_GETIFADDRS && KERNEL_LINUX */
 
 static int interface_read (void)
 {
@@ -231,8 +319,7 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *line;
 	derive_t incoming, outgoing;
 	char *device;
 
@@ -240,47 +327,68 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+	if ((pf_net_dev == NULL)
+			&& ((pf_net_dev = procfs_open ("/proc/net/dev")) == NULL))
 	{
 		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
+		WARNING ("interface plugin: procfs_open: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	if (procfs_read (pf_net_dev) < 0)
 	{
-		if (!(dummy = strchr(buffer, ':')))
+		char errbuf[1024];
+		WARNING ("interface plugin: procfs_read: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if_generation++;
+
+	while ((line = procfs_next_line (pf_net_dev)) != NULL)
+	{
+		ifstats_t *ifs;
+
+		if (!(dummy = strchr(line, ':')))
 			continue;
 		dummy[0] = '\0';
 		dummy++;
 
-		device = buffer;
+		device = line;
 		while (device[0] == ' ')
 			device++;
 
 		if (device[0] == '\0')
 			continue;
 
-		numfields = strsplit (dummy, fields, 16);
+		ifs = if_get (device);
+		if (ifs == NULL)
+			continue;
+
+		ifs->generation = if_generation;
+		if (ifs->ignored)
+			continue;
+
+		numfields = procfs_split (dummy, fields, 16);
 
 		if (numfields < 11)
 			continue;
 
-		incoming = atoll (fields[0]);
-		outgoing = atoll (fields[8]);
-		if_submit (device, "if_octets", incoming, outgoing);
+		incoming = procfs_atoll (fields[0]);
+		outgoing = procfs_atoll (fields[8]);
+		if_dispatch (ifs->name, "if_octets", incoming, outgoing);
 
-		incoming = atoll (fields[1]);
-		outgoing = atoll (fields[9]);
-		if_submit (device, "if_packets", incoming, outgoing);
+		incoming = procfs_atoll (fields[1]);
+		outgoing = procfs_atoll (fields[9]);
+		if_dispatch (ifs->name, "if_packets", incoming, outgoing);
 
-		incoming = atoll (fields[2]);
-		outgoing = atoll (fields[10]);
-		if_submit (device, "if_errors", incoming, outgoing);
+		incoming = procfs_atoll (fields[2]);
+		outgoing = procfs_atoll (fields[10]);
+		if_dispatch (ifs->name, "if_errors", incoming, outgoing);
 	}
 
-	fclose (fh);
+	if_table_gc ();
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
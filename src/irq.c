@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,8 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+static procfs_file_t *pf_interrupts = NULL;
+
 /*
  * Private functions
  */
@@ -92,8 +95,7 @@ static void irq_submit (const char *irq_name, derive_t value)
 
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
+	char *line;
 	int  cpu_count;
 	char *fields[256];
 
@@ -104,18 +106,26 @@ static int irq_read (void)
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if ((pf_interrupts == NULL)
+			&& ((pf_interrupts = procfs_open ("/proc/interrupts")) == NULL))
 	{
 		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
+		ERROR ("irq plugin: procfs_open (/proc/interrupts): %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (procfs_read (pf_interrupts) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("irq plugin: procfs_read (/proc/interrupts): %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
 	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
+	if ((line = procfs_next_line (pf_interrupts)) != NULL) {
+		cpu_count = procfs_split (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 	} else {
 		ERROR ("irq plugin: unable to get CPU count from first line "
@@ -123,7 +133,7 @@ static int irq_read (void)
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((line = procfs_next_line (pf_interrupts)) != NULL)
 	{
 		char *irq_name;
 		size_t irq_name_len;
@@ -132,7 +142,7 @@ static int irq_read (void)
 		int fields_num;
 		int irq_values_to_parse;
 
-		fields_num = strsplit (buffer, fields,
+		fields_num = procfs_split (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 		if (fields_num < 2)
 			continue;
@@ -162,14 +172,10 @@ static int irq_read (void)
 		for (i = 1; i <= irq_values_to_parse; i++)
 		{
 			/* Per-CPU value */
-			value_t v;
-			int status;
-
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
-			if (status != 0)
+			if ((fields[i][0] < '0') || (fields[i][0] > '9'))
 				break;
 
-			irq_value += v.derive;
+			irq_value += procfs_atoll (fields[i]);
 		} /* for (i) */
 
 		/* No valid fields -> do not submit anything. */
@@ -179,8 +185,6 @@ static int irq_read (void)
 		irq_submit (irq_name, irq_value);
 	}
 
-	fclose (fh);
-
 	return (0);
 } /* int irq_read */
 
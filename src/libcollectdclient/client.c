@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <poll.h>
 
 #include "client.h"
 
@@ -58,6 +59,10 @@
 # endif
 #endif
 
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
 /* Secure/static macros. They work like `strcpy' and `strcat', but assure null
  * termination. They work for static buffers only, because they use `sizeof'.
  * The `SSTRCATF' combines the functionality of `snprintf' and `strcat' which
@@ -95,12 +100,48 @@
 /*
  * Types
  */
+/* A command sent with the asynchronous interface whose response hasn't been
+ * read yet. */
+struct lcc_pending_s
+{
+  lcc_callback_t callback;
+  void *user_data;
+};
+typedef struct lcc_pending_s lcc_pending_t;
+
 struct lcc_connection_s
 {
   FILE *fh;
   char errbuf[1024];
+
+  /* Asynchronous interface. Commands are appended to "wbuf" and written
+   * without waiting for their responses. The callbacks of the commands in
+   * flight are kept in "pending", in the order the commands were issued,
+   * starting at "pending_head". Responses are read into "rbuf". */
+  char  *wbuf;
+  size_t wbuf_pos;
+  size_t wbuf_len;
+  size_t wbuf_size;
+
+  lcc_pending_t *pending;
+  size_t pending_head;
+  size_t pending_num;
+  size_t pending_size;
+
+  char   rbuf[4096];
+  size_t rbuf_len;
+
+  int async_failures;
 };
 
+/* Once this much data is buffered, lcc_putval_async() tries to send it. */
+#define LCC_ASYNC_WBUF_HIGH 65536
+/* lcc_putval_async() waits for responses once this many commands are in
+ * flight. */
+#define LCC_ASYNC_PENDING_MAX 8192
+/* Maximum number of lines per PUTVALS command, see collectd-unixsock(5). */
+#define LCC_PUTVALS_MAX_LINES 16384
+
 struct lcc_response_s
 {
   int status;
@@ -408,6 +449,10 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
+  /* Responses of asynchronous commands would be mistaken for ours. */
+  if ((c->pending_num > 0) && (lcc_async_flush (c) < 0))
+    return (-1);
+
   status = lcc_send (c, command);
   if (status != 0)
     return (status);
@@ -420,6 +465,268 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
   return (status);
 } /* }}} int lcc_sendreceive */
 
+/* Formats a PUTVAL command, i.e. "prefix" followed by the identifier,
+ * options and values. PUTVALS blocks use an empty prefix. */
+static int lcc_format_putval (lcc_connection_t *c, /* {{{ */
+    char *command, size_t command_size, const char *prefix,
+    const lcc_value_list_t *vl)
+{
+  char ident_str[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  char buffer[1024] = "";
+  int status;
+  size_t i;
+
+  if ((vl == NULL) || (vl->values_len < 1)
+      || (vl->values == NULL) || (vl->values_types == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
+      &vl->identifier);
+  if (status != 0)
+    return (status);
+
+  SSTRCATF (buffer, "%s%s", prefix,
+      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+
+  if (vl->interval > 0)
+    SSTRCATF (buffer, " interval=%i", vl->interval);
+
+  if (vl->time > 0)
+    SSTRCATF (buffer, " %u", (unsigned int) vl->time);
+  else
+    SSTRCAT (buffer, " N");
+
+  for (i = 0; i < vl->values_len; i++)
+  {
+    if (vl->values_types[i] == LCC_TYPE_COUNTER)
+      SSTRCATF (buffer, ":%"PRIu64, vl->values[i].counter);
+    else if (vl->values_types[i] == LCC_TYPE_GAUGE)
+    {
+      if (isnan (vl->values[i].gauge))
+        SSTRCATF (buffer, ":U");
+      else
+        SSTRCATF (buffer, ":%g", vl->values[i].gauge);
+    }
+    else if (vl->values_types[i] == LCC_TYPE_DERIVE)
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].derive);
+    else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].absolute);
+
+  } /* for (i = 0; i < vl->values_len; i++) */
+
+  if (strlen (buffer) >= (command_size - 1))
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  strncpy (command, buffer, command_size);
+  command[command_size - 1] = 0;
+
+  return (0);
+} /* }}} int lcc_format_putval */
+
+/* Appends "command" and a line break to the write buffer. */
+static int lcc_async_append (lcc_connection_t *c, /* {{{ */
+    const char *command)
+{
+  size_t len = strlen (command);
+
+  /* Reclaim the space of data which has been sent already. */
+  if (c->wbuf_pos > 0)
+  {
+    memmove (c->wbuf, c->wbuf + c->wbuf_pos, c->wbuf_len - c->wbuf_pos);
+    c->wbuf_len -= c->wbuf_pos;
+    c->wbuf_pos = 0;
+  }
+
+  if ((c->wbuf_len + len + 2) > c->wbuf_size)
+  {
+    char *tmp;
+    size_t new_size = (c->wbuf_size == 0) ? 4096 : c->wbuf_size;
+
+    while (new_size < (c->wbuf_len + len + 2))
+      new_size *= 2;
+
+    tmp = realloc (c->wbuf, new_size);
+    if (tmp == NULL)
+    {
+      lcc_set_errno (c, ENOMEM);
+      return (-1);
+    }
+    c->wbuf = tmp;
+    c->wbuf_size = new_size;
+  }
+
+  memcpy (c->wbuf + c->wbuf_len, command, len);
+  memcpy (c->wbuf + c->wbuf_len + len, "\r\n", 2);
+  c->wbuf_len += len + 2;
+
+  return (0);
+} /* }}} int lcc_async_append */
+
+static int lcc_async_push (lcc_connection_t *c, /* {{{ */
+    lcc_callback_t callback, void *user_data)
+{
+  if ((c->pending_head + c->pending_num) >= c->pending_size)
+  {
+    if (c->pending_head > 0)
+    {
+      memmove (c->pending, c->pending + c->pending_head,
+          c->pending_num * sizeof (*c->pending));
+      c->pending_head = 0;
+    }
+
+    if (c->pending_num >= c->pending_size)
+    {
+      lcc_pending_t *tmp;
+      size_t new_size = (c->pending_size == 0) ? 64 : 2 * c->pending_size;
+
+      tmp = realloc (c->pending, new_size * sizeof (*tmp));
+      if (tmp == NULL)
+      {
+        lcc_set_errno (c, ENOMEM);
+        return (-1);
+      }
+      c->pending = tmp;
+      c->pending_size = new_size;
+    }
+  }
+
+  c->pending[c->pending_head + c->pending_num].callback = callback;
+  c->pending[c->pending_head + c->pending_num].user_data = user_data;
+  c->pending_num++;
+
+  return (0);
+} /* }}} int lcc_async_push */
+
+/* Handles one response line: Removes the oldest pending command and calls
+ * its callback. */
+static int lcc_async_complete (lcc_connection_t *c, char *line) /* {{{ */
+{
+  lcc_pending_t p;
+  char *ptr = NULL;
+  int status;
+
+  lcc_chomp (line);
+  LCC_DEBUG ("receive: <-- %s\n", line);
+
+  if (c->pending_num == 0)
+  {
+    LCC_SET_ERRSTR (c, "Unexpected response: %s", line);
+    return (-1);
+  }
+
+  errno = 0;
+  status = (int) strtol (line, &ptr, 0);
+  if ((errno != 0) || (ptr == line))
+  {
+    LCC_SET_ERRSTR (c, "Malformed response: %s", line);
+    return (-1);
+  }
+  while ((*ptr == ' ') || (*ptr == '\t'))
+    ptr++;
+
+  p = c->pending[c->pending_head];
+  c->pending_head++;
+  c->pending_num--;
+  if (c->pending_num == 0)
+    c->pending_head = 0;
+
+  if (status < 0)
+    c->async_failures++;
+
+  if (p.callback != NULL)
+    (*p.callback) (c, status, ptr, p.user_data);
+
+  return (0);
+} /* }}} int lcc_async_complete */
+
+/* Writes as much of the write buffer as possible without blocking. */
+static int lcc_async_write (lcc_connection_t *c) /* {{{ */
+{
+  int fd = fileno (c->fh);
+
+  while (c->wbuf_pos < c->wbuf_len)
+  {
+    ssize_t status;
+
+    status = send (fd, c->wbuf + c->wbuf_pos, c->wbuf_len - c->wbuf_pos,
+        MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return (0);
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
+
+    c->wbuf_pos += (size_t) status;
+  }
+
+  c->wbuf_pos = 0;
+  c->wbuf_len = 0;
+  return (0);
+} /* }}} int lcc_async_write */
+
+/* Reads and handles the responses available without blocking. */
+static int lcc_async_read (lcc_connection_t *c) /* {{{ */
+{
+  int fd = fileno (c->fh);
+
+  while (c->pending_num > 0)
+  {
+    ssize_t status;
+    char *line;
+    char *eol;
+
+    status = recv (fd, c->rbuf + c->rbuf_len,
+        sizeof (c->rbuf) - c->rbuf_len - 1, MSG_DONTWAIT);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return (0);
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      LCC_SET_ERRSTR (c, "Connection closed by peer.");
+      return (-1);
+    }
+
+    c->rbuf_len += (size_t) status;
+    c->rbuf[c->rbuf_len] = 0;
+
+    line = c->rbuf;
+    while ((eol = strchr (line, '\n')) != NULL)
+    {
+      *eol = 0;
+      if (lcc_async_complete (c, line) != 0)
+        return (-1);
+      line = eol + 1;
+    }
+
+    c->rbuf_len -= (size_t) (line - c->rbuf);
+    memmove (c->rbuf, line, c->rbuf_len);
+
+    if (c->rbuf_len >= (sizeof (c->rbuf) - 1))
+    {
+      LCC_SET_ERRSTR (c, "Response line too long.");
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int lcc_async_read */
+
 static int lcc_open_unixsocket (lcc_connection_t *c, const char *path) /* {{{ */
 {
   struct sockaddr_un sa;
@@ -649,10 +956,15 @@ int lcc_disconnect (lcc_connection_t *c) /* {{{ */
 
   if (c->fh != NULL)
   {
+    if (c->pending_num > 0)
+      lcc_async_flush (c);
+
     fclose (c->fh);
     c->fh = NULL;
   }
 
+  free (c->wbuf);
+  free (c->pending);
   free (c);
   return (0);
 } /* }}} int lcc_disconnect */
@@ -787,68 +1099,222 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
 
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 {
-  char ident_str[6 * LCC_NAME_LEN];
-  char ident_esc[12 * LCC_NAME_LEN];
-  char command[1024] = "";
+  char command[1024];
   lcc_response_t res;
   int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_format_putval (c, command, sizeof (command), "PUTVAL ", vl);
+  if (status != 0)
+    return (status);
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_putval */
+
+int lcc_putval_many (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, size_t vl_num)
+{
+  char buffer[1024];
+  lcc_response_t res;
   size_t i;
+  int status;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
-      || (vl->values == NULL) || (vl->values_types == NULL))
+  if (c == NULL)
+    return (-1);
+
+  if ((vl == NULL) && (vl_num > 0))
   {
     lcc_set_errno (c, EINVAL);
     return (-1);
   }
 
-  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
-      &vl->identifier);
-  if (status != 0)
-    return (status);
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
 
-  SSTRCATF (command, "PUTVAL %s",
-      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+  if ((c->pending_num > 0) && (lcc_async_flush (c) < 0))
+    return (-1);
 
-  if (vl->interval > 0)
-    SSTRCATF (command, " interval=%i", vl->interval);
+  memset (&res, 0, sizeof (res));
+  for (i = 0; i < vl_num; i += LCC_PUTVALS_MAX_LINES)
+  {
+    size_t end = i + LCC_PUTVALS_MAX_LINES;
+    size_t j;
 
-  if (vl->time > 0)
-    SSTRCATF (command, " %u", (unsigned int) vl->time);
-  else
-    SSTRCAT (command, " N");
+    if (end > vl_num)
+      end = vl_num;
 
-  for (i = 0; i < vl->values_len; i++)
-  {
-    if (vl->values_types[i] == LCC_TYPE_COUNTER)
-      SSTRCATF (command, ":%"PRIu64, vl->values[i].counter);
-    else if (vl->values_types[i] == LCC_TYPE_GAUGE)
+    /* The block is written through the connection's stdio buffer, so it is
+     * sent in large chunks. */
+    status = lcc_send (c, "PUTVALS");
+    for (j = i; (j < end) && (status == 0); j++)
     {
-      if (isnan (vl->values[i].gauge))
-        SSTRCATF (command, ":U");
-      else
-        SSTRCATF (command, ":%g", vl->values[i].gauge);
+      status = lcc_format_putval (c, buffer, sizeof (buffer), "", vl + j);
+      if (status == 0)
+        status = lcc_send (c, buffer);
     }
-    else if (vl->values_types[i] == LCC_TYPE_DERIVE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].derive);
-    else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].absolute);
+    if (status == 0)
+      status = lcc_send (c, ".");
 
-  } /* for (i = 0; i < vl->values_len; i++) */
+    if (status != 0)
+    {
+      /* Terminate the block, so the connection stays usable. */
+      lcc_send (c, ".");
+      if (lcc_receive (c, &res) == 0)
+        lcc_response_free (&res);
+      return (-1);
+    }
 
-  status = lcc_sendreceive (c, command, &res);
+    memset (&res, 0, sizeof (res));
+    status = lcc_receive (c, &res);
+    if (status != 0)
+      return (status);
+
+    if (res.status != 0)
+    {
+      /* Bound the message, so it fits into errbuf after the prefix. */
+      LCC_SET_ERRSTR (c, "Server error: %.1000s", res.message);
+      lcc_response_free (&res);
+      return (-1);
+    }
+    lcc_response_free (&res);
+  }
+
+  return (0);
+} /* }}} int lcc_putval_many */
+
+int lcc_putval_async (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, lcc_callback_t callback, void *user_data)
+{
+  char command[1024];
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  status = lcc_format_putval (c, command, sizeof (command), "PUTVAL ", vl);
   if (status != 0)
     return (status);
 
-  if (res.status != 0)
+  LCC_DEBUG ("send:    --> %s\n", command);
+
+  if (lcc_async_append (c, command) != 0)
+    return (-1);
+
+  if (lcc_async_push (c, callback, user_data) != 0)
   {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
+    /* Drop the command again, its response couldn't be matched. */
+    c->wbuf_len -= strlen (command) + 2;
     return (-1);
   }
 
-  lcc_response_free (&res);
+  if (c->pending_num >= LCC_ASYNC_PENDING_MAX)
+  {
+    if (lcc_async_flush (c) < 0)
+      return (-1);
+  }
+  else if ((c->wbuf_len - c->wbuf_pos) >= LCC_ASYNC_WBUF_HIGH)
+  {
+    if (lcc_async_poll (c) < 0)
+      return (-1);
+  }
+
   return (0);
-} /* }}} int lcc_putval */
+} /* }}} int lcc_putval_async */
+
+int lcc_async_poll (lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return (-1);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  /* Anything the synchronous functions left in the stdio buffer has to go
+   * out first. */
+  fflush (c->fh);
+
+  if ((lcc_async_write (c) != 0) || (lcc_async_read (c) != 0))
+    return (-1);
+
+  return ((int) c->pending_num);
+} /* }}} int lcc_async_poll */
+
+int lcc_async_flush (lcc_connection_t *c) /* {{{ */
+{
+  int failures;
+
+  if (c == NULL)
+    return (-1);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  fflush (c->fh);
+
+  /* Send and receive at the same time: The daemon stops reading commands
+   * if its responses aren't read. */
+  while ((c->pending_num > 0) || (c->wbuf_pos < c->wbuf_len))
+  {
+    struct pollfd pfd;
+    int status;
+
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = fileno (c->fh);
+    if (c->wbuf_pos < c->wbuf_len)
+      pfd.events |= POLLOUT;
+    if (c->pending_num > 0)
+      pfd.events |= POLLIN;
+
+    status = poll (&pfd, 1, /* timeout = */ -1);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
+
+    if ((pfd.revents & (POLLOUT | POLLERR | POLLHUP))
+        && (lcc_async_write (c) != 0))
+      return (-1);
+    if ((pfd.revents & (POLLIN | POLLERR | POLLHUP))
+        && (lcc_async_read (c) != 0))
+      return (-1);
+  }
+
+  failures = c->async_failures;
+  c->async_failures = 0;
+  return (failures);
+} /* }}} int lcc_async_flush */
 
 int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
     lcc_identifier_t *ident, int timeout)
@@ -101,6 +101,40 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
 
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Submits "vl_num" value lists with as few round trips as possible, using
+ * the PUTVALS command. Fails if the daemon rejects any of them. */
+int lcc_putval_many (lcc_connection_t *c,
+    const lcc_value_list_t *vl, size_t vl_num);
+
+/*
+ * Asynchronous interface
+ *
+ * Commands are buffered and sent without waiting for the response of the
+ * previous one, so many commands can be in flight on a connection. The
+ * responses are matched to the commands in order. The callback of a command
+ * is called once its response has been read, with the status and message
+ * sent by the daemon. This happens from within lcc_putval_async(),
+ * lcc_async_poll() or lcc_async_flush(). Synchronous functions called on the
+ * same connection flush all pending commands first.
+ */
+typedef void (*lcc_callback_t) (lcc_connection_t *c,
+    int status, const char *message, void *user_data);
+
+/* Queues a PUTVAL command. "callback" may be NULL. This function only blocks
+ * if a large number of commands is waiting for a response. */
+int lcc_putval_async (lcc_connection_t *c, const lcc_value_list_t *vl,
+    lcc_callback_t callback, void *user_data);
+
+/* Sends buffered commands and handles available responses without blocking.
+ * Returns the number of commands still waiting for a response or -1 on
+ * failure. */
+int lcc_async_poll (lcc_connection_t *c);
+
+/* Sends all buffered commands and waits for all responses. Returns the
+ * number of commands which failed since the last call or -1 if the
+ * connection failed. */
+int lcc_async_flush (lcc_connection_t *c);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
@@ -27,6 +27,10 @@
 #include "common.h"
 #include "plugin.h"
 
+#if KERNEL_LINUX
+# include "utils_procfs.h"
+#endif
+
 #ifdef HAVE_SYS_LOADAVG_H
 #include <sys/loadavg.h>
 #endif
@@ -49,6 +53,10 @@
 # include <libperfstat.h>
 #endif /* HAVE_PERFSTAT */
 
+#if !defined(HAVE_GETLOADAVG) && defined(KERNEL_LINUX)
+static procfs_file_t *pf_loadavg = NULL;
+#endif
+
 static void load_submit (gauge_t snum, gauge_t mnum, gauge_t lnum)
 {
 	value_t values[3];
@@ -84,44 +92,37 @@ static int load_read (void)
 
 #elif defined(KERNEL_LINUX)
 	gauge_t snum, mnum, lnum;
-	FILE *loadavg;
-	char buffer[16];
+	char *line;
 
 	char *fields[8];
 	int numfields;
 
-	if ((loadavg = fopen ("/proc/loadavg", "r")) == NULL)
+	if ((pf_loadavg == NULL)
+			&& ((pf_loadavg = procfs_open ("/proc/loadavg")) == NULL))
 	{
 		char errbuf[1024];
-		WARNING ("load: fopen: %s",
+		WARNING ("load: procfs_open: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	if (fgets (buffer, 16, loadavg) == NULL)
+	if ((procfs_read (pf_loadavg) < 0)
+			|| ((line = procfs_next_line (pf_loadavg)) == NULL))
 	{
 		char errbuf[1024];
-		WARNING ("load: fgets: %s",
+		WARNING ("load: procfs_read: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (loadavg);
 		return (-1);
 	}
 
-	if (fclose (loadavg))
-	{
-		char errbuf[1024];
-		WARNING ("load: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
-
-	numfields = strsplit (buffer, fields, 8);
+	numfields = procfs_split (line, fields, 8);
 
 	if (numfields < 3)
 		return (-1);
 
-	snum = atof (fields[0]);
-	mnum = atof (fields[1]);
-	lnum = atof (fields[2]);
+	snum = strtod (fields[0], NULL);
+	mnum = strtod (fields[1], NULL);
+	lnum = strtod (fields[2], NULL);
 
 	load_submit (snum, mnum, lnum);
 /* #endif KERNEL_LINUX */
@@ -27,6 +27,10 @@
 #include "common.h"
 #include "plugin.h"
 
+#if KERNEL_LINUX
+# include "utils_procfs.h"
+#endif
+
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
 #endif
@@ -67,7 +71,7 @@ static vm_size_t pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+static procfs_file_t *pf_meminfo = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -261,8 +265,7 @@ static int memory_read (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *line;
 
 	char *fields[8];
 	int numfields;
@@ -272,42 +275,44 @@ static int memory_read (void)
 	long long mem_cached = 0;
 	long long mem_free = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if ((pf_meminfo == NULL)
+			&& ((pf_meminfo = procfs_open ("/proc/meminfo")) == NULL))
+	{
+		char errbuf[1024];
+		WARNING ("memory: procfs_open: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (procfs_read (pf_meminfo) < 0)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
+		WARNING ("memory: procfs_read: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	while ((line = procfs_next_line (pf_meminfo)) != NULL)
 	{
 		long long *val = NULL;
 
-		if (strncasecmp (buffer, "MemTotal:", 9) == 0)
+		if (strncasecmp (line, "MemTotal:", 9) == 0)
 			val = &mem_used;
-		else if (strncasecmp (buffer, "MemFree:", 8) == 0)
+		else if (strncasecmp (line, "MemFree:", 8) == 0)
 			val = &mem_free;
-		else if (strncasecmp (buffer, "Buffers:", 8) == 0)
+		else if (strncasecmp (line, "Buffers:", 8) == 0)
 			val = &mem_buffered;
-		else if (strncasecmp (buffer, "Cached:", 7) == 0)
+		else if (strncasecmp (line, "Cached:", 7) == 0)
 			val = &mem_cached;
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields, 8);
+		numfields = procfs_split (line, fields, 8);
 
 		if (numfields < 2)
 			continue;
 
-		*val = atoll (fields[1]) * 1024LL;
-	}
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		*val = procfs_atoll (fields[1]) * 1024LL;
 	}
 
 	if (mem_used >= (mem_free + mem_buffered + mem_cached))
@@ -38,22 +38,80 @@ union meta_value_u
 };
 typedef union meta_value_u meta_value_t;
 
-struct meta_entry_s;
-typedef struct meta_entry_s meta_entry_t;
+/* Keys are interned in a global table, so objects share one copy of each
+ * key and its hash. Keys are case insensitive: all spellings of a key share
+ * one interned key. Each entry holds a reference to its key; keys which are
+ * no longer referenced are removed from the table by md_keys_sweep().
+ * Lookups compare against the keys of the object's entries and never touch
+ * the table. Only adding a key which the object doesn't have yet does. */
+struct md_key_s;
+typedef struct md_key_s md_key_t;
+struct md_key_s
+{
+  char         *name;
+  unsigned int  hash;
+  unsigned int  refcount;
+  md_key_t     *next;
+};
+
+/* "name" is the key as spelled by the caller, if that differs from the
+ * spelling of the interned key. */
 struct meta_entry_s
 {
-  char         *key;
+  md_key_t     *key;
+  char         *name;
   meta_value_t  value;
   int           type;
-  meta_entry_t *next;
 };
+typedef struct meta_entry_s meta_entry_t;
+
+/* The entries of an object. Up to MD_INLINE_NUM entries are stored in the
+ * body itself and searched linearly. Larger bodies move the entries to the
+ * heap and index them with an open addressing hash table. Entries are kept
+ * in insertion order.
+ *
+ * Bodies are shared by meta_data_clone and copied by the first write to one
+ * of the objects using them ("copy on write"). A body with a reference count
+ * greater than one is never modified. */
+#define MD_INLINE_NUM 4
+struct md_body_s
+{
+  unsigned int  refcount;
+
+  meta_entry_t *entries;
+  int           entries_num;
+  int           entries_size;
+
+  int          *index;
+  int           index_size;
+
+  meta_entry_t  inline_entries[MD_INLINE_NUM];
+};
+typedef struct md_body_s md_body_t;
 
 struct meta_data_s
 {
-  meta_entry_t   *head;
-  pthread_mutex_t lock;
+  md_body_t       *body;
+  pthread_rwlock_t lock;
 };
 
+/*
+ * Private variables
+ */
+/* Reference counts are changed atomically. Taking the first reference of an
+ * entry requires holding md_keys_lock for reading, removing keys requires
+ * holding it for writing, so a key can't be removed while a reference is
+ * being taken. Copying an entry may add a reference without the lock, since
+ * the original entry already holds one.
+ * Unused keys are removed when the table has grown to "md_keys_sweep_at"
+ * keys. */
+#define MD_KEYS_BUCKETS 256
+#define MD_KEYS_SWEEP_MIN 1024
+static md_key_t *md_keys[MD_KEYS_BUCKETS];
+static size_t md_keys_num = 0;
+static size_t md_keys_sweep_at = MD_KEYS_SWEEP_MIN;
+static pthread_rwlock_t md_keys_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 /*
  * Private functions
  */
@@ -75,136 +133,529 @@ static char *md_strdup (const char *orig) /* {{{ */
   return (dest);
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc (const char *key) /* {{{ */
+/* FNV-1a over the lower case key. */
+static unsigned int md_key_hash (const char *key) /* {{{ */
+{
+  unsigned int hash = 2166136261U;
+
+  for (; *key != 0; key++)
+  {
+    hash ^= (unsigned int) tolower ((unsigned char) *key);
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} unsigned int md_key_hash */
+
+/* md_keys_lock must be held. */
+static md_key_t *md_key_find (const char *key, /* {{{ */
+    unsigned int hash)
+{
+  md_key_t *k;
+
+  for (k = md_keys[hash % MD_KEYS_BUCKETS]; k != NULL; k = k->next)
+    if ((k->hash == hash) && (strcasecmp (key, k->name) == 0))
+      break;
+
+  return (k);
+} /* }}} md_key_t *md_key_find */
+
+/* Frees all keys which are no longer referenced. md_keys_lock must be held
+ * for writing. */
+static void md_keys_sweep (void) /* {{{ */
 {
-  meta_entry_t *e;
+  size_t i;
 
-  e = (meta_entry_t *) malloc (sizeof (*e));
-  if (e == NULL)
+  for (i = 0; i < MD_KEYS_BUCKETS; i++)
   {
-    ERROR ("md_entry_alloc: malloc failed.");
+    md_key_t **prev = md_keys + i;
+
+    while (*prev != NULL)
+    {
+      md_key_t *k = *prev;
+
+      if (__sync_fetch_and_add (&k->refcount, 0) != 0)
+      {
+        prev = &k->next;
+        continue;
+      }
+
+      *prev = k->next;
+      md_keys_num--;
+      free (k->name);
+      free (k);
+    }
+  }
+
+  md_keys_sweep_at = 2 * md_keys_num;
+  if (md_keys_sweep_at < MD_KEYS_SWEEP_MIN)
+    md_keys_sweep_at = MD_KEYS_SWEEP_MIN;
+} /* }}} void md_keys_sweep */
+
+/* Returns a reference to the interned key for "key", adding it to the table
+ * if necessary. "hash" is the md_key_hash() of "key". */
+static md_key_t *md_key_intern (const char *key, unsigned int hash) /* {{{ */
+{
+  md_key_t *k;
+
+  pthread_rwlock_rdlock (&md_keys_lock);
+  k = md_key_find (key, hash);
+  if (k != NULL)
+    __sync_add_and_fetch (&k->refcount, 1);
+  pthread_rwlock_unlock (&md_keys_lock);
+  if (k != NULL)
+    return (k);
+
+  pthread_rwlock_wrlock (&md_keys_lock);
+
+  /* Another thread may have added the key in the meantime. */
+  k = md_key_find (key, hash);
+  if (k != NULL)
+  {
+    __sync_add_and_fetch (&k->refcount, 1);
+    pthread_rwlock_unlock (&md_keys_lock);
+    return (k);
+  }
+
+  if (md_keys_num >= md_keys_sweep_at)
+    md_keys_sweep ();
+
+  k = (md_key_t *) malloc (sizeof (*k));
+  if (k == NULL)
+  {
+    pthread_rwlock_unlock (&md_keys_lock);
+    ERROR ("md_key_intern: malloc failed.");
     return (NULL);
   }
-  memset (e, 0, sizeof (*e));
 
-  e->key = md_strdup (key);
-  if (e->key == NULL)
+  k->name = md_strdup (key);
+  if (k->name == NULL)
   {
-    free (e);
-    ERROR ("md_entry_alloc: md_strdup failed.");
+    pthread_rwlock_unlock (&md_keys_lock);
+    free (k);
+    ERROR ("md_key_intern: md_strdup failed.");
     return (NULL);
   }
+  k->hash = hash;
+  k->refcount = 1;
+  k->next = md_keys[hash % MD_KEYS_BUCKETS];
+  md_keys[hash % MD_KEYS_BUCKETS] = k;
+  md_keys_num++;
 
-  e->type = 0;
-  e->next = NULL;
+  pthread_rwlock_unlock (&md_keys_lock);
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_alloc */
+  return (k);
+} /* }}} md_key_t *md_key_intern */
 
-static meta_entry_t *md_entry_clone (const meta_entry_t *orig) /* {{{ */
+static void md_key_release (md_key_t *k) /* {{{ */
 {
-  meta_entry_t *copy;
+  if (k != NULL)
+    __sync_sub_and_fetch (&k->refcount, 1);
+} /* }}} void md_key_release */
 
-  if (orig == NULL)
+static void md_entry_clear (meta_entry_t *e) /* {{{ */
+{
+  if (e->type == MD_TYPE_STRING)
+    free (e->value.mv_string);
+  free (e->name);
+  md_key_release (e->key);
+} /* }}} void md_entry_clear */
+
+static const char *md_entry_name (const meta_entry_t *e) /* {{{ */
+{
+  return ((e->name != NULL) ? e->name : e->key->name);
+} /* }}} const char *md_entry_name */
+
+static md_body_t *md_body_alloc (void) /* {{{ */
+{
+  md_body_t *b;
+
+  b = (md_body_t *) malloc (sizeof (*b));
+  if (b == NULL)
     return (NULL);
+  memset (b, 0, sizeof (*b));
 
-  copy = md_entry_alloc (orig->key);
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup (orig->value.mv_string);
-  else
-    copy->value = orig->value;
+  b->refcount = 1;
+  b->entries = b->inline_entries;
+  b->entries_num = 0;
+  b->entries_size = MD_INLINE_NUM;
+  b->index = NULL;
+  b->index_size = 0;
 
-  copy->next = md_entry_clone (orig->next);
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone */
+  return (b);
+} /* }}} md_body_t *md_body_alloc */
 
-static void md_entry_free (meta_entry_t *e) /* {{{ */
+static void md_body_free (md_body_t *b) /* {{{ */
 {
-  if (e == NULL)
+  int i;
+
+  if (b == NULL)
     return;
 
-  free (e->key);
+  for (i = 0; i < b->entries_num; i++)
+    md_entry_clear (b->entries + i);
 
-  if (e->type == MD_TYPE_STRING)
-    free (e->value.mv_string);
+  if (b->entries != b->inline_entries)
+    free (b->entries);
+  free (b->index);
+  free (b);
+} /* }}} void md_body_free */
 
-  if (e->next != NULL)
-    md_entry_free (e->next);
+static void md_body_release (md_body_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
 
-  free (e);
-} /* }}} void md_entry_free */
+  if (__sync_sub_and_fetch (&b->refcount, 1) == 0)
+    md_body_free (b);
+} /* }}} void md_body_release */
 
-static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
+static void md_index_add (md_body_t *b, int pos) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  unsigned int mask = (unsigned int) (b->index_size - 1);
+  unsigned int i;
 
-  if ((md == NULL) || (e == NULL))
-    return (-EINVAL);
+  for (i = b->entries[pos].key->hash & mask;
+      b->index[i] >= 0;
+      i = (i + 1) & mask)
+    /* do nothing */;
+
+  b->index[i] = pos;
+} /* }}} void md_index_add */
 
-  pthread_mutex_lock (&md->lock);
+/* (Re-)builds the hash index of a body. Small bodies don't have one. The
+ * index is kept at most half full. */
+static int md_index_rebuild (md_body_t *b) /* {{{ */
+{
+  int *index;
+  int size;
+  int i;
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+  if (b->entries_num <= MD_INLINE_NUM)
   {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+    free (b->index);
+    b->index = NULL;
+    b->index_size = 0;
+    return (0);
+  }
+
+  size = 2 * MD_INLINE_NUM;
+  while (size < (2 * b->entries_num))
+    size *= 2;
+
+  if (size != b->index_size)
+  {
+    index = (int *) realloc (b->index, size * sizeof (*index));
+    if (index == NULL)
+      return (-ENOMEM);
+    b->index = index;
+    b->index_size = size;
+  }
+
+  for (i = 0; i < b->index_size; i++)
+    b->index[i] = -1;
+  for (i = 0; i < b->entries_num; i++)
+    md_index_add (b, i);
 
-    prev = this;
-    this = this->next;
+  return (0);
+} /* }}} int md_index_rebuild */
+
+static _Bool md_entry_match (const meta_entry_t *e, /* {{{ */
+    const char *key, unsigned int hash)
+{
+  return ((e->key->hash == hash) && (strcasecmp (key, e->key->name) == 0));
+} /* }}} _Bool md_entry_match */
+
+/* Returns the position of "key" in the entries of "b", or -1. "hash" is the
+ * md_key_hash() of "key". The entries hold references to their keys, so the
+ * keys can be compared without locking the key table. */
+static int md_body_find (const md_body_t *b, const char *key, /* {{{ */
+    unsigned int hash)
+{
+  unsigned int mask;
+  unsigned int i;
+  int pos;
+
+  if (b->index == NULL)
+  {
+    for (pos = 0; pos < b->entries_num; pos++)
+      if (md_entry_match (b->entries + pos, key, hash))
+        return (pos);
+    return (-1);
   }
 
-  if (this == NULL)
+  mask = (unsigned int) (b->index_size - 1);
+  for (i = hash & mask; b->index[i] >= 0; i = (i + 1) & mask)
+    if (md_entry_match (b->entries + b->index[i], key, hash))
+      return (b->index[i]);
+
+  return (-1);
+} /* }}} int md_body_find */
+
+static md_body_t *md_body_copy (const md_body_t *orig) /* {{{ */
+{
+  md_body_t *copy;
+  int i;
+
+  copy = md_body_alloc ();
+  if (copy == NULL)
+    return (NULL);
+
+  if (orig->entries_num > MD_INLINE_NUM)
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
+    copy->entries = (meta_entry_t *) malloc (orig->entries_size
+        * sizeof (*copy->entries));
+    if (copy->entries == NULL)
+    {
+      copy->entries = copy->inline_entries;
+      md_body_free (copy);
+      return (NULL);
+    }
+    copy->entries_size = orig->entries_size;
+  }
+
+  for (i = 0; i < orig->entries_num; i++)
+  {
+    meta_entry_t *e = copy->entries + i;
+
+    *e = orig->entries[i];
+    e->name = NULL;
+    if (e->type == MD_TYPE_STRING)
+      e->value.mv_string = NULL;
+    __sync_add_and_fetch (&e->key->refcount, 1);
+    /* Counted now, so md_body_free cleans up if copying fails. */
+    copy->entries_num = i + 1;
+
+    if (orig->entries[i].name != NULL)
     {
-      assert (prev != NULL);
-      prev->next = e;
+      e->name = md_strdup (orig->entries[i].name);
+      if (e->name == NULL)
+      {
+        md_body_free (copy);
+        return (NULL);
+      }
     }
 
-    e->next = NULL;
+    if (e->type == MD_TYPE_STRING)
+    {
+      e->value.mv_string = md_strdup (orig->entries[i].value.mv_string);
+      if (e->value.mv_string == NULL)
+      {
+        md_body_free (copy);
+        return (NULL);
+      }
+    }
   }
-  else /* (this != NULL) */
+  copy->entries_num = orig->entries_num;
+
+  if (md_index_rebuild (copy) != 0)
+  {
+    md_body_free (copy);
+    return (NULL);
+  }
+
+  return (copy);
+} /* }}} md_body_t *md_body_copy */
+
+/* Makes sure "md" is the only user of its body, copying the body if it is
+ * shared with clones. The write lock on md must be held. */
+static int md_body_unshare (meta_data_t *md) /* {{{ */
+{
+  md_body_t *copy;
+
+  if (md->body->refcount == 1)
+    return (0);
+
+  copy = md_body_copy (md->body);
+  if (copy == NULL)
   {
-    if (prev == NULL)
-      md->head = e;
+    ERROR ("md_body_unshare: md_body_copy failed.");
+    return (-ENOMEM);
+  }
+
+  md_body_release (md->body);
+  md->body = copy;
+
+  return (0);
+} /* }}} int md_body_unshare */
+
+static int md_body_append (md_body_t *b, const meta_entry_t *e) /* {{{ */
+{
+  if (b->entries_num >= b->entries_size)
+  {
+    meta_entry_t *tmp;
+    int new_size = 2 * b->entries_size;
+
+    if (b->entries == b->inline_entries)
+    {
+      tmp = (meta_entry_t *) malloc (new_size * sizeof (*tmp));
+      if (tmp != NULL)
+        memcpy (tmp, b->inline_entries, sizeof (b->inline_entries));
+    }
     else
-      prev->next = e;
+      tmp = (meta_entry_t *) realloc (b->entries, new_size * sizeof (*tmp));
 
-    e->next = this->next;
+    if (tmp == NULL)
+      return (-ENOMEM);
+
+    b->entries = tmp;
+    b->entries_size = new_size;
   }
 
-  pthread_mutex_unlock (&md->lock);
+  b->entries[b->entries_num] = *e;
+  b->entries_num++;
+
+  if (b->entries_num <= MD_INLINE_NUM)
+    return (0);
 
-  if (this != NULL)
+  if ((b->index == NULL) || ((2 * b->entries_num) > b->index_size))
   {
-    this->next = NULL;
-    md_entry_free (this);
+    if (md_index_rebuild (b) != 0)
+    {
+      b->entries_num--;
+      return (-ENOMEM);
+    }
   }
+  else
+    md_index_add (b, b->entries_num - 1);
 
   return (0);
+} /* }}} int md_body_append */
+
+/* Adds or replaces the entry for "key". Like before keys were interned, a
+ * replaced entry takes the spelling of the new key. On success, the entry
+ * takes ownership of string values. */
+static int md_entry_insert (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t value)
+{
+  meta_entry_t e;
+  meta_entry_t old;
+  md_body_t *b;
+  unsigned int hash;
+  int pos;
+  int status;
+
+  memset (&e, 0, sizeof (e));
+  e.type = type;
+  e.value = value;
+  memset (&old, 0, sizeof (old));
+
+  hash = md_key_hash (key);
+
+  pthread_rwlock_wrlock (&md->lock);
+
+  status = md_body_unshare (md);
+  if (status != 0)
+  {
+    pthread_rwlock_unlock (&md->lock);
+    return (status);
+  }
+  b = md->body;
+
+  /* A replaced entry hands its reference to the new entry, so updating a
+   * value touches neither the key table nor the key's reference count. */
+  pos = md_body_find (b, key, hash);
+  if (pos >= 0)
+  {
+    old = b->entries[pos];
+    e.key = old.key;
+    old.key = NULL;
+  }
+  else
+  {
+    e.key = md_key_intern (key, hash);
+    if (e.key == NULL)
+    {
+      pthread_rwlock_unlock (&md->lock);
+      return (-ENOMEM);
+    }
+  }
+
+  if (strcmp (key, e.key->name) != 0)
+  {
+    e.name = md_strdup (key);
+    if (e.name == NULL)
+    {
+      pthread_rwlock_unlock (&md->lock);
+      /* A replaced entry still holds the reference. */
+      if (pos < 0)
+        md_key_release (e.key);
+      return (-ENOMEM);
+    }
+  }
+
+  if (pos >= 0)
+  {
+    b->entries[pos] = e;
+    pthread_rwlock_unlock (&md->lock);
+
+    md_entry_clear (&old);
+    return (0);
+  }
+
+  status = md_body_append (b, &e);
+  pthread_rwlock_unlock (&md->lock);
+
+  if (status != 0)
+  {
+    ERROR ("md_entry_insert: md_body_append failed.");
+    free (e.name);
+    md_key_release (e.key);
+  }
+  return (status);
 } /* }}} int md_entry_insert */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
-    const char *key)
+/* Returns the position of "key" in md's body, or -1. The lock on md must be
+ * held. */
+static int md_entry_lookup (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  return (md_body_find (md->body, key, md_key_hash (key)));
+} /* }}} int md_entry_lookup */
 
-  if ((md == NULL) || (key == NULL))
-    return (NULL);
+/* Copies the value of "key" to "value" if it has type "type". String values
+ * are duplicated. */
+static int md_entry_get (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t *value, const char *func)
+{
+  const meta_entry_t *e;
+  int pos;
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp (key, e->key) == 0)
-      break;
+  if ((md == NULL) || (key == NULL) || (value == NULL))
+    return (-EINVAL);
+
+  pthread_rwlock_rdlock (&md->lock);
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_lookup */
+  pos = md_entry_lookup (md, key);
+  if (pos < 0)
+  {
+    pthread_rwlock_unlock (&md->lock);
+    return (-ENOENT);
+  }
+  e = md->body->entries + pos;
+
+  if (e->type != type)
+  {
+    ERROR ("%s: Type mismatch for key `%s'", func, md_entry_name (e));
+    pthread_rwlock_unlock (&md->lock);
+    return (-ENOENT);
+  }
+
+  if (type == MD_TYPE_STRING)
+  {
+    value->mv_string = md_strdup (e->value.mv_string);
+    if (value->mv_string == NULL)
+    {
+      pthread_rwlock_unlock (&md->lock);
+      ERROR ("%s: md_strdup failed.", func);
+      return (-ENOMEM);
+    }
+  }
+  else
+    *value = e->value;
+
+  pthread_rwlock_unlock (&md->lock);
+  return (0);
+} /* }}} int md_entry_get */
 
 /*
  * Public functions
@@ -221,12 +672,19 @@ meta_data_t *meta_data_create (void) /* {{{ */
   }
   memset (md, 0, sizeof (*md));
 
-  md->head = NULL;
-  pthread_mutex_init (&md->lock, /* attr = */ NULL);
+  md->body = md_body_alloc ();
+  if (md->body == NULL)
+  {
+    ERROR ("meta_data_create: md_body_alloc failed.");
+    free (md);
+    return (NULL);
+  }
+  pthread_rwlock_init (&md->lock, /* attr = */ NULL);
 
   return (md);
 } /* }}} meta_data_t *meta_data_create */
 
+/* The clone shares the body of "orig" until one of them is modified. */
 meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
 {
   meta_data_t *copy;
@@ -234,13 +692,19 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
   if (orig == NULL)
     return (NULL);
 
-  copy = meta_data_create ();
+  copy = (meta_data_t *) malloc (sizeof (*copy));
   if (copy == NULL)
+  {
+    ERROR ("meta_data_clone: malloc failed.");
     return (NULL);
+  }
+  memset (copy, 0, sizeof (*copy));
+  pthread_rwlock_init (&copy->lock, /* attr = */ NULL);
 
-  pthread_mutex_lock (&orig->lock);
-  copy->head = md_entry_clone (orig->head);
-  pthread_mutex_unlock (&orig->lock);
+  pthread_rwlock_rdlock (&orig->lock);
+  copy->body = orig->body;
+  __sync_add_and_fetch (&copy->body->refcount, 1);
+  pthread_rwlock_unlock (&orig->lock);
 
   return (copy);
 } /* }}} meta_data_t *meta_data_clone */
@@ -250,214 +714,184 @@ void meta_data_destroy (meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  pthread_mutex_destroy(&md->lock);
-  md_entry_free (md->head);
-  pthread_mutex_destroy (&md->lock);
+  md_body_release (md->body);
+  pthread_rwlock_destroy (&md->lock);
   free (md);
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int pos;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
+  pthread_rwlock_rdlock (&md->lock);
+  pos = md_entry_lookup (md, key);
+  pthread_rwlock_unlock (&md->lock);
 
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return (1);
-    }
-  }
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return ((pos >= 0) ? 1 : 0);
 } /* }}} int meta_data_exists */
 
 int meta_data_type (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int pos;
+  int type = 0;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return e->type;
-    }
-  }
+  pthread_rwlock_rdlock (&md->lock);
+  pos = md_entry_lookup (md, key);
+  if (pos >= 0)
+    type = md->body->entries[pos].type;
+  pthread_rwlock_unlock (&md->lock);
 
-  pthread_mutex_unlock (&md->lock);
-  return 0;
+  return type;
 } /* }}} int meta_data_type */
 
 int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
-  meta_entry_t *e;
+  int i, count;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-    ++count;    
+  pthread_rwlock_rdlock (&md->lock);
 
+  count = md->body->entries_num;
   *toc = malloc(count * sizeof(**toc));
-  for (e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
-  
-  pthread_mutex_unlock (&md->lock);
+  for (i = 0; i < count; i++)
+    (*toc)[i] = strdup(md_entry_name (md->body->entries + i));
+
+  pthread_rwlock_unlock (&md->lock);
   return count;
 } /* }}} int meta_data_toc */
 
 int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  md_body_t *b;
+  meta_entry_t e;
+  int pos;
+  int status;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
+  pthread_rwlock_wrlock (&md->lock);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+  pos = md_entry_lookup (md, key);
+  if (pos < 0)
   {
-    if (strcasecmp (key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
+    pthread_rwlock_unlock (&md->lock);
+    return (-ENOENT);
   }
 
-  if (this == NULL)
+  status = md_body_unshare (md);
+  if (status != 0)
   {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
+    pthread_rwlock_unlock (&md->lock);
+    return (status);
   }
+  b = md->body;
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
+  e = b->entries[pos];
+  memmove (b->entries + pos, b->entries + pos + 1,
+      (b->entries_num - (pos + 1)) * sizeof (*b->entries));
+  b->entries_num--;
 
-  pthread_mutex_unlock (&md->lock);
+  /* Shrinking only ever needs less memory, so this can't fail. */
+  md_index_rebuild (b);
 
-  this->next = NULL;
-  md_entry_free (this);
+  pthread_rwlock_unlock (&md->lock);
+
+  md_entry_clear (&e);
 
   return (0);
 } /* }}} int meta_data_delete */
 
+/* Frees the keys which are no longer used by any object. */
+void meta_data_shutdown (void) /* {{{ */
+{
+  pthread_rwlock_wrlock (&md_keys_lock);
+  md_keys_sweep ();
+  if (md_keys_num != 0)
+    DEBUG ("meta_data_shutdown: %zu keys are still in use.", md_keys_num);
+  pthread_rwlock_unlock (&md_keys_lock);
+} /* }}} void meta_data_shutdown */
+
 /*
  * Add functions
  */
 int meta_data_add_string (meta_data_t *md, /* {{{ */
     const char *key, const char *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_string = md_strdup (value);
-  if (e->value.mv_string == NULL)
+  v.mv_string = md_strdup (value);
+  if (v.mv_string == NULL)
   {
     ERROR ("meta_data_add_string: md_strdup failed.");
-    md_entry_free (e);
     return (-ENOMEM);
   }
-  e->type = MD_TYPE_STRING;
 
-  return (md_entry_insert (md, e));
+  status = md_entry_insert (md, key, MD_TYPE_STRING, v);
+  if (status != 0)
+    free (v.mv_string);
+
+  return (status);
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  v.mv_signed_int = value;
+  return (md_entry_insert (md, key, MD_TYPE_SIGNED_INT, v));
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  v.mv_unsigned_int = value;
+  return (md_entry_insert (md, key, MD_TYPE_UNSIGNED_INT, v));
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double (meta_data_t *md, /* {{{ */
     const char *key, double value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
-
-  return (md_entry_insert (md, e));
+  v.mv_double = value;
+  return (md_entry_insert (md, key, MD_TYPE_DOUBLE, v));
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return (md_entry_insert (md, e));
+  v.mv_boolean = value;
+  return (md_entry_insert (md, key, MD_TYPE_BOOLEAN, v));
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -466,161 +900,86 @@ int meta_data_add_boolean (meta_data_t *md, /* {{{ */
 int meta_data_get_string (meta_data_t *md, /* {{{ */
     const char *key, char **value)
 {
-  meta_entry_t *e;
-  char *temp;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_STRING)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  temp = md_strdup (e->value.mv_string);
-  if (temp == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    ERROR ("meta_data_get_string: md_strdup failed.");
-    return (-ENOMEM);
-  }
- 
-  pthread_mutex_unlock (&md->lock);
-
-  *value = temp;
+  status = md_entry_get (md, key, MD_TYPE_STRING, &v,
+      "meta_data_get_string");
+  if (status == 0)
+    *value = v.mv_string;
 
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_string */
 
 int meta_data_get_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
+  status = md_entry_get (md, key, MD_TYPE_SIGNED_INT, &v,
+      "meta_data_get_signed_int");
+  if (status == 0)
+    *value = v.mv_signed_int;
 
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_SIGNED_INT)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_signed_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_signed_int */
 
 int meta_data_get_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_UNSIGNED_INT)
-  {
-    ERROR ("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_UNSIGNED_INT, &v,
+      "meta_data_get_unsigned_int");
+  if (status == 0)
+    *value = v.mv_unsigned_int;
 
-  *value = e->value.mv_unsigned_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_unsigned_int */
 
 int meta_data_get_double (meta_data_t *md, /* {{{ */
     const char *key, double *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_DOUBLE, &v,
+      "meta_data_get_double");
+  if (status == 0)
+    *value = v.mv_double;
 
-  if (e->type != MD_TYPE_DOUBLE)
-  {
-    ERROR ("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_double;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_double */
 
 int meta_data_get_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_BOOLEAN)
-  {
-    ERROR ("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_boolean;
+  status = md_entry_get (md, key, MD_TYPE_BOOLEAN, &v,
+      "meta_data_get_boolean");
+  if (status == 0)
+    *value = v.mv_boolean;
 
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_boolean */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
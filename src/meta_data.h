@@ -45,6 +45,10 @@ int meta_data_type (meta_data_t *md, const char *key);
 int meta_data_toc (meta_data_t *md, char ***toc);
 int meta_data_delete (meta_data_t *md, const char *key);
 
+/* Frees internal data which isn't used by any object anymore. Called when
+ * the daemon shuts down. */
+void meta_data_shutdown (void);
+
 int meta_data_add_string (meta_data_t *md,
     const char *key,
     const char *value);
@@ -313,15 +313,15 @@ static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
  */
 static _Bool check_receive_okay (const value_list_t *vl) /* {{{ */
 {
-  uint64_t time_sent = 0;
+  cdtime_t last_time = 0;
   int status;
 
-  status = uc_meta_data_get_unsigned_int (vl,
-      "network:time_sent", &time_sent);
-
-  /* This is a value we already sent. Don't allow it to be received again in
-   * order to avoid looping. */
-  if ((status == 0) && (time_sent >= ((uint64_t) vl->time)))
+  /* Every value this daemon has sent has been dispatched locally before, so
+   * the cache already holds a value at least as new. Don't allow such a
+   * value to be received again in order to avoid looping. Looking at the
+   * cache here means the send path doesn't need to record anything. */
+  status = uc_get_last_time (vl, &last_time);
+  if ((status == 0) && (last_time >= vl->time))
     return (0);
 
   return (1);
@@ -2760,9 +2760,6 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	  return (0);
 	}
 
-	uc_meta_data_add_unsigned_int (vl,
-	    "network:time_sent", (uint64_t) vl->time);
-
 	pthread_mutex_lock (&send_buffer_lock);
 
 	status = add_to_buffer (send_buffer_ptr,
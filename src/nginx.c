@@ -26,6 +26,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl.h"
 
 #include <curl/curl.h>
 
@@ -35,6 +36,7 @@ static char *pass        = NULL;
 static char *verify_peer = NULL;
 static char *verify_host = NULL;
 static char *cacert      = NULL;
+static cdtime_t timeout  = 0;
 
 static CURL *curl = NULL;
 
@@ -49,7 +51,8 @@ static const char *config_keys[] =
   "Password",
   "VerifyPeer",
   "VerifyHost",
-  "CACert"
+  "CACert",
+  "Timeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -103,6 +106,14 @@ static int config (const char *key, const char *value)
     return (config_set (&verify_host, value));
   else if (strcasecmp (key, "cacert") == 0)
     return (config_set (&cacert, value));
+  else if (strcasecmp (key, "timeout") == 0)
+  {
+    double tmp = atof (value);
+    if (tmp < 0.0)
+      return (1);
+    timeout = DOUBLE_TO_CDTIME_T (tmp);
+    return (0);
+  }
   else
     return (-1);
 } /* int config */
@@ -196,7 +207,9 @@ static void submit (char *type, char *inst, long long value)
   plugin_dispatch_values (&vl);
 } /* void submit */
 
-static int nginx_read (void)
+/* Called by the curl engine when the status page has been fetched. */
+static void nginx_read_done (CURL __attribute__((unused)) *handle,
+    CURLcode status, void __attribute__((unused)) *user_data)
 {
   int i;
 
@@ -208,16 +221,13 @@ static int nginx_read (void)
   char *fields[16];
   int   fields_num;
 
-  if (curl == NULL)
-    return (-1);
-  if (url == NULL)
-    return (-1);
-
-  nginx_buffer_len = 0;
-  if (curl_easy_perform (curl) != 0)
+  if (status == CURLE_ABORTED_BY_CALLBACK)
+    return;
+  else if (status != CURLE_OK)
   {
-    WARNING ("nginx plugin: curl_easy_perform failed: %s", nginx_curl_error);
-    return (-1);
+    WARNING ("nginx plugin: Fetching the status page failed: %s",
+        nginx_curl_error);
+    return;
   }
 
   ptr = nginx_buffer;
@@ -270,15 +280,53 @@ static int nginx_read (void)
   }
 
   nginx_buffer_len = 0;
+} /* void nginx_read_done */
+
+static int nginx_read (void)
+{
+  int status;
+
+  if (curl == NULL)
+    return (-1);
+  if (url == NULL)
+    return (-1);
+
+  if (ucurl_busy (curl))
+  {
+    WARNING ("nginx plugin: The status page is still being fetched. "
+        "Skipping this interval.");
+    return (0);
+  }
+
+  nginx_buffer_len = 0;
+  nginx_buffer[0] = 0;
+  status = ucurl_submit (curl, timeout, nginx_read_done, /* user_data = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("nginx plugin: ucurl_submit failed.");
+    return (-1);
+  }
 
   return (0);
 } /* int nginx_read */
 
+static int nginx_shutdown (void)
+{
+  ucurl_shutdown ();
+
+  if (curl != NULL)
+    curl_easy_cleanup (curl);
+  curl = NULL;
+
+  return (0);
+} /* int nginx_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("nginx", config, config_keys, config_keys_num);
   plugin_register_init ("nginx", init);
   plugin_register_read ("nginx", nginx_read);
+  plugin_register_shutdown ("nginx", nginx_shutdown);
 } /* void module_register */
 
 /*
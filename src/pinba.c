@@ -23,10 +23,14 @@
  *   Florian Forster <octo at verplant.org>
  **/
 
+/* For recvmmsg(2) */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_latency.h"
 
 #include <pthread.h>
 #include <sys/socket.h>
@@ -54,6 +58,17 @@
 # define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Number of packets received with one call of recvmmsg(2). */
+#ifndef PINBA_RECV_BATCH
+# define PINBA_RECV_BATCH 16
+#endif
+
+/* Bits of pinba_view_key_t.mask: the fields a view selects. */
+#define PINBA_VIEW_HOST   0x01
+#define PINBA_VIEW_SERVER 0x02
+#define PINBA_VIEW_SCRIPT 0x04
+#define PINBA_VIEW_MASKS  8
+
 /*
  * Private data structures
  */
@@ -73,6 +88,22 @@ struct float_counter_s
 };
 typedef struct float_counter_s float_counter_t;
 
+/* Data of one view received by one thread since the last read. */
+struct pinba_accum_s
+{
+  derive_t req_count;
+
+  float_counter_t req_time;
+  float_counter_t ru_utime;
+  float_counter_t ru_stime;
+
+  derive_t doc_size;
+  gauge_t mem_peak;
+
+  latency_histogram_t req_time_hist; /* us */
+};
+typedef struct pinba_accum_s pinba_accum_t;
+
 struct pinba_statnode_s
 {
   /* collector name, used as plugin instance */
@@ -83,6 +114,7 @@ struct pinba_statnode_s
   char *server;
   char *script;
 
+  /* Totals, only updated by plugin_read(). */
   derive_t req_count;
 
   float_counter_t req_time;
@@ -91,8 +123,42 @@ struct pinba_statnode_s
 
   derive_t doc_size;
   gauge_t mem_peak;
+
+  /* Request times of the last interval, in microseconds */
+  latency_histogram_t req_time_hist;
 };
 typedef struct pinba_statnode_s pinba_statnode_t;
+
+/* Entry of the hash table used to find the views matching a request. Views
+ * selecting the same values are stored in the same entry. */
+struct pinba_view_key_s;
+typedef struct pinba_view_key_s pinba_view_key_t;
+struct pinba_view_key_s
+{
+  int mask;
+  const char *host;
+  const char *server;
+  const char *script;
+
+  unsigned int *nodes;
+  size_t nodes_num;
+
+  pinba_view_key_t *next;
+};
+
+/* A receiving thread. The thread holds "lock" while updating "accum";
+ * plugin_read() swaps "accum" and "spare", so the thread can continue while
+ * the data is being submitted. */
+struct pinba_thread_s
+{
+  pthread_t id;
+  _Bool running;
+
+  pthread_mutex_t lock;
+  pinba_accum_t *accum;
+  pinba_accum_t *spare;
+};
+typedef struct pinba_thread_s pinba_thread_t;
 /* }}} */
 
 /*
@@ -101,14 +167,20 @@ typedef struct pinba_statnode_s pinba_statnode_t;
 /* {{{ */
 static pinba_statnode_t *stat_nodes = NULL;
 static unsigned int stat_nodes_num = 0;
-static pthread_mutex_t stat_nodes_lock;
+
+/* Index of "stat_nodes", built by plugin_init() and read-only afterwards. */
+static pinba_view_key_t **view_table = NULL;
+static size_t view_table_size = 0;
+static int view_masks_used = 0;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+static int conf_threads = 1;
+static char *conf_replay_file = NULL;
 
-static _Bool collector_thread_running = 0;
+static pinba_thread_t *threads = NULL;
+static size_t threads_num = 0;
 static _Bool collector_thread_do_shutdown = 0;
-static pthread_t collector_thread_id;
 /* }}} */
 
 /*
@@ -135,6 +207,20 @@ static void float_counter_add (float_counter_t *fc, float val) /* {{{ */
   }
 } /* }}} void float_counter_add */
 
+static void float_counter_merge (float_counter_t *dst, /* {{{ */
+    const float_counter_t *src)
+{
+  dst->i += src->i;
+  dst->n += src->n;
+
+  if (dst->n >= 1000000000)
+  {
+    dst->i += 1;
+    dst->n -= 1000000000;
+    assert (dst->n < 1000000000);
+  }
+} /* }}} void float_counter_merge */
+
 static derive_t float_counter_get (const float_counter_t *fc, /* {{{ */
     uint64_t factor)
 {
@@ -198,38 +284,153 @@ static void service_statnode_add(const char *name, /* {{{ */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
-/* Copy the data from the global "stat_nodes" list into the buffer pointed to
- * by "res", doing the derivation in the process. Returns the next index or
- * zero if the end of the list has been reached. */
-static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
-    unsigned int index)
+/* FNV-1a hash of the fields of a request selected by "mask". */
+static uint32_t view_hash (int mask, const char *host, /* {{{ */
+    const char *server, const char *script)
 {
-  pinba_statnode_t *node;
-  
-  if (stat_nodes_num == 0)
-    return 0;
-  
-  /* begin collecting */
-  if (index == 0)
-    pthread_mutex_lock (&stat_nodes_lock);
-  
-  /* end collecting */
-  if (index >= stat_nodes_num)
+  const char *fields[3] = { host, server, script };
+  uint32_t hash = 2166136261U;
+  int i;
+
+  hash = (hash ^ ((uint32_t) mask)) * 16777619U;
+
+  for (i = 0; i < 3; i++)
   {
-    pthread_mutex_unlock (&stat_nodes_lock);
-    return 0;
+    const unsigned char *ptr;
+
+    if ((mask & (1 << i)) == 0)
+      continue;
+
+    for (ptr = (const unsigned char *) fields[i]; *ptr != 0; ptr++)
+      hash = (hash ^ ((uint32_t) *ptr)) * 16777619U;
+    /* Separate the fields, so "ab" + "c" differs from "a" + "bc". */
+    hash = (hash ^ 0xff) * 16777619U;
   }
 
-  node = stat_nodes + index;
-  memcpy (res, node, sizeof (*res));
+  return (hash);
+} /* }}} uint32_t view_hash */
 
-  /* reset node */
-  node->mem_peak = NAN;
-  
-  return (index + 1);
-} /* }}} unsigned int service_statnode_collect */
+static _Bool view_key_equal (const pinba_view_key_t *key, /* {{{ */
+    int mask, const char *host, const char *server, const char *script)
+{
+  if (key->mask != mask)
+    return (0);
+  if ((mask & PINBA_VIEW_HOST) && (strcmp (key->host, host) != 0))
+    return (0);
+  if ((mask & PINBA_VIEW_SERVER) && (strcmp (key->server, server) != 0))
+    return (0);
+  if ((mask & PINBA_VIEW_SCRIPT) && (strcmp (key->script, script) != 0))
+    return (0);
+  return (1);
+} /* }}} _Bool view_key_equal */
+
+static int view_mask (const pinba_statnode_t *node) /* {{{ */
+{
+  int mask = 0;
+
+  if (node->host != NULL)
+    mask |= PINBA_VIEW_HOST;
+  if (node->server != NULL)
+    mask |= PINBA_VIEW_SERVER;
+  if (node->script != NULL)
+    mask |= PINBA_VIEW_SCRIPT;
+
+  return (mask);
+} /* }}} int view_mask */
+
+static void view_table_free (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < view_table_size; i++)
+  {
+    pinba_view_key_t *key = view_table[i];
+
+    while (key != NULL)
+    {
+      pinba_view_key_t *next = key->next;
+
+      sfree (key->nodes);
+      sfree (key);
+      key = next;
+    }
+  }
 
-static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
+  sfree (view_table);
+  view_table_size = 0;
+  view_masks_used = 0;
+} /* }}} void view_table_free */
+
+/* Builds the hash table used by service_process_request(). Views which don't
+ * select all fields are stored under the hash of the fields they do select,
+ * so a request is looked up once for each combination of fields in use. */
+static int view_table_create (void) /* {{{ */
+{
+  unsigned int i;
+
+  view_table_size = 16;
+  while (view_table_size < (2 * stat_nodes_num))
+    view_table_size *= 2;
+
+  view_table = calloc (view_table_size, sizeof (*view_table));
+  if (view_table == NULL)
+  {
+    ERROR ("pinba plugin: calloc failed.");
+    view_table_size = 0;
+    return (-1);
+  }
+
+  for (i = 0; i < stat_nodes_num; i++)
+  {
+    pinba_statnode_t *node = stat_nodes + i;
+    pinba_view_key_t *key;
+    unsigned int *tmp;
+    int mask = view_mask (node);
+    size_t bucket;
+
+    bucket = view_hash (mask, node->host, node->server, node->script)
+      & (view_table_size - 1);
+
+    for (key = view_table[bucket]; key != NULL; key = key->next)
+      if (view_key_equal (key, mask, node->host, node->server, node->script))
+        break;
+
+    if (key == NULL)
+    {
+      key = calloc (1, sizeof (*key));
+      if (key == NULL)
+      {
+        ERROR ("pinba plugin: calloc failed.");
+        view_table_free ();
+        return (-1);
+      }
+      key->mask = mask;
+      key->host = node->host;
+      key->server = node->server;
+      key->script = node->script;
+
+      key->next = view_table[bucket];
+      view_table[bucket] = key;
+    }
+
+    tmp = realloc (key->nodes, (key->nodes_num + 1) * sizeof (*key->nodes));
+    if (tmp == NULL)
+    {
+      ERROR ("pinba plugin: realloc failed.");
+      view_table_free ();
+      return (-1);
+    }
+    key->nodes = tmp;
+    key->nodes[key->nodes_num] = i;
+    key->nodes_num++;
+
+    view_masks_used |= 1 << mask;
+  }
+
+  return (0);
+} /* }}} int view_table_create */
+
+static void service_statnode_process (pinba_accum_t *node, /* {{{ */
     Pinba__Request* request)
 {
   node->req_count++;
@@ -244,33 +445,77 @@ static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
       || (node->mem_peak < ((gauge_t) request->memory_peak)))
     node->mem_peak = (gauge_t) request->memory_peak;
 
+  if (request->request_time >= 0.0)
+    latency_hist_add (&node->req_time_hist, (uint64_t)
+        ((((double) request->request_time) * 1000000.0) + .5));
 } /* }}} void service_statnode_process */
 
-static void service_process_request (Pinba__Request *request) /* {{{ */
+/* Adds the request to the views it matches. Must be called with the lock of
+ * the thread owning "accum" held. */
+static void service_process_request (pinba_accum_t *accum, /* {{{ */
+    Pinba__Request *request)
+{
+  int mask;
+
+  for (mask = 0; mask < PINBA_VIEW_MASKS; mask++)
+  {
+    pinba_view_key_t *key;
+    size_t bucket;
+    size_t i;
+
+    if ((view_masks_used & (1 << mask)) == 0)
+      continue;
+
+    bucket = view_hash (mask, request->hostname, request->server_name,
+        request->script_name) & (view_table_size - 1);
+
+    for (key = view_table[bucket]; key != NULL; key = key->next)
+    {
+      if (!view_key_equal (key, mask, request->hostname,
+            request->server_name, request->script_name))
+        continue;
+
+      for (i = 0; i < key->nodes_num; i++)
+        service_statnode_process (accum + key->nodes[i], request);
+      break;
+    }
+  }
+} /* }}} void service_process_request */
+
+static void accum_reset (pinba_accum_t *accum) /* {{{ */
+{
+  unsigned int i;
+
+  memset (accum, 0, stat_nodes_num * sizeof (*accum));
+  for (i = 0; i < stat_nodes_num; i++)
+    accum[i].mem_peak = NAN;
+} /* }}} void accum_reset */
+
+/* Adds the data received by one thread to the totals in "stat_nodes". */
+static void service_statnode_merge (const pinba_accum_t *accum) /* {{{ */
 {
   unsigned int i;
 
-  pthread_mutex_lock (&stat_nodes_lock);
-  
   for (i = 0; i < stat_nodes_num; i++)
   {
-    if ((stat_nodes[i].host != NULL)
-        && (strcmp (request->hostname, stat_nodes[i].host) != 0))
-      continue;
+    pinba_statnode_t *node = stat_nodes + i;
+    const pinba_accum_t *a = accum + i;
 
-    if ((stat_nodes[i].server != NULL)
-      && (strcmp (request->server_name, stat_nodes[i].server) != 0))
+    if (a->req_count == 0)
       continue;
 
-    if ((stat_nodes[i].script != NULL)
-      && (strcmp (request->script_name, stat_nodes[i].script) != 0))
-      continue;
+    node->req_count += a->req_count;
+    float_counter_merge (&node->req_time, &a->req_time);
+    float_counter_merge (&node->ru_utime, &a->ru_utime);
+    float_counter_merge (&node->ru_stime, &a->ru_stime);
+    node->doc_size += a->doc_size;
+
+    if (isnan (node->mem_peak) || (node->mem_peak < a->mem_peak))
+      node->mem_peak = a->mem_peak;
 
-    service_statnode_process(&stat_nodes[i], request);
+    latency_hist_merge (&node->req_time_hist, &a->req_time_hist);
   }
-  
-  pthread_mutex_unlock(&stat_nodes_lock);
-} /* }}} void service_process_request */
+} /* }}} void service_statnode_merge */
 
 static int pb_del_socket (pinba_socket_t *s, /* {{{ */
     nfds_t index)
@@ -325,6 +570,22 @@ static int pb_add_socket (pinba_socket_t *s, /* {{{ */
         sstrerror (errno, errbuf, sizeof (errbuf)));
   }
 
+#ifdef SO_REUSEPORT
+  /* Every receiving thread binds its own sockets to the address; the kernel
+   * distributes the packets among them. */
+  if (conf_threads > 1)
+  {
+    tmp = 1;
+    status = setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &tmp, sizeof (tmp));
+    if (status != 0)
+    {
+      char errbuf[1024];
+      WARNING ("pinba plugin: setsockopt(SO_REUSEPORT) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+  }
+#endif
+
   status = bind (fd, ai->ai_addr, ai->ai_addrlen);
   if (status != 0)
   {
@@ -422,8 +683,8 @@ static void pinba_socket_free (pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
-    size_t buffer_size)
+static int pinba_process_stats_packet (pinba_accum_t *accum, /* {{{ */
+    const uint8_t *buffer, size_t buffer_size)
 {
   Pinba__Request *request;  
   
@@ -432,34 +693,91 @@ static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
   if (!request)
     return (-1);
 
-  service_process_request(request);
+  service_process_request (accum, request);
   pinba__request__free_unpacked (request, NULL);
     
   return (0);
 } /* }}} int pinba_process_stats_packet */
 
-static int pinba_udp_read_callback_fn (int sock) /* {{{ */
+#if HAVE_RECVMMSG
+/* Receives up to PINBA_RECV_BATCH packets with one system call. */
+static int pinba_udp_read_callback_fn (pinba_thread_t *t, int sock, /* {{{ */
+    uint8_t *buffer)
+{
+  struct mmsghdr msgs[PINBA_RECV_BATCH];
+  struct iovec iovs[PINBA_RECV_BATCH];
+  int status;
+  int i;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < PINBA_RECV_BATCH; i++)
+  {
+    iovs[i].iov_base = buffer + (i * PINBA_UDP_BUFFER_SIZE);
+    iovs[i].iov_len = PINBA_UDP_BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (42)
+  {
+    status = recvmmsg (sock, msgs, PINBA_RECV_BATCH, MSG_DONTWAIT,
+        /* timeout = */ NULL);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN)
+#ifdef EWOULDBLOCK
+          || (errno == EWOULDBLOCK)
+#endif
+         )
+        return (0);
+
+      WARNING("pinba plugin: recvmmsg(2) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    break;
+  } /* while (42) */
+
+  pthread_mutex_lock (&t->lock);
+  for (i = 0; i < status; i++)
+  {
+    if (pinba_process_stats_packet (t->accum, iovs[i].iov_base,
+          (size_t) msgs[i].msg_len) != 0)
+      DEBUG("pinba plugin: Parsing packet failed.");
+  }
+  pthread_mutex_unlock (&t->lock);
+
+  return (0);
+} /* }}} int pinba_udp_read_callback_fn */
+/* #endif HAVE_RECVMMSG */
+
+#else /* if !HAVE_RECVMMSG */
+static int pinba_udp_read_callback_fn (pinba_thread_t *t, int sock, /* {{{ */
+    uint8_t *buffer)
 {
-  uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
   size_t buffer_size;
   int status;
 
   while (42)
   {
-    buffer_size = sizeof (buffer);
+    buffer_size = PINBA_UDP_BUFFER_SIZE;
     status = recvfrom (sock, buffer, buffer_size - 1, MSG_DONTWAIT, /* from = */ NULL, /* from len = */ 0);
     if (status < 0)
     {
       char errbuf[1024];
 
-      if ((errno == EINTR)
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN)
 #ifdef EWOULDBLOCK
           || (errno == EWOULDBLOCK)
 #endif
-          || (errno == EAGAIN))
-      {
-        continue;
-      }
+         )
+        return (0);
 
       WARNING("pinba plugin: recvfrom(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
@@ -476,7 +794,9 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
       buffer_size = (size_t) status;
       buffer[buffer_size] = 0;
 
-      status = pinba_process_stats_packet (buffer, buffer_size);
+      pthread_mutex_lock (&t->lock);
+      status = pinba_process_stats_packet (t->accum, buffer, buffer_size);
+      pthread_mutex_unlock (&t->lock);
       if (status != 0)
         DEBUG("pinba plugin: Parsing packet failed.");
       return (status);
@@ -486,16 +806,30 @@ static int pinba_udp_read_callback_fn (int sock) /* {{{ */
   /* not reached */
   assert (23 == 42);
   return (-1);
-} /* }}} void pinba_udp_read_callback_fn */
+} /* }}} int pinba_udp_read_callback_fn */
+#endif /* !HAVE_RECVMMSG */
 
-static int receive_loop (void) /* {{{ */
+static int receive_loop (pinba_thread_t *t) /* {{{ */
 {
   pinba_socket_t *s;
+  uint8_t *buffer;
+
+#if HAVE_RECVMMSG
+  buffer = malloc (PINBA_RECV_BATCH * PINBA_UDP_BUFFER_SIZE);
+#else
+  buffer = malloc (PINBA_UDP_BUFFER_SIZE);
+#endif
+  if (buffer == NULL)
+  {
+    ERROR ("pinba plugin: malloc failed.");
+    return (-1);
+  }
 
   s = pinba_socket_open (conf_node, conf_service);
   if (s == NULL)
   {
     ERROR ("pinba plugin: Collector thread is exiting prematurely.");
+    sfree (buffer);
     return (-1);
   }
 
@@ -522,6 +856,7 @@ static int receive_loop (void) /* {{{ */
       ERROR ("pinba plugin: poll(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
       pinba_socket_free (s);
+      sfree (buffer);
       return (-1);
     }
 
@@ -534,23 +869,91 @@ static int receive_loop (void) /* {{{ */
       }
       else if (s->fd[i].revents & (POLLIN | POLLPRI))
       {
-        pinba_udp_read_callback_fn (s->fd[i].fd);
+        pinba_udp_read_callback_fn (t, s->fd[i].fd, buffer);
       }
     } /* for (s->fd) */
   } /* while (!collector_thread_do_shutdown) */
 
   pinba_socket_free (s);
   s = NULL;
+  sfree (buffer);
 
   return (0);
 } /* }}} int receive_loop */
 
+/* Reads packets from "conf_replay_file" instead of the network, so the
+ * throughput of the plugin can be measured with reproducible input. Every
+ * packet is preceded by its size, a 32 bit integer in network byte order. */
+static int replay_loop (pinba_thread_t *t) /* {{{ */
+{
+  FILE *fh;
+  uint8_t *buffer;
+  uint64_t packets_num = 0;
+  uint64_t errors_num = 0;
+  cdtime_t start;
+  double duration;
+
+  fh = fopen (conf_replay_file, "r");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("pinba plugin: Opening \"%s\" failed: %s", conf_replay_file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  buffer = malloc (PINBA_UDP_BUFFER_SIZE);
+  if (buffer == NULL)
+  {
+    ERROR ("pinba plugin: malloc failed.");
+    fclose (fh);
+    return (-1);
+  }
+
+  start = cdtime ();
+  while (!collector_thread_do_shutdown)
+  {
+    uint32_t size;
+
+    if (fread (&size, sizeof (size), 1, fh) != 1)
+      break;
+    size = ntohl (size);
+    if (size > PINBA_UDP_BUFFER_SIZE)
+    {
+      ERROR ("pinba plugin: Packet in \"%s\" is too large (%"PRIu32" bytes).",
+          conf_replay_file, size);
+      break;
+    }
+    if (fread (buffer, 1, size, fh) != size)
+      break;
+
+    pthread_mutex_lock (&t->lock);
+    if (pinba_process_stats_packet (t->accum, buffer, size) != 0)
+      errors_num++;
+    pthread_mutex_unlock (&t->lock);
+    packets_num++;
+  }
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+
+  INFO ("pinba plugin: Read %"PRIu64" packets (%"PRIu64" invalid) from "
+      "\"%s\" in %.3f seconds (%.0f packets per second).",
+      packets_num, errors_num, conf_replay_file, duration,
+      (duration > 0.0) ? (((double) packets_num) / duration) : 0.0);
+
+  sfree (buffer);
+  fclose (fh);
+  return (0);
+} /* }}} int replay_loop */
+
 static void *collector_thread (void *arg) /* {{{ */
 {
-  receive_loop ();
+  pinba_thread_t *t = arg;
+
+  if (conf_replay_file != NULL)
+    replay_loop (t);
+  else
+    receive_loop (t);
 
-  memset (&collector_thread_id, 0, sizeof (collector_thread_id));
-  collector_thread_running = 0;
   pthread_exit (NULL);
   return (NULL);
 } /* }}} void *collector_thread */
@@ -606,10 +1009,6 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
 {
   int i;
   
-  /* The lock should not be necessary in the config callback, but let's be
-   * sure.. */
-  pthread_mutex_lock (&stat_nodes_lock);
-
   for (i = 0; i < ci->children_num; i++)
   {
     oconfig_item_t *child = ci->children + i;
@@ -618,20 +1017,32 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
       cf_util_get_string (child, &conf_node);
     else if (strcasecmp ("Port", child->key) == 0)
       cf_util_get_service (child, &conf_service);
+    else if (strcasecmp ("Threads", child->key) == 0)
+    {
+      int tmp = conf_threads;
+      if ((cf_util_get_int (child, &tmp) != 0) || (tmp < 1))
+        WARNING ("pinba plugin: The \"Threads\" option requires a positive "
+            "integer.");
+      else
+        conf_threads = tmp;
+    }
+    else if (strcasecmp ("ReplayFile", child->key) == 0)
+      cf_util_get_string (child, &conf_replay_file);
     else if (strcasecmp ("View", child->key) == 0)
       pinba_config_view (child);
     else
       WARNING ("pinba plugin: Unknown config option: %s", child->key);
   }
 
-  pthread_mutex_unlock(&stat_nodes_lock);
-  
   return (0);
 } /* }}} int pinba_config */
 
 static int plugin_init (void) /* {{{ */
 {
-  int status;
+  size_t i;
+
+  if (threads != NULL)
+    return (0);
 
   if (stat_nodes == NULL)
   {
@@ -642,45 +1053,109 @@ static int plugin_init (void) /* {{{ */
         /* script = */ NULL);
   }
 
-  if (collector_thread_running)
-    return (0);
+  if (view_table_create () != 0)
+    return (-1);
 
-  status = pthread_create (&collector_thread_id,
-      /* attrs = */ NULL,
-      collector_thread,
-      /* args = */ NULL);
-  if (status != 0)
+#ifndef SO_REUSEPORT
+  if ((conf_threads > 1) && (conf_replay_file == NULL))
   {
-    char errbuf[1024];
-    ERROR ("pinba plugin: pthread_create(3) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
+    WARNING ("pinba plugin: Receiving with more than one thread requires "
+        "SO_REUSEPORT, which is not available. Using one thread.");
+    conf_threads = 1;
+  }
+#endif
+  /* A file is always replayed by a single thread. */
+  if (conf_replay_file != NULL)
+    conf_threads = 1;
+
+  threads = calloc ((size_t) conf_threads, sizeof (*threads));
+  if (threads == NULL)
+  {
+    ERROR ("pinba plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < (size_t) conf_threads; i++)
+  {
+    pinba_thread_t *t = threads + i;
+    int status;
+
+    pthread_mutex_init (&t->lock, /* attr = */ NULL);
+    t->accum = malloc (stat_nodes_num * sizeof (*t->accum));
+    t->spare = malloc (stat_nodes_num * sizeof (*t->spare));
+    if ((t->accum == NULL) || (t->spare == NULL))
+    {
+      ERROR ("pinba plugin: malloc failed.");
+      sfree (t->accum);
+      sfree (t->spare);
+      pthread_mutex_destroy (&t->lock);
+      break;
+    }
+    accum_reset (t->accum);
+    accum_reset (t->spare);
+
+    status = pthread_create (&t->id,
+        /* attrs = */ NULL,
+        collector_thread,
+        /* args = */ t);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("pinba plugin: pthread_create(3) failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      sfree (t->accum);
+      sfree (t->spare);
+      pthread_mutex_destroy (&t->lock);
+      break;
+    }
+    t->running = 1;
+    threads_num++;
+  }
+
+  if (threads_num == 0)
+  {
+    sfree (threads);
     return (-1);
   }
-  collector_thread_running = 1;
 
   return (0);
 } /* }}} */
 
 static int plugin_shutdown (void) /* {{{ */
 {
-  if (collector_thread_running)
+  size_t i;
+
+  DEBUG ("pinba plugin: Shutting down collector threads.");
+  collector_thread_do_shutdown = 1;
+
+  for (i = 0; i < threads_num; i++)
   {
+    pinba_thread_t *t = threads + i;
     int status;
 
-    DEBUG ("pinba plugin: Shutting down collector thread.");
-    collector_thread_do_shutdown = 1;
+    if (!t->running)
+      continue;
 
-    status = pthread_join (collector_thread_id, /* retval = */ NULL);
+    status = pthread_join (t->id, /* retval = */ NULL);
     if (status != 0)
     {
       char errbuf[1024];
       ERROR ("pinba plugin: pthread_join(3) failed: %s",
           sstrerror (status, errbuf, sizeof (errbuf)));
+      continue;
     }
 
-    collector_thread_running = 0;
-    collector_thread_do_shutdown = 0;
-  } /* if (collector_thread_running) */
+    pthread_mutex_destroy (&t->lock);
+    sfree (t->accum);
+    sfree (t->spare);
+    t->running = 0;
+  }
+
+  sfree (threads);
+  threads_num = 0;
+  collector_thread_do_shutdown = 0;
+
+  view_table_free ();
 
   return (0);
 } /* }}} int plugin_shutdown */
@@ -723,18 +1198,62 @@ static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
   sstrncpy (vl.type_instance, "peak", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
 
+  /* Request time percentiles of the last interval, in seconds. */
+  sstrncpy (vl.type, "response_time", sizeof (vl.type));
+
+  value.gauge = latency_hist_percentile (&res->req_time_hist, 50.0)
+    / 1000000.0;
+  sstrncpy (vl.type_instance, "p50", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  value.gauge = latency_hist_percentile (&res->req_time_hist, 95.0)
+    / 1000000.0;
+  sstrncpy (vl.type_instance, "p95", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  value.gauge = latency_hist_percentile (&res->req_time_hist, 99.0)
+    / 1000000.0;
+  sstrncpy (vl.type_instance, "p99", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
   return (0);
 } /* }}} int plugin_submit */
 
 static int plugin_read (void) /* {{{ */
 {
-  unsigned int i=0;
-  pinba_statnode_t data;
-  
-  while ((i = service_statnode_collect (&data, i)) != 0)
+  unsigned int i;
+  size_t j;
+
+  for (i = 0; i < stat_nodes_num; i++)
   {
-    plugin_submit (&data);
+    pinba_statnode_t *node = stat_nodes + i;
+
+    node->mem_peak = NAN;
+    latency_hist_reset (&node->req_time_hist);
   }
+
+  /* Swap the buffers of the receiving threads, so they can continue while
+   * the data they have received since the last read is being merged. */
+  for (j = 0; j < threads_num; j++)
+  {
+    pinba_thread_t *t = threads + j;
+    pinba_accum_t *tmp;
+
+    if (!t->running)
+      continue;
+
+    pthread_mutex_lock (&t->lock);
+    tmp = t->accum;
+    t->accum = t->spare;
+    t->spare = tmp;
+    pthread_mutex_unlock (&t->lock);
+
+    service_statnode_merge (t->spare);
+    accum_reset (t->spare);
+  }
+
+  for (i = 0; i < stat_nodes_num; i++)
+    plugin_submit (stat_nodes + i);
   
   return 0;
 } /* }}} int plugin_read */
@@ -36,6 +36,7 @@
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_cache.h"
+#include "utils_stats.h"
 #include "filter_chain.h"
 
 /*
@@ -45,6 +46,7 @@ struct callback_func_s
 {
 	void *cf_callback;
 	user_data_t cf_udata;
+	int cf_stats_id;
 };
 typedef struct callback_func_s callback_func_t;
 
@@ -57,6 +59,7 @@ struct read_func_s
 	 * The `rf_super' member MUST be the first one in this structure! */
 #define rf_callback rf_super.cf_callback
 #define rf_udata rf_super.cf_udata
+#define rf_stats_id rf_super.cf_stats_id
 	callback_func_t rf_super;
 	char rf_group[DATA_MAX_NAME_LEN];
 	char rf_name[DATA_MAX_NAME_LEN];
@@ -67,6 +70,13 @@ struct read_func_s
 };
 typedef struct read_func_s read_func_t;
 
+struct plugin_write_handle_s
+{
+	char *name;
+	callback_func_t *cf;
+	plugin_write_handle_t *next;
+};
+
 /*
  * Private variables
  */
@@ -78,6 +88,10 @@ static llist_t *list_shutdown;
 static llist_t *list_log;
 static llist_t *list_notification;
 
+/* Handles returned by plugin_write_handle_create(). Their callback pointers
+ * are updated whenever a write callback is registered or unregistered. */
+static plugin_write_handle_t *write_handles = NULL;
+
 static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
 
@@ -270,6 +284,29 @@ static int plugin_unregister (llist_t *list, const char *name) /* {{{ */
 	return (0);
 } /* }}} int plugin_unregister */
 
+/* Write plugins are looked up case-insensitively, like config blocks. */
+static callback_func_t *plugin_write_lookup (const char *name) /* {{{ */
+{
+	llentry_t *le;
+
+	if (list_write == NULL)
+		return (NULL);
+
+	for (le = llist_head (list_write); le != NULL; le = le->next)
+		if (strcasecmp (name, le->key) == 0)
+			return (le->value);
+
+	return (NULL);
+} /* }}} callback_func_t *plugin_write_lookup */
+
+static void plugin_write_handles_update (void) /* {{{ */
+{
+	plugin_write_handle_t *h;
+
+	for (h = write_handles; h != NULL; h = h->next)
+		h->cf = plugin_write_lookup (h->name);
+} /* }}} void plugin_write_handles_update */
+
 /*
  * (Try to) load the shared object `file'. Won't complain if it isn't a shared
  * object, but it will bitch about a shared object not having a
@@ -347,6 +384,7 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 	{
 		read_func_t *rf;
 		cdtime_t now;
+		cdtime_t start = 0;
 		int status;
 		int rf_type;
 		int rc;
@@ -423,6 +461,27 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 
 		DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
 
+		if (ustats_enabled)
+		{
+			static int delay_stats_id = 0;
+			cdtime_t next_read;
+
+			if (delay_stats_id == 0)
+				delay_stats_id = ustats_register ("scheduler",
+						"read_delay");
+
+			/* Time the callback had to wait for a free read
+			 * thread. Callbacks with their own interval don't
+			 * have a due time before their first call. */
+			start = cdtime ();
+			next_read = TIMESPEC_TO_CDTIME_T (&rf->rf_next_read);
+			if (next_read != 0)
+				ustats_add (delay_stats_id,
+						(start > next_read)
+						? (start - next_read) : 0,
+						/* failed = */ 0);
+		}
+
 		if (rf_type == RF_SIMPLE)
 		{
 			int (*callback) (void);
@@ -440,6 +499,10 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 			status = (*callback) (&rf->rf_udata);
 		}
 
+		if (ustats_enabled)
+			ustats_add (rf->rf_stats_id, cdtime () - start,
+					/* failed = */ status != 0);
+
 		/* If the function signals failure, we will increase the
 		 * intervals in which it will be called. */
 		if (status != 0)
@@ -714,6 +777,8 @@ static int plugin_insert_read (read_func_t *rf)
 	int status;
 	llentry_t *le;
 
+	rf->rf_stats_id = ustats_register ("read", rf->rf_name);
+
 	pthread_mutex_lock (&read_lock);
 
 	if (read_list == NULL)
@@ -854,8 +919,24 @@ int plugin_register_complex_read (const char *group, const char *name,
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_write, name,
-				(void *) callback, ud));
+	llentry_t *le;
+	int status;
+
+	status = create_register_callback (&list_write, name,
+			(void *) callback, ud);
+	if (status != 0)
+		return (status);
+
+	le = llist_search (list_write, name);
+	if (le != NULL)
+	{
+		callback_func_t *cf = le->value;
+		cf->cf_stats_id = ustats_register ("write", name);
+	}
+
+	plugin_write_handles_update ();
+
+	return (0);
 } /* int plugin_register_write */
 
 int plugin_register_flush (const char *name,
@@ -1050,7 +1131,12 @@ int plugin_unregister_read_group (const char *group) /* {{{ */
 
 int plugin_unregister_write (const char *name)
 {
-	return (plugin_unregister (list_write, name));
+	int status;
+
+	status = plugin_unregister (list_write, name);
+	plugin_write_handles_update ();
+
+	return (status);
 }
 
 int plugin_unregister_flush (const char *name)
@@ -1157,7 +1243,24 @@ void plugin_init_all (void)
 /* TODO: Rename this function. */
 void plugin_read_all (void)
 {
+	static int stats_id = 0;
+	cdtime_t start;
+
+	if (!ustats_enabled)
+	{
+		uc_check_timeout ();
+		uc_snapshot_periodic ();
+		return;
+	}
+
+	if (stats_id == 0)
+		stats_id = ustats_register ("cache", "check_timeout");
+
+	start = cdtime ();
 	uc_check_timeout ();
+	ustats_add (stats_id, cdtime () - start, /* failed = */ 0);
+
+	uc_snapshot_periodic ();
 
 	return;
 } /* void plugin_read_all */
@@ -1210,6 +1313,26 @@ int plugin_read_all_once (void)
 	return (return_status);
 } /* int plugin_read_all_once */
 
+/* Calls a write callback, measuring the time it takes if statistics are being
+ * collected. */
+static int plugin_write_timed (callback_func_t *cf, /* {{{ */
+    plugin_write_cb callback,
+    const data_set_t *ds, const value_list_t *vl)
+{
+  cdtime_t start;
+  int status;
+
+  if (!ustats_enabled)
+    return ((*callback) (ds, vl, &cf->cf_udata));
+
+  start = cdtime ();
+  status = (*callback) (ds, vl, &cf->cf_udata);
+  ustats_add (cf->cf_stats_id, cdtime () - start,
+      /* failed = */ status != 0);
+
+  return (status);
+} /* }}} int plugin_write_timed */
+
 int plugin_write (const char *plugin, /* {{{ */
 		const data_set_t *ds, const value_list_t *vl)
 {
@@ -1245,7 +1368,7 @@ int plugin_write (const char *plugin, /* {{{ */
 
       DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
       callback = cf->cf_callback;
-      status = (*callback) (ds, vl, &cf->cf_udata);
+      status = plugin_write_timed (cf, callback, ds, vl);
       if (status != 0)
         failure++;
       else
@@ -1264,28 +1387,96 @@ int plugin_write (const char *plugin, /* {{{ */
     callback_func_t *cf;
     plugin_write_cb callback;
 
-    le = llist_head (list_write);
-    while (le != NULL)
-    {
-      if (strcasecmp (plugin, le->key) == 0)
-        break;
-
-      le = le->next;
-    }
-
-    if (le == NULL)
+    cf = plugin_write_lookup (plugin);
+    if (cf == NULL)
       return (ENOENT);
 
-    cf = le->value;
-
-    DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+    DEBUG ("plugin: plugin_write: Writing values via %s.", plugin);
     callback = cf->cf_callback;
-    status = (*callback) (ds, vl, &cf->cf_udata);
+    status = plugin_write_timed (cf, callback, ds, vl);
   }
 
   return (status);
 } /* }}} int plugin_write */
 
+plugin_write_handle_t *plugin_write_handle_create (const char *name) /* {{{ */
+{
+  plugin_write_handle_t *h;
+
+  if (name == NULL)
+    return (NULL);
+
+  h = malloc (sizeof (*h));
+  if (h == NULL)
+    return (NULL);
+  memset (h, 0, sizeof (*h));
+
+  h->name = strdup (name);
+  if (h->name == NULL)
+  {
+    sfree (h);
+    return (NULL);
+  }
+
+  h->cf = plugin_write_lookup (name);
+  h->next = write_handles;
+  write_handles = h;
+
+  return (h);
+} /* }}} plugin_write_handle_t *plugin_write_handle_create */
+
+void plugin_write_handle_destroy (plugin_write_handle_t *h) /* {{{ */
+{
+  plugin_write_handle_t **prev;
+
+  if (h == NULL)
+    return;
+
+  for (prev = &write_handles; *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == h)
+    {
+      *prev = h->next;
+      break;
+    }
+  }
+
+  sfree (h->name);
+  sfree (h);
+} /* }}} void plugin_write_handle_destroy */
+
+const char *plugin_write_handle_name (const plugin_write_handle_t *h) /* {{{ */
+{
+  if (h == NULL)
+    return (NULL);
+  return (h->name);
+} /* }}} const char *plugin_write_handle_name */
+
+int plugin_write_handle (plugin_write_handle_t *h, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  callback_func_t *cf;
+
+  if ((h == NULL) || (vl == NULL))
+    return (EINVAL);
+
+  cf = h->cf;
+  if (cf == NULL)
+    return (ENOENT);
+
+  if (ds == NULL)
+  {
+    ds = plugin_get_ds (vl->type);
+    if (ds == NULL)
+    {
+      ERROR ("plugin_write_handle: Unable to lookup type `%s'.", vl->type);
+      return (ENOENT);
+    }
+  }
+
+  return (plugin_write_timed (cf, (plugin_write_cb) cf->cf_callback, ds, vl));
+} /* }}} int plugin_write_handle */
+
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
 {
   llentry_t *le;
@@ -1356,6 +1547,10 @@ void plugin_shutdown_all (void)
 		(*callback) ();
 	}
 
+	/* All threads dispatching values have been stopped by now. */
+	uc_shutdown ();
+	meta_data_shutdown ();
+
 	/* Write plugins which use the `user_data' pointer usually need the
 	 * same data available to the flush callback. If this is the case, set
 	 * the free_function to NULL when registering the flush callback and to
@@ -1364,6 +1559,7 @@ void plugin_shutdown_all (void)
 	destroy_all_callbacks (&list_flush);
 	destroy_all_callbacks (&list_missing);
 	destroy_all_callbacks (&list_write);
+	plugin_write_handles_update ();
 
 	destroy_all_callbacks (&list_notification);
 	destroy_all_callbacks (&list_shutdown);
@@ -1408,7 +1604,7 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-int plugin_dispatch_values (value_list_t *vl)
+static int plugin_dispatch_values_internal (value_list_t *vl)
 {
 	int status;
 	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
@@ -1584,6 +1780,25 @@ int plugin_dispatch_values (value_list_t *vl)
 	}
 
 	return (0);
+} /* int plugin_dispatch_values_internal */
+
+int plugin_dispatch_values (value_list_t *vl)
+{
+	static int stats_id = 0;
+	cdtime_t start;
+	int status;
+
+	if (!ustats_enabled)
+		return (plugin_dispatch_values_internal (vl));
+
+	if (stats_id == 0)
+		stats_id = ustats_register ("dispatch", "values");
+
+	start = cdtime ();
+	status = plugin_dispatch_values_internal (vl);
+	ustats_add (stats_id, cdtime () - start, /* failed = */ status != 0);
+
+	return (status);
 } /* int plugin_dispatch_values */
 
 int plugin_dispatch_values_secure (const value_list_t *vl)
@@ -253,6 +253,30 @@ void plugin_shutdown_all (void);
 int plugin_write (const char *plugin,
     const data_set_t *ds, const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_write_handle_create
+ *
+ * DESCRIPTION
+ *  Returns a handle for the write function of the plugin `name', so that
+ *  values can be written to it without looking up the plugin by name every
+ *  time. The handle may be created before the plugin has registered its write
+ *  function; it is updated whenever write functions are registered or
+ *  unregistered. Handles should only be created and destroyed while the
+ *  configuration is being read.
+ *
+ *  `plugin_write_handle' behaves like `plugin_write' with a plugin name and
+ *  returns ENOENT if no write function with that name is registered.
+ */
+struct plugin_write_handle_s;
+typedef struct plugin_write_handle_s plugin_write_handle_t;
+
+plugin_write_handle_t *plugin_write_handle_create (const char *name);
+void plugin_write_handle_destroy (plugin_write_handle_t *h);
+const char *plugin_write_handle_name (const plugin_write_handle_t *h);
+int plugin_write_handle (plugin_write_handle_t *h,
+    const data_set_t *ds, const value_list_t *vl);
+
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier);
 
 /*
@@ -48,6 +48,10 @@
 #include <pg_config_manual.h>
 #include <libpq-fe.h>
 
+#if HAVE_POLL_H
+# include <poll.h>
+#endif
+
 #define log_err(...) ERROR ("postgresql: " __VA_ARGS__)
 #define log_warn(...) WARNING ("postgresql: " __VA_ARGS__)
 #define log_info(...) INFO ("postgresql: " __VA_ARGS__)
@@ -103,6 +107,31 @@ typedef struct {
 	int             params_num;
 } c_psql_user_data_t;
 
+/* Commands sent to the server during a read. */
+typedef enum {
+	C_PSQL_CMD_PREPARE,
+	C_PSQL_CMD_EXEC,
+	C_PSQL_CMD_SYNC,
+} c_psql_cmd_type_t;
+
+typedef struct {
+	c_psql_cmd_type_t type;
+	int               query; /* index into db->queries */
+} c_psql_cmd_t;
+
+/* Per-connection state of a query. */
+typedef struct {
+	_Bool prepared;
+	/* Result format requested from the server: 0 = text, 1 = binary. */
+	int   result_format;
+} c_psql_query_state_t;
+
+typedef enum {
+	C_PSQL_STATE_IDLE = 0,
+	C_PSQL_STATE_CONNECTING,
+	C_PSQL_STATE_BUSY,
+} c_psql_state_t;
+
 typedef struct {
 	PGconn      *conn;
 	c_complain_t conn_complaint;
@@ -112,8 +141,24 @@ typedef struct {
 
 	int max_params_num;
 
+	/* state of the current read */
+	c_psql_state_t state;
+	PostgresPollingStatusType connect_status;
+	_Bool pipeline;
+	_Bool want_write;
+	_Bool success;
+
+	c_psql_cmd_t *cmds;
+	size_t        cmds_num;
+	size_t        cmds_done;
+
+	/* column values of all rows of the current result */
+	char  **values;
+	size_t  values_num;
+
 	/* user configuration */
 	udb_query_preparation_area_t **q_prep_areas;
+	c_psql_query_state_t          *q_states;
 	udb_query_t    **queries;
 	size_t           queries_num;
 
@@ -132,6 +177,26 @@ typedef struct {
 	char *service;
 } c_psql_database_t;
 
+/* All databases using the same interval are read by one callback, which
+ * runs their queries concurrently. */
+typedef struct {
+	cdtime_t interval;
+
+	c_psql_database_t **databases;
+	size_t              databases_num;
+} c_psql_group_t;
+
+/* Type OIDs, see the server's catalog/pg_type.h. */
+#define C_PSQL_NAMEOID     19
+#define C_PSQL_INT8OID     20
+#define C_PSQL_INT2OID     21
+#define C_PSQL_INT4OID     23
+#define C_PSQL_TEXTOID     25
+#define C_PSQL_FLOAT4OID   700
+#define C_PSQL_FLOAT8OID   701
+#define C_PSQL_BPCHAROID   1042
+#define C_PSQL_VARCHAROID  1043
+
 static char *def_queries[] = {
 	"backends",
 	"transactions",
@@ -146,6 +211,11 @@ static int def_queries_num = STATIC_ARRAY_SIZE (def_queries);
 static udb_query_t      **queries       = NULL;
 static size_t             queries_num   = 0;
 
+/* The groups are owned by the read callbacks; this list is only used to
+ * find the group of a database while reading the configuration. */
+static c_psql_group_t   **groups        = NULL;
+static size_t             groups_num    = 0;
+
 static c_psql_database_t *c_psql_database_new (const char *name)
 {
 	c_psql_database_t *db;
@@ -165,7 +235,21 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 
 	db->max_params_num = 0;
 
+	db->state          = C_PSQL_STATE_IDLE;
+	db->connect_status = PGRES_POLLING_FAILED;
+	db->pipeline       = 0;
+	db->want_write     = 0;
+	db->success        = 0;
+
+	db->cmds      = NULL;
+	db->cmds_num  = 0;
+	db->cmds_done = 0;
+
+	db->values     = NULL;
+	db->values_num = 0;
+
 	db->q_prep_areas   = NULL;
+	db->q_states       = NULL;
 	db->queries        = NULL;
 	db->queries_num    = 0;
 
@@ -198,6 +282,10 @@ static void c_psql_database_delete (void *data)
 		for (i = 0; i < db->queries_num; ++i)
 			udb_query_delete_preparation_area (db->q_prep_areas[i]);
 	free (db->q_prep_areas);
+	sfree (db->q_states);
+
+	sfree (db->cmds);
+	sfree (db->values);
 
 	sfree (db->queries);
 	db->queries_num = 0;
@@ -213,15 +301,32 @@ static void c_psql_database_delete (void *data)
 	sfree (db->krbsrvname);
 
 	sfree (db->service);
+
+	sfree (db);
 	return;
 } /* c_psql_database_delete */
 
+static void c_psql_group_delete (void *data)
+{
+	c_psql_group_t *group = data;
+	size_t i;
+
+	for (i = 0; i < group->databases_num; ++i)
+		c_psql_database_delete (group->databases[i]);
+	sfree (group->databases);
+
+	sfree (group);
+} /* c_psql_group_delete */
+
+/* Starts a non-blocking connection attempt. The connection is completed by
+ * c_psql_process(). */
 static int c_psql_connect (c_psql_database_t *db)
 {
 	char  conninfo[4096];
 	char *buf     = conninfo;
 	int   buf_len = sizeof (conninfo);
 	int   status;
+	size_t i;
 
 	if (! db)
 		return -1;
@@ -240,47 +345,64 @@ static int c_psql_connect (c_psql_database_t *db)
 	C_PSQL_PAR_APPEND (buf, buf_len, "krbsrvname", db->krbsrvname);
 	C_PSQL_PAR_APPEND (buf, buf_len, "service",    db->service);
 
-	db->conn = PQconnectdb (conninfo);
-	db->proto_version = PQprotocolVersion (db->conn);
-	return 0;
-} /* c_psql_connect */
-
-static int c_psql_check_connection (c_psql_database_t *db)
-{
-	_Bool init = 0;
-
-	if (! db->conn) {
-		init = 1;
+	/* trigger c_release() */
+	if (0 == db->conn_complaint.interval)
+		db->conn_complaint.interval = 1;
 
-		/* trigger c_release() */
-		if (0 == db->conn_complaint.interval)
-			db->conn_complaint.interval = 1;
+	PQfinish (db->conn);
+	db->conn = PQconnectStart (conninfo);
+	if (NULL == db->conn) {
+		log_err ("Out of memory.");
+		return -1;
+	}
 
-		c_psql_connect (db);
+	if (CONNECTION_BAD == PQstatus (db->conn)) {
+		c_complain (LOG_ERR, &db->conn_complaint,
+				"Failed to connect to database %s: %s",
+				db->database, PQerrorMessage (db->conn));
+		return -1;
 	}
 
-	/* "ping" */
-	PQclear (PQexec (db->conn, "SELECT 42;"));
+	/* Prepared statements don't survive the connection. */
+	for (i = 0; i < db->queries_num; ++i)
+		db->q_states[i].prepared = 0;
 
-	if (CONNECTION_OK != PQstatus (db->conn)) {
-		PQreset (db->conn);
+	/* As if PQconnectPoll() had returned PGRES_POLLING_WRITING. */
+	db->connect_status = PGRES_POLLING_WRITING;
+	db->state = C_PSQL_STATE_CONNECTING;
+	return 0;
+} /* c_psql_connect */
 
-		/* trigger c_release() */
-		if (0 == db->conn_complaint.interval)
-			db->conn_complaint.interval = 1;
+static void c_psql_disconnect (c_psql_database_t *db)
+{
+	PQfinish (db->conn);
+	db->conn = NULL;
 
-		if (CONNECTION_OK != PQstatus (db->conn)) {
-			c_complain (LOG_ERR, &db->conn_complaint,
-					"Failed to connect to database %s: %s",
-					db->database, PQerrorMessage (db->conn));
-			return -1;
-		}
+	db->state = C_PSQL_STATE_IDLE;
+	db->want_write = 0;
+} /* c_psql_disconnect */
 
-		db->proto_version = PQprotocolVersion (db->conn);
-	}
+/* Called once PQconnectPoll() has reported an established connection. */
+static void c_psql_connected (c_psql_database_t *db)
+{
+	_Bool init = (0 == db->server_version);
 
+	db->proto_version = PQprotocolVersion (db->conn);
 	db->server_version = PQserverVersion (db->conn);
 
+	if (0 != PQsetnonblocking (db->conn, 1))
+		log_warn ("Failed to put the connection to database %s into "
+				"non-blocking mode: %s",
+				db->database, PQerrorMessage (db->conn));
+
+	/* Pipelining sends all queries at once instead of waiting for the
+	 * result of each query before sending the next one. */
+	db->pipeline = 0;
+#ifdef LIBPQ_HAS_PIPELINING
+	if (3 <= db->proto_version)
+		db->pipeline = (1 == PQenterPipelineMode (db->conn));
+#endif
+
 	if (c_would_release (&db->conn_complaint)) {
 		char *server_host;
 		int   server_version;
@@ -301,24 +423,13 @@ static int c_psql_check_connection (c_psql_database_t *db)
 			log_warn ("Protocol version %d does not support parameters.",
 					db->proto_version);
 	}
-	return 0;
-} /* c_psql_check_connection */
-
-static PGresult *c_psql_exec_query_noparams (c_psql_database_t *db,
-		udb_query_t *q)
-{
-	return PQexec (db->conn, udb_query_get_statement (q));
-} /* c_psql_exec_query_noparams */
+} /* c_psql_connected */
 
-static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
-		udb_query_t *q, c_psql_user_data_t *data)
+static void c_psql_get_params (c_psql_database_t *db,
+		c_psql_user_data_t *data, char **params,
+		char *interval, size_t interval_size)
 {
-	char *params[db->max_params_num];
-	char  interval[64];
-	int   i;
-
-	if ((data == NULL) || (data->params_num == 0))
-		return (c_psql_exec_query_noparams (db, q));
+	int i;
 
 	assert (db->max_params_num >= data->params_num);
 
@@ -335,100 +446,245 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 				params[i] = db->user;
 				break;
 			case C_PSQL_PARAM_INTERVAL:
-				ssnprintf (interval, sizeof (interval), "%.3f",
-						(db->interval > 0)
-						? CDTIME_T_TO_DOUBLE (db->interval) : interval_g);
+				ssnprintf (interval, interval_size, "%.3f",
+						CDTIME_T_TO_DOUBLE ((db->interval > 0)
+							? db->interval : interval_g));
 				params[i] = interval;
 				break;
 			default:
 				assert (0);
 		}
 	}
+} /* c_psql_get_params */
 
-	return PQexecParams (db->conn, udb_query_get_statement (q),
-			data->params_num, NULL,
-			(const char *const *) params,
-			NULL, NULL, /* return text data */ 0);
-} /* c_psql_exec_query_params */
-
-static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
-		udb_query_preparation_area_t *prep_area)
+static int c_psql_flush (c_psql_database_t *db)
 {
-	PGresult *res;
+	int status;
 
-	c_psql_user_data_t *data;
+	status = PQflush (db->conn);
+	if (0 > status) {
+		log_err ("Failed to send data to database %s: %s",
+				db->database, PQerrorMessage (db->conn));
+		return -1;
+	}
 
-	const char *host;
+	db->want_write = (1 == status);
+	return 0;
+} /* c_psql_flush */
 
-	char **column_names;
-	char **column_values;
-	int    column_num;
+static int c_psql_send_cmd (c_psql_database_t *db, c_psql_cmd_t *cmd)
+{
+	udb_query_t *q;
+	c_psql_user_data_t *data;
 
-	int rows_num;
-	int status;
-	int row, col;
+	char stmt_name[32];
+	int  params_num;
+	int  status;
+
+	if (C_PSQL_CMD_SYNC == cmd->type) {
+#ifdef LIBPQ_HAS_PIPELINING
+		/* Each query is followed by a sync point, so that a failing query
+		 * does not abort the remaining ones. */
+		status = PQpipelineSync (db->conn);
+#else
+		status = 0;
+#endif
+		if (1 != status) {
+			log_err ("Failed to send sync to database %s: %s",
+					db->database, PQerrorMessage (db->conn));
+			return -1;
+		}
+		return c_psql_flush (db);
+	}
+
+	q = db->queries[cmd->query];
 
 	/* The user data may hold parameter information, but may be NULL. */
 	data = udb_query_get_user_data (q);
+	params_num = (NULL == data) ? 0 : data->params_num;
 
-	/* Versions up to `3' don't know how to handle parameters. */
-	if (3 <= db->proto_version)
-		res = c_psql_exec_query_params (db, q, data);
-	else if ((NULL == data) || (0 == data->params_num))
-		res = c_psql_exec_query_noparams (db, q);
+	ssnprintf (stmt_name, sizeof (stmt_name), "collectd_%i", cmd->query);
+
+	if (C_PSQL_CMD_PREPARE == cmd->type)
+		status = PQsendPrepare (db->conn, stmt_name,
+				udb_query_get_statement (q), params_num,
+				/* param types = */ NULL);
+	else if (3 > db->proto_version)
+		status = PQsendQuery (db->conn, udb_query_get_statement (q));
 	else {
-		log_err ("Connection to database \"%s\" does not support parameters "
-				"(protocol version %d) - cannot execute query \"%s\".",
-				db->database, db->proto_version,
-				udb_query_get_name (q));
-		return -1;
-	}
+		char *params[db->max_params_num + 1];
+		char  interval[64];
 
-	column_names = NULL;
-	column_values = NULL;
+		if (0 < params_num)
+			c_psql_get_params (db, data, params, interval, sizeof (interval));
 
-#define BAIL_OUT(status) \
-	sfree (column_names); \
-	sfree (column_values); \
-	PQclear (res); \
-	return status
+		status = PQsendQueryPrepared (db->conn, stmt_name, params_num,
+				(const char *const *) params, NULL, NULL,
+				db->q_states[cmd->query].result_format);
+	}
 
-	if (PGRES_TUPLES_OK != PQresultStatus (res)) {
-		log_err ("Failed to execute SQL query: %s",
+	if (1 != status) {
+		log_err ("Failed to send query \"%s\" to database %s: %s",
+				udb_query_get_name (q), db->database,
 				PQerrorMessage (db->conn));
-		log_info ("SQL query was: %s",
-				udb_query_get_statement (q));
-		BAIL_OUT (-1);
+		return -1;
 	}
 
-	rows_num = PQntuples (res);
-	if (1 > rows_num) {
-		BAIL_OUT (0);
+	return c_psql_flush (db);
+} /* c_psql_send_cmd */
+
+static void c_psql_add_cmd (c_psql_database_t *db,
+		c_psql_cmd_type_t type, int query)
+{
+	db->cmds[db->cmds_num].type = type;
+	db->cmds[db->cmds_num].query = query;
+	db->cmds_num++;
+} /* c_psql_add_cmd */
+
+/* Sends all queries of the database. Queries are prepared once per
+ * connection. Without pipelining, only the first command is sent here and
+ * the following ones are sent by c_psql_receive() as the results arrive. */
+static int c_psql_send_queries (c_psql_database_t *db)
+{
+	size_t send_num;
+	size_t i;
+
+	db->cmds_num  = 0;
+	db->cmds_done = 0;
+
+	for (i = 0; i < db->queries_num; ++i) {
+		udb_query_t *q = db->queries[i];
+		c_psql_user_data_t *data;
+
+		if ((0 != db->server_version)
+				&& (udb_query_check_version (q, db->server_version) <= 0))
+			continue;
+
+		/* Versions up to `3' don't know how to handle parameters. */
+		if (3 > db->proto_version) {
+			data = udb_query_get_user_data (q);
+			if ((NULL != data) && (0 != data->params_num)) {
+				log_err ("Connection to database \"%s\" does not support "
+						"parameters (protocol version %d) - "
+						"cannot execute query \"%s\".",
+						db->database, db->proto_version,
+						udb_query_get_name (q));
+				continue;
+			}
+		}
+		else if (! db->q_states[i].prepared)
+			c_psql_add_cmd (db, C_PSQL_CMD_PREPARE, (int) i);
+
+		c_psql_add_cmd (db, C_PSQL_CMD_EXEC, (int) i);
+
+		if (db->pipeline)
+			c_psql_add_cmd (db, C_PSQL_CMD_SYNC, (int) i);
 	}
 
-	column_num = PQnfields (res);
-	column_names = (char **) calloc (column_num, sizeof (char *));
-	if (NULL == column_names) {
-		log_err ("calloc failed.");
-		BAIL_OUT (-1);
+	if (0 == db->cmds_num) {
+		db->state = C_PSQL_STATE_IDLE;
+		return 0;
 	}
 
-	column_values = (char **) calloc (column_num, sizeof (char *));
-	if (NULL == column_values) {
-		log_err ("calloc failed.");
-		BAIL_OUT (-1);
+	db->state = C_PSQL_STATE_BUSY;
+
+	send_num = db->pipeline ? db->cmds_num : 1;
+	for (i = 0; i < send_num; ++i)
+		if (0 != c_psql_send_cmd (db, db->cmds + i))
+			return -1;
+	return 0;
+} /* c_psql_send_queries */
+
+/* Returns the UDB_COLUMN_* type used for a column in binary format or -1 if
+ * the type can't be read in binary format. */
+static int c_psql_column_type (Oid type)
+{
+	switch (type) {
+		case C_PSQL_INT2OID:    return UDB_COLUMN_INT16;
+		case C_PSQL_INT4OID:    return UDB_COLUMN_INT32;
+		case C_PSQL_INT8OID:    return UDB_COLUMN_INT64;
+		case C_PSQL_FLOAT4OID:  return UDB_COLUMN_FLOAT;
+		case C_PSQL_FLOAT8OID:  return UDB_COLUMN_DOUBLE;
+		/* the binary format of these is the plain string */
+		case C_PSQL_NAMEOID:
+		case C_PSQL_TEXTOID:
+		case C_PSQL_BPCHAROID:
+		case C_PSQL_VARCHAROID: return UDB_COLUMN_STRING;
 	}
-	
+	return -1;
+} /* c_psql_column_type */
+
+static int c_psql_submit_result (c_psql_database_t *db, int query,
+		PGresult *res)
+{
+	udb_query_t *q = db->queries[query];
+	udb_query_preparation_area_t *prep_area = db->q_prep_areas[query];
+	c_psql_query_state_t *q_state = db->q_states + query;
+
+	const char *host;
+
+	int    rows_num   = PQntuples (res);
+	int    column_num = PQnfields (res);
+	size_t values_num;
+
+	char *column_names[(0 < column_num) ? column_num : 1];
+	int   column_types[(0 < column_num) ? column_num : 1];
+
+	_Bool binary_ok = 1;
+	int status;
+	int row, col;
+
+	if ((1 > rows_num) || (1 > column_num))
+		return 0;
+
 	for (col = 0; col < column_num; ++col) {
-		/* Pointers returned by `PQfname' are freed by `PQclear' via
-		 * `BAIL_OUT'. */
+		int type;
+
+		/* Pointers returned by `PQfname' are freed by `PQclear'. */
 		column_names[col] = PQfname (res, col);
 		if (NULL == column_names[col]) {
 			log_err ("Failed to resolve name of column %i.", col);
-			BAIL_OUT (-1);
+			return -1;
 		}
+
+		type = c_psql_column_type (PQftype (res, col));
+		if (0 > type)
+			binary_ok = 0;
+
+		if (0 == PQfformat (res, col))
+			column_types[col] = UDB_COLUMN_STRING;
+		else if (0 <= type)
+			column_types[col] = type;
+		else {
+			/* The column's type has changed since switching to the binary
+			 * format. */
+			log_warn ("Column \"%s\" of query \"%s\" can't be read in "
+					"binary format; falling back to the text format.",
+					column_names[col], udb_query_get_name (q));
+			q_state->result_format = 0;
+			return -1;
+		}
+	}
+
+	values_num = ((size_t) rows_num) * ((size_t) column_num);
+	if (db->values_num < values_num) {
+		char **tmp;
+
+		tmp = realloc (db->values, values_num * sizeof (*db->values));
+		if (NULL == tmp) {
+			log_err ("Out of memory.");
+			return -1;
+		}
+		db->values = tmp;
+		db->values_num = values_num;
 	}
 
+	/* Pointers returned by `PQgetvalue' are freed by `PQclear'. */
+	for (row = 0; row < rows_num; ++row)
+		for (col = 0; col < column_num; ++col)
+			db->values[row * column_num + col] = PQgetisnull (res, row, col)
+				? NULL : PQgetvalue (res, row, col);
+
 	if (C_PSQL_IS_UNIX_DOMAIN_SOCKET (db->host)
 			|| (0 == strcmp (db->host, "localhost")))
 		host = hostname_g;
@@ -440,70 +696,250 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 	if (0 != status) {
 		log_err ("udb_query_prepare_result failed with status %i.",
 				status);
-		BAIL_OUT (-1);
+		return -1;
 	}
 
-	for (row = 0; row < rows_num; ++row) {
-		for (col = 0; col < column_num; ++col) {
-			/* Pointers returned by `PQgetvalue' are freed by `PQclear' via
-			 * `BAIL_OUT'. */
-			column_values[col] = PQgetvalue (res, row, col);
-			if (NULL == column_values[col]) {
-				log_err ("Failed to get value at (row = %i, col = %i).",
-						row, col);
-				break;
+	status = udb_query_handle_results (q, prep_area, db->values,
+			column_types, (size_t) rows_num);
+	if (0 != status)
+		log_err ("udb_query_handle_results failed with status %i.",
+				status);
+
+	udb_query_finish_result (q, prep_area);
+
+	/* All columns can be transferred in binary format, which saves
+	 * formatting and parsing the numbers. */
+	if (binary_ok && (3 <= db->proto_version))
+		q_state->result_format = 1;
+
+	return status;
+} /* c_psql_submit_result */
+
+static void c_psql_handle_result (c_psql_database_t *db,
+		c_psql_cmd_t *cmd, PGresult *res)
+{
+	udb_query_t *q = db->queries[cmd->query];
+	ExecStatusType status = PQresultStatus (res);
+
+	switch (cmd->type) {
+		case C_PSQL_CMD_PREPARE:
+			if (PGRES_COMMAND_OK == status) {
+				db->q_states[cmd->query].prepared = 1;
+				return;
+			}
+			log_err ("Failed to prepare SQL query: %s",
+					PQresultErrorMessage (res));
+			break;
+
+		case C_PSQL_CMD_EXEC:
+			if (PGRES_TUPLES_OK == status) {
+				if (0 == c_psql_submit_result (db, cmd->query, res))
+					db->success = 1;
+				return;
 			}
+#ifdef LIBPQ_HAS_PIPELINING
+			/* An earlier command of this query failed and has been
+			 * reported already. */
+			if (PGRES_PIPELINE_ABORTED == status)
+				return;
+#endif
+			log_err ("Failed to execute SQL query: %s",
+					PQresultErrorMessage (res));
+			break;
+
+		case C_PSQL_CMD_SYNC:
+			return;
+	}
+
+	log_info ("SQL query was: %s", udb_query_get_statement (q));
+} /* c_psql_handle_result */
+
+/* Reads all results available without blocking. */
+static int c_psql_receive (c_psql_database_t *db)
+{
+	if (! PQconsumeInput (db->conn)) {
+		log_err ("Failed to read from database %s: %s",
+				db->database, PQerrorMessage (db->conn));
+		return -1;
+	}
+
+	while ((db->cmds_done < db->cmds_num) && (! PQisBusy (db->conn))) {
+		c_psql_cmd_t *cmd = db->cmds + db->cmds_done;
+		PGresult *res;
+
+		res = PQgetResult (db->conn);
+
+		/* A sync point has exactly one result, which is not followed by
+		 * NULL. */
+		if (C_PSQL_CMD_SYNC == cmd->type) {
+			PQclear (res);
+			db->cmds_done++;
+			continue;
 		}
 
-		/* check for an error */
-		if (col < column_num)
+		if (NULL != res) {
+			c_psql_handle_result (db, cmd, res);
+			PQclear (res);
 			continue;
+		}
 
-		status = udb_query_handle_result (q, prep_area, column_values);
-		if (status != 0) {
-			log_err ("udb_query_handle_result failed with status %i.",
-					status);
+		/* All results of the command have been read. */
+		db->cmds_done++;
+
+		if (db->pipeline)
+			continue;
+
+		/* Don't execute a statement which could not be prepared. */
+		if ((C_PSQL_CMD_PREPARE == cmd->type)
+				&& (! db->q_states[cmd->query].prepared))
+			db->cmds_done++;
+
+		if (db->cmds_done < db->cmds_num)
+			if (0 != c_psql_send_cmd (db, db->cmds + db->cmds_done))
+				return -1;
+	}
+
+	if (db->cmds_done >= db->cmds_num)
+		db->state = C_PSQL_STATE_IDLE;
+	return 0;
+} /* c_psql_receive */
+
+/* Starts reading the database, connecting first if necessary. */
+static int c_psql_start (c_psql_database_t *db)
+{
+	db->success = 0;
+	db->cmds_num = 0;
+	db->cmds_done = 0;
+
+	if ((NULL == db->conn) || (CONNECTION_BAD == PQstatus (db->conn)))
+		return c_psql_connect (db);
+
+	return c_psql_send_queries (db);
+} /* c_psql_start */
+
+/* Handles activity on the database's socket. */
+static int c_psql_process (c_psql_database_t *db, short revents)
+{
+	int status = 0;
+
+	if (C_PSQL_STATE_CONNECTING == db->state) {
+		db->connect_status = PQconnectPoll (db->conn);
+
+		if (PGRES_POLLING_OK == db->connect_status) {
+			c_psql_connected (db);
+			status = c_psql_send_queries (db);
 		}
-	} /* for (row = 0; row < rows_num; ++row) */
+		else if (PGRES_POLLING_FAILED == db->connect_status) {
+			c_complain (LOG_ERR, &db->conn_complaint,
+					"Failed to connect to database %s: %s",
+					db->database, PQerrorMessage (db->conn));
+			status = -1;
+		}
+	}
+	else if (C_PSQL_STATE_BUSY == db->state) {
+		if ((revents & POLLOUT) && db->want_write)
+			status = c_psql_flush (db);
 
-	udb_query_finish_result (q, prep_area);
+		if ((0 == status) && (revents & (POLLIN | POLLERR | POLLHUP)))
+			status = c_psql_receive (db);
+	}
 
-	BAIL_OUT (0);
-#undef BAIL_OUT
-} /* c_psql_exec_query */
+	return status;
+} /* c_psql_process */
+
+static short c_psql_poll_events (c_psql_database_t *db)
+{
+	if (C_PSQL_STATE_CONNECTING == db->state)
+		return (PGRES_POLLING_READING == db->connect_status)
+			? POLLIN : POLLOUT;
+
+	return POLLIN | (db->want_write ? POLLOUT : 0);
+} /* c_psql_poll_events */
 
 static int c_psql_read (user_data_t *ud)
 {
-	c_psql_database_t *db;
+	c_psql_group_t *group;
+
+	cdtime_t deadline;
 
 	int success = 0;
-	int i;
+	size_t i;
 
 	if ((ud == NULL) || (ud->data == NULL)) {
 		log_err ("c_psql_read: Invalid user data.");
 		return -1;
 	}
 
-	db = ud->data;
+	group = ud->data;
 
-	assert (NULL != db->database);
+	/* Give up on databases which did not answer within one interval. */
+	deadline = cdtime () + ((group->interval > 0)
+			? group->interval : interval_g);
 
-	if (0 != c_psql_check_connection (db))
-		return -1;
+	for (i = 0; i < group->databases_num; ++i) {
+		c_psql_database_t *db = group->databases[i];
 
-	for (i = 0; i < db->queries_num; ++i)
-	{
-		udb_query_preparation_area_t *prep_area;
-		udb_query_t *q;
+		assert (NULL != db->database);
 
-		prep_area = db->q_prep_areas[i];
-		q = db->queries[i];
+		if (0 != c_psql_start (db))
+			c_psql_disconnect (db);
+	}
 
-		if ((0 != db->server_version)
-				&& (udb_query_check_version (q, db->server_version) <= 0))
-			continue;
+	while (42) {
+		struct pollfd fds[group->databases_num];
+		c_psql_database_t *dbs[group->databases_num];
+		size_t fds_num = 0;
+		cdtime_t now;
+		int status;
+
+		for (i = 0; i < group->databases_num; ++i) {
+			c_psql_database_t *db = group->databases[i];
+
+			if (C_PSQL_STATE_IDLE == db->state)
+				continue;
+
+			fds[fds_num].fd = PQsocket (db->conn);
+			fds[fds_num].events = c_psql_poll_events (db);
+			fds[fds_num].revents = 0;
+			dbs[fds_num] = db;
+			fds_num++;
+		}
+
+		if (0 == fds_num)
+			break;
+
+		now = cdtime ();
+		if (now >= deadline)
+			break;
+
+		status = poll (fds, (nfds_t) fds_num,
+				(int) CDTIME_T_TO_MS (deadline - now));
+		if (0 > status) {
+			char errbuf[1024];
+
+			if (EINTR == errno)
+				continue;
+
+			log_err ("poll failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
 
-		if (0 == c_psql_exec_query (db, q, prep_area))
+		for (i = 0; i < fds_num; ++i)
+			if (0 != fds[i].revents)
+				if (0 != c_psql_process (dbs[i], fds[i].revents))
+					c_psql_disconnect (dbs[i]);
+	}
+
+	for (i = 0; i < group->databases_num; ++i) {
+		c_psql_database_t *db = group->databases[i];
+
+		if (C_PSQL_STATE_IDLE != db->state) {
+			log_err ("Timeout while reading database %s.", db->database);
+			c_psql_disconnect (db);
+		}
+
+		if (db->success)
 			success = 1;
 	}
 
@@ -516,6 +952,10 @@ static int c_psql_shutdown (void)
 {
 	plugin_unregister_read_group ("postgresql");
 
+	/* The groups have been freed by unregistering the read callbacks. */
+	sfree (groups);
+	groups_num = 0;
+
 	udb_query_free (queries, queries_num);
 	queries = NULL;
 	queries_num = 0;
@@ -579,14 +1019,72 @@ static int config_query_callback (udb_query_t *q, oconfig_item_t *ci)
 	return (-1);
 } /* config_query_callback */
 
-static int c_psql_config_database (oconfig_item_t *ci)
+/* Returns the group of databases read with the given interval, registering
+ * a new read callback if necessary. */
+static c_psql_group_t *c_psql_get_group (cdtime_t interval)
 {
-	c_psql_database_t *db;
+	c_psql_group_t  *group;
+	c_psql_group_t **tmp;
 
 	char cb_name[DATA_MAX_NAME_LEN];
 	struct timespec cb_interval = { 0, 0 };
 	user_data_t ud;
 
+	size_t i;
+	int status;
+
+	for (i = 0; i < groups_num; ++i)
+		if (groups[i]->interval == interval)
+			return groups[i];
+
+	tmp = (c_psql_group_t **) realloc (groups,
+			(groups_num + 1) * sizeof (*groups));
+	if (NULL == tmp) {
+		log_err ("Out of memory.");
+		return NULL;
+	}
+	groups = tmp;
+
+	group = (c_psql_group_t *) malloc (sizeof (*group));
+	if (NULL == group) {
+		log_err ("Out of memory.");
+		return NULL;
+	}
+	memset (group, 0, sizeof (*group));
+	group->interval = interval;
+
+	memset (&ud, 0, sizeof (ud));
+	ud.data = group;
+	ud.free_func = c_psql_group_delete;
+
+	if (interval > 0)
+		ssnprintf (cb_name, sizeof (cb_name), "postgresql-%.3f",
+				CDTIME_T_TO_DOUBLE (interval));
+	else
+		sstrncpy (cb_name, "postgresql", sizeof (cb_name));
+
+	CDTIME_T_TO_TIMESPEC (interval, &cb_interval);
+
+	status = plugin_register_complex_read ("postgresql", cb_name, c_psql_read,
+			/* interval = */ (interval > 0) ? &cb_interval : NULL,
+			&ud);
+	if (0 != status) {
+		log_err ("Registering the read callback failed.");
+		sfree (group);
+		return NULL;
+	}
+
+	groups[groups_num] = group;
+	groups_num++;
+	return group;
+} /* c_psql_get_group */
+
+static int c_psql_config_database (oconfig_item_t *ci)
+{
+	c_psql_database_t  *db;
+	c_psql_group_t     *group;
+	c_psql_database_t **tmp;
+
 	int i;
 
 	if ((1 != ci->values_num)
@@ -595,8 +1093,6 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		return 1;
 	}
 
-	memset (&ud, 0, sizeof (ud));
-
 	db = c_psql_database_new (ci->values[0].value.string);
 	if (db == NULL)
 		return -1;
@@ -638,8 +1134,14 @@ static int c_psql_config_database (oconfig_item_t *ci)
 	if (db->queries_num > 0) {
 		db->q_prep_areas = (udb_query_preparation_area_t **) calloc (
 				db->queries_num, sizeof (*db->q_prep_areas));
-
-		if (db->q_prep_areas == NULL) {
+		db->q_states = (c_psql_query_state_t *) calloc (
+				db->queries_num, sizeof (*db->q_states));
+		/* at most prepare, execute and sync per query */
+		db->cmds = (c_psql_cmd_t *) calloc (
+				3 * db->queries_num, sizeof (*db->cmds));
+
+		if ((db->q_prep_areas == NULL) || (db->q_states == NULL)
+				|| (db->cmds == NULL)) {
 			log_err ("Out of memory.");
 			c_psql_database_delete (db);
 			return -1;
@@ -662,16 +1164,23 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		}
 	}
 
-	ud.data = db;
-	ud.free_func = c_psql_database_delete;
-
-	ssnprintf (cb_name, sizeof (cb_name), "postgresql-%s", db->database);
+	group = c_psql_get_group (db->interval);
+	if (group == NULL) {
+		c_psql_database_delete (db);
+		return -1;
+	}
 
-	CDTIME_T_TO_TIMESPEC (db->interval, &cb_interval);
+	tmp = (c_psql_database_t **) realloc (group->databases,
+			(group->databases_num + 1) * sizeof (*group->databases));
+	if (tmp == NULL) {
+		log_err ("Out of memory.");
+		c_psql_database_delete (db);
+		return -1;
+	}
+	group->databases = tmp;
+	group->databases[group->databases_num] = db;
+	group->databases_num++;
 
-	plugin_register_complex_read ("postgresql", cb_name, c_psql_read,
-			/* interval = */ (db->interval > 0) ? &cb_interval : NULL,
-			&ud);
 	return 0;
 } /* c_psql_config_database */
 
@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *values_list = NULL;
 
+static procfs_file_t *pf_snmp = NULL;
+static procfs_file_t *pf_netstat = NULL;
+
 /* 
  * Functions
  */
@@ -51,15 +55,17 @@ static void submit (const char *protocol_name,
 {
   value_t values[1];
   value_list_t vl = VALUE_LIST_INIT;
-  int status;
+  const char *digits = str_value;
 
-  status = parse_value (str_value, values, DS_TYPE_DERIVE);
-  if (status != 0)
+  if (*digits == '-')
+    digits++;
+  if ((*digits < '0') || (*digits > '9'))
   {
     ERROR ("protocols plugin: Parsing string as integer failed: %s",
         str_value);
     return;
   }
+  values[0].derive = (derive_t) procfs_atoll (str_value);
 
   vl.values = values;
   vl.values_len = 1;
@@ -72,11 +78,10 @@ static void submit (const char *protocol_name,
   plugin_dispatch_values (&vl);
 } /* void submit */
 
-static int read_file (const char *path)
+static int read_file (procfs_file_t **pf, const char *path)
 {
-  FILE *fh;
-  char key_buffer[4096];
-  char value_buffer[4096];
+  char *key_buffer;
+  char *value_buffer;
   char *key_ptr;
   char *value_ptr;
   char *key_fields[256];
@@ -86,40 +91,34 @@ static int read_file (const char *path)
   int status;
   int i;
 
-  fh = fopen (path, "r");
-  if (fh == NULL)
+  if ((*pf == NULL) && ((*pf = procfs_open (path)) == NULL))
   {
-    ERROR ("protocols plugin: fopen (%s) failed: %s.",
-        path, sstrerror (errno, key_buffer, sizeof (key_buffer)));
+    char errbuf[1024];
+    ERROR ("protocols plugin: procfs_open (%s) failed: %s.",
+        path, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (procfs_read (*pf) < 0)
+  {
+    char errbuf[1024];
+    ERROR ("protocols plugin: Reading from %s failed: %s.",
+        path, sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   status = -1;
   while (42)
   {
-    clearerr (fh);
-    key_ptr = fgets (key_buffer, sizeof (key_buffer), fh);
-    if (key_ptr == NULL)
+    key_buffer = procfs_next_line (*pf);
+    if (key_buffer == NULL)
     {
-      if (feof (fh) != 0)
-      {
-        status = 0;
-        break;
-      }
-      else if (ferror (fh) != 0)
-      {
-        ERROR ("protocols plugin: Reading from %s failed.", path);
-        break;
-      }
-      else
-      {
-        ERROR ("protocols plugin: fgets failed for an unknown reason.");
-        break;
-      }
-    } /* if (key_ptr == NULL) */
+      status = 0;
+      break;
+    }
 
-    value_ptr = fgets (value_buffer, sizeof (value_buffer), fh);
-    if (value_ptr == NULL)
+    value_buffer = procfs_next_line (*pf);
+    if (value_buffer == NULL)
     {
       ERROR ("protocols plugin: read_file (%s): Could not read values line.",
           path);
@@ -154,9 +153,9 @@ static int read_file (const char *path)
     }
 
 
-    key_fields_num = strsplit (key_ptr,
+    key_fields_num = procfs_split (key_ptr,
         key_fields, STATIC_ARRAY_SIZE (key_fields));
-    value_fields_num = strsplit (value_ptr,
+    value_fields_num = procfs_split (value_ptr,
         value_fields, STATIC_ARRAY_SIZE (value_fields));
 
     if (key_fields_num != value_fields_num)
@@ -184,8 +183,6 @@ static int read_file (const char *path)
     } /* for (i = 0; i < key_fields_num; i++) */
   } /* while (42) */
 
-  fclose (fh);
-
   return (status);
 } /* int read_file */
 
@@ -194,11 +191,11 @@ static int protocols_read (void)
   int status;
   int success = 0;
 
-  status = read_file (SNMP_FILE);
+  status = read_file (&pf_snmp, SNMP_FILE);
   if (status == 0)
     success++;
 
-  status = read_file (NETSTAT_FILE);
+  status = read_file (&pf_netstat, NETSTAT_FILE);
   if (status == 0)
     success++;
 
@@ -24,10 +24,66 @@
 #include "common.h"
 #include "utils_rrdcreate.h"
 
+#include "utils_avltree.h"
+
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+/* Interval in which the queue thread looks for timed out cache entries. */
+#define RC_SWEEP_INTERVAL TIME_T_TO_CDTIME_T (1)
+
+/* Cache entries without values are removed after this many sweep timeouts.
+ * They are kept around for a while so that files aren't stat'ed on every
+ * write. */
+#define RC_GC_FACTOR 10
+
+/*
+ * Private types
+ */
+/* Values for one file which have not been sent to the daemon yet. The
+ * update strings are stored back to back, separated by null bytes, so that
+ * adding a value doesn't require an allocation most of the time. */
+struct rc_cache_entry_s
+{
+  char    *values;
+  size_t   values_size;
+  size_t   values_fill;
+  int      values_num;
+
+  const data_set_t *ds;
+  cdtime_t interval;
+  cdtime_t first_value;
+  cdtime_t last_value;
+
+  /* Set once the file is known to exist. */
+  _Bool    file_exists;
+  /* Set by rc_flush() to have the daemon flush the file. */
+  _Bool    flush;
+};
+typedef struct rc_cache_entry_s rc_cache_entry_t;
+
+/* Values taken from the cache by the queue thread. */
+struct rc_batch_s
+{
+  const char *filename;
+  rc_cache_entry_t *entry;
+
+  char    *values;
+  int      values_num;
+
+  const data_set_t *ds;
+  cdtime_t interval;
+  cdtime_t first_value;
+  _Bool    file_exists;
+  _Bool    flush;
+};
+typedef struct rc_batch_s rc_batch_t;
+
 /*
  * Private variables
  */
@@ -35,6 +91,7 @@ static char *datadir = NULL;
 static char *daemon_address = NULL;
 static int config_create_files = 1;
 static int config_collect_stats = 1;
+static cdtime_t cache_timeout = 0;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -49,6 +106,26 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions_num = */ 0
 };
 
+/* XXX: Entries are only ever removed from the cache by the queue thread. The
+ * thread can therefore use entries and their keys without holding
+ * "cache_lock", as long as it doesn't touch the values. */
+static c_avl_tree_t   *cache = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cache_cond = PTHREAD_COND_INITIALIZER;
+static int             cache_values_num = 0;
+static _Bool           cache_flush_all = 0;
+static _Bool           cache_flush_some = 0;
+
+static pthread_t queue_thread;
+static int       queue_thread_running = 0;
+static int       do_shutdown = 0;
+
+/* Statistics about the client side cache, protected by "cache_lock". */
+static uint64_t stats_values_written = 0;
+static uint64_t stats_updates = 0;
+static uint64_t stats_failures = 0;
+static cdtime_t stats_update_time = 0;
+
 /*
  * Prototypes.
  */
@@ -161,6 +238,417 @@ static int value_list_to_filename (char *buffer, int buffer_len,
   return (0);
 } /* int value_list_to_filename */
 
+/* Creates the RRD file for a batch if it doesn't exist yet. */
+static int rc_batch_create_file (rc_batch_t *b) /* {{{ */
+{
+  struct stat statbuf;
+  value_list_t vl = VALUE_LIST_INIT;
+  int status;
+
+  if (b->file_exists || (config_create_files == 0))
+    return (0);
+
+  status = stat (b->filename, &statbuf);
+  if (status == 0)
+  {
+    b->file_exists = 1;
+    return (0);
+  }
+  else if (errno != ENOENT)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: stat (%s) failed: %s",
+        b->filename, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  /* cu_rrd_create_file only uses the time and interval of the value list. */
+  vl.time = b->first_value;
+  vl.interval = b->interval;
+  sstrncpy (vl.type, b->ds->type, sizeof (vl.type));
+
+  status = cu_rrd_create_file (b->filename, b->ds, &vl, &rrdcreate_config);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
+        b->filename);
+    return (-1);
+  }
+
+  b->file_exists = 1;
+  return (0);
+} /* }}} int rc_batch_create_file */
+
+/* Sends the values of one batch to the daemon. All values for one file are
+ * sent with a single command over the (persistent) connection. */
+static int rc_batch_write (rc_batch_t *b) /* {{{ */
+{
+  const char **values_array = NULL;
+  cdtime_t start;
+  cdtime_t duration;
+  char *ptr;
+  int status;
+  int i;
+
+  status = rrdc_connect (daemon_address);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
+        daemon_address, status);
+    return (-1);
+  }
+
+  if (b->values_num > 0)
+  {
+    status = rc_batch_create_file (b);
+    if (status != 0)
+      return (-1);
+
+    values_array = malloc (sizeof (*values_array) * (b->values_num + 1));
+    if (values_array == NULL)
+    {
+      ERROR ("rrdcached plugin: malloc failed.");
+      return (-1);
+    }
+
+    ptr = b->values;
+    for (i = 0; i < b->values_num; i++)
+    {
+      values_array[i] = ptr;
+      ptr += strlen (ptr) + 1;
+    }
+    values_array[b->values_num] = NULL;
+
+    start = cdtime ();
+    status = rrdc_update (b->filename, b->values_num, values_array);
+    duration = cdtime () - start;
+
+    pthread_mutex_lock (&cache_lock);
+    stats_updates++;
+    stats_update_time += duration;
+    if (status == 0)
+      stats_values_written += (uint64_t) b->values_num;
+    pthread_mutex_unlock (&cache_lock);
+
+    if (status != 0)
+    {
+      ERROR ("rrdcached plugin: rrdc_update (%s, [%s], %i) failed with "
+          "status %i.",
+          b->filename, values_array[0], b->values_num, status);
+      sfree (values_array);
+      return (-1);
+    }
+    sfree (values_array);
+  }
+
+  if (b->flush)
+  {
+    status = rrdc_flush (b->filename);
+    if (status != 0)
+    {
+      ERROR ("rrdcached plugin: rrdc_flush (%s) failed with status %i.",
+          b->filename, status);
+      return (-1);
+    }
+    DEBUG ("rrdcached plugin: rrdc_flush (%s): Success.", b->filename);
+  }
+
+  return (0);
+} /* }}} int rc_batch_write */
+
+/* Moves all values which are older than "timeout" from the cache to
+ * "ret_batch". Entries without values that haven't been updated for a long
+ * time are removed.
+ * XXX: You must hold "cache_lock" when calling this function! */
+static int rc_cache_take (cdtime_t timeout, /* {{{ */
+    rc_batch_t **ret_batch, size_t *ret_batch_num)
+{
+  rc_batch_t *batch = NULL;
+  size_t batch_num = 0;
+  size_t batch_size = 0;
+
+  char **gc_keys = NULL;
+  size_t gc_keys_num = 0;
+
+  c_avl_iterator_t *iter;
+  char *key;
+  rc_cache_entry_t *rc;
+  cdtime_t now;
+  cdtime_t gc_timeout;
+  size_t i;
+
+  now = cdtime ();
+  gc_timeout = RC_GC_FACTOR * ((cache_timeout > interval_g)
+      ? cache_timeout : interval_g);
+
+  iter = c_avl_get_iterator (cache);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
+  {
+    rc_batch_t *b;
+
+    if ((rc->values_num == 0) && !rc->flush)
+    {
+      if ((now - rc->last_value) > gc_timeout)
+      {
+        char **tmp = realloc (gc_keys, (gc_keys_num + 1) * sizeof (*gc_keys));
+        if (tmp == NULL)
+          continue;
+        gc_keys = tmp;
+        gc_keys[gc_keys_num] = key;
+        gc_keys_num++;
+      }
+      continue;
+    }
+
+    /* timeout == 0  =>  take everything */
+    if (!rc->flush && (timeout != 0)
+        && ((now - rc->first_value) < timeout))
+      continue;
+
+    if (batch_num >= batch_size)
+    {
+      size_t new_size = (batch_size > 0) ? (2 * batch_size) : 64;
+      rc_batch_t *tmp = realloc (batch, new_size * sizeof (*batch));
+      if (tmp == NULL)
+      {
+        ERROR ("rrdcached plugin: realloc failed.");
+        break;
+      }
+      batch = tmp;
+      batch_size = new_size;
+    }
+
+    b = batch + batch_num;
+    memset (b, 0, sizeof (*b));
+    b->filename = key;
+    b->entry = rc;
+    b->values = rc->values;
+    b->values_num = rc->values_num;
+    b->ds = rc->ds;
+    b->interval = rc->interval;
+    b->first_value = rc->first_value;
+    b->file_exists = rc->file_exists;
+    b->flush = rc->flush;
+    batch_num++;
+
+    cache_values_num -= rc->values_num;
+    rc->values = NULL;
+    rc->values_size = 0;
+    rc->values_fill = 0;
+    rc->values_num = 0;
+    rc->flush = 0;
+  }
+  c_avl_iterator_destroy (iter);
+
+  for (i = 0; i < gc_keys_num; i++)
+  {
+    if (c_avl_remove (cache, gc_keys[i], (void *) &key, (void *) &rc) != 0)
+      continue;
+
+    sfree (rc->values);
+    sfree (rc);
+    sfree (key);
+  }
+  sfree (gc_keys);
+
+  *ret_batch = batch;
+  *ret_batch_num = batch_num;
+  return (0);
+} /* }}} int rc_cache_take */
+
+static void *rc_queue_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  cdtime_t next_sweep = 0;
+
+  while (42)
+  {
+    rc_batch_t *batch = NULL;
+    size_t batch_num = 0;
+    cdtime_t timeout;
+    _Bool exit_thread;
+    size_t i;
+
+    pthread_mutex_lock (&cache_lock);
+    while (42)
+    {
+      struct timespec ts_wait;
+
+      if (do_shutdown || cache_flush_all || cache_flush_some)
+        break;
+
+      /* Without a cache timeout values are sent as soon as possible. */
+      if (cache_timeout == 0)
+      {
+        if (cache_values_num > 0)
+          break;
+        pthread_cond_wait (&cache_cond, &cache_lock);
+        continue;
+      }
+
+      if (cdtime () >= next_sweep)
+        break;
+
+      CDTIME_T_TO_TIMESPEC (next_sweep, &ts_wait);
+      pthread_cond_timedwait (&cache_cond, &cache_lock, &ts_wait);
+    }
+
+    timeout = (do_shutdown || cache_flush_all) ? 0 : cache_timeout;
+    exit_thread = (do_shutdown != 0);
+    cache_flush_all = 0;
+    cache_flush_some = 0;
+
+    rc_cache_take (timeout, &batch, &batch_num);
+    next_sweep = cdtime () + RC_SWEEP_INTERVAL;
+    pthread_mutex_unlock (&cache_lock);
+
+    for (i = 0; i < batch_num; i++)
+    {
+      int status;
+
+      status = rc_batch_write (batch + i);
+      if (status != 0)
+      {
+        pthread_mutex_lock (&cache_lock);
+        stats_failures++;
+        pthread_mutex_unlock (&cache_lock);
+      }
+
+      /* Remember that the file exists, so it isn't stat'ed again. */
+      if (batch[i].file_exists && !batch[i].entry->file_exists)
+      {
+        pthread_mutex_lock (&cache_lock);
+        batch[i].entry->file_exists = 1;
+        pthread_mutex_unlock (&cache_lock);
+      }
+
+      sfree (batch[i].values);
+    }
+    sfree (batch);
+
+    if (exit_thread)
+      break;
+  } /* while (42) */
+
+  return (NULL);
+} /* }}} void *rc_queue_thread */
+
+static int rc_cache_insert (const char *filename, const char *value, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  rc_cache_entry_t *rc = NULL;
+  size_t value_len;
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (cache == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    WARNING ("rrdcached plugin: cache == NULL.");
+    return (-1);
+  }
+
+  if (c_avl_get (cache, filename, (void *) &rc) != 0)
+  {
+    char *key;
+
+    rc = malloc (sizeof (*rc));
+    key = strdup (filename);
+    if ((rc == NULL) || (key == NULL))
+    {
+      pthread_mutex_unlock (&cache_lock);
+      ERROR ("rrdcached plugin: malloc failed.");
+      sfree (rc);
+      sfree (key);
+      return (-1);
+    }
+    memset (rc, 0, sizeof (*rc));
+
+    if (c_avl_insert (cache, key, rc) != 0)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      ERROR ("rrdcached plugin: c_avl_insert (%s) failed.", filename);
+      sfree (rc);
+      sfree (key);
+      return (-1);
+    }
+  }
+
+  if (rc->last_value >= vl->time)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    DEBUG ("rrdcached plugin: (rc->last_value = %"PRIu64") "
+        ">= (value_time = %"PRIu64")", rc->last_value, vl->time);
+    return (-1);
+  }
+
+  value_len = strlen (value) + 1;
+  if ((rc->values_fill + value_len) > rc->values_size)
+  {
+    size_t new_size;
+    char *tmp;
+
+    new_size = (rc->values_size > 0) ? rc->values_size : 256;
+    while (new_size < (rc->values_fill + value_len))
+      new_size *= 2;
+
+    tmp = realloc (rc->values, new_size);
+    if (tmp == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      ERROR ("rrdcached plugin: realloc failed.");
+      return (-1);
+    }
+    rc->values = tmp;
+    rc->values_size = new_size;
+  }
+
+  memcpy (rc->values + rc->values_fill, value, value_len);
+  rc->values_fill += value_len;
+  rc->values_num++;
+
+  if (rc->values_num == 1)
+    rc->first_value = vl->time;
+  rc->last_value = vl->time;
+  rc->ds = ds;
+  rc->interval = vl->interval;
+
+  cache_values_num++;
+  if ((cache_timeout == 0) && (cache_values_num == 1))
+    pthread_cond_signal (&cache_cond);
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (0);
+} /* }}} int rc_cache_insert */
+
+static void rc_cache_destroy (void) /* {{{ */
+{
+  void *key = NULL;
+  void *value = NULL;
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (cache == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return;
+  }
+
+  while (c_avl_pick (cache, &key, &value) == 0)
+  {
+    rc_cache_entry_t *rc = value;
+
+    sfree (rc->values);
+    sfree (rc);
+    sfree (key);
+  }
+
+  c_avl_destroy (cache);
+  cache = NULL;
+
+  pthread_mutex_unlock (&cache_lock);
+} /* }}} void rc_cache_destroy */
+
 static const char *config_get_string (oconfig_item_t *ci)
 {
   if ((ci->children_num != 0) || (ci->values_num != 1)
@@ -187,8 +675,16 @@ static int rc_config (oconfig_item_t *ci)
 
   for (i = 0; i < ci->children_num; ++i) {
     const char *key = ci->children[i].key;
-    const char *value = config_get_string (ci->children + i);
+    const char *value;
+
+    /* Numeric options */
+    if (strcasecmp ("CacheTimeout", key) == 0)
+    {
+      cf_util_get_cdtime (ci->children + i, &cache_timeout);
+      continue;
+    }
 
+    value = config_get_string (ci->children + i);
     if (value == NULL) /* config_get_strings prints error message */
       continue;
 
@@ -250,6 +746,64 @@ static int rc_config (oconfig_item_t *ci)
   return (0);
 } /* int rc_config */
 
+static void rc_submit (const char *type, const char *type_instance, /* {{{ */
+    value_t value)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "rrdcached", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, "client", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void rc_submit */
+
+/* Dispatches statistics about the client side cache. */
+static void rc_read_client_stats (void) /* {{{ */
+{
+  static uint64_t last_updates = 0;
+  static cdtime_t last_update_time = 0;
+
+  value_t values[6];
+  uint64_t updates;
+  cdtime_t update_time;
+
+  pthread_mutex_lock (&cache_lock);
+  if (cache == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return;
+  }
+  values[0].gauge = (gauge_t) cache_values_num;
+  values[1].gauge = (gauge_t) c_avl_size (cache);
+  values[2].derive = (derive_t) stats_values_written;
+  values[3].derive = (derive_t) stats_updates;
+  values[4].derive = (derive_t) stats_failures;
+  updates = stats_updates;
+  update_time = stats_update_time;
+  pthread_mutex_unlock (&cache_lock);
+
+  /* Average latency of the update commands since the last read. */
+  if (updates > last_updates)
+    values[5].gauge = CDTIME_T_TO_DOUBLE (update_time - last_update_time)
+      / ((double) (updates - last_updates));
+  else
+    values[5].gauge = NAN;
+  last_updates = updates;
+  last_update_time = update_time;
+
+  rc_submit ("queue_length", "values", values[0]);
+  rc_submit ("gauge", "files", values[1]);
+  rc_submit ("operations", "write-values", values[2]);
+  rc_submit ("operations", "write-updates", values[3]);
+  rc_submit ("operations", "write-failures", values[4]);
+  rc_submit ("latency", "update", values[5]);
+} /* }}} void rc_read_client_stats */
+
 static int rc_read (void)
 {
   int status;
@@ -265,6 +819,8 @@ static int rc_read (void)
   if (config_collect_stats == 0)
     return (-1);
 
+  rc_read_client_stats ();
+
   vl.values = values;
   vl.values_len = 1;
 
@@ -354,9 +910,34 @@ static int rc_read (void)
 
 static int rc_init (void)
 {
+  static int init_once = 0;
+  int status;
+
   if (config_collect_stats != 0)
     plugin_register_read ("rrdcached", rc_read);
 
+  if ((daemon_address == NULL) || (init_once != 0))
+    return (0);
+  init_once = 1;
+
+  pthread_mutex_lock (&cache_lock);
+  cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  pthread_mutex_unlock (&cache_lock);
+  if (cache == NULL)
+  {
+    ERROR ("rrdcached plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  status = pthread_create (&queue_thread, /* attr = */ NULL,
+      rc_queue_thread, /* args = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: Cannot create queue-thread.");
+    return (-1);
+  }
+  queue_thread_running = 1;
+
   return (0);
 } /* int rc_init */
 
@@ -365,8 +946,6 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
 {
   char filename[PATH_MAX];
   char values[512];
-  char *values_array[2];
-  int status;
 
   if (daemon_address == NULL)
   {
@@ -375,6 +954,9 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
+  if (do_shutdown)
+    return (0);
+
   if (strcmp (ds->type, vl->type) != 0)
   {
     ERROR ("rrdcached plugin: DS type does not match value list type");
@@ -393,52 +975,9 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
-  if (config_create_files != 0)
-  {
-    struct stat statbuf;
-
-    status = stat (filename, &statbuf);
-    if (status != 0)
-    {
-      if (errno != ENOENT)
-      {
-        char errbuf[1024];
-        ERROR ("rrdcached plugin: stat (%s) failed: %s",
-            filename, sstrerror (errno, errbuf, sizeof (errbuf)));
-        return (-1);
-      }
-
-      status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
-      if (status != 0)
-      {
-        ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
-            filename);
-        return (-1);
-      }
-    }
-  }
-
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
-    return (-1);
-  }
-
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
-    return (-1);
-  }
-
-  return (0);
+  /* The values are sent to the daemon by the queue thread, see
+   * rc_queue_thread(). */
+  return (rc_cache_insert (filename, values, ds, vl));
 } /* int rc_write */
 
 static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
@@ -446,16 +985,43 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
     __attribute__((unused)) user_data_t *ud)
 {
   char filename[PATH_MAX + 1];
+  rc_cache_entry_t *rc = NULL;
   int status;
 
+  pthread_mutex_lock (&cache_lock);
+
+  if (cache == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (0);
+  }
+
+  /* Without an identifier only the client side cache is flushed. */
   if (identifier == NULL)
-    return (EINVAL);
+  {
+    cache_flush_all = 1;
+    pthread_cond_signal (&cache_cond);
+    pthread_mutex_unlock (&cache_lock);
+    return (0);
+  }
 
   if (datadir != NULL)
     ssnprintf (filename, sizeof (filename), "%s/%s.rrd", datadir, identifier);
   else
     ssnprintf (filename, sizeof (filename), "%s.rrd", identifier);
 
+  /* The queue thread sends pending values before asking the daemon to flush
+   * the file, so that it flushes the most recent values, too. */
+  if (c_avl_get (cache, filename, (void *) &rc) == 0)
+  {
+    rc->flush = 1;
+    cache_flush_some = 1;
+    pthread_cond_signal (&cache_cond);
+    pthread_mutex_unlock (&cache_lock);
+    return (0);
+  }
+  pthread_mutex_unlock (&cache_lock);
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -478,6 +1044,26 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  pthread_mutex_lock (&cache_lock);
+  do_shutdown = 1;
+  pthread_cond_signal (&cache_cond);
+  pthread_mutex_unlock (&cache_lock);
+
+  /* Wait for all pending values to be sent to the daemon. */
+  if (queue_thread_running != 0)
+  {
+    if (cache_values_num > 0)
+      INFO ("rrdcached plugin: Sending %i pending values to the daemon. "
+          "This may take a while.", cache_values_num);
+
+    pthread_join (queue_thread, NULL);
+    memset (&queue_thread, 0, sizeof (queue_thread));
+    queue_thread_running = 0;
+    DEBUG ("rrdcached plugin: queue_thread exited.");
+  }
+
+  rc_cache_destroy ();
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
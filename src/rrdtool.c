@@ -38,13 +38,48 @@
 /*
  * Private types
  */
+/* Pending updates are stored as binary records, i.e. the time followed by
+ * "ds_num" value_t's, in chunks which are handed out by a simple slab
+ * allocator. The records are converted to strings only when they are written
+ * to the RRD file. New cache entries start with a small chunk, further chunks
+ * are larger. */
+#define RRD_CHUNK_SMALL 128
+#define RRD_CHUNK_LARGE 1024
+#define RRD_SLAB_SIZE   65536
+
+struct rrd_chunk_s
+{
+	struct rrd_chunk_s *next;
+	uint32_t fill;
+	uint32_t size;
+	/* "size" bytes of data follow */
+};
+typedef struct rrd_chunk_s rrd_chunk_t;
+
+#define RRD_CHUNK_DATA(c) (((char *) (c)) + sizeof (rrd_chunk_t))
+
+struct rrd_slab_class_s
+{
+	uint32_t     chunk_size;
+	rrd_chunk_t *free_list;
+	void       **slabs;
+	size_t       slabs_num;
+	size_t       chunks_used;
+};
+typedef struct rrd_slab_class_s rrd_slab_class_t;
+
 struct rrd_cache_s
 {
 	int      values_num;
-	char   **values;
+	const data_set_t *ds;
+	rrd_chunk_t *chunks_head;
+	rrd_chunk_t *chunks_tail;
 	cdtime_t first_value;
 	cdtime_t last_value;
 	int64_t  random_variation;
+	/* Set while the RRD file is being created. Values are buffered but not
+	 * queued for writing until the creator thread is done. */
+	_Bool    creating;
 	enum
 	{
 		FLAG_NONE   = 0x00,
@@ -68,6 +103,16 @@ struct rrd_queue_s
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+struct rrd_create_queue_s
+{
+	char *filename;
+	const data_set_t *ds;
+	cdtime_t time;
+	cdtime_t interval;
+	struct rrd_create_queue_s *next;
+};
+typedef struct rrd_create_queue_s rrd_create_queue_t;
+
 /*
  * Private variables
  */
@@ -82,7 +127,9 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"CreateFilesPerSecond",
+	"CollectStatistics"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -91,6 +138,7 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
  * being used. */
 static char *datadir   = NULL;
 static double write_rate = 0.0;
+static double create_rate = 0.0;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -112,6 +160,7 @@ static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
 static cdtime_t    cache_flush_last;
 static c_avl_tree_t *cache = NULL;
+static int          cache_values_num = 0;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static rrd_queue_t    *queue_head = NULL;
@@ -123,10 +172,37 @@ static int             queue_thread_running = 1;
 static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
 
+/* New RRD files are created by a separate thread so that a burst of new
+ * identifiers doesn't block rrd_write(). "createq_lock" may be acquired while
+ * holding "cache_lock", but not the other way around. */
+static rrd_create_queue_t *createq_head = NULL;
+static rrd_create_queue_t *createq_tail = NULL;
+static int             createq_length = 0;
+static pthread_t       create_thread;
+static int             create_thread_running = 0;
+static int             create_shutdown = 0;
+static pthread_mutex_t createq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  createq_cond = PTHREAD_COND_INITIALIZER;
+
+/* Files known to exist, so rrd_write() doesn't need to stat(2) them. */
+static c_avl_tree_t   *known_files = NULL;
+static pthread_mutex_t known_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/* XXX: "slab_lock" may be acquired while holding "cache_lock", but not the
+ * other way around. */
+static rrd_slab_class_t slab_classes[] =
+{
+	{ RRD_CHUNK_SMALL, NULL, NULL, 0, 0 },
+	{ RRD_CHUNK_LARGE, NULL, NULL, 0, 0 }
+};
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Bool collect_stats = 0;
+
 static int do_shutdown = 0;
 
 #if HAVE_THREADSAFE_LIBRRD
@@ -284,6 +360,267 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 	return (0);
 } /* int value_list_to_filename */
 
+static _Bool rrd_file_is_known (const char *filename) /* {{{ */
+{
+	int status;
+
+	pthread_mutex_lock (&known_files_lock);
+	if (known_files == NULL)
+		status = -1;
+	else
+		status = c_avl_get (known_files, filename, /* value = */ NULL);
+	pthread_mutex_unlock (&known_files_lock);
+
+	return (status == 0);
+} /* }}} _Bool rrd_file_is_known */
+
+static void rrd_file_set_known (const char *filename) /* {{{ */
+{
+	char *key;
+
+	pthread_mutex_lock (&known_files_lock);
+
+	if ((known_files == NULL)
+			|| (c_avl_get (known_files, filename, NULL) == 0))
+	{
+		pthread_mutex_unlock (&known_files_lock);
+		return;
+	}
+
+	key = strdup (filename);
+	if (key == NULL)
+	{
+		pthread_mutex_unlock (&known_files_lock);
+		ERROR ("rrdtool plugin: strdup failed.");
+		return;
+	}
+
+	if (c_avl_insert (known_files, key, /* value = */ NULL) != 0)
+		sfree (key);
+
+	pthread_mutex_unlock (&known_files_lock);
+} /* }}} void rrd_file_set_known */
+
+static void rrd_file_set_unknown (const char *filename) /* {{{ */
+{
+	char *key = NULL;
+
+	pthread_mutex_lock (&known_files_lock);
+	if (known_files != NULL)
+		c_avl_remove (known_files, filename, (void *) &key, NULL);
+	pthread_mutex_unlock (&known_files_lock);
+
+	sfree (key);
+} /* }}} void rrd_file_set_unknown */
+
+static rrd_chunk_t *rrd_chunk_alloc (size_t class_index) /* {{{ */
+{
+	rrd_slab_class_t *sc;
+	rrd_chunk_t *chunk;
+
+	assert (class_index < STATIC_ARRAY_SIZE (slab_classes));
+	sc = slab_classes + class_index;
+
+	pthread_mutex_lock (&slab_lock);
+
+	if (sc->free_list == NULL)
+	{
+		size_t chunk_total = sizeof (rrd_chunk_t) + sc->chunk_size;
+		size_t chunks_num = RRD_SLAB_SIZE / chunk_total;
+		void **tmp;
+		char *slab;
+		size_t i;
+
+		tmp = realloc (sc->slabs, (sc->slabs_num + 1) * sizeof (*sc->slabs));
+		if (tmp == NULL)
+		{
+			pthread_mutex_unlock (&slab_lock);
+			ERROR ("rrdtool plugin: realloc failed.");
+			return (NULL);
+		}
+		sc->slabs = tmp;
+
+		slab = malloc (chunks_num * chunk_total);
+		if (slab == NULL)
+		{
+			pthread_mutex_unlock (&slab_lock);
+			ERROR ("rrdtool plugin: malloc failed.");
+			return (NULL);
+		}
+		sc->slabs[sc->slabs_num] = slab;
+		sc->slabs_num++;
+
+		for (i = 0; i < chunks_num; i++)
+		{
+			chunk = (rrd_chunk_t *) (slab + i * chunk_total);
+			chunk->size = sc->chunk_size;
+			chunk->next = sc->free_list;
+			sc->free_list = chunk;
+		}
+	}
+
+	chunk = sc->free_list;
+	sc->free_list = chunk->next;
+	sc->chunks_used++;
+
+	pthread_mutex_unlock (&slab_lock);
+
+	chunk->next = NULL;
+	chunk->fill = 0;
+	return (chunk);
+} /* }}} rrd_chunk_t *rrd_chunk_alloc */
+
+/* Returns a list of chunks to the slab allocator. */
+static void rrd_chunks_free (rrd_chunk_t *chunk) /* {{{ */
+{
+	pthread_mutex_lock (&slab_lock);
+	while (chunk != NULL)
+	{
+		rrd_chunk_t *next = chunk->next;
+		rrd_slab_class_t *sc;
+
+		sc = (chunk->size == RRD_CHUNK_SMALL)
+			? slab_classes + 0 : slab_classes + 1;
+
+		chunk->next = sc->free_list;
+		sc->free_list = chunk;
+		sc->chunks_used--;
+
+		chunk = next;
+	}
+	pthread_mutex_unlock (&slab_lock);
+} /* }}} void rrd_chunks_free */
+
+static void rrd_slabs_destroy (void) /* {{{ */
+{
+	size_t i;
+	size_t j;
+
+	pthread_mutex_lock (&slab_lock);
+	for (i = 0; i < STATIC_ARRAY_SIZE (slab_classes); i++)
+	{
+		rrd_slab_class_t *sc = slab_classes + i;
+
+		for (j = 0; j < sc->slabs_num; j++)
+			sfree (sc->slabs[j]);
+		sfree (sc->slabs);
+		sc->slabs_num = 0;
+		sc->free_list = NULL;
+		sc->chunks_used = 0;
+	}
+	pthread_mutex_unlock (&slab_lock);
+} /* }}} void rrd_slabs_destroy */
+
+static size_t rrd_record_size (const data_set_t *ds) /* {{{ */
+{
+	return (sizeof (cdtime_t) + ds->ds_num * sizeof (value_t));
+} /* }}} size_t rrd_record_size */
+
+static int record_to_string (char *buffer, int buffer_len, /* {{{ */
+		const data_set_t *ds, const char *record)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[ds->ds_num];
+	cdtime_t t;
+
+	/* Records are not aligned within the chunks. */
+	memcpy (&t, record, sizeof (t));
+	memcpy (values, record + sizeof (t), sizeof (values));
+
+	vl.time = t;
+	vl.values = values;
+	vl.values_len = ds->ds_num;
+
+	return (value_list_to_string (buffer, buffer_len, ds, &vl));
+} /* }}} int record_to_string */
+
+/* Converts "values_num" binary records to the string arguments expected by
+ * rrd_update. The strings are stored in one buffer which is returned in
+ * "ret_buffer", the pointers into it in "ret_argv". */
+static int rrd_records_to_argv (const data_set_t *ds, /* {{{ */
+		const rrd_chunk_t *chunks, int values_num,
+		char **ret_buffer, char ***ret_argv)
+{
+	size_t record_size;
+	size_t buffer_size;
+	size_t buffer_fill;
+	size_t *offsets;
+	char *buffer;
+	char **argv;
+	const rrd_chunk_t *c;
+	int argc;
+	int i;
+
+	record_size = rrd_record_size (ds);
+
+	offsets = malloc (values_num * sizeof (*offsets));
+	argv = malloc ((values_num + 1) * sizeof (*argv));
+	buffer_size = 32 * values_num * ds->ds_num;
+	if (buffer_size < 512)
+		buffer_size = 512;
+	buffer = malloc (buffer_size);
+	if ((offsets == NULL) || (argv == NULL) || (buffer == NULL))
+	{
+		ERROR ("rrdtool plugin: malloc failed.");
+		sfree (offsets);
+		sfree (argv);
+		sfree (buffer);
+		return (-1);
+	}
+	buffer_fill = 0;
+
+	argc = 0;
+	for (c = chunks; (c != NULL) && (argc < values_num); c = c->next)
+	{
+		size_t pos;
+
+		for (pos = 0; (pos + record_size) <= c->fill; pos += record_size)
+		{
+			char tmp[512];
+			size_t len;
+
+			if (record_to_string (tmp, sizeof (tmp), ds,
+						RRD_CHUNK_DATA (c) + pos) != 0)
+				continue;
+
+			len = strlen (tmp) + 1;
+			if ((buffer_fill + len) > buffer_size)
+			{
+				char *new_buffer;
+
+				while ((buffer_fill + len) > buffer_size)
+					buffer_size *= 2;
+				new_buffer = realloc (buffer, buffer_size);
+				if (new_buffer == NULL)
+				{
+					ERROR ("rrdtool plugin: realloc failed.");
+					sfree (offsets);
+					sfree (argv);
+					sfree (buffer);
+					return (-1);
+				}
+				buffer = new_buffer;
+			}
+
+			memcpy (buffer + buffer_fill, tmp, len);
+			offsets[argc] = buffer_fill;
+			buffer_fill += len;
+			argc++;
+		}
+	}
+
+	/* The buffer may have been moved by realloc, so pointers are only
+	 * computed at the end. */
+	for (i = 0; i < argc; i++)
+		argv[i] = buffer + offsets[i];
+	argv[argc] = NULL;
+	sfree (offsets);
+
+	*ret_buffer = buffer;
+	*ret_argv = argv;
+	return (argc);
+} /* }}} int rrd_records_to_argv */
+
 static void *rrd_queue_thread (void __attribute__((unused)) *data)
 {
         struct timeval tv_next_update;
@@ -295,11 +632,16 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	{
 		rrd_queue_t *queue_entry;
 		rrd_cache_t *cache_entry;
+		rrd_chunk_t *chunks;
+		const data_set_t *ds;
+		char  *values_buffer;
 		char **values;
 		int    values_num;
 		int    status;
-		int    i;
 
+		chunks = NULL;
+		ds = NULL;
+		values_buffer = NULL;
 		values = NULL;
 		values_num = 0;
 
@@ -387,18 +729,37 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 
 		if (status == 0)
 		{
-			values = cache_entry->values;
+			chunks = cache_entry->chunks_head;
 			values_num = cache_entry->values_num;
+			ds = cache_entry->ds;
 
-			cache_entry->values = NULL;
+			cache_entry->chunks_head = NULL;
+			cache_entry->chunks_tail = NULL;
+			cache_values_num -= cache_entry->values_num;
 			cache_entry->values_num = 0;
 			cache_entry->flags = FLAG_NONE;
 		}
 
 		pthread_mutex_unlock (&cache_lock);
 
-		if (status != 0)
+		if ((status != 0) || (values_num == 0))
 		{
+			rrd_chunks_free (chunks);
+			sfree (queue_entry->filename);
+			sfree (queue_entry);
+			continue;
+		}
+
+		/* Convert the binary records to strings, then give the chunks
+		 * back to the allocator. */
+		values_num = rrd_records_to_argv (ds, chunks, values_num,
+				&values_buffer, &values);
+		rrd_chunks_free (chunks);
+		chunks = NULL;
+		if (values_num <= 0)
+		{
+			sfree (values_buffer);
+			sfree (values);
 			sfree (queue_entry->filename);
 			sfree (queue_entry);
 			continue;
@@ -419,16 +780,23 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                 }
 
 		/* Write the values to the RRD-file */
-		srrd_update (queue_entry->filename, NULL,
+		status = srrd_update (queue_entry->filename, NULL,
 				values_num, (const char **)values);
+		if (status != 0)
+		{
+			struct stat statbuf;
+
+			/* If the file has been removed, forget about it so it's
+			 * created again. */
+			if ((stat (queue_entry->filename, &statbuf) != 0)
+					&& (errno == ENOENT))
+				rrd_file_set_unknown (queue_entry->filename);
+		}
 		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
 				values_num, (values_num == 1) ? "" : "s",
 				queue_entry->filename);
 
-		for (i = 0; i < values_num; i++)
-		{
-			sfree (values[i]);
-		}
+		sfree (values_buffer);
 		sfree (values);
 		sfree (queue_entry->filename);
 		sfree (queue_entry);
@@ -512,6 +880,159 @@ static int rrd_queue_dequeue (const char *filename,
   return (0);
 } /* int rrd_queue_dequeue */
 
+/* XXX: You must hold "cache_lock" when calling this function! */
+static int rrd_create_enqueue (const char *filename, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	rrd_create_queue_t *entry;
+
+	entry = malloc (sizeof (*entry));
+	if (entry == NULL)
+		return (-1);
+
+	entry->filename = strdup (filename);
+	if (entry->filename == NULL)
+	{
+		sfree (entry);
+		return (-1);
+	}
+	entry->ds = ds;
+	entry->time = vl->time;
+	entry->interval = vl->interval;
+	entry->next = NULL;
+
+	pthread_mutex_lock (&createq_lock);
+
+	if (createq_tail == NULL)
+		createq_head = entry;
+	else
+		createq_tail->next = entry;
+	createq_tail = entry;
+	createq_length++;
+
+	pthread_cond_signal (&createq_cond);
+	pthread_mutex_unlock (&createq_lock);
+
+	return (0);
+} /* }}} int rrd_create_enqueue */
+
+/* Called by the creator thread when it's done with a file. If the file has
+ * been created, values which have been buffered in the meantime are queued
+ * for writing. Otherwise they are dropped. */
+static void rrd_cache_file_created (const char *filename, /* {{{ */
+		int create_status)
+{
+	rrd_cache_t *rc = NULL;
+	char *key = NULL;
+
+	pthread_mutex_lock (&cache_lock);
+
+	if ((cache == NULL)
+			|| (c_avl_get (cache, filename, (void *) &rc) != 0))
+	{
+		pthread_mutex_unlock (&cache_lock);
+		return;
+	}
+
+	if (create_status == 0)
+	{
+		rc->creating = 0;
+		if ((rc->values_num > 0) && (rc->flags == FLAG_NONE))
+		{
+			if (rrd_queue_enqueue (filename,
+						&queue_head, &queue_tail) == 0)
+				rc->flags = FLAG_QUEUED;
+		}
+		pthread_mutex_unlock (&cache_lock);
+		return;
+	}
+
+	/* Creating the file failed: Remove the entry, so the next value will
+	 * try again. */
+	c_avl_remove (cache, filename, (void *) &key, (void *) &rc);
+	cache_values_num -= rc->values_num;
+
+	pthread_mutex_unlock (&cache_lock);
+
+	rrd_chunks_free (rc->chunks_head);
+	sfree (rc);
+	sfree (key);
+} /* }}} void rrd_cache_file_created */
+
+static void *rrd_create_thread (void __attribute__((unused)) *data) /* {{{ */
+{
+	cdtime_t next_create = 0;
+
+	pthread_mutex_lock (&createq_lock);
+
+	while (42)
+	{
+		rrd_create_queue_t *entry;
+		value_list_t vl = VALUE_LIST_INIT;
+		struct stat statbuf;
+		int status;
+
+		while ((createq_head == NULL) && (create_shutdown == 0))
+			pthread_cond_wait (&createq_cond, &createq_lock);
+
+		if (createq_head == NULL)
+			break;
+
+		/* Limit the rate in which files are created, unless we're
+		 * shutting down. */
+		if ((create_rate > 0.0) && (create_shutdown == 0))
+		{
+			cdtime_t now = cdtime ();
+
+			if (now < next_create)
+			{
+				struct timespec ts_wait;
+
+				CDTIME_T_TO_TIMESPEC (next_create, &ts_wait);
+				pthread_cond_timedwait (&createq_cond, &createq_lock,
+						&ts_wait);
+				continue;
+			}
+		}
+
+		entry = createq_head;
+		createq_head = entry->next;
+		if (createq_head == NULL)
+			createq_tail = NULL;
+		createq_length--;
+
+		pthread_mutex_unlock (&createq_lock);
+
+		vl.time = entry->time;
+		vl.interval = entry->interval;
+
+		/* The file may have been created by someone else in the
+		 * meantime. */
+		if (stat (entry->filename, &statbuf) == 0)
+			status = 0;
+		else
+			status = cu_rrd_create_file (entry->filename,
+					entry->ds, &vl, &rrdcreate_config);
+
+		if (status == 0)
+			rrd_file_set_known (entry->filename);
+		rrd_cache_file_created (entry->filename, status);
+
+		if (create_rate > 0.0)
+			next_create = cdtime () + DOUBLE_TO_CDTIME_T (create_rate);
+
+		sfree (entry->filename);
+		sfree (entry);
+
+		pthread_mutex_lock (&createq_lock);
+	} /* while (42) */
+
+	pthread_mutex_unlock (&createq_lock);
+
+	pthread_exit ((void *) 0);
+	return ((void *) 0);
+} /* }}} void *rrd_create_thread */
+
 /* XXX: You must hold "cache_lock" when calling this function! */
 static void rrd_cache_flush (cdtime_t timeout)
 {
@@ -535,7 +1056,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 	iter = c_avl_get_iterator (cache);
 	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
 	{
-		if (rc->flags != FLAG_NONE)
+		if ((rc->flags != FLAG_NONE) || rc->creating)
 			continue;
 		/* timeout == 0  =>  flush everything */
 		else if ((timeout != 0)
@@ -579,7 +1100,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 			continue;
 		}
 
-		assert (rc->values == NULL);
+		assert (rc->chunks_head == NULL);
 		assert (rc->values_num == 0);
 
 		sfree (rc);
@@ -625,7 +1146,7 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
     return (status);
   }
 
-  if (rc->flags == FLAG_FLUSHQ)
+  if ((rc->flags == FLAG_FLUSHQ) || rc->creating)
   {
     status = 0;
   }
@@ -686,11 +1207,21 @@ static int64_t rrd_get_random_variation (void)
 } /* int64_t rrd_get_random_variation */
 
 static int rrd_cache_insert (const char *filename,
-		const char *value, cdtime_t value_time)
+		const data_set_t *ds, const value_list_t *vl, _Bool file_exists)
 {
 	rrd_cache_t *rc = NULL;
 	int new_rc = 0;
-	char **values_new;
+	size_t record_size;
+	rrd_chunk_t *chunk;
+	char *record;
+
+	record_size = rrd_record_size (ds);
+	if (record_size > RRD_CHUNK_LARGE)
+	{
+		ERROR ("rrdtool plugin: Type \"%s\" has too many data sources.",
+				ds->type);
+		return (-1);
+	}
 
 	pthread_mutex_lock (&cache_lock);
 
@@ -709,53 +1240,86 @@ static int rrd_cache_insert (const char *filename,
 	{
 		rc = malloc (sizeof (*rc));
 		if (rc == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
 			return (-1);
+		}
 		rc->values_num = 0;
-		rc->values = NULL;
+		rc->ds = ds;
+		rc->chunks_head = NULL;
+		rc->chunks_tail = NULL;
 		rc->first_value = 0;
 		rc->last_value = 0;
 		rc->random_variation = rrd_get_random_variation ();
+		rc->creating = file_exists ? 0 : 1;
 		rc->flags = FLAG_NONE;
 		new_rc = 1;
 	}
 
-	if (rc->last_value >= value_time)
+	if (rc->last_value >= vl->time)
 	{
 		pthread_mutex_unlock (&cache_lock);
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
-				rc->last_value, value_time);
+				rc->last_value, vl->time);
+		if (new_rc)
+			sfree (rc);
 		return (-1);
 	}
 
-	values_new = (char **) realloc ((void *) rc->values,
-			(rc->values_num + 1) * sizeof (char *));
-	if (values_new == NULL)
+	/* Get a chunk with enough room for one more record. The first chunk of
+	 * an entry is a small one, which is enough for most entries when the
+	 * cache is disabled. */
+	chunk = rc->chunks_tail;
+	if ((chunk == NULL) || ((chunk->fill + record_size) > chunk->size))
 	{
-		char errbuf[1024];
-		void *cache_key = NULL;
-
-		sstrerror (errno, errbuf, sizeof (errbuf));
+		size_t class_index;
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
-		pthread_mutex_unlock (&cache_lock);
-
-		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
+		class_index = ((rc->chunks_head == NULL)
+				&& (record_size <= RRD_CHUNK_SMALL)) ? 0 : 1;
+		chunk = rrd_chunk_alloc (class_index);
+		if (chunk == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
+			if (new_rc)
+				sfree (rc);
+			return (-1);
+		}
 
-		sfree (cache_key);
-		sfree (rc->values);
-		sfree (rc);
-		return (-1);
+		if (rc->chunks_tail == NULL)
+			rc->chunks_head = chunk;
+		else
+			rc->chunks_tail->next = chunk;
+		rc->chunks_tail = chunk;
 	}
-	rc->values = values_new;
 
-	rc->values[rc->values_num] = strdup (value);
-	if (rc->values[rc->values_num] != NULL)
-		rc->values_num++;
+	record = RRD_CHUNK_DATA (chunk) + chunk->fill;
+	memcpy (record, &vl->time, sizeof (vl->time));
+	memcpy (record + sizeof (vl->time), vl->values,
+			ds->ds_num * sizeof (value_t));
+	chunk->fill += record_size;
+
+	rc->values_num++;
+	cache_values_num++;
+	rc->ds = ds;
 
 	if (rc->values_num == 1)
-		rc->first_value = value_time;
-	rc->last_value = value_time;
+		rc->first_value = vl->time;
+	rc->last_value = vl->time;
+
+	/* The queue thread forgets about files which have been removed. Create
+	 * them again, starting before the oldest buffered value. */
+	if (!new_rc && !file_exists && !rc->creating)
+	{
+		value_list_t vl_create = *vl;
+
+		vl_create.time = rc->first_value;
+		if (rrd_create_enqueue (filename, ds, &vl_create) == 0)
+			rc->creating = 1;
+		else
+			ERROR ("rrdtool plugin: Queueing the creation of "
+					"\"%s\" failed.", filename);
+	}
 
 	/* Insert if this is the first value */
 	if (new_rc == 1)
@@ -767,16 +1331,31 @@ static int rrd_cache_insert (const char *filename,
 			char errbuf[1024];
 			sstrerror (errno, errbuf, sizeof (errbuf));
 
+			cache_values_num -= rc->values_num;
 			pthread_mutex_unlock (&cache_lock);
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
-			sfree (rc->values[0]);
-			sfree (rc->values);
+			rrd_chunks_free (rc->chunks_head);
 			sfree (rc);
 			return (-1);
 		}
 
+		if (rc->creating
+				&& (rrd_create_enqueue (filename, ds, vl) != 0))
+		{
+			cache_values_num -= rc->values_num;
+			pthread_mutex_unlock (&cache_lock);
+
+			ERROR ("rrdtool plugin: Queueing the creation of "
+					"\"%s\" failed.", filename);
+
+			rrd_chunks_free (rc->chunks_head);
+			sfree (rc);
+			sfree (cache_key);
+			return (-1);
+		}
+
 		c_avl_insert (cache, cache_key, rc);
 	}
 
@@ -785,7 +1364,11 @@ static int rrd_cache_insert (const char *filename,
 			filename, rc->values_num,
 			CDTIME_T_TO_DOUBLE (rc->last_value - rc->first_value));
 
-	if ((rc->last_value - rc->first_value) >= (cache_timeout + rc->random_variation))
+	if (rc->creating)
+	{
+		DEBUG ("rrdtool plugin: `%s' is being created.", filename);
+	}
+	else if ((rc->last_value - rc->first_value) >= (cache_timeout + rc->random_variation))
 	{
 		/* XXX: If you need to lock both, cache_lock and queue_lock, at
 		 * the same time, ALWAYS lock `cache_lock' first! */
@@ -832,7 +1415,6 @@ static int rrd_cache_destroy (void) /* {{{ */
   while (c_avl_pick (cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
-    int i;
 
     sfree (key);
     key = NULL;
@@ -843,14 +1425,13 @@ static int rrd_cache_destroy (void) /* {{{ */
     if (rc->values_num > 0)
       non_empty++;
 
-    for (i = 0; i < rc->values_num; i++)
-      sfree (rc->values[i]);
-    sfree (rc->values);
+    rrd_chunks_free (rc->chunks_head);
     sfree (rc);
   }
 
   c_avl_destroy (cache);
   cache = NULL;
+  cache_values_num = 0;
 
   if (non_empty > 0)
   {
@@ -883,9 +1464,8 @@ static int rrd_compare_numeric (const void *a_ptr, const void *b_ptr)
 static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
 	char         filename[512];
-	char         values[512];
+	_Bool        file_exists;
 	int          status;
 
 	if (do_shutdown)
@@ -899,35 +1479,38 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 	if (value_list_to_filename (filename, sizeof (filename), ds, vl) != 0)
 		return (-1);
 
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
-		return (-1);
-
-	if (stat (filename, &statbuf) == -1)
+	/* Missing files are created by the creator thread. Until then, values
+	 * are buffered in the cache. */
+	file_exists = rrd_file_is_known (filename);
+	if (!file_exists)
 	{
-		if (errno == ENOENT)
+		struct stat statbuf;
+
+		if (stat (filename, &statbuf) == -1)
 		{
-			status = cu_rrd_create_file (filename,
-					ds, vl, &rrdcreate_config);
-			if (status != 0)
+			if (errno != ENOENT)
+			{
+				char errbuf[1024];
+				ERROR ("stat(%s) failed: %s", filename,
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
 				return (-1);
+			}
 		}
-		else
+		else if (!S_ISREG (statbuf.st_mode))
 		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			ERROR ("stat(%s): Not a regular file!",
+					filename);
 			return (-1);
 		}
-	}
-	else if (!S_ISREG (statbuf.st_mode))
-	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
-		return (-1);
+		else
+		{
+			rrd_file_set_known (filename);
+			file_exists = 1;
+		}
 	}
 
-	status = rrd_cache_insert (filename, values, vl->time);
+	status = rrd_cache_insert (filename, ds, vl, file_exists);
 
 	return (status);
 } /* int rrd_write */
@@ -1092,6 +1675,29 @@ static int rrd_config (const char *key, const char *value)
 			write_rate = 1.0 / wps;
 		}
 	}
+	else if (strcasecmp ("CreateFilesPerSecond", key) == 0)
+	{
+		double cps = atof (value);
+
+		if (cps < 0.0)
+		{
+			fprintf (stderr, "rrdtool: `CreateFilesPerSecond' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		else if (cps == 0.0)
+		{
+			create_rate = 0.0;
+		}
+		else
+		{
+			create_rate = 1.0 / cps;
+		}
+	}
+	else if (strcasecmp ("CollectStatistics", key) == 0)
+	{
+		collect_stats = IS_TRUE (value) ? 1 : 0;
+	}
 	else if (strcasecmp ("RandomTimeout", key) == 0)
         {
 		double tmp;
@@ -1116,8 +1722,89 @@ static int rrd_config (const char *key, const char *value)
 	return (0);
 } /* int rrd_config */
 
+static void rrd_submit (const char *type, const char *type_instance, /* {{{ */
+		gauge_t value)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	values[0].gauge = value;
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "rrdtool", sizeof (vl.plugin));
+	sstrncpy (vl.type, type, sizeof (vl.type));
+	sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* }}} void rrd_submit */
+
+/* Reports the memory used by the cache of pending updates. */
+static int rrd_read (void) /* {{{ */
+{
+	gauge_t slab_bytes = 0.0;
+	gauge_t chunk_bytes = 0.0;
+	gauge_t entries_num;
+	gauge_t values_num;
+	gauge_t create_num;
+	size_t i;
+
+	pthread_mutex_lock (&cache_lock);
+	entries_num = (gauge_t) c_avl_size (cache);
+	values_num = (gauge_t) cache_values_num;
+	pthread_mutex_unlock (&cache_lock);
+
+	pthread_mutex_lock (&createq_lock);
+	create_num = (gauge_t) createq_length;
+	pthread_mutex_unlock (&createq_lock);
+
+	pthread_mutex_lock (&slab_lock);
+	for (i = 0; i < STATIC_ARRAY_SIZE (slab_classes); i++)
+	{
+		rrd_slab_class_t *sc = slab_classes + i;
+		size_t chunk_total = sizeof (rrd_chunk_t) + sc->chunk_size;
+
+		slab_bytes += (gauge_t) (sc->slabs_num
+				* (RRD_SLAB_SIZE / chunk_total) * chunk_total);
+		chunk_bytes += (gauge_t) (sc->chunks_used * chunk_total);
+	}
+	pthread_mutex_unlock (&slab_lock);
+
+	rrd_submit ("memory", "slabs", slab_bytes);
+	rrd_submit ("memory", "chunks_used", chunk_bytes);
+	rrd_submit ("memory", "cache_entries",
+			entries_num * (gauge_t) sizeof (rrd_cache_t));
+	rrd_submit ("cache_size", "", entries_num);
+	rrd_submit ("queue_length", "values", values_num);
+	rrd_submit ("queue_length", "create", create_num);
+
+	return (0);
+} /* }}} int rrd_read */
+
 static int rrd_shutdown (void)
 {
+	int create_pending;
+
+	/* Create the remaining files first, so their values can be written
+	 * below. The rate limit is ignored while shutting down. */
+	pthread_mutex_lock (&createq_lock);
+	create_shutdown = 1;
+	create_pending = createq_length;
+	pthread_cond_signal (&createq_cond);
+	pthread_mutex_unlock (&createq_lock);
+
+	if (create_thread_running != 0)
+	{
+		if (create_pending > 0)
+			INFO ("rrdtool plugin: Creating %i remaining RRD file%s.",
+					create_pending, (create_pending == 1) ? "" : "s");
+		pthread_join (create_thread, NULL);
+		memset (&create_thread, 0, sizeof (create_thread));
+		create_thread_running = 0;
+		DEBUG ("rrdtool plugin: create_thread exited.");
+	}
+
 	pthread_mutex_lock (&cache_lock);
 	rrd_cache_flush (0);
 	pthread_mutex_unlock (&cache_lock);
@@ -1148,6 +1835,20 @@ static int rrd_shutdown (void)
 	}
 
 	rrd_cache_destroy ();
+	rrd_slabs_destroy ();
+
+	pthread_mutex_lock (&known_files_lock);
+	if (known_files != NULL)
+	{
+		void *key;
+		void *value;
+
+		while (c_avl_pick (known_files, &key, &value) == 0)
+			sfree (key);
+		c_avl_destroy (known_files);
+		known_files = NULL;
+	}
+	pthread_mutex_unlock (&known_files_lock);
 
 	return (0);
 } /* int rrd_shutdown */
@@ -1195,6 +1896,24 @@ static int rrd_init (void)
 
 	pthread_mutex_unlock (&cache_lock);
 
+	pthread_mutex_lock (&known_files_lock);
+	known_files = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	pthread_mutex_unlock (&known_files_lock);
+	if (known_files == NULL)
+	{
+		ERROR ("rrdtool plugin: c_avl_create failed.");
+		return (-1);
+	}
+
+	status = pthread_create (&create_thread, /* attr = */ NULL,
+			rrd_create_thread, /* args = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("rrdtool plugin: Cannot create creator-thread.");
+		return (-1);
+	}
+	create_thread_running = 1;
+
 	status = pthread_create (&queue_thread, /* attr = */ NULL,
 			rrd_queue_thread, /* args = */ NULL);
 	if (status != 0)
@@ -1204,6 +1923,9 @@ static int rrd_init (void)
 	}
 	queue_thread_running = 1;
 
+	if (collect_stats)
+		plugin_register_read ("rrdtool", rrd_read);
+
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
 			" heartbeat = %i; rrarows = %i; xff = %lf;",
 			(datadir == NULL) ? "(null)" : datadir,
@@ -0,0 +1,231 @@
+/**
+ * collectd - src/self.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+#include "utils_stats.h"
+
+/*
+ * Private variables
+ */
+static cdtime_t self_interval = 0;
+
+/* State of the previous read, for calculating the read threads' load. */
+static cdtime_t self_last_time = 0;
+static cdtime_t self_last_read_time = 0;
+
+/*
+ * Private functions
+ */
+static void self_submit (const char *plugin_instance, /* {{{ */
+    const char *type, const char *type_instance, value_t value)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  if (self_interval != 0)
+    vl.interval = self_interval;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "self", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  if (type_instance != NULL)
+    sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void self_submit */
+
+/* FNV-1a, continued from "hash". */
+static unsigned int self_hash (unsigned int hash, const char *str) /* {{{ */
+{
+  for (; *str != 0; str++)
+  {
+    hash ^= (unsigned char) *str;
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} unsigned int self_hash */
+
+/* Builds the plugin instance "<type>-<name>". Callback names may contain
+ * slashes and other characters which are not valid in identifiers, for
+ * example "write_redis/<node>" or the URL in "curl_json-<instance>-<URL>",
+ * so these are replaced. Names which don't fit are truncated and get a hash
+ * of the full name appended, so different callbacks still get different
+ * identifiers. */
+static void self_plugin_instance (char *buffer, size_t buffer_size, /* {{{ */
+    const char *type, const char *name)
+{
+  ssnprintf (buffer, buffer_size, "%s-%s", type, name);
+
+  if ((strlen (type) + 1 + strlen (name)) >= buffer_size)
+  {
+    char suffix[10];
+    unsigned int hash;
+
+    hash = self_hash (2166136261U, type);
+    hash = self_hash (hash, "-");
+    hash = self_hash (hash, name);
+
+    ssnprintf (suffix, sizeof (suffix), "-%08x", hash);
+    sstrncpy (buffer + buffer_size - sizeof (suffix), suffix, sizeof (suffix));
+  }
+
+  replace_special (buffer, buffer_size);
+} /* }}} void self_plugin_instance */
+
+static int self_submit_counter (const char *type, const char *name, /* {{{ */
+    const ustats_counter_t *counter, void *user_data)
+{
+  cdtime_t *read_time = user_data;
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  value_t value;
+
+  self_plugin_instance (plugin_instance, sizeof (plugin_instance),
+      type, name);
+
+  value.derive = (derive_t) counter->calls;
+  self_submit (plugin_instance, "invocations", NULL, value);
+
+  value.derive = (derive_t) counter->failures;
+  self_submit (plugin_instance, "invocations", "failed", value);
+
+  value.derive = (derive_t) (CDTIME_T_TO_DOUBLE (counter->time) * 1000.0);
+  self_submit (plugin_instance, "total_time_in_ms", NULL, value);
+
+  if (strcmp ("read", type) == 0)
+    *read_time += counter->time;
+
+  return (0);
+} /* }}} int self_submit_counter */
+
+static int self_read_threads_num (void) /* {{{ */
+{
+  const char *str;
+  int num;
+
+  /* Same logic as in plugin_init_all(). */
+  str = global_option_get ("ReadThreads");
+  num = (str != NULL) ? atoi (str) : 0;
+
+  return ((num > 0) ? num : 5);
+} /* }}} int self_read_threads_num */
+
+static int self_read (user_data_t __attribute__((unused)) *ud) /* {{{ */
+{
+  cdtime_t read_time = 0;
+  cdtime_t now;
+  size_t cache_bytes = 0;
+  size_t cache_entries = 0;
+  int threads_num;
+  value_t value;
+
+  ustats_read (self_submit_counter, &read_time);
+
+  if (uc_get_memory (&cache_bytes, &cache_entries) == 0)
+  {
+    value.gauge = (gauge_t) cache_entries;
+    self_submit ("cache", "cache_size", NULL, value);
+
+    value.gauge = (gauge_t) cache_bytes;
+    self_submit ("cache", "bytes", NULL, value);
+
+    if (cache_entries > 0)
+    {
+      value.gauge = ((gauge_t) cache_bytes) / ((gauge_t) cache_entries);
+      self_submit ("cache", "bytes", "per_identifier", value);
+    }
+  }
+
+  threads_num = self_read_threads_num ();
+  value.gauge = (gauge_t) threads_num;
+  self_submit ("read_threads", "threads", NULL, value);
+
+  /* Fraction of the time the read threads spent in read callbacks since the
+   * last call. Very short periods, for example if the callback is called
+   * twice right after start-up, are merged with the next one. */
+  now = cdtime ();
+  if (self_last_time == 0)
+  {
+    self_last_time = now;
+    self_last_read_time = read_time;
+  }
+  else if ((now - self_last_time) >= (((self_interval != 0)
+          ? self_interval : interval_g) / 2))
+  {
+    value.gauge = 100.0 * CDTIME_T_TO_DOUBLE (read_time - self_last_read_time)
+      / (CDTIME_T_TO_DOUBLE (now - self_last_time) * ((double) threads_num));
+    if (value.gauge > 100.0)
+      value.gauge = 100.0;
+    self_submit ("read_threads", "percent", "busy", value);
+
+    self_last_time = now;
+    self_last_read_time = read_time;
+  }
+
+  return (0);
+} /* }}} int self_read */
+
+static int self_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp ("Interval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &self_interval);
+    else
+      WARNING ("self plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+
+    if (status != 0)
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int self_config */
+
+static int self_init (void) /* {{{ */
+{
+  struct timespec interval;
+
+  ustats_enable ();
+
+  if (self_interval == 0)
+    return (plugin_register_complex_read (/* group = */ NULL, "self",
+          self_read, /* interval = */ NULL, /* user_data = */ NULL));
+
+  CDTIME_T_TO_TIMESPEC (self_interval, &interval);
+  return (plugin_register_complex_read (/* group = */ NULL, "self",
+        self_read, &interval, /* user_data = */ NULL));
+} /* }}} int self_init */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("self", self_config);
+  plugin_register_init ("self", self_init);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -70,6 +70,15 @@
 #endif
 
 #if KERNEL_LINUX
+# if HAVE_LINUX_INET_DIAG_H
+#  include "utils_complain.h"
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <linux/netlink.h>
+#  include <linux/rtnetlink.h>
+#  include <linux/inet_diag.h>
+# endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -263,6 +272,10 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int port_collect_listening = 0;
 static port_entry_t *port_list_head = NULL;
 
+/* All entries of "port_list_head", indexed by port number. Looking up the
+ * ports of every connection must be fast on hosts with many connections. */
+static port_entry_t *port_table[65536];
+
 static void conn_submit_port_entry (port_entry_t *pe)
 {
   value_t values[1];
@@ -319,13 +332,7 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
 {
   port_entry_t *ret;
 
-  ret = port_list_head;
-  while (ret != NULL)
-  {
-    if (ret->port == port)
-      break;
-    ret = ret->next;
-  }
+  ret = port_table[port];
 
   if ((ret == NULL) && (create != 0))
   {
@@ -337,6 +344,7 @@ static port_entry_t *conn_get_port_entry (uint16_t port, int create)
     ret->port = port;
     ret->next = port_list_head;
     port_list_head = ret;
+    port_table[port] = ret;
   }
 
   return (ret);
@@ -366,6 +374,7 @@ static void conn_reset_port_entry (void)
 	port_list_head = next;
       else
 	prev->next = next;
+      port_table[pe->port] = NULL;
 
       sfree (pe);
       pe = next;
@@ -493,6 +502,323 @@ static int conn_read_file (const char *file)
 
   return (0);
 } /* int conn_read_file */
+
+#if HAVE_LINUX_INET_DIAG_H
+/* Requesting the sockets via netlink is much cheaper than parsing the files
+ * in /proc on hosts with many connections: The kernel filters the sockets by
+ * state and port and no text has to be formatted and parsed. */
+
+/* All states in "tcp_state", i.e. all but the unused state zero. */
+# define CONN_NETLINK_STATES_ALL \
+  ((uint32_t) (((1 << (TCP_STATE_MAX + 1)) - 1) & ~1))
+# define CONN_NETLINK_STATE_LISTEN ((uint32_t) (1 << TCP_STATE_LISTEN))
+
+/* Beyond this number of ports, no filter is sent to the kernel. The time
+ * the kernel spends running the filter grows with the number of ports. */
+# define CONN_NETLINK_FILTER_MAX 1024
+
+static int conn_netlink_fd = -1;
+static uint32_t conn_netlink_seq = 0;
+static _Bool conn_netlink_disabled = 0;
+static c_complain_t conn_netlink_complaint = C_COMPLAIN_INIT_STATIC;
+
+static char *conn_netlink_buffer = NULL;
+static size_t conn_netlink_buffer_size = 65536;
+
+static int conn_netlink_open (void) /* {{{ */
+{
+  char errbuf[1024];
+
+  if (conn_netlink_fd >= 0)
+    return (0);
+
+  if (conn_netlink_buffer == NULL)
+  {
+    conn_netlink_buffer = malloc (conn_netlink_buffer_size);
+    if (conn_netlink_buffer == NULL)
+      return (-1);
+  }
+
+  conn_netlink_fd = socket (AF_NETLINK, SOCK_DGRAM, NETLINK_INET_DIAG);
+  if (conn_netlink_fd < 0)
+  {
+    /* The kernel doesn't support INET_DIAG or we're not allowed to use it.
+     * This is not going to change, so stop trying. */
+    conn_netlink_disabled = 1;
+    NOTICE ("tcpconns plugin: Opening the netlink socket failed: %s. "
+        "Falling back to reading /proc/net/tcp and /proc/net/tcp6.",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int conn_netlink_open */
+
+static void conn_netlink_close (void) /* {{{ */
+{
+  if (conn_netlink_fd >= 0)
+    close (conn_netlink_fd);
+  conn_netlink_fd = -1;
+} /* }}} void conn_netlink_close */
+
+/* Appends a condition matching sockets with the source ("local" is true) or
+ * destination port "port" to the filter "ops". The conditions are combined
+ * with a logical "or": If a condition doesn't match, the next one is tried;
+ * if the last one doesn't match, the socket is rejected. Jumps taken when a
+ * condition doesn't match must end on a jump taken when one matches, or the
+ * kernel rejects the filter, hence the INET_DIAG_BC_JMP after every
+ * condition but the last one. */
+static size_t conn_netlink_filter_add (struct inet_diag_bc_op *ops, /* {{{ */
+    size_t ops_num, size_t ops_total, uint16_t port, _Bool local)
+{
+  struct inet_diag_bc_op *op = ops + ops_num;
+  /* Length of the remaining filter in bytes, starting at "op". */
+  unsigned short len = (unsigned short) ((ops_total - ops_num) * sizeof (*op));
+  _Bool last = ((ops_num + 4) == ops_total);
+  unsigned short fail = last ? (len + 4) : (5 * sizeof (*op));
+
+  op[0].code = local ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE;
+  op[0].yes = 2 * sizeof (*op);
+  op[0].no = fail;
+  op[1].code = INET_DIAG_BC_NOP;
+  op[1].yes = 0;
+  op[1].no = port;
+
+  op[2].code = local ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE;
+  op[2].yes = 2 * sizeof (*op);
+  op[2].no = fail - 2 * sizeof (*op);
+  op[3].code = INET_DIAG_BC_NOP;
+  op[3].yes = 0;
+  op[3].no = port;
+
+  if (last)
+    return (ops_num + 4);
+
+  op[4].code = INET_DIAG_BC_JMP;
+  op[4].yes = sizeof (*op);
+  op[4].no = len - 4 * sizeof (*op);
+
+  return (ops_num + 5);
+} /* }}} size_t conn_netlink_filter_add */
+
+/* Builds a filter matching the connections of the ports in "port_list_head".
+ * Returns the number of operations in "ops", zero if no port is of interest
+ * and -1 if there are too many ports to filter in the kernel. */
+static ssize_t conn_netlink_filter (struct inet_diag_bc_op *ops) /* {{{ */
+{
+  port_entry_t *pe;
+  size_t conditions_num = 0;
+  size_t ops_total;
+  size_t ops_num;
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if ((pe->flags & PORT_IS_LISTENING) || (pe->flags & PORT_COLLECT_LOCAL))
+      conditions_num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      conditions_num++;
+  }
+
+  if (conditions_num == 0)
+    return (0);
+  else if (conditions_num > CONN_NETLINK_FILTER_MAX)
+    return (-1);
+
+  ops_total = 5 * conditions_num - 1;
+  ops_num = 0;
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if ((pe->flags & PORT_IS_LISTENING) || (pe->flags & PORT_COLLECT_LOCAL))
+      ops_num = conn_netlink_filter_add (ops, ops_num, ops_total,
+          pe->port, /* local = */ 1);
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      ops_num = conn_netlink_filter_add (ops, ops_num, ops_total,
+          pe->port, /* local = */ 0);
+  }
+  assert (ops_num == ops_total);
+
+  return ((ssize_t) ops_num);
+} /* }}} ssize_t conn_netlink_filter */
+
+/* Passes the sockets in the netlink messages in "buffer", which holds
+ * "buffer_len" bytes received in reply to the request "seq", to
+ * conn_handle_ports(). Returns zero when the dump is complete, greater than
+ * zero if more messages are expected and less than zero on error. */
+static int conn_netlink_handle (char *buffer, ssize_t buffer_len, /* {{{ */
+    uint32_t seq)
+{
+  struct nlmsghdr *h;
+  char errbuf[1024];
+
+  for (h = (struct nlmsghdr *) buffer;
+      NLMSG_OK (h, (size_t) buffer_len);
+      h = NLMSG_NEXT (h, buffer_len))
+  {
+    struct inet_diag_msg *r;
+
+    /* Replies to an earlier, aborted request. */
+    if (h->nlmsg_seq != seq)
+      continue;
+
+    if (h->nlmsg_type == NLMSG_DONE)
+      return (0);
+
+    if (h->nlmsg_type == NLMSG_ERROR)
+    {
+      struct nlmsgerr *e = NLMSG_DATA (h);
+
+      c_complain (LOG_ERR, &conn_netlink_complaint,
+          "tcpconns plugin: The kernel rejected the netlink request: %s",
+          sstrerror (-e->error, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    if (h->nlmsg_len < NLMSG_LENGTH (sizeof (*r)))
+      continue;
+
+    r = NLMSG_DATA (h);
+    conn_handle_ports (ntohs (r->id.idiag_sport), ntohs (r->id.idiag_dport),
+        r->idiag_state);
+  } /* for (h) */
+
+  return (1);
+} /* }}} int conn_netlink_handle */
+
+/* Requests all IPv4 and IPv6 TCP sockets in one of "states" and passes them
+ * to conn_handle_ports(). If "ops" is not NULL, only sockets matching the
+ * filter are returned. */
+static int conn_netlink_dump (uint32_t states, /* {{{ */
+    const struct inet_diag_bc_op *ops, size_t ops_num)
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct inet_diag_req r;
+  } req;
+  struct rtattr rta;
+  struct sockaddr_nl nladdr;
+  struct iovec iov[3];
+  struct msghdr msg;
+  char errbuf[1024];
+  uint32_t seq;
+
+  memset (&nladdr, 0, sizeof (nladdr));
+  nladdr.nl_family = AF_NETLINK;
+
+  seq = ++conn_netlink_seq;
+
+  memset (&req, 0, sizeof (req));
+  req.nlh.nlmsg_len = sizeof (req);
+  req.nlh.nlmsg_type = TCPDIAG_GETSOCK;
+  req.nlh.nlmsg_flags = NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST;
+  req.nlh.nlmsg_seq = seq;
+  /* With the old request type, the kernel returns IPv4 and IPv6 sockets. */
+  req.r.idiag_family = AF_INET;
+  req.r.idiag_states = states;
+
+  memset (iov, 0, sizeof (iov));
+  iov[0].iov_base = &req;
+  iov[0].iov_len = sizeof (req);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_name = &nladdr;
+  msg.msg_namelen = sizeof (nladdr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 1;
+
+  if ((ops != NULL) && (ops_num > 0))
+  {
+    memset (&rta, 0, sizeof (rta));
+    rta.rta_type = INET_DIAG_REQ_BYTECODE;
+    rta.rta_len = RTA_LENGTH (ops_num * sizeof (*ops));
+    req.nlh.nlmsg_len += RTA_ALIGN (rta.rta_len);
+
+    iov[1].iov_base = &rta;
+    iov[1].iov_len = sizeof (rta);
+    iov[2].iov_base = (void *) ops;
+    iov[2].iov_len = ops_num * sizeof (*ops);
+    msg.msg_iovlen = 3;
+  }
+
+  if (sendmsg (conn_netlink_fd, &msg, /* flags = */ 0) < 0)
+  {
+    c_complain (LOG_ERR, &conn_netlink_complaint,
+        "tcpconns plugin: Sending the netlink request failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  while (42)
+  {
+    ssize_t status;
+
+    status = recv (conn_netlink_fd, conn_netlink_buffer,
+        conn_netlink_buffer_size, /* flags = */ 0);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      c_complain (LOG_ERR, &conn_netlink_complaint,
+          "tcpconns plugin: Receiving from the netlink socket failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      c_complain (LOG_ERR, &conn_netlink_complaint,
+          "tcpconns plugin: Unexpected end of file on the netlink socket.");
+      return (-1);
+    }
+
+    status = conn_netlink_handle (conn_netlink_buffer, status, seq);
+    if (status <= 0)
+      return ((int) status);
+  } /* while (42) */
+
+  /* Not reached */
+  return (-1);
+} /* }}} int conn_netlink_dump */
+
+static int conn_read_netlink (void) /* {{{ */
+{
+  struct inet_diag_bc_op ops[5 * CONN_NETLINK_FILTER_MAX];
+  uint32_t states = CONN_NETLINK_STATES_ALL;
+  ssize_t ops_num;
+  int status;
+
+  if (conn_netlink_open () != 0)
+    return (-1);
+
+  /* First find all listening ports, so the filter below can include them. */
+  if (port_collect_listening != 0)
+  {
+    status = conn_netlink_dump (CONN_NETLINK_STATE_LISTEN,
+        /* ops = */ NULL, /* ops_num = */ 0);
+    if (status != 0)
+    {
+      conn_netlink_close ();
+      return (status);
+    }
+    states &= ~CONN_NETLINK_STATE_LISTEN;
+  }
+
+  ops_num = conn_netlink_filter (ops);
+  if (ops_num == 0) /* No port of interest. */
+    return (0);
+
+  status = conn_netlink_dump (states, (ops_num > 0) ? ops : NULL,
+      (ops_num > 0) ? ((size_t) ops_num) : 0);
+  if (status != 0)
+  {
+    conn_netlink_close ();
+    return (status);
+  }
+
+  c_release (LOG_INFO, &conn_netlink_complaint,
+      "tcpconns plugin: Reading sockets via netlink succeeded again.");
+  return (0);
+} /* }}} int conn_read_netlink */
+#endif /* HAVE_LINUX_INET_DIAG_H */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -557,6 +883,20 @@ static int conn_read (void)
 
   conn_reset_port_entry ();
 
+#if HAVE_LINUX_INET_DIAG_H
+  if (!conn_netlink_disabled)
+  {
+    if (conn_read_netlink () == 0)
+    {
+      conn_submit_all ();
+      return (0);
+    }
+
+    /* Some sockets may have been counted already. */
+    conn_reset_port_entry ();
+  }
+#endif
+
   if (conn_read_file ("/proc/net/tcp") != 0)
     errors_num++;
   if (conn_read_file ("/proc/net/tcp6") != 0)
@@ -575,6 +915,16 @@ static int conn_read (void)
 
   return (0);
 } /* int conn_read */
+
+static int conn_shutdown (void)
+{
+#if HAVE_LINUX_INET_DIAG_H
+  conn_netlink_close ();
+  sfree (conn_netlink_buffer);
+#endif
+
+  return (0);
+} /* int conn_shutdown */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -825,6 +1175,7 @@ void module_register (void)
 			config_keys, config_keys_num);
 #if KERNEL_LINUX
 	plugin_register_init ("tcpconns", conn_init);
+	plugin_register_shutdown ("tcpconns", conn_shutdown);
 #elif HAVE_SYSCTLBYNAME
 	/* no initialization */
 #elif HAVE_LIBKVM_NLIST
@@ -28,6 +28,7 @@
 #include "plugin.h"
 #include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
 
 #include <assert.h>
 #include <pthread.h>
@@ -40,6 +41,18 @@
 #define UT_FLAG_PERCENTAGE 0x04
 #define UT_FLAG_INTERESTING 0x08
 #define UT_FLAG_PERSIST_OK 0x10
+
+#define UT_AGGREGATE_NONE 0
+#define UT_AGGREGATE_MEAN 1
+#define UT_AGGREGATE_MIN  2
+#define UT_AGGREGATE_MAX  3
+#define UT_AGGREGATE_SUM  4
+#define UT_AGGREGATE_EWMA 5
+static const char *ut_aggregate_names[] =
+{
+  "None", "Mean", "Min", "Max", "Sum", "EWMA"
+};
+
 typedef struct threshold_s
 {
   char host[DATA_MAX_NAME_LEN];
@@ -55,6 +68,11 @@ typedef struct threshold_s
   gauge_t hysteresis;
   unsigned int flags;
   int hits;
+  /* Check an aggregate over the last "window" values instead of the current
+   * value, see uc_get_window_stats(). */
+  size_t window;
+  int aggregate;
+  c_complain_t window_complaint;
   struct threshold_s *next;
 } threshold_t;
 /* }}} */
@@ -327,6 +345,48 @@ static int ut_config_type_hysteresis (threshold_t *th, oconfig_item_t *ci)
   return (0);
 } /* int ut_config_type_hysteresis */
 
+static int ut_config_type_window (threshold_t *th, oconfig_item_t *ci)
+{
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER)
+      || (ci->values[0].value.number < 1.0))
+  {
+    WARNING ("threshold values: The `%s' option needs exactly one "
+      "positive number argument.", ci->key);
+    return (-1);
+  }
+
+  th->window = (size_t) ci->values[0].value.number;
+
+  return (0);
+} /* int ut_config_type_window */
+
+static int ut_config_type_aggregate (threshold_t *th, oconfig_item_t *ci)
+{
+  size_t i;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("threshold values: The `%s' option needs exactly one "
+      "string argument.", ci->key);
+    return (-1);
+  }
+
+  for (i = 1; i < STATIC_ARRAY_SIZE (ut_aggregate_names); i++)
+  {
+    if (strcasecmp (ut_aggregate_names[i], ci->values[0].value.string) == 0)
+    {
+      th->aggregate = (int) i;
+      return (0);
+    }
+  }
+
+  WARNING ("threshold values: Unknown aggregate `%s'. Valid aggregates are "
+      "`Mean', `Min', `Max', `Sum' and `EWMA'.", ci->values[0].value.string);
+  return (-1);
+} /* int ut_config_type_aggregate */
+
 static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
 {
   int i;
@@ -356,6 +416,9 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
   th.failure_max = NAN;
   th.hits = 0;
   th.hysteresis = 0;
+  th.window = 0;
+  th.aggregate = UT_AGGREGATE_NONE;
+  C_COMPLAIN_INIT (&th.window_complaint);
   th.flags = UT_FLAG_INTERESTING; /* interesting by default */
 
   for (i = 0; i < ci->children_num; i++)
@@ -387,6 +450,10 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
       status = ut_config_type_hits (&th, option);
     else if (strcasecmp ("Hysteresis", option->key) == 0)
       status = ut_config_type_hysteresis (&th, option);
+    else if (strcasecmp ("Window", option->key) == 0)
+      status = ut_config_type_window (&th, option);
+    else if (strcasecmp ("Aggregate", option->key) == 0)
+      status = ut_config_type_aggregate (&th, option);
     else
     {
       WARNING ("threshold values: Option `%s' not allowed inside a `Type' "
@@ -398,6 +465,16 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
       break;
   }
 
+  if ((status == 0) && (th.aggregate != UT_AGGREGATE_NONE) && (th.window == 0))
+  {
+    WARNING ("threshold values: The `Aggregate' option requires the `Window' "
+	"option.");
+    status = -1;
+  }
+  else if ((status == 0) && (th.window > 0)
+      && (th.aggregate == UT_AGGREGATE_NONE))
+    th.aggregate = UT_AGGREGATE_MEAN;
+
   if (status == 0)
   {
     status = ut_threshold_add (&th);
@@ -620,6 +697,13 @@ static int ut_report_state (const data_set_t *ds,
   plugin_notification_meta_add_double (&n, "WarningMax", th->warning_max);
   plugin_notification_meta_add_double (&n, "FailureMin", th->failure_min);
   plugin_notification_meta_add_double (&n, "FailureMax", th->failure_max);
+  if (th->window > 0)
+  {
+    plugin_notification_meta_add_string (&n, "Aggregate",
+        ut_aggregate_names[th->aggregate]);
+    plugin_notification_meta_add_unsigned_int (&n, "Window",
+        (uint64_t) th->window);
+  }
 
   /* Send an okay notification */
   if (state == STATE_OKAY)
@@ -701,6 +785,14 @@ static int ut_report_state (const data_set_t *ds,
     }
     buf += status;
     bufsize -= status;
+
+    if (th->window > 0)
+    {
+      status = ssnprintf (buf, bufsize, " (%s of the last %u values)",
+          ut_aggregate_names[th->aggregate], (unsigned int) th->window);
+      buf += status;
+      bufsize -= status;
+    }
   }
 
   plugin_dispatch_notification (&n);
@@ -857,6 +949,52 @@ static int ut_check_one_threshold (const data_set_t *ds,
   return (ret);
 } /* }}} int ut_check_one_threshold */
 
+/*
+ * int ut_window_values
+ *
+ * Replaces the values with the configured aggregate over the last
+ * `th->window' values. The aggregates are kept up to date by the cache, so
+ * this doesn't copy the history. Returns non-zero if the aggregate is not
+ * available, for example because the window exceeds `CacheWindowMax'.
+ */
+static int ut_window_values (const data_set_t *ds, const value_list_t *vl,
+    threshold_t *th, gauge_t *ret_values)
+{ /* {{{ */
+  uc_window_stats_t stats[ds->ds_num];
+  int status;
+  int i;
+
+  status = uc_get_window_stats (ds, vl, th->window,
+      stats, (size_t) ds->ds_num);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    c_complain (LOG_WARNING, &th->window_complaint,
+        "ut_window_values: Getting a window of %u values for "
+        "plugin %s, type %s failed: %s", (unsigned int) th->window,
+        vl->plugin, vl->type,
+        sstrerror ((status < 0) ? -status : status, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  c_release (LOG_INFO, &th->window_complaint,
+      "ut_window_values: Window of %u values for plugin %s, type %s is "
+      "available again.", (unsigned int) th->window, vl->plugin, vl->type);
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    switch (th->aggregate)
+    {
+      case UT_AGGREGATE_MIN:  ret_values[i] = stats[i].min;  break;
+      case UT_AGGREGATE_MAX:  ret_values[i] = stats[i].max;  break;
+      case UT_AGGREGATE_SUM:  ret_values[i] = stats[i].sum;  break;
+      case UT_AGGREGATE_EWMA: ret_values[i] = stats[i].ewma; break;
+      default:                ret_values[i] = stats[i].mean; break;
+    }
+  }
+
+  return (0);
+} /* }}} int ut_window_values */
+
 /*
  * int ut_check_threshold
  *
@@ -871,6 +1009,8 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
 { /* {{{ */
   threshold_t *th;
   gauge_t *values;
+  gauge_t window_values[ds->ds_num];
+  gauge_t worst_values[ds->ds_num];
   int status;
 
   int worst_state = -1;
@@ -896,9 +1036,20 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
 
   while (th != NULL)
   {
+    const gauge_t *th_values = values;
     int ds_index = -1;
 
-    status = ut_check_one_threshold (ds, vl, th, values, &ds_index);
+    if (th->window > 0)
+    {
+      if (ut_window_values (ds, vl, th, window_values) != 0)
+      {
+        th = th->next;
+        continue;
+      }
+      th_values = window_values;
+    }
+
+    status = ut_check_one_threshold (ds, vl, th, th_values, &ds_index);
     if (status < 0)
     {
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
@@ -911,12 +1062,19 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
       worst_state = status;
       worst_th = th;
       worst_ds_index = ds_index;
+      memcpy (worst_values, th_values, sizeof (worst_values));
     }
 
     th = th->next;
   } /* while (th) */
 
-  status = ut_report_state (ds, vl, worst_th, values,
+  if (worst_th == NULL)
+  {
+    sfree (values);
+    return (0);
+  }
+
+  status = ut_report_state (ds, vl, worst_th, worst_values,
       worst_ds_index, worst_state);
   if (status != 0)
   {
@@ -27,6 +27,7 @@
 #include "utils_cmd_flush.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
+#include "utils_cmd_putbin.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
 
@@ -45,6 +46,9 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+/* Maximum number of lines in a GETVALS or PUTVALS block. */
+#define US_BLOCK_MAX_LINES 16384
+
 /*
  * Private variables
  */
@@ -174,6 +178,157 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
+/* Reads the lines of a GETVALS or PUTVALS block up to the terminating ".".
+ * The lines are stored in "*ret_data"; the caller has to free both
+ * "*ret_data" and "*ret_lines". Returns less than zero if reading from the
+ * socket failed and greater than zero if the block has more than
+ * US_BLOCK_MAX_LINES lines. In that case, the block is skipped. */
+static int us_read_block (FILE *fhin, char **ret_data, /* {{{ */
+		char ***ret_lines, size_t *ret_lines_num)
+{
+	char *data = NULL;
+	size_t data_len = 0;
+	size_t data_size = 0;
+	size_t *offsets = NULL;
+	size_t offsets_size = 0;
+	size_t lines_num = 0;
+	char **lines;
+	int status = 0;
+	size_t i;
+
+	while (42)
+	{
+		char buffer[1024];
+		size_t len;
+
+		errno = 0;
+		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
+		{
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			status = -1;
+			break;
+		}
+
+		len = strlen (buffer);
+		while ((len > 0)
+				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+			buffer[--len] = '\0';
+
+		if (strcmp (".", buffer) == 0)
+			break;
+		if ((len == 0) || (status != 0))
+			continue;
+
+		if (lines_num >= US_BLOCK_MAX_LINES)
+		{
+			/* Keep reading until the end of the block, so the
+			 * connection stays usable. */
+			status = 1;
+			continue;
+		}
+
+		if ((data_len + len + 1) > data_size)
+		{
+			char *tmp;
+			size_t new_size = (data_size == 0) ? 16384 : 2 * data_size;
+
+			while (new_size < (data_len + len + 1))
+				new_size *= 2;
+			tmp = realloc (data, new_size);
+			if (tmp == NULL)
+			{
+				status = 1;
+				continue;
+			}
+			data = tmp;
+			data_size = new_size;
+		}
+
+		if (lines_num >= offsets_size)
+		{
+			size_t *tmp;
+			size_t new_size = (offsets_size == 0) ? 256 : 2 * offsets_size;
+
+			tmp = realloc (offsets, new_size * sizeof (*tmp));
+			if (tmp == NULL)
+			{
+				status = 1;
+				continue;
+			}
+			offsets = tmp;
+			offsets_size = new_size;
+		}
+
+		memcpy (data + data_len, buffer, len + 1);
+		offsets[lines_num] = data_len;
+		data_len += len + 1;
+		lines_num++;
+	}
+
+	lines = NULL;
+	if (status == 0)
+	{
+		lines = calloc (lines_num + 1, sizeof (*lines));
+		if (lines == NULL)
+			status = 1;
+	}
+
+	if (status != 0)
+	{
+		sfree (data);
+		sfree (offsets);
+		return (status);
+	}
+
+	for (i = 0; i < lines_num; i++)
+		lines[i] = data + offsets[i];
+	sfree (offsets);
+
+	*ret_data = data;
+	*ret_lines = lines;
+	*ret_lines_num = lines_num;
+	return (0);
+} /* }}} int us_read_block */
+
+/* Reads the payload of a PUTBIN command and dispatches it. Returns non-zero
+ * if the connection can't be used any longer. */
+static int us_handle_putbin (FILE *fhin, FILE *fhout, /* {{{ */
+		const char *size_str)
+{
+	char *data;
+	char *endptr = NULL;
+	unsigned long size;
+
+	errno = 0;
+	size = strtoul (size_str, &endptr, 0);
+	if ((errno != 0) || (endptr == size_str) || (*endptr != 0)
+			|| (size > PUTBIN_MAX_SIZE))
+	{
+		/* The size of the payload is unknown, so there's no way to
+		 * find the next command. */
+		fprintf (fhout, "-1 Invalid size: %s\n", size_str);
+		return (-1);
+	}
+
+	data = malloc (size + 1);
+	if (data == NULL)
+	{
+		fprintf (fhout, "-1 malloc failed.\n");
+		return (-1);
+	}
+
+	if ((size > 0) && (fread (data, 1, size, fhin) != size))
+	{
+		sfree (data);
+		return (-1);
+	}
+
+	handle_putbin (fhout, data, (size_t) size);
+	sfree (data);
+	return (0);
+} /* }}} int us_handle_putbin */
+
 static void *us_handle_client (void *arg)
 {
 	int fdin;
@@ -220,8 +375,10 @@ static void *us_handle_client (void *arg)
 		return ((void *) 1);
 	}
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	/* Responses are flushed after each command. Full buffering lets
+	 * commands with long responses, such as LISTVAL and GETVALS, write them
+	 * with few system calls. */
+	if (setvbuf (fhout, NULL, _IOFBF, 0) != 0)
 	{
 		char errbuf[1024];
 		ERROR ("unixsock plugin: setvbuf failed: %s",
@@ -297,16 +454,50 @@ static void *us_handle_client (void *arg)
 		{
 			handle_flush (fhout, buffer);
 		}
-		else
+		else if ((strcasecmp (fields[0], "getvals") == 0)
+				|| (strcasecmp (fields[0], "putvals") == 0))
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			char *data = NULL;
+			char **lines = NULL;
+			size_t lines_num = 0;
+			int status;
+
+			status = us_read_block (fhin, &data, &lines, &lines_num);
+			if (status < 0)
+				break;
+			else if (status > 0)
+				fprintf (fhout, "-1 Block too long, at most %i lines "
+						"are allowed.\n", US_BLOCK_MAX_LINES);
+			else if (strcasecmp (fields[0], "getvals") == 0)
+				handle_getvals (fhout, buffer, lines, lines_num);
+			else
+				handle_putvals (fhout, buffer, lines, lines_num);
+
+			sfree (lines);
+			sfree (data);
+		}
+		else if (strcasecmp (fields[0], "putbin") == 0)
+		{
+			if (fields_num != 2)
 			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
+				fprintf (fhout, "-1 Usage: PUTBIN <size>\n");
 				break;
 			}
+			if (us_handle_putbin (fhin, fhout, fields[1]) != 0)
+				break;
+		}
+		else
+		{
+			fprintf (fhout, "-1 Unknown command: %s\n", fields[0]);
+		}
+
+		if (fflush (fhout) != 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
 		}
 	} /* while (fgets) */
 
@@ -654,6 +654,40 @@ c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t)
 	return (iter);
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+c_avl_iterator_t *c_avl_get_iterator_after (c_avl_tree_t *t, const void *key)
+{
+	c_avl_iterator_t *iter;
+	c_avl_node_t *n;
+	int cmp;
+
+	iter = c_avl_get_iterator (t);
+	if ((iter == NULL) || (key == NULL))
+		return (iter);
+
+	/* Find the greatest node which is less than or equal to `key'.
+	 * `c_avl_iterator_next' continues with its successor. If there is no
+	 * such node, `iter->node' stays NULL and the iteration starts at the
+	 * smallest node. */
+	n = t->root;
+	while (n != NULL)
+	{
+		cmp = t->compare (key, n->key);
+		if (cmp < 0)
+		{
+			n = n->left;
+		}
+		else
+		{
+			iter->node = n;
+			if (cmp == 0)
+				break;
+			n = n->right;
+		}
+	}
+
+	return (iter);
+} /* c_avl_iterator_t *c_avl_get_iterator_after */
+
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value)
 {
 	c_avl_node_t *n;
@@ -144,6 +144,26 @@ int c_avl_get (c_avl_tree_t *t, const void *key, void **value);
 int c_avl_pick (c_avl_tree_t *t, void **key, void **value);
 
 c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t);
+
+/*
+ * NAME
+ *   c_avl_get_iterator_after
+ *
+ * DESCRIPTION
+ *   Returns an iterator which is positioned so that the first call to
+ *   `c_avl_iterator_next' returns the smallest element greater than `key'.
+ *   The key doesn't need to be in the tree. This allows to resume an
+ *   iteration after the tree has been unlocked and possibly modified.
+ *
+ * PARAMETERS
+ *   `t'        AVL-tree to iterate over.
+ *   `key'      Key to start after. If NULL, the iteration starts at the
+ *              smallest element.
+ *
+ * RETURN VALUE
+ *   An iterator or NULL on failure.
+ */
+c_avl_iterator_t *c_avl_get_iterator_after (c_avl_tree_t *t, const void *key);
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy (c_avl_iterator_t *iter);
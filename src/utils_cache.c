@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "configfile.h"
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "meta_data.h"
@@ -29,9 +30,52 @@
 #include <assert.h>
 #include <pthread.h>
 
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/* Default for the "CacheWindowMax" option: The number of values all moving
+ * windows of one entry may hold together. */
+#define UC_WINDOW_MAX_DEFAULT 1024
+
+/* Running aggregates of one data source in a moving window. The "min" and
+ * "max" deques hold sequence numbers of values in the window; the values
+ * referenced by "min" increase from head to tail, the ones referenced by
+ * "max" decrease, so the head is always the minimum (maximum) of the
+ * window. */
+typedef struct uc_window_ds_s
+{
+	gauge_t sum;
+	size_t  count; /* number of non-NaN values in the window */
+	gauge_t ewma;
+
+	size_t min_head;
+	size_t min_num;
+	size_t max_head;
+	size_t max_num;
+} uc_window_ds_t;
+
+/* Moving window over the last "length" rates of a cache entry. All arrays
+ * are allocated together with the structure. */
+typedef struct uc_window_s uc_window_t;
+struct uc_window_s
+{
+	size_t   length;
+	uint64_t seq;   /* number of values added so far */
+	gauge_t  alpha; /* EWMA smoothing factor */
+
+	gauge_t  *values; /* [length * values_num], same layout as "history" */
+	uint64_t *min;    /* [values_num * length] */
+	uint64_t *max;    /* [values_num * length] */
+	uc_window_ds_t *ds; /* [values_num] */
+
+	uc_window_t *next;
+};
+
+/* Entries are allocated in one piece: The name, which is also the key in
+ * "cache_tree", is followed by the "values_gauge" and "values_raw" arrays. */
 typedef struct cache_entry_s
 {
-	char name[6 * DATA_MAX_NAME_LEN];
 	int        values_num;
 	gauge_t   *values_gauge;
 	value_t   *values_raw;
@@ -60,63 +104,357 @@ typedef struct cache_entry_s
 	size_t   history_index; /* points to the next position to write to. */
 	size_t   history_length;
 
+	/* Moving windows requested with uc_get_window_stats(). "windows_size" is
+	 * the sum of their lengths. */
+	uc_window_t *windows;
+	size_t       windows_size;
+
 	meta_data_t *meta;
+
+	char name[];
 } cache_entry_t;
 
+/* Small entries are carved out of slabs of UC_SLAB_SIZE bytes. Freed entries
+ * are kept in one free list per size class and reused for entries of the
+ * same size class; slabs are never returned to the system. Entries larger
+ * than UC_SLAB_CHUNK_MAX are allocated with malloc(3). */
+#define UC_SLAB_SIZE      65536
+#define UC_SLAB_ALIGN        16
+#define UC_SLAB_CHUNK_MAX  1024
+#define UC_SLAB_CLASS(size) (((size) + UC_SLAB_ALIGN - 1) / UC_SLAB_ALIGN)
+
+typedef struct uc_slab_s uc_slab_t;
+struct uc_slab_s
+{
+	uc_slab_t *next;
+	size_t used;
+	/* Aligns "data" like malloc(3) would. */
+	union { double d; void *p; uint64_t u; } data[];
+};
+
+/* Cursor over the cache. The names of the current chunk are packed into
+ * "buffer". "last" is the last name looked at, the next chunk starts after
+ * it. */
+#define UC_ITER_CHUNK_SIZE 256
+#define UC_ITER_SCAN_MAX  4096
+
+struct uc_iter_s
+{
+  char prefix[6 * DATA_MAX_NAME_LEN];
+  size_t prefix_len;
+  uc_iter_filter_t filter;
+  void *user_data;
+
+  char last[6 * DATA_MAX_NAME_LEN];
+  _Bool done;
+
+  char buffer[UC_ITER_CHUNK_SIZE * 64];
+  size_t buffer_used;
+  char *names[UC_ITER_CHUNK_SIZE];
+  cdtime_t times[UC_ITER_CHUNK_SIZE];
+  size_t names_num;
+  size_t names_index;
+};
+
 static c_avl_tree_t   *cache_tree = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
+static size_t uc_window_max = UC_WINDOW_MAX_DEFAULT;
+
+static char    *uc_snapshot_file = NULL;
+static cdtime_t uc_snapshot_interval = 0;
+static cdtime_t uc_snapshot_last = 0;
+
+/* Slab allocator state and memory statistics. Protected by "cache_lock". */
+static uc_slab_t *uc_slabs = NULL;
+static void *uc_slab_free_list[UC_SLAB_CLASS (UC_SLAB_CHUNK_MAX) + 1];
+static size_t uc_memory_used = 0;
+
+static void *uc_slab_alloc (size_t size) /* {{{ */
 {
-  assert ((a != NULL) && (b != NULL));
-  return (strcmp (a->name, b->name));
-} /* int cache_compare */
+  size_t class = UC_SLAB_CLASS (size);
+  size_t chunk_size = class * UC_SLAB_ALIGN;
+  void *ret;
+
+  if (size > UC_SLAB_CHUNK_MAX)
+  {
+    ret = malloc (size);
+    if (ret != NULL)
+      uc_memory_used += size;
+    return (ret);
+  }
+
+  if (uc_slab_free_list[class] != NULL)
+  {
+    ret = uc_slab_free_list[class];
+    uc_slab_free_list[class] = *((void **) ret);
+    return (ret);
+  }
+
+  if ((uc_slabs == NULL)
+      || ((uc_slabs->used + chunk_size)
+        > (UC_SLAB_SIZE - sizeof (uc_slab_t))))
+  {
+    uc_slab_t *slab;
+
+    /* Put the rest of the current slab on the free lists. */
+    if (uc_slabs != NULL)
+    {
+      size_t left = UC_SLAB_SIZE - sizeof (uc_slab_t) - uc_slabs->used;
+      size_t left_class = left / UC_SLAB_ALIGN;
+
+      if (left_class > 0)
+      {
+        void *chunk = ((char *) uc_slabs->data) + uc_slabs->used;
+        *((void **) chunk) = uc_slab_free_list[left_class];
+        uc_slab_free_list[left_class] = chunk;
+        uc_slabs->used += left_class * UC_SLAB_ALIGN;
+      }
+    }
+
+    slab = malloc (UC_SLAB_SIZE);
+    if (slab == NULL)
+      return (NULL);
+    slab->used = 0;
+    slab->next = uc_slabs;
+    uc_slabs = slab;
+    uc_memory_used += UC_SLAB_SIZE;
+  }
+
+  ret = ((char *) uc_slabs->data) + uc_slabs->used;
+  uc_slabs->used += chunk_size;
+  return (ret);
+} /* }}} void *uc_slab_alloc */
 
-static cache_entry_t *cache_alloc (int values_num)
+/* "size" must be the size passed to uc_slab_alloc(). */
+static void uc_slab_free (void *ptr, size_t size) /* {{{ */
 {
-  cache_entry_t *ce;
+  size_t class = UC_SLAB_CLASS (size);
 
-  ce = (cache_entry_t *) malloc (sizeof (cache_entry_t));
-  if (ce == NULL)
+  if (ptr == NULL)
+    return;
+
+  if (size > UC_SLAB_CHUNK_MAX)
   {
-    ERROR ("utils_cache: cache_alloc: malloc failed.");
+    free (ptr);
+    uc_memory_used -= size;
+    return;
+  }
+
+  *((void **) ptr) = uc_slab_free_list[class];
+  uc_slab_free_list[class] = ptr;
+} /* }}} void uc_slab_free */
+
+/* Offset of the values following the name, aligned for value_t. */
+#define CACHE_VALUES_OFFSET(name) \
+  ((offsetof (cache_entry_t, name) + strlen (name) + sizeof (value_t)) \
+   & ~(sizeof (value_t) - 1))
+
+static size_t cache_entry_size (int values_num, const char *name) /* {{{ */
+{
+  return (CACHE_VALUES_OFFSET (name)
+      + ((size_t) values_num) * (sizeof (gauge_t) + sizeof (value_t)));
+} /* }}} size_t cache_entry_size */
+
+static size_t uc_window_size (size_t length, size_t values_num) /* {{{ */
+{
+  return (sizeof (uc_window_t)
+      + length * values_num * (sizeof (gauge_t) + 2 * sizeof (uint64_t))
+      + values_num * sizeof (uc_window_ds_t));
+} /* }}} size_t uc_window_size */
+
+static uc_window_t *uc_window_create (size_t length, size_t values_num) /* {{{ */
+{
+  uc_window_t *w;
+  size_t i;
+
+  w = calloc (1, uc_window_size (length, values_num));
+  if (w == NULL)
     return (NULL);
+
+  w->length = length;
+  w->seq = 0;
+  w->alpha = 2.0 / (((gauge_t) length) + 1.0);
+
+  w->values = (gauge_t *) (w + 1);
+  w->min = (uint64_t *) (w->values + (length * values_num));
+  w->max = w->min + (length * values_num);
+  w->ds = (uc_window_ds_t *) (w->max + (length * values_num));
+
+  for (i = 0; i < length * values_num; i++)
+    w->values[i] = NAN;
+  for (i = 0; i < values_num; i++)
+    w->ds[i].ewma = NAN;
+
+  return (w);
+} /* }}} uc_window_t *uc_window_create */
+
+/* Adds one set of rates to the window. Runs in constant time, apart from
+ * re-summing the window once every "length" values so rounding errors of
+ * the running sums don't accumulate. */
+static void uc_window_add (uc_window_t *w, /* {{{ */
+    const gauge_t *values, size_t values_num)
+{
+  size_t length = w->length;
+  size_t pos = (size_t) (w->seq % length);
+  size_t i;
+
+  for (i = 0; i < values_num; i++)
+  {
+    uc_window_ds_t *d = w->ds + i;
+    uint64_t *min = w->min + (i * length);
+    uint64_t *max = w->max + (i * length);
+    gauge_t *slot = w->values + (pos * values_num) + i;
+    gauge_t value = values[i];
+
+    /* Remove the value falling out of the window. */
+    if (!isnan (*slot))
+    {
+      d->sum -= *slot;
+      d->count--;
+    }
+
+    /* Sequence numbers are unique, so at most one entry per deque expires. */
+    if ((d->min_num > 0) && ((min[d->min_head] + length) <= w->seq))
+    {
+      d->min_head = (d->min_head + 1) % length;
+      d->min_num--;
+    }
+    if ((d->max_num > 0) && ((max[d->max_head] + length) <= w->seq))
+    {
+      d->max_head = (d->max_head + 1) % length;
+      d->max_num--;
+    }
+
+    *slot = value;
+    if (isnan (value))
+      continue;
+
+    d->sum += value;
+    d->count++;
+
+    while (d->min_num > 0)
+    {
+      uint64_t tail = min[(d->min_head + d->min_num - 1) % length];
+      if (w->values[((tail % length) * values_num) + i] < value)
+        break;
+      d->min_num--;
+    }
+    min[(d->min_head + d->min_num) % length] = w->seq;
+    d->min_num++;
+
+    while (d->max_num > 0)
+    {
+      uint64_t tail = max[(d->max_head + d->max_num - 1) % length];
+      if (w->values[((tail % length) * values_num) + i] > value)
+        break;
+      d->max_num--;
+    }
+    max[(d->max_head + d->max_num) % length] = w->seq;
+    d->max_num++;
+
+    if (isnan (d->ewma))
+      d->ewma = value;
+    else
+      d->ewma = (w->alpha * value) + ((1.0 - w->alpha) * d->ewma);
+  } /* for (i = 0; i < values_num; i++) */
+
+  w->seq++;
+
+  if ((w->seq % length) == 0)
+  {
+    for (i = 0; i < values_num; i++)
+    {
+      size_t j;
+
+      w->ds[i].sum = 0.0;
+      for (j = 0; j < length; j++)
+      {
+        gauge_t value = w->values[(j * values_num) + i];
+        if (!isnan (value))
+          w->ds[i].sum += value;
+      }
+    }
   }
-  memset (ce, '\0', sizeof (cache_entry_t));
-  ce->values_num = values_num;
+} /* }}} void uc_window_add */
+
+static void uc_window_get_stats (const uc_window_t *w, /* {{{ */
+    uc_window_stats_t *ret_stats, size_t values_num)
+{
+  size_t i;
 
-  ce->values_gauge = calloc (values_num, sizeof (*ce->values_gauge));
-  ce->values_raw   = calloc (values_num, sizeof (*ce->values_raw));
-  if ((ce->values_gauge == NULL) || (ce->values_raw == NULL))
+  for (i = 0; i < values_num; i++)
   {
-    sfree (ce->values_gauge);
-    sfree (ce->values_raw);
-    sfree (ce);
-    ERROR ("utils_cache: cache_alloc: calloc failed.");
+    const uc_window_ds_t *d = w->ds + i;
+    uc_window_stats_t *s = ret_stats + i;
+
+    s->num = d->count;
+    s->sum = (d->count > 0) ? d->sum : NAN;
+    s->mean = (d->count > 0) ? (d->sum / ((gauge_t) d->count)) : NAN;
+    s->min = NAN;
+    s->max = NAN;
+    s->ewma = d->ewma;
+
+    if (d->min_num > 0)
+      s->min = w->values[((w->min[(i * w->length) + d->min_head] % w->length)
+          * values_num) + i];
+    if (d->max_num > 0)
+      s->max = w->values[((w->max[(i * w->length) + d->max_head] % w->length)
+          * values_num) + i];
+  }
+} /* }}} void uc_window_get_stats */
+
+/* Must be called with "cache_lock" held. */
+static cache_entry_t *cache_alloc (int values_num, const char *name)
+{
+  cache_entry_t *ce;
+  size_t size;
+
+  size = cache_entry_size (values_num, name);
+  ce = uc_slab_alloc (size);
+  if (ce == NULL)
+  {
+    ERROR ("utils_cache: cache_alloc: uc_slab_alloc failed.");
     return (NULL);
   }
+  memset (ce, '\0', size);
+  ce->values_num = values_num;
+
+  memcpy (ce->name, name, strlen (name) + 1);
+  ce->values_gauge = (gauge_t *) (((char *) ce) + CACHE_VALUES_OFFSET (name));
+  ce->values_raw = (value_t *) (ce->values_gauge + values_num);
 
   ce->history = NULL;
   ce->history_length = 0;
+  ce->windows = NULL;
+  ce->windows_size = 0;
   ce->meta = NULL;
 
   return (ce);
 } /* cache_entry_t *cache_alloc */
 
+/* Must be called with "cache_lock" held. */
 static void cache_free (cache_entry_t *ce)
 {
   if (ce == NULL)
     return;
 
-  sfree (ce->values_gauge);
-  sfree (ce->values_raw);
+  uc_memory_used -= ce->history_length * ce->values_num * sizeof (gauge_t);
   sfree (ce->history);
+  while (ce->windows != NULL)
+  {
+    uc_window_t *next = ce->windows->next;
+    uc_memory_used -= uc_window_size (ce->windows->length,
+        (size_t) ce->values_num);
+    sfree (ce->windows);
+    ce->windows = next;
+  }
   if (ce->meta != NULL)
   {
     meta_data_destroy (ce->meta);
     ce->meta = NULL;
   }
-  sfree (ce);
+  uc_slab_free (ce, cache_entry_size (ce->values_num, ce->name));
 } /* void cache_free */
 
 static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
@@ -138,28 +476,17 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
     const char *key)
 {
   int i;
-  char *key_copy;
   cache_entry_t *ce;
 
   /* `cache_lock' has been locked by `uc_update' */
 
-  key_copy = strdup (key);
-  if (key_copy == NULL)
-  {
-    ERROR ("uc_insert: strdup failed.");
-    return (-1);
-  }
-
-  ce = cache_alloc (ds->ds_num);
+  ce = cache_alloc (ds->ds_num, key);
   if (ce == NULL)
   {
-    sfree (key_copy);
     ERROR ("uc_insert: cache_alloc (%i) failed.", ds->ds_num);
     return (-1);
   }
 
-  sstrncpy (ce->name, key, sizeof (ce->name));
-
   for (i = 0; i < ds->ds_num; i++)
   {
     switch (ds->ds[i].type)
@@ -191,6 +518,7 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 	/* This shouldn't happen. */
 	ERROR ("uc_insert: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
+	cache_free (ce);
 	return (-1);
     } /* switch (ds->ds[i].type) */
   } /* for (i) */
@@ -203,9 +531,9 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert (cache_tree, key_copy, ce) != 0)
+  if (c_avl_insert (cache_tree, ce->name, ce) != 0)
   {
-    sfree (key_copy);
+    cache_free (ce);
     ERROR ("uc_insert: c_avl_insert failed.");
     return (-1);
   }
@@ -216,9 +544,37 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 
 int uc_init (void)
 {
+  const char *str;
+
+  str = global_option_get ("CacheWindowMax");
+  if (str != NULL)
+  {
+    int tmp = atoi (str);
+    if (tmp < 0)
+      WARNING ("uc_init: CacheWindowMax must not be negative.");
+    else
+      uc_window_max = (size_t) tmp;
+  }
+
   if (cache_tree == NULL)
     cache_tree = c_avl_create ((int (*) (const void *, const void *))
-	cache_compare);
+	strcmp);
+
+  str = global_option_get ("CacheSnapshotFile");
+  if ((str != NULL) && (str[0] != 0))
+  {
+    sfree (uc_snapshot_file);
+    uc_snapshot_file = strdup (str);
+
+    str = global_option_get ("CacheSnapshotInterval");
+    if (str != NULL)
+      uc_snapshot_interval = DOUBLE_TO_CDTIME_T (atof (str));
+
+    /* Called before the read threads are started, so the rates of the first
+     * values can be calculated. */
+    if (uc_snapshot_file != NULL)
+      uc_snapshot_read (uc_snapshot_file);
+  }
 
   return (0);
 } /* int uc_init */
@@ -315,7 +671,6 @@ int uc_check_timeout (void)
     if (status != 0)
     {
       ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.", keys[i]);
-      cache_free (ce);
       continue;
     }
 
@@ -343,8 +698,8 @@ int uc_check_timeout (void)
       continue;
     }
 
+    /* "key" points into "ce". */
     sfree (keys[i]);
-    sfree (key);
     cache_free (ce);
   } /* for (i = 0; i < keys_len; i++) */
   pthread_mutex_unlock (&cache_lock);
@@ -360,6 +715,7 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
+  uc_window_t *w;
   int status;
   int i;
 
@@ -473,6 +829,10 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   /* Prune invalid gauge data */
   uc_check_range (ds, ce);
 
+  /* Update the moving windows, if any. */
+  for (w = ce->windows; w != NULL; w = w->next)
+    uc_window_add (w, ce->values_gauge, (size_t) ce->values_num);
+
   ce->last_time = vl->time;
   ce->last_update = cdtime ();
   ce->interval = vl->interval;
@@ -532,6 +892,41 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
   return (status);
 } /* gauge_t *uc_get_rate_by_name */
 
+int uc_get_rates_by_names (char * const *names, size_t names_num, /* {{{ */
+    const size_t *values_num, gauge_t *ret_values, int *ret_status)
+{
+  gauge_t *values = ret_values;
+  size_t i;
+
+  if ((names == NULL) || (values_num == NULL)
+      || (ret_values == NULL) || (ret_status == NULL))
+    return (-1);
+
+  pthread_mutex_lock (&cache_lock);
+
+  for (i = 0; i < names_num; i++)
+  {
+    cache_entry_t *ce = NULL;
+
+    if ((c_avl_get (cache_tree, names[i], (void *) &ce) != 0)
+        || (ce->state == STATE_MISSING))
+      ret_status[i] = ENOENT;
+    else if ((size_t) ce->values_num != values_num[i])
+      ret_status[i] = EINVAL;
+    else
+    {
+      memcpy (values, ce->values_gauge, values_num[i] * sizeof (gauge_t));
+      ret_status[i] = 0;
+    }
+
+    values += values_num[i];
+  }
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (0);
+} /* }}} int uc_get_rates_by_names */
+
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -563,74 +958,236 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
   return (ret);
 } /* gauge_t *uc_get_rate */
 
-int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+int uc_get_memory (size_t *ret_bytes, size_t *ret_entries) /* {{{ */
 {
-  c_avl_iterator_t *iter;
+  if (ret_bytes == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&cache_lock);
+  *ret_bytes = uc_memory_used;
+  if (ret_entries != NULL)
+    *ret_entries = (cache_tree != NULL) ? (size_t) c_avl_size (cache_tree) : 0;
+  pthread_mutex_unlock (&cache_lock);
+
+  return (0);
+} /* }}} int uc_get_memory */
+
+uc_iter_t *uc_iter_create (const char *prefix, /* {{{ */
+    uc_iter_filter_t filter, void *user_data)
+{
+  uc_iter_t *iter;
+
+  iter = calloc (1, sizeof (*iter));
+  if (iter == NULL)
+    return (NULL);
+
+  if (prefix != NULL)
+    sstrncpy (iter->prefix, prefix, sizeof (iter->prefix));
+  iter->prefix_len = strlen (iter->prefix);
+  iter->filter = filter;
+  iter->user_data = user_data;
+
+  return (iter);
+} /* }}} uc_iter_t *uc_iter_create */
+
+/* Adds "name" to the current chunk. Returns non-zero if the chunk is full. */
+static int uc_iter_add (uc_iter_t *iter, /* {{{ */
+    const char *name, const cache_entry_t *ce)
+{
+  size_t len;
+
+  len = strlen (name) + 1;
+  if ((iter->names_num >= UC_ITER_CHUNK_SIZE)
+      || ((iter->buffer_used + len) > sizeof (iter->buffer)))
+    return (-1);
+
+  iter->names[iter->names_num] = iter->buffer + iter->buffer_used;
+  memcpy (iter->names[iter->names_num], name, len);
+  iter->times[iter->names_num] = ce->last_time;
+  iter->buffer_used += len;
+  iter->names_num++;
+
+  return (0);
+} /* }}} int uc_iter_add */
+
+/* Copies the next chunk of names while holding the cache lock. At most
+ * UC_ITER_SCAN_MAX entries are looked at per call, so the lock is released
+ * regularly even if the filter rejects most entries. */
+static void uc_iter_fill (uc_iter_t *iter) /* {{{ */
+{
+  c_avl_iterator_t *avl_iter;
   char *key;
   cache_entry_t *value;
+  const char *last = NULL;
+  size_t scanned = 0;
+  int status;
+
+  iter->names_num = 0;
+  iter->names_index = 0;
+  iter->buffer_used = 0;
+
+  pthread_mutex_lock (&cache_lock);
+
+  /* On the first call, start right at the prefix. Since the tree is sorted,
+   * all matching entries follow each other. */
+  if (iter->last[0] == 0)
+  {
+    if ((iter->prefix_len > 0)
+        && (c_avl_get (cache_tree, iter->prefix, (void *) &value) == 0)
+        && (value->state != STATE_MISSING)
+        && ((iter->filter == NULL)
+          || (*iter->filter) (iter->prefix, iter->user_data)))
+    {
+      uc_iter_add (iter, iter->prefix, value);
+      last = iter->prefix;
+    }
+
+    avl_iter = c_avl_get_iterator_after (cache_tree,
+        (iter->prefix_len > 0) ? iter->prefix : NULL);
+  }
+  else
+  {
+    avl_iter = c_avl_get_iterator_after (cache_tree, iter->last);
+  }
+
+  if (avl_iter == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    iter->done = 1;
+    return;
+  }
+
+  while (42)
+  {
+    status = c_avl_iterator_next (avl_iter, (void *) &key, (void *) &value);
+    if ((status != 0)
+        || (strncmp (iter->prefix, key, iter->prefix_len) != 0))
+    {
+      iter->done = 1;
+      break;
+    }
+
+    if ((value->state != STATE_MISSING)
+        && ((iter->filter == NULL)
+          || (*iter->filter) (key, iter->user_data))
+        && (uc_iter_add (iter, key, value) != 0))
+      break;
+
+    last = key;
+    scanned++;
+    if (scanned >= UC_ITER_SCAN_MAX)
+      break;
+  }
+
+  if (last != NULL)
+    sstrncpy (iter->last, last, sizeof (iter->last));
+
+  c_avl_iterator_destroy (avl_iter);
+  pthread_mutex_unlock (&cache_lock);
+} /* }}} void uc_iter_fill */
+
+int uc_iter_next (uc_iter_t *iter, /* {{{ */
+    const char **ret_name, cdtime_t *ret_time)
+{
+  if ((iter == NULL) || (ret_name == NULL))
+    return (-1);
+
+  while (iter->names_index >= iter->names_num)
+  {
+    if (iter->done)
+      return (1);
+    uc_iter_fill (iter);
+  }
+
+  *ret_name = iter->names[iter->names_index];
+  if (ret_time != NULL)
+    *ret_time = iter->times[iter->names_index];
+  iter->names_index++;
+
+  return (0);
+} /* }}} int uc_iter_next */
+
+void uc_iter_destroy (uc_iter_t *iter) /* {{{ */
+{
+  sfree (iter);
+} /* }}} void uc_iter_destroy */
+
+int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+{
+  uc_iter_t *iter;
+  const char *name;
+  cdtime_t time;
 
   char **names = NULL;
   cdtime_t *times = NULL;
   size_t number = 0;
+  size_t size = 0;
 
   int status = 0;
 
   if ((ret_names == NULL) || (ret_number == NULL))
     return (-1);
 
-  pthread_mutex_lock (&cache_lock);
+  iter = uc_iter_create (/* prefix = */ NULL, /* filter = */ NULL,
+      /* user_data = */ NULL);
+  if (iter == NULL)
+    return (-1);
 
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
+  while ((status = uc_iter_next (iter, &name, &time)) == 0)
   {
-    char **temp;
-
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
-
-    if (ret_times != NULL)
+    if (number >= size)
     {
-      cdtime_t *tmp_times;
+      char **tmp_names;
+      size_t new_size = (size == 0) ? 64 : 2 * size;
 
-      tmp_times = (cdtime_t *) realloc (times, sizeof (cdtime_t) * (number + 1));
-      if (tmp_times == NULL)
+      tmp_names = realloc (names, new_size * sizeof (*names));
+      if (tmp_names == NULL)
       {
-	status = -1;
-	break;
+        status = -1;
+        break;
       }
-      times = tmp_times;
-      times[number] = value->last_time;
-    }
+      names = tmp_names;
 
-    temp = (char **) realloc (names, sizeof (char *) * (number + 1));
-    if (temp == NULL)
-    {
-      status = -1;
-      break;
+      if (ret_times != NULL)
+      {
+        cdtime_t *tmp_times;
+
+        tmp_times = realloc (times, new_size * sizeof (*times));
+        if (tmp_times == NULL)
+        {
+          status = -1;
+          break;
+        }
+        times = tmp_times;
+      }
+
+      size = new_size;
     }
-    names = temp;
-    names[number] = strdup (key);
+
+    names[number] = strdup (name);
     if (names[number] == NULL)
     {
       status = -1;
       break;
     }
+    if (ret_times != NULL)
+      times[number] = time;
     number++;
-  } /* while (c_avl_iterator_next) */
+  } /* while (uc_iter_next) */
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+  uc_iter_destroy (iter);
 
-  if (status != 0)
+  /* uc_iter_next returns one at the end of the cache. */
+  if (status < 0)
   {
     size_t i;
-    
+
     for (i = 0; i < number; i++)
     {
       sfree (names[i]);
     }
     sfree (names);
+    sfree (times);
 
     return (-1);
   }
@@ -668,6 +1225,32 @@ int uc_get_state (const data_set_t *ds, const value_list_t *vl)
   return (ret);
 } /* int uc_get_state */
 
+int uc_get_last_time (const value_list_t *vl, cdtime_t *ret_time)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+  int ret = -1;
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("uc_get_last_time: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  {
+    assert (ce != NULL);
+    *ret_time = ce->last_time;
+    ret = 0;
+  }
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (ret);
+} /* int uc_get_last_time */
+
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -736,6 +1319,8 @@ int uc_get_history_by_name (const char *name,
 	i++)
       tmp[i] = NAN;
 
+    uc_memory_used += (num_steps - ce->history_length)
+      * ce->values_num * sizeof (*ce->history);
     ce->history = tmp;
     ce->history_length = num_steps;
   } /* if (ce->history_length < num_steps) */
@@ -777,17 +1362,91 @@ int uc_get_history (const data_set_t *ds, const value_list_t *vl,
   return (uc_get_history_by_name (name, ret_history, num_steps, num_ds));
 } /* int uc_get_history */
 
-int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
+int uc_get_window_stats_by_name (const char *name, size_t window, /* {{{ */
+    uc_window_stats_t *ret_stats, size_t num_ds)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
-  int ret = STATE_ERROR;
+  uc_window_t *w;
+  int status;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
+  if ((name == NULL) || (window == 0) || (ret_stats == NULL))
+    return (-EINVAL);
+
+  pthread_mutex_lock (&cache_lock);
+
+  status = c_avl_get (cache_tree, name, (void *) &ce);
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (-ENOENT);
+  }
+
+  if (((size_t) ce->values_num) != num_ds)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (-EINVAL);
+  }
+
+  for (w = ce->windows; w != NULL; w = w->next)
+    if (w->length == window)
+      break;
+
+  /* Start a new window with the most recent rates. From now on, uc_update()
+   * keeps it up to date. */
+  if (w == NULL)
+  {
+    if ((ce->windows_size + window) > uc_window_max)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      return (-ENOSPC);
+    }
+
+    w = uc_window_create (window, num_ds);
+    if (w == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      return (-ENOMEM);
+    }
+    uc_memory_used += uc_window_size (window, num_ds);
+    uc_window_add (w, ce->values_gauge, num_ds);
+
+    w->next = ce->windows;
+    ce->windows = w;
+    ce->windows_size += window;
+  }
+
+  uc_window_get_stats (w, ret_stats, num_ds);
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (0);
+} /* }}} int uc_get_window_stats_by_name */
+
+int uc_get_window_stats (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    size_t window, uc_window_stats_t *ret_stats, size_t num_ds)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("utils_cache: uc_get_window_stats: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  return (uc_get_window_stats_by_name (name, window, ret_stats, num_ds));
+} /* }}} int uc_get_window_stats */
+
+int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+  int ret = STATE_ERROR;
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("uc_get_state: FORMAT_VL failed.");
+    return (STATE_ERROR);
+  }
 
   pthread_mutex_lock (&cache_lock);
 
@@ -854,6 +1513,710 @@ int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
   return (ret);
 } /* int uc_inc_hits */
 
+/*
+ * Snapshots
+ *
+ * The file starts with a uc_snapshot_header_t, followed by one record per
+ * entry. Every record starts at an eight byte boundary, so the file can be
+ * used in place after mapping it into memory:
+ *
+ *   uc_snapshot_record_t
+ *   value_t  values_raw[values_num]
+ *   gauge_t  values_gauge[values_num]
+ *   gauge_t  history[history_length * values_num]
+ *   uint8_t  ds_types[values_num]
+ *   char     name[name_len]        (null terminated)
+ *   char     meta[meta_size]
+ *   padding to eight bytes
+ *
+ * The meta data is a sequence of a type byte, the null terminated key and
+ * the value: strings are null terminated, all other types take eight bytes.
+ * Numbers are stored in host byte order, so a snapshot can only be read on
+ * the architecture that wrote it.
+ */
+#define UC_SNAPSHOT_MAGIC      "collectd-cache"
+#define UC_SNAPSHOT_VERSION    1
+#define UC_SNAPSHOT_BYTE_ORDER 0x01020304
+#define UC_SNAPSHOT_CHUNK_SIZE 1024
+#define UC_SNAPSHOT_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+struct uc_snapshot_header_s
+{
+  char     magic[16];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t time;
+  uint64_t entries_num;
+  uint64_t size;
+};
+typedef struct uc_snapshot_header_s uc_snapshot_header_t;
+
+struct uc_snapshot_record_s
+{
+  uint32_t size;
+  uint16_t values_num;
+  uint16_t name_len;
+  uint64_t last_time;
+  uint64_t interval;
+  int32_t  state;
+  int32_t  hits;
+  uint32_t history_length;
+  uint32_t history_index;
+  uint32_t meta_size;
+  uint32_t reserved;
+};
+typedef struct uc_snapshot_record_s uc_snapshot_record_t;
+
+struct uc_snapshot_buffer_s
+{
+  char  *data;
+  size_t size;
+  size_t len;
+};
+typedef struct uc_snapshot_buffer_s uc_snapshot_buffer_t;
+
+/* Returns the data set of the type contained in "name", which has the form
+ * "host/plugin[-instance]/type[-instance]". */
+static const data_set_t *uc_snapshot_get_ds (const char *name) /* {{{ */
+{
+  char type[DATA_MAX_NAME_LEN];
+  const char *ptr;
+  size_t len;
+
+  ptr = strrchr (name, '/');
+  if (ptr == NULL)
+    return (NULL);
+  ptr++;
+
+  len = strcspn (ptr, "-");
+  if (len >= sizeof (type))
+    return (NULL);
+  memcpy (type, ptr, len);
+  type[len] = 0;
+
+  return (plugin_get_ds (type));
+} /* }}} const data_set_t *uc_snapshot_get_ds */
+
+/* Makes room for "len" more bytes and returns a pointer to them. */
+static char *uc_snapshot_reserve (uc_snapshot_buffer_t *buf, /* {{{ */
+    size_t len)
+{
+  char *ret;
+
+  if ((buf->len + len) > buf->size)
+  {
+    size_t new_size = (buf->size > 0) ? buf->size : 65536;
+    char *tmp;
+
+    while (new_size < (buf->len + len))
+      new_size *= 2;
+
+    tmp = realloc (buf->data, new_size);
+    if (tmp == NULL)
+      return (NULL);
+    buf->data = tmp;
+    buf->size = new_size;
+  }
+
+  ret = buf->data + buf->len;
+  buf->len += len;
+  return (ret);
+} /* }}} char *uc_snapshot_reserve */
+
+static int uc_snapshot_append_meta (uc_snapshot_buffer_t *buf, /* {{{ */
+    meta_data_t *md)
+{
+  char **toc = NULL;
+  int toc_num;
+  int status = 0;
+  int i;
+
+  toc_num = meta_data_toc (md, &toc);
+  if (toc_num <= 0)
+    return (0);
+
+  for (i = 0; i < toc_num; i++)
+  {
+    int type = meta_data_type (md, toc[i]);
+    size_t key_len = strlen (toc[i]) + 1;
+    char *string = NULL;
+    union { int64_t si; uint64_t ui; double d; } value;
+    size_t value_len = sizeof (value);
+    char *ptr;
+
+    memset (&value, 0, sizeof (value));
+    if (type == MD_TYPE_STRING)
+    {
+      if (meta_data_get_string (md, toc[i], &string) != 0)
+        continue;
+      value_len = strlen (string) + 1;
+    }
+    else if (type == MD_TYPE_SIGNED_INT)
+      meta_data_get_signed_int (md, toc[i], &value.si);
+    else if (type == MD_TYPE_UNSIGNED_INT)
+      meta_data_get_unsigned_int (md, toc[i], &value.ui);
+    else if (type == MD_TYPE_DOUBLE)
+      meta_data_get_double (md, toc[i], &value.d);
+    else if (type == MD_TYPE_BOOLEAN)
+    {
+      _Bool b = 0;
+      meta_data_get_boolean (md, toc[i], &b);
+      value.ui = b ? 1 : 0;
+    }
+    else
+      continue;
+
+    ptr = uc_snapshot_reserve (buf, 1 + key_len + value_len);
+    if (ptr == NULL)
+    {
+      sfree (string);
+      status = ENOMEM;
+      break;
+    }
+
+    ptr[0] = (char) type;
+    memcpy (ptr + 1, toc[i], key_len);
+    memcpy (ptr + 1 + key_len, (string != NULL) ? (void *) string : &value,
+        value_len);
+    sfree (string);
+  }
+
+  for (i = 0; i < toc_num; i++)
+    sfree (toc[i]);
+  sfree (toc);
+
+  return (status);
+} /* }}} int uc_snapshot_append_meta */
+
+/* Appends the record of "ce" to "buf". Must be called with "cache_lock"
+ * held. Returns ENOENT if the entry's type is unknown. */
+static int uc_snapshot_append (uc_snapshot_buffer_t *buf, /* {{{ */
+    const cache_entry_t *ce)
+{
+  const data_set_t *ds;
+  uc_snapshot_record_t *rec;
+  size_t rec_offset;
+  size_t name_len = strlen (ce->name) + 1;
+  size_t values_num = (size_t) ce->values_num;
+  size_t history_num = ce->history_length * values_num;
+  size_t meta_offset;
+  size_t fixed_size;
+  uint8_t *ds_types;
+  char *ptr;
+  size_t i;
+
+  ds = uc_snapshot_get_ds (ce->name);
+  if ((ds == NULL) || (ds->ds_num != ce->values_num))
+    return (ENOENT);
+  if ((values_num > UINT16_MAX) || (name_len > UINT16_MAX))
+    return (EINVAL);
+
+  fixed_size = sizeof (*rec) + values_num * (sizeof (value_t) + sizeof (gauge_t))
+    + history_num * sizeof (gauge_t) + values_num + name_len;
+
+  rec_offset = buf->len;
+  ptr = uc_snapshot_reserve (buf, fixed_size);
+  if (ptr == NULL)
+    return (ENOMEM);
+
+  rec = (uc_snapshot_record_t *) ptr;
+  memset (rec, 0, sizeof (*rec));
+  rec->values_num = (uint16_t) values_num;
+  rec->name_len = (uint16_t) name_len;
+  rec->last_time = (uint64_t) ce->last_time;
+  rec->interval = (uint64_t) ce->interval;
+  rec->state = (int32_t) ce->state;
+  rec->hits = (int32_t) ce->hits;
+  rec->history_length = (uint32_t) ce->history_length;
+  rec->history_index = (uint32_t) ce->history_index;
+  ptr += sizeof (*rec);
+
+  memcpy (ptr, ce->values_raw, values_num * sizeof (value_t));
+  ptr += values_num * sizeof (value_t);
+  memcpy (ptr, ce->values_gauge, values_num * sizeof (gauge_t));
+  ptr += values_num * sizeof (gauge_t);
+  if (history_num > 0)
+    memcpy (ptr, ce->history, history_num * sizeof (gauge_t));
+  ptr += history_num * sizeof (gauge_t);
+
+  ds_types = (uint8_t *) ptr;
+  for (i = 0; i < values_num; i++)
+    ds_types[i] = (uint8_t) ds->ds[i].type;
+  ptr += values_num;
+
+  memcpy (ptr, ce->name, name_len);
+
+  meta_offset = buf->len;
+  if ((ce->meta != NULL)
+      && (uc_snapshot_append_meta (buf, ce->meta) != 0))
+  {
+    buf->len = rec_offset;
+    return (ENOMEM);
+  }
+
+  /* "buf" may have been moved by appending the meta data. */
+  rec = (uc_snapshot_record_t *) (buf->data + rec_offset);
+  rec->meta_size = (uint32_t) (buf->len - meta_offset);
+
+  i = UC_SNAPSHOT_ALIGN (buf->len) - buf->len;
+  ptr = uc_snapshot_reserve (buf, i);
+  if (ptr == NULL)
+  {
+    buf->len = rec_offset;
+    return (ENOMEM);
+  }
+  memset (ptr, 0, i);
+
+  rec->size = (uint32_t) (buf->len - rec_offset);
+  return (0);
+} /* }}} int uc_snapshot_append */
+
+int uc_snapshot_write (const char *file) /* {{{ */
+{
+  char tmpfile[PATH_MAX];
+  char errbuf[1024];
+  char last[6 * DATA_MAX_NAME_LEN];
+  _Bool have_last = 0;
+  uc_snapshot_header_t header;
+  uc_snapshot_buffer_t buf;
+  FILE *fh;
+  int status = 0;
+
+  if (file == NULL)
+    return (EINVAL);
+
+  ssnprintf (tmpfile, sizeof (tmpfile), "%s.tmp", file);
+
+  fh = fopen (tmpfile, "w");
+  if (fh == NULL)
+  {
+    status = errno;
+    ERROR ("uc_snapshot_write: fopen (%s) failed: %s", tmpfile,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  memset (&header, 0, sizeof (header));
+  sstrncpy (header.magic, UC_SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = UC_SNAPSHOT_VERSION;
+  header.byte_order = UC_SNAPSHOT_BYTE_ORDER;
+  header.time = (uint64_t) cdtime ();
+  header.size = sizeof (header);
+
+  memset (&buf, 0, sizeof (buf));
+
+  if (fwrite (&header, sizeof (header), 1, fh) != 1)
+    status = errno;
+
+  /* Serialize the cache in chunks, so updates aren't blocked while writing
+   * to disk. Like the iterator above, this continues after the last name
+   * written. */
+  while (status == 0)
+  {
+    c_avl_iterator_t *iter;
+    char *key;
+    cache_entry_t *ce;
+    int num = 0;
+
+    buf.len = 0;
+
+    pthread_mutex_lock (&cache_lock);
+    iter = c_avl_get_iterator_after (cache_tree, have_last ? last : NULL);
+    if (iter == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      status = ENOMEM;
+      break;
+    }
+
+    while ((num < UC_SNAPSHOT_CHUNK_SIZE)
+        && (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0))
+    {
+      sstrncpy (last, key, sizeof (last));
+      have_last = 1;
+      num++;
+
+      status = uc_snapshot_append (&buf, ce);
+      if (status == ENOENT)
+      {
+        status = 0;
+        continue;
+      }
+      else if (status != 0)
+        break;
+
+      header.entries_num++;
+    }
+
+    c_avl_iterator_destroy (iter);
+    pthread_mutex_unlock (&cache_lock);
+
+    if ((status == 0) && (buf.len > 0))
+    {
+      if (fwrite (buf.data, buf.len, 1, fh) != 1)
+        status = errno;
+      header.size += buf.len;
+    }
+
+    if (num < UC_SNAPSHOT_CHUNK_SIZE)
+      break;
+  } /* while (status == 0) */
+
+  sfree (buf.data);
+
+  if (status == 0)
+  {
+    rewind (fh);
+    if (fwrite (&header, sizeof (header), 1, fh) != 1)
+      status = errno;
+  }
+  if ((status == 0) && (fflush (fh) != 0))
+    status = errno;
+  if ((status == 0) && (fsync (fileno (fh)) != 0))
+    status = errno;
+  if ((fclose (fh) != 0) && (status == 0))
+    status = errno;
+
+  if (status == 0)
+  {
+    if (rename (tmpfile, file) != 0)
+      status = errno;
+  }
+
+  if (status != 0)
+  {
+    ERROR ("uc_snapshot_write: Writing \"%s\" failed: %s", file,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    unlink (tmpfile);
+    return (status);
+  }
+
+  DEBUG ("uc_snapshot_write: Wrote %"PRIu64" entries to \"%s\".",
+      header.entries_num, file);
+  return (0);
+} /* }}} int uc_snapshot_write */
+
+static meta_data_t *uc_snapshot_read_meta (const char *data, /* {{{ */
+    size_t size)
+{
+  meta_data_t *md;
+  size_t pos = 0;
+
+  md = meta_data_create ();
+  if (md == NULL)
+    return (NULL);
+
+  while (pos < size)
+  {
+    int type = (int) data[pos];
+    const char *key = data + pos + 1;
+    const char *value;
+    const char *ptr;
+    size_t key_len;
+    size_t value_len;
+
+    ptr = memchr (key, 0, size - (pos + 1));
+    if (ptr == NULL)
+      break;
+    key_len = ((size_t) (ptr - key)) + 1;
+
+    value = key + key_len;
+    if (type == MD_TYPE_STRING)
+    {
+      ptr = memchr (value, 0, size - (pos + 1 + key_len));
+      if (ptr == NULL)
+        break;
+      value_len = ((size_t) (ptr - value)) + 1;
+      meta_data_add_string (md, key, value);
+    }
+    else
+    {
+      union { int64_t si; uint64_t ui; double d; } v;
+
+      value_len = sizeof (v);
+      if ((pos + 1 + key_len + value_len) > size)
+        break;
+      memcpy (&v, value, sizeof (v));
+
+      if (type == MD_TYPE_SIGNED_INT)
+        meta_data_add_signed_int (md, key, v.si);
+      else if (type == MD_TYPE_UNSIGNED_INT)
+        meta_data_add_unsigned_int (md, key, v.ui);
+      else if (type == MD_TYPE_DOUBLE)
+        meta_data_add_double (md, key, v.d);
+      else if (type == MD_TYPE_BOOLEAN)
+        meta_data_add_boolean (md, key, (v.ui != 0) ? 1 : 0);
+      else
+        break;
+    }
+
+    pos += 1 + key_len + value_len;
+  }
+
+  return (md);
+} /* }}} meta_data_t *uc_snapshot_read_meta */
+
+/* Adds the entry described by "rec" to the cache, unless its types don't
+ * match the data set any longer. Must be called with "cache_lock" held.
+ * "rec" has been checked to fit into the snapshot. */
+static int uc_snapshot_read_record (const uc_snapshot_record_t *rec) /* {{{ */
+{
+  const char *ptr = (const char *) (rec + 1);
+  size_t values_num = (size_t) rec->values_num;
+  size_t history_num = ((size_t) rec->history_length) * values_num;
+  const value_t *values_raw;
+  const gauge_t *values_gauge;
+  const gauge_t *history;
+  const uint8_t *ds_types;
+  const char *name;
+  const data_set_t *ds;
+  cache_entry_t *ce = NULL;
+  size_t i;
+
+  values_raw = (const value_t *) ptr;
+  ptr += values_num * sizeof (value_t);
+  values_gauge = (const gauge_t *) ptr;
+  ptr += values_num * sizeof (gauge_t);
+  history = (const gauge_t *) ptr;
+  ptr += history_num * sizeof (gauge_t);
+  ds_types = (const uint8_t *) ptr;
+  ptr += values_num;
+  name = ptr;
+  ptr += rec->name_len;
+
+  if ((rec->name_len < 1) || (name[rec->name_len - 1] != 0)
+      || (strlen (name) != ((size_t) rec->name_len - 1)))
+    return (EINVAL);
+
+  ds = uc_snapshot_get_ds (name);
+  if ((ds == NULL) || (((size_t) ds->ds_num) != values_num))
+    return (ENOENT);
+  for (i = 0; i < values_num; i++)
+    if (ds->ds[i].type != (int) ds_types[i])
+      return (ENOENT);
+
+  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+    return (EEXIST);
+
+  ce = cache_alloc ((int) values_num, name);
+  if (ce == NULL)
+    return (ENOMEM);
+
+  memcpy (ce->values_raw, values_raw, values_num * sizeof (value_t));
+  memcpy (ce->values_gauge, values_gauge, values_num * sizeof (gauge_t));
+  ce->last_time = (cdtime_t) rec->last_time;
+  /* Give the entry a full timeout to be updated again. */
+  ce->last_update = cdtime ();
+  ce->interval = (cdtime_t) rec->interval;
+  ce->state = (int) rec->state;
+  ce->hits = (int) rec->hits;
+
+  if ((history_num > 0) && (rec->history_index < rec->history_length))
+  {
+    ce->history = malloc (history_num * sizeof (gauge_t));
+    if (ce->history != NULL)
+    {
+      memcpy (ce->history, history, history_num * sizeof (gauge_t));
+      ce->history_length = (size_t) rec->history_length;
+      ce->history_index = (size_t) rec->history_index;
+      uc_memory_used += history_num * sizeof (gauge_t);
+    }
+  }
+
+  if (rec->meta_size > 0)
+    ce->meta = uc_snapshot_read_meta (ptr, (size_t) rec->meta_size);
+
+  if (c_avl_insert (cache_tree, ce->name, ce) != 0)
+  {
+    cache_free (ce);
+    return (ENOMEM);
+  }
+
+  return (0);
+} /* }}} int uc_snapshot_read_record */
+
+int uc_snapshot_read (const char *file) /* {{{ */
+{
+  char errbuf[1024];
+  const uc_snapshot_header_t *header;
+  struct stat statbuf;
+  char *data;
+  size_t size;
+  size_t pos;
+  uint64_t loaded = 0;
+  uint64_t skipped = 0;
+  int fd;
+  int status = 0;
+
+  if ((file == NULL) || (cache_tree == NULL))
+    return (EINVAL);
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+  {
+    status = errno;
+    if (status != ENOENT)
+      ERROR ("uc_snapshot_read: open (%s) failed: %s", file,
+          sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    status = errno;
+    close (fd);
+    ERROR ("uc_snapshot_read: fstat (%s) failed: %s", file,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+  size = (size_t) statbuf.st_size;
+  if (size < sizeof (*header))
+  {
+    close (fd);
+    ERROR ("uc_snapshot_read: \"%s\" is too short.", file);
+    return (EINVAL);
+  }
+
+#if HAVE_SYS_MMAN_H
+  data = mmap (/* addr = */ NULL, size, PROT_READ, MAP_PRIVATE, fd,
+      /* offset = */ 0);
+  if (data == MAP_FAILED)
+  {
+    status = errno;
+    close (fd);
+    ERROR ("uc_snapshot_read: mmap (%s) failed: %s", file,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+#else
+  data = malloc (size);
+  if ((data == NULL) || (sread (fd, data, size) != 0))
+  {
+    sfree (data);
+    close (fd);
+    ERROR ("uc_snapshot_read: Reading \"%s\" failed.", file);
+    return (EIO);
+  }
+#endif
+  close (fd);
+
+  header = (const uc_snapshot_header_t *) data;
+  if ((strncmp (header->magic, UC_SNAPSHOT_MAGIC, sizeof (header->magic)) != 0)
+      || (header->version != UC_SNAPSHOT_VERSION)
+      || (header->byte_order != UC_SNAPSHOT_BYTE_ORDER)
+      || (header->size != (uint64_t) size))
+  {
+    ERROR ("uc_snapshot_read: \"%s\" is not a complete snapshot written on "
+        "this architecture. Ignoring it.", file);
+#if HAVE_SYS_MMAN_H
+    munmap (data, size);
+#else
+    sfree (data);
+#endif
+    return (EINVAL);
+  }
+
+  pthread_mutex_lock (&cache_lock);
+  for (pos = sizeof (*header); pos < size; )
+  {
+    const uc_snapshot_record_t *rec;
+    size_t min_size;
+
+    rec = (const uc_snapshot_record_t *) (data + pos);
+    if ((size - pos) < sizeof (*rec))
+    {
+      status = EINVAL;
+      break;
+    }
+
+    min_size = sizeof (*rec)
+      + ((size_t) rec->values_num) * (sizeof (value_t) + sizeof (gauge_t))
+      + ((size_t) rec->history_length) * ((size_t) rec->values_num)
+        * sizeof (gauge_t)
+      + ((size_t) rec->values_num) + ((size_t) rec->name_len)
+      + ((size_t) rec->meta_size);
+    if ((rec->size < min_size) || ((rec->size % 8) != 0)
+        || (((size_t) rec->size) > (size - pos)))
+    {
+      status = EINVAL;
+      break;
+    }
+
+    if (uc_snapshot_read_record (rec) == 0)
+      loaded++;
+    else
+      skipped++;
+
+    pos += rec->size;
+  }
+  pthread_mutex_unlock (&cache_lock);
+
+#if HAVE_SYS_MMAN_H
+  munmap (data, size);
+#else
+  sfree (data);
+#endif
+
+  if (status != 0)
+  {
+    ERROR ("uc_snapshot_read: \"%s\" is corrupt. Loaded %"PRIu64" entries "
+        "before the error.", file, loaded);
+    return (status);
+  }
+
+  INFO ("uc_snapshot_read: Loaded %"PRIu64" entries from \"%s\", skipped "
+      "%"PRIu64" entries which don't match the types any longer.",
+      loaded, file, skipped);
+  return (0);
+} /* }}} int uc_snapshot_read */
+
+int uc_snapshot_periodic (void) /* {{{ */
+{
+  cdtime_t now;
+
+  if ((uc_snapshot_file == NULL) || (uc_snapshot_interval == 0))
+    return (0);
+
+  now = cdtime ();
+  if (uc_snapshot_last == 0)
+    uc_snapshot_last = now;
+  if ((now - uc_snapshot_last) < uc_snapshot_interval)
+    return (0);
+
+  uc_snapshot_last = now;
+  return (uc_snapshot_write (uc_snapshot_file));
+} /* }}} int uc_snapshot_periodic */
+
+int uc_shutdown (void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  cache_entry_t *ce;
+  char *key;
+  int status = 0;
+
+  if (uc_snapshot_file != NULL)
+    status = uc_snapshot_write (uc_snapshot_file);
+
+  sfree (uc_snapshot_file);
+
+  /* Release the meta data, so meta_data_shutdown() can free the keys. The
+   * entries themselves stay, in case a plugin still looks something up. */
+  pthread_mutex_lock (&cache_lock);
+  if (cache_tree != NULL)
+  {
+    iter = c_avl_get_iterator (cache_tree);
+    while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+    {
+      meta_data_destroy (ce->meta);
+      ce->meta = NULL;
+    }
+    c_avl_iterator_destroy (iter);
+  }
+  pthread_mutex_unlock (&cache_lock);
+
+  return (status);
+} /* }}} int uc_shutdown */
+
 /*
  * Meta data interface
  */
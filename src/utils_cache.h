@@ -30,13 +30,58 @@
 #define STATE_MISSING 15
 
 int uc_init (void);
+/* Writes the final snapshot, if configured, and releases the meta data. */
+int uc_shutdown (void);
 int uc_check_timeout (void);
 int uc_update (const data_set_t *ds, const value_list_t *vl);
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
+/* Looks up several entries while holding the cache lock only once. The rates
+ * of entry "i" are copied to the next "values_num[i]" elements of
+ * "ret_values". "ret_status[i]" is set to zero on success, ENOENT if the
+ * entry doesn't exist and EINVAL if it has a different number of values. */
+int uc_get_rates_by_names (char * const *names, size_t names_num,
+    const size_t *values_num, gauge_t *ret_values, int *ret_status);
 
+/* Returns copies of all names in the cache. Built on top of the iterator
+ * below; prefer the iterator if the names don't need to be kept. */
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * Iterator over the names in the cache. The names are copied in chunks and
+ * the cache lock is released between chunks, so walking a large cache
+ * doesn't stall the threads updating it. Entries added or removed while
+ * iterating may or may not be returned; entries in the "missing" state are
+ * skipped.
+ */
+struct uc_iter_s;
+typedef struct uc_iter_s uc_iter_t;
+
+/* Called with the cache locked, so it must not call any of the uc_*
+ * functions. Returns non-zero if "name" should be returned. */
+typedef int (*uc_iter_filter_t) (const char *name, void *user_data);
+
+/* Only names starting with "prefix" are returned. Since the cache is sorted,
+ * the iteration starts right at the prefix. Both "prefix" and "filter" may
+ * be NULL. */
+uc_iter_t *uc_iter_create (const char *prefix,
+    uc_iter_filter_t filter, void *user_data);
+/* Returns zero and the next name, one at the end or less than zero on
+ * error. "ret_name" is valid until the next call. "ret_time" may be NULL. */
+int uc_iter_next (uc_iter_t *iter, const char **ret_name, cdtime_t *ret_time);
+void uc_iter_destroy (uc_iter_t *iter);
+
+/* Returns the memory allocated for the cache entries, including their
+ * history and moving windows, and the number of entries. Both are read at
+ * the same time, so they can be used to calculate the memory used per
+ * entry. Slabs are counted as a whole, so memory of removed entries which
+ * hasn't been reused yet is included. "ret_entries" may be NULL. */
+int uc_get_memory (size_t *ret_bytes, size_t *ret_entries);
+
+/* Returns the time of the most recent value in the cache for "vl". The
+ * network plugin uses this to detect values it has seen before. */
+int uc_get_last_time (const value_list_t *vl, cdtime_t *ret_time);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
@@ -48,6 +93,57 @@ int uc_get_history (const data_set_t *ds, const value_list_t *vl,
 int uc_get_history_by_name (const char *name,
     gauge_t *ret_history, size_t num_steps, size_t num_ds);
 
+/*
+ * Moving windows
+ *
+ * Aggregates over the last "window" rates of an entry. The first request for
+ * a window size starts the window, seeded with the current rates; after that
+ * the aggregates are updated with every new value in constant time, so
+ * reading them doesn't copy the history. NaN values are skipped; "num" is the
+ * number of values the aggregates are based on and all aggregates are NaN if
+ * it is zero. "ewma" is an exponentially weighted moving average with a
+ * smoothing factor of 2 / (window + 1).
+ *
+ * The windows of one entry may hold at most "CacheWindowMax" values
+ * together. Returns -ENOSPC if the window would exceed this limit, -ENOENT
+ * if the entry doesn't exist and -EINVAL if it doesn't have "num_ds" values.
+ */
+struct uc_window_stats_s
+{
+  size_t  num;
+  gauge_t sum;
+  gauge_t mean;
+  gauge_t min;
+  gauge_t max;
+  gauge_t ewma;
+};
+typedef struct uc_window_stats_s uc_window_stats_t;
+
+int uc_get_window_stats (const data_set_t *ds, const value_list_t *vl,
+    size_t window, uc_window_stats_t *ret_stats, size_t num_ds);
+int uc_get_window_stats_by_name (const char *name, size_t window,
+    uc_window_stats_t *ret_stats, size_t num_ds);
+
+/*
+ * Snapshots
+ *
+ * A snapshot holds the raw values, rates, times, state, history and meta
+ * data of all entries, so that rates can be calculated right after a
+ * restart. If the "CacheSnapshotFile" option is set, the snapshot is read by
+ * uc_init(), written every "CacheSnapshotInterval" seconds by
+ * uc_snapshot_periodic() and written at shutdown by uc_shutdown(). Entries
+ * whose data set has changed since the snapshot was written are skipped.
+ *
+ * Writing doesn't block updates for more than a chunk of entries, so the
+ * snapshot isn't a consistent image of the whole cache. The file is replaced
+ * atomically, though.
+ */
+int uc_snapshot_write (const char *file);
+/* Must be called before any values are dispatched. Entries already in the
+ * cache are not overwritten. */
+int uc_snapshot_read (const char *file);
+int uc_snapshot_periodic (void);
+
 /*
  * Meta data interface
  */
@@ -155,4 +155,159 @@ int handle_getval (FILE *fh, char *buffer)
   return (0);
 } /* int handle_getval */
 
+int handle_getvals (FILE *fh, char *buffer, /* {{{ */
+    char **lines, size_t lines_num)
+{
+  char *command;
+  char **names = NULL;
+  const data_set_t **data_sets = NULL;
+  size_t *values_num = NULL;
+  gauge_t *values = NULL;
+  int *status_list = NULL;
+  size_t values_total = 0;
+  gauge_t *v;
+  int status;
+  size_t i;
+  size_t j;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("GETVALS", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    return (-1);
+  }
+
+  if (*buffer != 0)
+  {
+    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    return (-1);
+  }
+
+  names = calloc (lines_num + 1, sizeof (*names));
+  data_sets = calloc (lines_num + 1, sizeof (*data_sets));
+  values_num = calloc (lines_num + 1, sizeof (*values_num));
+  status_list = calloc (lines_num + 1, sizeof (*status_list));
+  if ((names == NULL) || (data_sets == NULL) || (values_num == NULL)
+      || (status_list == NULL))
+  {
+    sfree (names);
+    sfree (data_sets);
+    sfree (values_num);
+    sfree (status_list);
+    print_to_socket (fh, "-1 malloc failed.\n");
+    return (-1);
+  }
+
+  /* Parse all identifiers and look up their types first, so the cache only
+   * needs to be locked once. Lines which can't be parsed are looked up with
+   * zero values and reported as unknown. */
+  for (i = 0; i < lines_num; i++)
+  {
+    char identifier_copy[6 * DATA_MAX_NAME_LEN];
+    char *hostname;
+    char *plugin;
+    char *plugin_instance;
+    char *type;
+    char *type_instance;
+    char *ptr = lines[i];
+
+    names[i] = "";
+    if ((parse_string (&ptr, &names[i]) != 0) || (*ptr != 0)
+        || (strlen (names[i]) >= sizeof (identifier_copy)))
+      continue;
+
+    sstrncpy (identifier_copy, names[i], sizeof (identifier_copy));
+    if (parse_identifier (identifier_copy, &hostname,
+          &plugin, &plugin_instance, &type, &type_instance) != 0)
+      continue;
+
+    data_sets[i] = plugin_get_ds (type);
+    if (data_sets[i] == NULL)
+      continue;
+
+    values_num[i] = (size_t) data_sets[i]->ds_num;
+    values_total += values_num[i];
+  }
+
+  values = calloc (values_total + 1, sizeof (*values));
+  if (values == NULL)
+  {
+    sfree (names);
+    sfree (data_sets);
+    sfree (values_num);
+    sfree (status_list);
+    print_to_socket (fh, "-1 malloc failed.\n");
+    return (-1);
+  }
+
+  uc_get_rates_by_names (names, lines_num, values_num, values, status_list);
+
+  status = 0;
+  if (fprintf (fh, "%zu Value list%s follow%s\n", lines_num,
+        (lines_num == 1) ? "" : "s", (lines_num == 1) ? "s" : "") < 0)
+    status = -1;
+
+  v = values;
+  for (i = 0; (i < lines_num) && (status == 0); i++)
+  {
+    if (data_sets[i] == NULL)
+    {
+      if (fprintf (fh, "-1 %s Unknown identifier or type.\n", names[i]) < 0)
+        status = -1;
+      continue;
+    }
+
+    if (status_list[i] != 0)
+    {
+      if (fprintf (fh, "-1 %s %s\n", names[i],
+            (status_list[i] == ENOENT) ? "No such value"
+            : "Error reading value from cache.") < 0)
+        status = -1;
+      v += values_num[i];
+      continue;
+    }
+
+    if (fprintf (fh, "0 %s", names[i]) < 0)
+      status = -1;
+    for (j = 0; (j < values_num[i]) && (status == 0); j++)
+    {
+      if (isnan (v[j]))
+        status = fprintf (fh, " %s=NaN", data_sets[i]->ds[j].name);
+      else
+        status = fprintf (fh, " %s=%e", data_sets[i]->ds[j].name, v[j]);
+      status = (status < 0) ? -1 : 0;
+    }
+    if ((status == 0) && (fprintf (fh, "\n") < 0))
+      status = -1;
+
+    v += values_num[i];
+  }
+
+  if (status != 0)
+  {
+    char errbuf[1024];
+    WARNING ("handle_getvals: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  sfree (names);
+  sfree (data_sets);
+  sfree (values_num);
+  sfree (status_list);
+  sfree (values);
+
+  return (status);
+} /* }}} int handle_getvals */
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -26,6 +26,10 @@
 
 int handle_getval (FILE *fh, char *buffer);
 
+/* Handles a GETVALS command: "buffer" is the command line, "lines" the
+ * identifiers to look up, one per line. */
+int handle_getvals (FILE *fh, char *buffer, char **lines, size_t lines_num);
+
 #endif /* UTILS_CMD_GETVAL_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -27,14 +27,33 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
+#include <fnmatch.h>
+
+/* Patterns given with the "host", "plugin" and "type" options. Plugin and
+ * type patterns are matched against the plugin and type including the
+ * instance, i.e. "cpu-0" and "cpu-idle". */
+struct listval_filter_s
+{
+  char *host;
+  char *plugin;
+  char *type;
+};
+typedef struct listval_filter_s listval_filter_t;
+
+/* The number of values is sent before the values. The cache is read in
+ * chunks without holding its lock throughout, so the number is only known
+ * once the last chunk has been read. Until then, the response is assembled
+ * in memory. */
+struct listval_buffer_s
+{
+  char *data;
+  size_t len;
+  size_t size;
+};
+typedef struct listval_buffer_s listval_buffer_t;
+
 #define free_everything_and_return(status) do { \
-    size_t j; \
-    for (j = 0; j < number; j++) { \
-      sfree(names[j]); \
-      names[j] = NULL; \
-    } \
-    sfree(names); \
-    sfree(times); \
+    sfree (buf.data); \
     return (status); \
   } while (0)
 
@@ -46,15 +65,116 @@
     free_everything_and_return (-1); \
   }
 
+static int listval_buffer_add (listval_buffer_t *buf, /* {{{ */
+    cdtime_t time, const char *name)
+{
+  int status;
+
+  while (42)
+  {
+    if (buf->size > buf->len)
+    {
+      status = ssnprintf (buf->data + buf->len, buf->size - buf->len,
+          "%.3f %s\n", CDTIME_T_TO_DOUBLE (time), name);
+      if ((status >= 0) && (((size_t) status) < (buf->size - buf->len)))
+      {
+        buf->len += (size_t) status;
+        return (0);
+      }
+    }
+
+    {
+      char *tmp;
+      size_t new_size = (buf->size == 0) ? 4096 : 2 * buf->size;
+
+      tmp = realloc (buf->data, new_size);
+      if (tmp == NULL)
+        return (-1);
+      buf->data = tmp;
+      buf->size = new_size;
+    }
+  }
+} /* }}} int listval_buffer_add */
+
+/* Returns true if "pattern" is NULL or matches the first "len" bytes of
+ * "str". */
+static _Bool listval_match (const char *pattern, /* {{{ */
+    const char *str, size_t len)
+{
+  char tmp[DATA_MAX_NAME_LEN * 2];
+
+  if (pattern == NULL)
+    return (1);
+
+  if (len >= sizeof (tmp))
+    return (0);
+  memcpy (tmp, str, len);
+  tmp[len] = 0;
+
+  return (fnmatch (pattern, tmp, /* flags = */ 0) == 0);
+} /* }}} _Bool listval_match */
+
+/* Called by the cache iterator with the cache locked. */
+static int listval_filter (const char *name, void *user_data) /* {{{ */
+{
+  listval_filter_t *filter = user_data;
+  const char *plugin;
+  const char *type;
+
+  plugin = strchr (name, '/');
+  if (plugin == NULL)
+    return (0);
+  plugin++;
+  type = strchr (plugin, '/');
+  if (type == NULL)
+    return (0);
+  type++;
+
+  return (listval_match (filter->host, name, (size_t) (plugin - name - 1))
+      && listval_match (filter->plugin, plugin, (size_t) (type - plugin - 1))
+      && listval_match (filter->type, type, strlen (type)));
+} /* }}} int listval_filter */
+
+/* Copies the part of the host pattern before the first wildcard to
+ * "prefix", so the cache iterator can skip to the matching hosts. */
+static void listval_prefix (const char *host, /* {{{ */
+    char *prefix, size_t prefix_size)
+{
+  size_t len;
+
+  prefix[0] = 0;
+  if (host == NULL)
+    return;
+
+  len = strcspn (host, "*?[\\");
+  if (host[len] == 0)
+  {
+    /* No wildcards: The host must match exactly. */
+    ssnprintf (prefix, prefix_size, "%s/", host);
+    return;
+  }
+
+  if (len >= prefix_size)
+    len = prefix_size - 1;
+  memcpy (prefix, host, len);
+  prefix[len] = 0;
+} /* }}} void listval_prefix */
+
 int handle_listval (FILE *fh, char *buffer)
 {
   char *command;
-  char **names = NULL;
-  cdtime_t *times = NULL;
+  listval_filter_t filter;
+  listval_buffer_t buf;
+  char prefix[6 * DATA_MAX_NAME_LEN];
+  uc_iter_t *iter;
+  const char *name;
+  cdtime_t time;
   size_t number = 0;
-  size_t i;
   int status;
 
+  memset (&filter, 0, sizeof (filter));
+  memset (&buf, 0, sizeof (buf));
+
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
       (void *) fh, buffer);
 
@@ -73,25 +193,71 @@ int handle_listval (FILE *fh, char *buffer)
     free_everything_and_return (-1);
   }
 
-  if (*buffer != 0)
+  while (*buffer != 0)
   {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    char *key;
+    char *value;
+
+    status = parse_option (&buffer, &key, &value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Misformatted option: %s\n", buffer);
+      free_everything_and_return (-1);
+    }
+
+    if (strcasecmp ("host", key) == 0)
+      filter.host = value;
+    else if (strcasecmp ("plugin", key) == 0)
+      filter.plugin = value;
+    else if (strcasecmp ("type", key) == 0)
+      filter.type = value;
+    else
+    {
+      print_to_socket (fh, "-1 Unknown option: %s\n", key);
+      free_everything_and_return (-1);
+    }
+  }
+
+  listval_prefix (filter.host, prefix, sizeof (prefix));
+
+  iter = uc_iter_create (prefix,
+      ((filter.host != NULL) || (filter.plugin != NULL)
+       || (filter.type != NULL)) ? listval_filter : NULL,
+      &filter);
+  if (iter == NULL)
+  {
+    print_to_socket (fh, "-1 uc_iter_create failed.\n");
     free_everything_and_return (-1);
   }
 
-  status = uc_get_names (&names, &times, &number);
-  if (status != 0)
+  while ((status = uc_iter_next (iter, &name, &time)) == 0)
+  {
+    if (listval_buffer_add (&buf, time, name) != 0)
+    {
+      status = -1;
+      break;
+    }
+    number++;
+  }
+  uc_iter_destroy (iter);
+
+  if (status < 0)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
+    DEBUG ("command listval: Reading the cache failed with status %i",
+        status);
+    print_to_socket (fh, "-1 Reading the cache failed.\n");
     free_everything_and_return (-1);
   }
 
   print_to_socket (fh, "%i Value%s found\n",
       (int) number, (number == 1) ? "" : "s");
-  for (i = 0; i < number; i++)
-    print_to_socket (fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE (times[i]),
-       	names[i]);
+  if ((buf.len > 0) && (fwrite (buf.data, 1, buf.len, fh) != buf.len))
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    free_everything_and_return (-1);
+  }
 
   free_everything_and_return (0);
 } /* int handle_listval */
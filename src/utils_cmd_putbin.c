@@ -0,0 +1,255 @@
+/**
+ * collectd - src/utils_cmd_putbin.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_putbin.h"
+#include "network.h"
+
+#if HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#endif
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+#define print_to_socket(fh, ...) \
+  if (fprintf (fh, __VA_ARGS__) < 0) { \
+    char errbuf[1024]; \
+    WARNING ("handle_putbin: failed to write to socket #%i: %s", \
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+    return -1; \
+  }
+
+#define PART_HEADER_SIZE (2 * sizeof (uint16_t))
+
+static int putbin_parse_string (const char *part, size_t part_size, /* {{{ */
+    char *output, size_t output_size)
+{
+  size_t len = part_size - PART_HEADER_SIZE;
+
+  if ((len < 1) || (len > output_size) || (part[part_size - 1] != 0))
+    return (-1);
+
+  memcpy (output, part + PART_HEADER_SIZE, len);
+  return (0);
+} /* }}} int putbin_parse_string */
+
+static int putbin_parse_number (const char *part, size_t part_size, /* {{{ */
+    uint64_t *ret_value)
+{
+  uint64_t tmp;
+
+  if (part_size != (PART_HEADER_SIZE + sizeof (tmp)))
+    return (-1);
+
+  memcpy (&tmp, part + PART_HEADER_SIZE, sizeof (tmp));
+  *ret_value = ntohll (tmp);
+  return (0);
+} /* }}} int putbin_parse_number */
+
+/* Decodes a values part into "vl->values", which has room for
+ * "values_size" values. */
+static int putbin_parse_values (const char *part, size_t part_size, /* {{{ */
+    value_list_t *vl, size_t values_size)
+{
+  const uint8_t *types;
+  const char *values;
+  uint16_t tmp16;
+  size_t num;
+  size_t i;
+
+  if (part_size < (PART_HEADER_SIZE + sizeof (tmp16)))
+    return (-1);
+
+  memcpy (&tmp16, part + PART_HEADER_SIZE, sizeof (tmp16));
+  num = (size_t) ntohs (tmp16);
+  if ((num == 0) || (num > values_size)
+      || (part_size != (PART_HEADER_SIZE + sizeof (tmp16)
+          + num * (sizeof (uint8_t) + sizeof (value_t)))))
+    return (-1);
+
+  types = (const uint8_t *) (part + PART_HEADER_SIZE + sizeof (tmp16));
+  values = (const char *) (types + num);
+
+  for (i = 0; i < num; i++)
+  {
+    value_t v;
+
+    memcpy (&v, values + i * sizeof (v), sizeof (v));
+    switch (types[i])
+    {
+      case DS_TYPE_COUNTER:
+        vl->values[i].counter = (counter_t) ntohll (v.counter);
+        break;
+      case DS_TYPE_GAUGE:
+        vl->values[i].gauge = (gauge_t) ntohd (v.gauge);
+        break;
+      case DS_TYPE_DERIVE:
+        vl->values[i].derive = (derive_t) ntohll (v.derive);
+        break;
+      case DS_TYPE_ABSOLUTE:
+        vl->values[i].absolute = (absolute_t) ntohll (v.absolute);
+        break;
+      default:
+        return (-1);
+    }
+  }
+
+  vl->values_len = (int) num;
+  return (0);
+} /* }}} int putbin_parse_values */
+
+int handle_putbin (FILE *fh, const void *data, size_t data_size) /* {{{ */
+{
+  const char *buffer = data;
+  value_t values[64];
+  value_list_t vl = VALUE_LIST_INIT;
+  const data_set_t *ds;
+  int values_submitted = 0;
+  int values_failed = 0;
+  int status = 0;
+
+  DEBUG ("utils_cmd_putbin: handle_putbin (fh = %p, data_size = %zu);",
+      (void *) fh, data_size);
+
+  vl.values = values;
+
+  while (data_size > 0)
+  {
+    uint16_t tmp16;
+    uint16_t part_type;
+    size_t part_size;
+
+    if (data_size < PART_HEADER_SIZE)
+    {
+      status = -1;
+      break;
+    }
+
+    memcpy (&tmp16, buffer, sizeof (tmp16));
+    part_type = ntohs (tmp16);
+    memcpy (&tmp16, buffer + sizeof (tmp16), sizeof (tmp16));
+    part_size = (size_t) ntohs (tmp16);
+
+    if ((part_size < PART_HEADER_SIZE) || (part_size > data_size))
+    {
+      status = -1;
+      break;
+    }
+
+    switch (part_type)
+    {
+      case TYPE_HOST:
+        status = putbin_parse_string (buffer, part_size,
+            vl.host, sizeof (vl.host));
+        break;
+      case TYPE_PLUGIN:
+        status = putbin_parse_string (buffer, part_size,
+            vl.plugin, sizeof (vl.plugin));
+        break;
+      case TYPE_PLUGIN_INSTANCE:
+        status = putbin_parse_string (buffer, part_size,
+            vl.plugin_instance, sizeof (vl.plugin_instance));
+        break;
+      case TYPE_TYPE:
+        status = putbin_parse_string (buffer, part_size,
+            vl.type, sizeof (vl.type));
+        break;
+      case TYPE_TYPE_INSTANCE:
+        status = putbin_parse_string (buffer, part_size,
+            vl.type_instance, sizeof (vl.type_instance));
+        break;
+
+      case TYPE_TIME:
+      case TYPE_TIME_HR:
+      case TYPE_INTERVAL:
+      case TYPE_INTERVAL_HR:
+      {
+        uint64_t tmp = 0;
+
+        status = putbin_parse_number (buffer, part_size, &tmp);
+        if (status != 0)
+          break;
+
+        if (part_type == TYPE_TIME)
+          vl.time = TIME_T_TO_CDTIME_T (tmp);
+        else if (part_type == TYPE_TIME_HR)
+          vl.time = (cdtime_t) tmp;
+        else if (part_type == TYPE_INTERVAL)
+          vl.interval = TIME_T_TO_CDTIME_T (tmp);
+        else
+          vl.interval = (cdtime_t) tmp;
+        break;
+      }
+
+      case TYPE_VALUES:
+        status = putbin_parse_values (buffer, part_size, &vl,
+            STATIC_ARRAY_SIZE (values));
+        if (status != 0)
+          break;
+
+        /* Check the type here: plugin_dispatch_values() only accepts
+         * value lists matching their data set. */
+        ds = plugin_get_ds (vl.type);
+        if ((ds != NULL) && (ds->ds_num == vl.values_len)
+            && (plugin_dispatch_values (&vl) == 0))
+          values_submitted++;
+        else
+          values_failed++;
+        break;
+
+      default:
+        /* Ignore notifications and anything else we don't know. */
+        break;
+    }
+
+    if (status != 0)
+      break;
+
+    buffer += part_size;
+    data_size -= part_size;
+  } /* while (data_size > 0) */
+
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Malformed part at offset %zu, "
+        "%i %s been dispatched.\n",
+        (size_t) (buffer - (const char *) data), values_submitted,
+        (values_submitted == 1) ? "value has" : "values have");
+    return (-1);
+  }
+
+  if (values_failed > 0)
+  {
+    print_to_socket (fh, "-1 %i of %i value lists could not be dispatched, "
+        "check the types.\n", values_failed,
+        values_failed + values_submitted);
+    return (-1);
+  }
+
+  print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+      values_submitted,
+      (values_submitted == 1) ? "value has" : "values have");
+
+  return (0);
+} /* }}} int handle_putbin */
+
+/* vim: set sw=2 sts=2 et : */
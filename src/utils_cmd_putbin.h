@@ -0,0 +1,37 @@
+/**
+ * collectd - src/utils_cmd_putbin.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CMD_PUTBIN_H
+#define UTILS_CMD_PUTBIN_H 1
+
+#include <stdio.h>
+
+/* Largest payload accepted by a single PUTBIN command. */
+#define PUTBIN_MAX_SIZE 1048576
+
+/*
+ * Dispatches the value lists in "data", which uses the binary format of the
+ * network plugin, i.e. a sequence of host, time, plugin, type, values, ...
+ * parts. Signed and encrypted parts and notifications are not supported.
+ * Writes a single status line to "fh".
+ */
+int handle_putbin (FILE *fh, const void *data, size_t data_size);
+
+#endif /* UTILS_CMD_PUTBIN_H */
+
+/* vim: set sw=2 sts=2 et : */
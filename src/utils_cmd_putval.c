@@ -33,21 +33,17 @@
 		return -1; \
 	}
 
-static int dispatch_values (const data_set_t *ds, value_list_t *vl,
-	       	FILE *fh, char *buffer)
+/* State kept between the lines of a PUTVALS block. The identifier and data
+ * set of the previous line are remembered, so that consecutive lines for the
+ * same value list don't parse the identifier and look up the type again. */
+struct putval_state_s
 {
-	int status;
-
-	status = parse_values (buffer, vl, ds);
-	if (status != 0)
-	{
-		print_to_socket (fh, "-1 Parsing the values string failed.\n");
-		return (-1);
-	}
-
-	plugin_dispatch_values (vl);
-	return (0);
-} /* int dispatch_values */
+	char identifier[6 * DATA_MAX_NAME_LEN];
+	const data_set_t *ds;
+	value_list_t vl;
+	size_t values_size;
+};
+typedef struct putval_state_s putval_state_t;
 
 static int set_option (value_list_t *vl, const char *key, const char *value)
 {
@@ -73,53 +69,33 @@ static int set_option (value_list_t *vl, const char *key, const char *value)
 	return (0);
 } /* int parse_option */
 
-int handle_putval (FILE *fh, char *buffer)
+/* Parses "identifier" and looks up its data set. On failure, an error
+ * message is stored in "errbuf" and the state is invalidated. */
+static int putval_set_identifier (putval_state_t *state, /* {{{ */
+		const char *identifier, char *errbuf, size_t errbuf_size)
 {
-	char *command;
-	char *identifier;
+	char identifier_copy[6 * DATA_MAX_NAME_LEN];
 	char *hostname;
 	char *plugin;
 	char *plugin_instance;
 	char *type;
 	char *type_instance;
-	int   status;
-	int   values_submitted;
-
-	char *identifier_copy;
-
 	const data_set_t *ds;
-	value_list_t vl = VALUE_LIST_INIT;
-
-	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
-			(void *) fh, buffer);
-
-	command = NULL;
-	status = parse_string (&buffer, &command);
-	if (status != 0)
-	{
-		print_to_socket (fh, "-1 Cannot parse command.\n");
-		return (-1);
-	}
-	assert (command != NULL);
+	value_list_t *vl = &state->vl;
+	int status;
 
-	if (strcasecmp ("PUTVAL", command) != 0)
-	{
-		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
-		return (-1);
-	}
+	state->ds = NULL;
+	state->identifier[0] = 0;
 
-	identifier = NULL;
-	status = parse_string (&buffer, &identifier);
-	if (status != 0)
+	if (strlen (identifier) >= sizeof (identifier_copy))
 	{
-		print_to_socket (fh, "-1 Cannot parse identifier.\n");
+		ssnprintf (errbuf, errbuf_size, "Identifier too long.");
 		return (-1);
 	}
-	assert (identifier != NULL);
 
 	/* parse_identifier() modifies its first argument,
 	 * returning pointers into it */
-	identifier_copy = sstrdup (identifier);
+	sstrncpy (identifier_copy, identifier, sizeof (identifier_copy));
 
 	status = parse_identifier (identifier_copy, &hostname,
 			&plugin, &plugin_instance,
@@ -128,55 +104,90 @@ int handle_putval (FILE *fh, char *buffer)
 	{
 		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
 				identifier);
-		print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n",
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier `%s'.",
 				identifier);
-		sfree (identifier_copy);
 		return (-1);
 	}
 
-	if ((strlen (hostname) >= sizeof (vl.host))
-			|| (strlen (plugin) >= sizeof (vl.plugin))
+	if ((strlen (hostname) >= sizeof (vl->host))
+			|| (strlen (plugin) >= sizeof (vl->plugin))
 			|| ((plugin_instance != NULL)
-				&& (strlen (plugin_instance) >= sizeof (vl.plugin_instance)))
+				&& (strlen (plugin_instance) >= sizeof (vl->plugin_instance)))
 			|| ((type_instance != NULL)
-				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
+				&& (strlen (type_instance) >= sizeof (vl->type_instance))))
 	{
-		print_to_socket (fh, "-1 Identifier too long.\n");
-		sfree (identifier_copy);
+		ssnprintf (errbuf, errbuf_size, "Identifier too long.");
 		return (-1);
 	}
 
-	sstrncpy (vl.host, hostname, sizeof (vl.host));
-	sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (plugin_instance != NULL)
-		sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
-	if (type_instance != NULL)
-		sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
-
 	ds = plugin_get_ds (type);
 	if (ds == NULL) {
-		print_to_socket (fh, "-1 Type `%s' isn't defined.\n", type);
-		sfree (identifier_copy);
+		ssnprintf (errbuf, errbuf_size, "Type `%s' isn't defined.", type);
 		return (-1);
 	}
 
-	/* Free identifier_copy */
-	hostname = NULL;
-	plugin = NULL; plugin_instance = NULL;
-	type = NULL;   type_instance = NULL;
-	sfree (identifier_copy);
+	if (state->values_size < (size_t) ds->ds_num)
+	{
+		value_t *tmp;
+
+		tmp = realloc (vl->values, ds->ds_num * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ssnprintf (errbuf, errbuf_size, "malloc failed.");
+			return (-1);
+		}
+		vl->values = tmp;
+		state->values_size = (size_t) ds->ds_num;
+	}
+	vl->values_len = ds->ds_num;
 
-	vl.values_len = ds->ds_num;
-	vl.values = (value_t *) malloc (vl.values_len * sizeof (value_t));
-	if (vl.values == NULL)
+	sstrncpy (vl->host, hostname, sizeof (vl->host));
+	sstrncpy (vl->plugin, plugin, sizeof (vl->plugin));
+	sstrncpy (vl->type, type, sizeof (vl->type));
+	if (plugin_instance != NULL)
+		sstrncpy (vl->plugin_instance, plugin_instance, sizeof (vl->plugin_instance));
+	else
+		vl->plugin_instance[0] = 0;
+	if (type_instance != NULL)
+		sstrncpy (vl->type_instance, type_instance, sizeof (vl->type_instance));
+	else
+		vl->type_instance[0] = 0;
+
+	sstrncpy (state->identifier, identifier, sizeof (state->identifier));
+	state->ds = ds;
+	return (0);
+} /* }}} int putval_set_identifier */
+
+/* Handles "<identifier> [<options>] <values> [<values> ...]", i.e. a PUTVAL
+ * command without the command itself. The number of dispatched values is
+ * returned in "ret_values_submitted", even if an error occurs later on. */
+static int putval_line (putval_state_t *state, char *buffer, /* {{{ */
+		int *ret_values_submitted, char *errbuf, size_t errbuf_size)
+{
+	char *identifier;
+	int status;
+
+	*ret_values_submitted = 0;
+
+	identifier = NULL;
+	status = parse_string (&buffer, &identifier);
+	if (status != 0)
 	{
-		print_to_socket (fh, "-1 malloc failed.\n");
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier.");
 		return (-1);
 	}
+	assert (identifier != NULL);
+
+	if ((state->ds == NULL) || (strcmp (identifier, state->identifier) != 0))
+	{
+		status = putval_set_identifier (state, identifier,
+				errbuf, errbuf_size);
+		if (status != 0)
+			return (-1);
+	}
+	state->vl.interval = interval_g;
 
 	/* All the remaining fields are part of the optionlist. */
-	values_submitted = 0;
 	while (*buffer != 0)
 	{
 		char *string = NULL;
@@ -187,14 +198,14 @@ int handle_putval (FILE *fh, char *buffer)
 		{
 			/* parse_option failed, buffer has been modified.
 			 * => we need to abort */
-			print_to_socket (fh, "-1 Misformatted option.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted option.");
 			return (-1);
 		}
 		else if (status == 0)
 		{
 			assert (string != NULL);
 			assert (value != NULL);
-			set_option (&vl, string, value);
+			set_option (&state->vl, string, value);
 			continue;
 		}
 		/* else: parse_option but buffer has not been modified. This is
@@ -203,30 +214,145 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_string (&buffer, &string);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Misformatted value.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted value.");
 			return (-1);
 		}
 		assert (string != NULL);
 
-		status = dispatch_values (ds, &vl, fh, string);
+		status = parse_values (string, &state->vl, state->ds);
 		if (status != 0)
 		{
-			/* An error has already been printed. */
+			ssnprintf (errbuf, errbuf_size,
+					"Parsing the values string failed.");
 			return (-1);
 		}
-		values_submitted++;
+
+		plugin_dispatch_values (&state->vl);
+		(*ret_values_submitted)++;
 	} /* while (*buffer != 0) */
 	/* Done parsing the options. */
 
+	return (0);
+} /* }}} int putval_line */
+
+int handle_putval (FILE *fh, char *buffer)
+{
+	char *command;
+	int   status;
+	int   values_submitted;
+	char  errbuf[1024];
+
+	putval_state_t state;
+
+	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	command = NULL;
+	status = parse_string (&buffer, &command);
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 Cannot parse command.\n");
+		return (-1);
+	}
+	assert (command != NULL);
+
+	if (strcasecmp ("PUTVAL", command) != 0)
+	{
+		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		return (-1);
+	}
+
+	memset (&state, 0, sizeof (state));
+	values_submitted = 0;
+	status = putval_line (&state, buffer, &values_submitted,
+			errbuf, sizeof (errbuf));
+	sfree (state.vl.values);
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 %s\n", errbuf);
+		return (-1);
+	}
+
 	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
 			values_submitted,
 			(values_submitted == 1) ? "value has" : "values have");
 
-	sfree (vl.values); 
-
 	return (0);
 } /* int handle_putval */
 
+int handle_putvals (FILE *fh, char *buffer, /* {{{ */
+		char **lines, size_t lines_num)
+{
+	char *command;
+	int   status;
+	int   values_submitted;
+	char  errbuf[1024];
+	char  first_error[1024];
+	size_t first_error_line = 0;
+	size_t errors_num = 0;
+	size_t i;
+
+	putval_state_t state;
+
+	command = NULL;
+	status = parse_string (&buffer, &command);
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 Cannot parse command.\n");
+		return (-1);
+	}
+	assert (command != NULL);
+
+	if (strcasecmp ("PUTVALS", command) != 0)
+	{
+		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		return (-1);
+	}
+
+	if (*buffer != 0)
+	{
+		print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+		return (-1);
+	}
+
+	memset (&state, 0, sizeof (state));
+	values_submitted = 0;
+	for (i = 0; i < lines_num; i++)
+	{
+		int line_values = 0;
+
+		status = putval_line (&state, lines[i], &line_values,
+				errbuf, sizeof (errbuf));
+		values_submitted += line_values;
+		if (status == 0)
+			continue;
+
+		if (errors_num == 0)
+		{
+			sstrncpy (first_error, errbuf, sizeof (first_error));
+			first_error_line = i + 1;
+		}
+		errors_num++;
+	}
+	sfree (state.vl.values);
+
+	if (errors_num > 0)
+	{
+		print_to_socket (fh, "-1 %zu of %zu lines failed, "
+				"%i %s been dispatched. Line %zu: %s\n",
+				errors_num, lines_num, values_submitted,
+				(values_submitted == 1) ? "value has" : "values have",
+				first_error_line, first_error);
+		return (-1);
+	}
+
+	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+			values_submitted,
+			(values_submitted == 1) ? "value has" : "values have");
+
+	return (0);
+} /* }}} int handle_putvals */
+
 int create_putval (char *ret, size_t ret_len, /* {{{ */
 	const data_set_t *ds, const value_list_t *vl)
 {
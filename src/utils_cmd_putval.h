@@ -28,6 +28,11 @@
 
 int handle_putval (FILE *fh, char *buffer);
 
+/* Handles a PUTVALS command: "buffer" is the command line, "lines" the lines
+ * of the block, each of which has the form of a PUTVAL command without the
+ * command itself. A single status line is written for the whole block. */
+int handle_putvals (FILE *fh, char *buffer, char **lines, size_t lines_num);
+
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
 
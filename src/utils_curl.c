@@ -0,0 +1,681 @@
+/**
+ * collectd - src/utils_curl.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_curl.h"
+
+#include <pthread.h>
+
+/* curl_multi_wait() is available since libcurl 7.28.0. Older versions fall
+ * back to select(). */
+#if LIBCURL_VERSION_NUM >= 0x071c00
+# define UCURL_HAVE_MULTI_WAIT 1
+#else
+# define UCURL_HAVE_MULTI_WAIT 0
+#endif
+
+/*
+ * Data types
+ */
+struct ucurl_request_s;
+typedef struct ucurl_request_s ucurl_request_t;
+struct ucurl_request_s /* {{{ */
+{
+  CURL *curl;
+  ucurl_callback_t callback;
+  void *user_data;
+  /* Set while the callback is running. */
+  _Bool finishing;
+  /* Set by ucurl_cancel(). */
+  _Bool cancelled;
+
+  ucurl_request_t *next;
+  ucurl_request_t *cancel_next;
+}; /* }}} */
+
+/*
+ * Private variables
+ */
+/* The engine is compiled into each plugin using it, so every plugin has its
+ * own multi handle and thread. The multi handle is only used by the engine's
+ * thread. */
+static CURLM *multi = NULL;
+static pthread_t engine_thread;
+static int engine_running = 0;
+static int engine_shutdown = 0;
+static int wakeup_pipe[2] = { -1, -1 };
+
+/* Requests which have been submitted but not yet been added to the multi
+ * handle. */
+static ucurl_request_t *pending_head = NULL;
+static ucurl_request_t *pending_tail = NULL;
+
+/* Requests which have been cancelled and have to be removed from the multi
+ * handle by the engine's thread. */
+static ucurl_request_t *cancel_head = NULL;
+
+/* All requests currently owned by the engine, keyed by easy handle. */
+static c_avl_tree_t *requests = NULL;
+static long max_connects = 0;
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled whenever a request has been removed from "requests". */
+static pthread_cond_t engine_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Private functions
+ */
+static int ucurl_compare_ptr (const void *a, const void *b) /* {{{ */
+{
+  if (a < b)
+    return (-1);
+  else if (a > b)
+    return (1);
+  return (0);
+} /* }}} int ucurl_compare_ptr */
+
+static void ucurl_wakeup (void) /* {{{ */
+{
+  char c = 0;
+
+  /* If the pipe is full the engine will wake up anyway. */
+  if (write (wakeup_pipe[1], &c, sizeof (c)) < 0)
+    return;
+} /* }}} void ucurl_wakeup */
+
+static void ucurl_drain_wakeup (void) /* {{{ */
+{
+  char buffer[64];
+
+  while (read (wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+    /* do nothing */;
+} /* }}} void ucurl_drain_wakeup */
+
+/* Calls the request's callback and removes the request from the set of known
+ * requests afterwards, so the handle is reported as busy until the callback
+ * has returned. If the callback has submitted the handle again, the entry
+ * belongs to the new request and is left alone. Must be called without
+ * holding "engine_lock". */
+static void ucurl_finish (ucurl_request_t *req, CURLcode status) /* {{{ */
+{
+  ucurl_request_t *current = NULL;
+
+  pthread_mutex_lock (&engine_lock);
+  req->finishing = 1;
+  /* A cancelled request may finish before the engine gets to it. */
+  if (req->cancelled)
+  {
+    ucurl_request_t **prev;
+
+    for (prev = &cancel_head; *prev != NULL; prev = &(*prev)->cancel_next)
+    {
+      if (*prev == req)
+      {
+        *prev = req->cancel_next;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock (&engine_lock);
+
+  (*req->callback) (req->curl, status, req->user_data);
+
+  pthread_mutex_lock (&engine_lock);
+  if ((c_avl_get (requests, req->curl, (void *) &current) == 0)
+      && (current == req))
+  {
+    c_avl_remove (requests, req->curl, /* key = */ NULL, /* value = */ NULL);
+    pthread_cond_broadcast (&engine_cond);
+  }
+  pthread_mutex_unlock (&engine_lock);
+
+  sfree (req);
+} /* }}} void ucurl_finish */
+
+/* Moves the pending requests to the multi handle. */
+static void ucurl_add_pending (void) /* {{{ */
+{
+  ucurl_request_t *req;
+  long active_num;
+
+  pthread_mutex_lock (&engine_lock);
+  req = pending_head;
+  pending_head = pending_tail = NULL;
+  active_num = (long) c_avl_size (requests);
+  pthread_mutex_unlock (&engine_lock);
+
+  /* Keep enough connections open to reuse one for each request. */
+  if (active_num > max_connects)
+  {
+    max_connects = active_num;
+    curl_multi_setopt (multi, CURLMOPT_MAXCONNECTS, max_connects);
+  }
+
+  while (req != NULL)
+  {
+    ucurl_request_t *next = req->next;
+    CURLMcode status;
+
+    req->next = NULL;
+    status = curl_multi_add_handle (multi, req->curl);
+    if (status != CURLM_OK)
+    {
+      ERROR ("utils_curl: curl_multi_add_handle failed: %s",
+          curl_multi_strerror (status));
+      ucurl_finish (req, CURLE_FAILED_INIT);
+    }
+
+    req = next;
+  }
+} /* }}} void ucurl_add_pending */
+
+/* Removes the cancelled requests from the multi handle. */
+static void ucurl_remove_cancelled (void) /* {{{ */
+{
+  while (42)
+  {
+    ucurl_request_t *req;
+
+    pthread_mutex_lock (&engine_lock);
+    req = cancel_head;
+    if (req != NULL)
+      cancel_head = req->cancel_next;
+    pthread_mutex_unlock (&engine_lock);
+
+    if (req == NULL)
+      break;
+
+    curl_multi_remove_handle (multi, req->curl);
+    ucurl_finish (req, CURLE_ABORTED_BY_CALLBACK);
+  }
+} /* }}} void ucurl_remove_cancelled */
+
+static void ucurl_read_info (void) /* {{{ */
+{
+  CURLMsg *msg;
+  int msgs_left;
+
+  while ((msg = curl_multi_info_read (multi, &msgs_left)) != NULL)
+  {
+    ucurl_request_t *req = NULL;
+    CURL *curl;
+    CURLcode status;
+
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    curl = msg->easy_handle;
+    status = msg->data.result;
+
+    curl_easy_getinfo (curl, CURLINFO_PRIVATE, (char **) &req);
+    curl_multi_remove_handle (multi, curl);
+
+    if (req == NULL)
+    {
+      ERROR ("utils_curl: Finished transfer has no request attached.");
+      continue;
+    }
+
+    ucurl_finish (req, status);
+  }
+} /* }}} void ucurl_read_info */
+
+/* Aborts all requests, both pending and in progress. */
+static void ucurl_abort_all (void) /* {{{ */
+{
+  ucurl_request_t *pending;
+  void *key;
+  void *value;
+
+  pthread_mutex_lock (&engine_lock);
+  pending = pending_head;
+  pending_head = pending_tail = NULL;
+  pthread_mutex_unlock (&engine_lock);
+
+  while (pending != NULL)
+  {
+    ucurl_request_t *next = pending->next;
+    ucurl_finish (pending, CURLE_ABORTED_BY_CALLBACK);
+    pending = next;
+  }
+
+  /* Whatever is left in the tree has been added to the multi handle. The
+   * entries are removed by ucurl_finish(), after the callback has returned.
+   * Callbacks can't submit new requests, because "engine_shutdown" is
+   * set. */
+  while (42)
+  {
+    c_avl_iterator_t *iter;
+    int status = -1;
+
+    pthread_mutex_lock (&engine_lock);
+    iter = c_avl_get_iterator (requests);
+    if (iter != NULL)
+    {
+      status = c_avl_iterator_next (iter, &key, &value);
+      c_avl_iterator_destroy (iter);
+    }
+    pthread_mutex_unlock (&engine_lock);
+    if (status != 0)
+      break;
+
+    curl_multi_remove_handle (multi, (CURL *) key);
+    ucurl_finish ((ucurl_request_t *) value, CURLE_ABORTED_BY_CALLBACK);
+  }
+} /* }}} void ucurl_abort_all */
+
+#if UCURL_HAVE_MULTI_WAIT
+/* Waits for activity on the transfers or the wakeup pipe. Unlike select(),
+ * this works with any file descriptor number. */
+static int ucurl_wait (long timeout_ms) /* {{{ */
+{
+  struct curl_waitfd wakeup_fd;
+  CURLMcode status;
+
+  wakeup_fd.fd = wakeup_pipe[0];
+  wakeup_fd.events = CURL_WAIT_POLLIN;
+  wakeup_fd.revents = 0;
+
+  status = curl_multi_wait (multi, &wakeup_fd, 1, (int) timeout_ms,
+      /* numfds = */ NULL);
+  if (status != CURLM_OK)
+  {
+    ERROR ("utils_curl: curl_multi_wait failed: %s",
+        curl_multi_strerror (status));
+    return (-1);
+  }
+
+  if (wakeup_fd.revents != 0)
+    ucurl_drain_wakeup ();
+
+  return (0);
+} /* }}} int ucurl_wait */
+#else /* if !UCURL_HAVE_MULTI_WAIT */
+/* libcurl doesn't add descriptors above FD_SETSIZE to the sets. If the wakeup
+ * pipe can't be added either, the engine falls back to polling. */
+static int ucurl_wait (long timeout_ms) /* {{{ */
+{
+  struct timeval tv;
+  fd_set fds_read;
+  fd_set fds_write;
+  fd_set fds_except;
+  int max_fd = -1;
+  _Bool use_pipe;
+  int status;
+
+  FD_ZERO (&fds_read);
+  FD_ZERO (&fds_write);
+  FD_ZERO (&fds_except);
+  curl_multi_fdset (multi, &fds_read, &fds_write, &fds_except, &max_fd);
+
+  /* libcurl may want to be called again without waiting for any file
+   * descriptor, e.g. while resolving names. */
+  if ((max_fd < 0) && (timeout_ms > 100))
+    timeout_ms = 100;
+
+  use_pipe = (wakeup_pipe[0] < FD_SETSIZE);
+  if (use_pipe)
+  {
+    FD_SET (wakeup_pipe[0], &fds_read);
+    if (max_fd < wakeup_pipe[0])
+      max_fd = wakeup_pipe[0];
+  }
+  else if (timeout_ms > 100)
+    timeout_ms = 100;
+
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  status = select (max_fd + 1, &fds_read, &fds_write, &fds_except, &tv);
+  if ((status < 0) && (errno != EINTR))
+  {
+    char errbuf[1024];
+    ERROR ("utils_curl: select failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (!use_pipe || ((status > 0) && FD_ISSET (wakeup_pipe[0], &fds_read)))
+    ucurl_drain_wakeup ();
+
+  return (0);
+} /* }}} int ucurl_wait */
+#endif /* !UCURL_HAVE_MULTI_WAIT */
+
+static void *ucurl_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (42)
+  {
+    int running = 0;
+    long timeout_ms = -1;
+    int status;
+
+    pthread_mutex_lock (&engine_lock);
+    status = engine_shutdown;
+    pthread_mutex_unlock (&engine_lock);
+    if (status != 0)
+      break;
+
+    ucurl_add_pending ();
+    ucurl_remove_cancelled ();
+
+    while (curl_multi_perform (multi, &running) == CURLM_CALL_MULTI_PERFORM)
+      /* do nothing */;
+    ucurl_read_info ();
+
+    curl_multi_timeout (multi, &timeout_ms);
+    if ((timeout_ms < 0) || (timeout_ms > 1000))
+      timeout_ms = 1000;
+
+#if UCURL_HAVE_MULTI_WAIT
+    /* libcurl may want to be called again while not waiting for any file
+     * descriptor, e.g. while resolving names, and curl_multi_wait() doesn't
+     * tell whether that's the case. */
+    if ((running > 0) && (timeout_ms > 100))
+      timeout_ms = 100;
+#endif
+
+    status = ucurl_wait (timeout_ms);
+    if (status != 0)
+    {
+      /* Avoid spinning. */
+      usleep (100000);
+      continue;
+    }
+  } /* while (42) */
+
+  ucurl_abort_all ();
+
+  pthread_exit ((void *) 0);
+  return ((void *) 0);
+} /* }}} void *ucurl_thread */
+
+/* Must be called with "engine_lock" held. */
+static int ucurl_start (void) /* {{{ */
+{
+  int status;
+
+  if (engine_running)
+    return (0);
+
+  if (requests == NULL)
+  {
+    requests = c_avl_create (ucurl_compare_ptr);
+    if (requests == NULL)
+    {
+      ERROR ("utils_curl: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
+  if (multi == NULL)
+  {
+    multi = curl_multi_init ();
+    if (multi == NULL)
+    {
+      ERROR ("utils_curl: curl_multi_init failed.");
+      return (-1);
+    }
+  }
+
+  if (wakeup_pipe[0] < 0)
+  {
+    status = pipe (wakeup_pipe);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("utils_curl: pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
+      return (-1);
+    }
+    fcntl (wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+  }
+
+  engine_shutdown = 0;
+  status = pthread_create (&engine_thread, /* attr = */ NULL,
+      ucurl_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("utils_curl: pthread_create failed.");
+    return (-1);
+  }
+  engine_running = 1;
+
+  return (0);
+} /* }}} int ucurl_start */
+
+/*
+ * Public functions
+ */
+int ucurl_submit (CURL *curl, cdtime_t timeout, /* {{{ */
+    ucurl_callback_t callback, void *user_data)
+{
+  ucurl_request_t *req;
+  int status;
+
+  if ((curl == NULL) || (callback == NULL))
+    return (-EINVAL);
+
+  if (timeout == 0)
+    timeout = interval_g;
+
+  req = malloc (sizeof (*req));
+  if (req == NULL)
+  {
+    ERROR ("utils_curl: malloc failed.");
+    return (-1);
+  }
+  memset (req, 0, sizeof (*req));
+  req->curl = curl;
+  req->callback = callback;
+  req->user_data = user_data;
+  req->next = NULL;
+
+  /* Signals must not be used from threads. */
+  curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt (curl, CURLOPT_TIMEOUT_MS,
+      (long) CDTIME_T_TO_MS (timeout));
+  curl_easy_setopt (curl, CURLOPT_PRIVATE, (char *) req);
+
+  pthread_mutex_lock (&engine_lock);
+
+  if (engine_shutdown)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    sfree (req);
+    return (-1);
+  }
+
+  status = ucurl_start ();
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    sfree (req);
+    return (status);
+  }
+
+  /* A handle may only be submitted again while it's in use if this is
+   * done by its own callback. The old request is freed by ucurl_finish(). */
+  {
+    ucurl_request_t *old = NULL;
+
+    if (c_avl_get (requests, curl, (void *) &old) == 0)
+    {
+      if (!old->finishing || old->cancelled
+          || !pthread_equal (pthread_self (), engine_thread))
+      {
+        pthread_mutex_unlock (&engine_lock);
+        sfree (req);
+        return (EBUSY);
+      }
+      c_avl_remove (requests, curl, /* key = */ NULL, /* value = */ NULL);
+    }
+  }
+
+  status = c_avl_insert (requests, curl, req);
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    ERROR ("utils_curl: c_avl_insert failed.");
+    sfree (req);
+    return (-1);
+  }
+
+  if (pending_tail == NULL)
+    pending_head = req;
+  else
+    pending_tail->next = req;
+  pending_tail = req;
+
+  pthread_mutex_unlock (&engine_lock);
+
+  ucurl_wakeup ();
+  return (0);
+} /* }}} int ucurl_submit */
+
+_Bool ucurl_busy (CURL *curl) /* {{{ */
+{
+  _Bool busy = 0;
+
+  pthread_mutex_lock (&engine_lock);
+  if (requests != NULL)
+    busy = (c_avl_get (requests, curl, /* value = */ NULL) == 0);
+  pthread_mutex_unlock (&engine_lock);
+
+  return (busy);
+} /* }}} _Bool ucurl_busy */
+
+int ucurl_cancel (CURL *curl) /* {{{ */
+{
+  ucurl_request_t *req = NULL;
+  ucurl_request_t *prev;
+  ucurl_request_t *ptr;
+
+  if (curl == NULL)
+    return (-EINVAL);
+
+  pthread_mutex_lock (&engine_lock);
+
+  if ((requests == NULL)
+      || (c_avl_get (requests, curl, (void *) &req) != 0))
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (0);
+  }
+
+  /* The engine's thread would wait for itself. */
+  if (engine_running && pthread_equal (pthread_self (), engine_thread))
+  {
+    pthread_mutex_unlock (&engine_lock);
+    ERROR ("utils_curl: ucurl_cancel must not be called from a callback.");
+    return (-EDEADLK);
+  }
+
+  /* Requests which haven't been added to the multi handle yet are finished
+   * right here. */
+  prev = NULL;
+  for (ptr = pending_head; ptr != NULL; ptr = ptr->next)
+  {
+    if (ptr == req)
+      break;
+    prev = ptr;
+  }
+
+  if (ptr != NULL)
+  {
+    if (prev == NULL)
+      pending_head = req->next;
+    else
+      prev->next = req->next;
+    if (pending_tail == req)
+      pending_tail = prev;
+    req->next = NULL;
+    req->cancelled = 1;
+    pthread_mutex_unlock (&engine_lock);
+
+    ucurl_finish (req, CURLE_ABORTED_BY_CALLBACK);
+    return (0);
+  }
+
+  /* Otherwise the engine's thread removes the handle from the multi handle,
+   * unless the transfer is finishing anyway. Cancelled requests can't be
+   * submitted again by their callback. */
+  if (!req->cancelled)
+  {
+    req->cancelled = 1;
+    if (!req->finishing)
+    {
+      req->cancel_next = cancel_head;
+      cancel_head = req;
+      ucurl_wakeup ();
+    }
+  }
+
+  while (c_avl_get (requests, curl, /* value = */ NULL) == 0)
+    pthread_cond_wait (&engine_cond, &engine_lock);
+
+  pthread_mutex_unlock (&engine_lock);
+  return (0);
+} /* }}} int ucurl_cancel */
+
+int ucurl_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&engine_lock);
+  if (!engine_running)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (0);
+  }
+  engine_shutdown = 1;
+  pthread_mutex_unlock (&engine_lock);
+
+  ucurl_wakeup ();
+  pthread_join (engine_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&engine_lock);
+  engine_running = 0;
+
+  if (multi != NULL)
+  {
+    curl_multi_cleanup (multi);
+    multi = NULL;
+  }
+
+  if (requests != NULL)
+  {
+    c_avl_destroy (requests);
+    requests = NULL;
+  }
+
+  close (wakeup_pipe[0]);
+  close (wakeup_pipe[1]);
+  wakeup_pipe[0] = wakeup_pipe[1] = -1;
+  cancel_head = NULL;
+  max_connects = 0;
+
+  pthread_mutex_unlock (&engine_lock);
+
+  return (0);
+} /* }}} int ucurl_shutdown */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,96 @@
+/**
+ * collectd - src/utils_curl.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CURL_H
+#define UTILS_CURL_H 1
+
+#include "collectd.h"
+
+/* Some versions of libcurl don't include this themselves and then don't have
+ * fd_set available. */
+#if HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#include <curl/curl.h>
+
+/*
+ * Data types
+ */
+/* Called when a request has finished, usually from the engine's thread.
+ * "status" is the result of the transfer, CURLE_ABORTED_BY_CALLBACK if the
+ * transfer has been cancelled or the engine has been shut down before the
+ * transfer finished. The handle counts as busy
+ * until the callback returns, so the callback may safely use any state
+ * belonging to the transfer. The easy handle may be submitted again from
+ * within the callback; the new transfer starts after the callback has
+ * returned. */
+typedef void (*ucurl_callback_t) (CURL *curl, CURLcode status,
+    void *user_data);
+
+/*
+ * Public functions
+ */
+/*
+ * ucurl_submit
+ *
+ * Starts the transfer configured in the easy handle "curl" on the plugin's
+ * shared multi handle and returns immediately. All transfers are run
+ * concurrently by one thread, so the calling read callback is not blocked
+ * while waiting for the network. Connections are reused between transfers
+ * to the same host. If "timeout" is non-zero, the transfer is aborted after
+ * that time, otherwise after the global interval.
+ *
+ * The handle must not be used by the caller until "callback" has been
+ * called. Returns EBUSY if the handle is still in use by an earlier
+ * transfer, zero on success and less than zero on failure.
+ */
+int ucurl_submit (CURL *curl, cdtime_t timeout,
+    ucurl_callback_t callback, void *user_data);
+
+/*
+ * ucurl_busy
+ *
+ * Returns true if "curl" has been submitted and its callback has not yet
+ * returned. Plugins use this to skip an interval before resetting any
+ * state the running transfer is still using.
+ */
+_Bool ucurl_busy (CURL *curl);
+
+/*
+ * ucurl_cancel
+ *
+ * Aborts the transfer of "curl", if any, calling its callback with
+ * CURLE_ABORTED_BY_CALLBACK, and waits until the callback has returned.
+ * Other transfers are not affected. Afterwards the handle and the state
+ * used by the callback may be freed. Must not be called from a callback.
+ */
+int ucurl_cancel (CURL *curl);
+
+/*
+ * ucurl_shutdown
+ *
+ * Aborts all outstanding transfers, calling their callbacks with
+ * CURLE_ABORTED_BY_CALLBACK, and stops the engine's thread. Since the
+ * engine is shared by all instances of a plugin, this is called once from
+ * the plugin's shutdown callback. Instances use ucurl_cancel instead.
+ */
+int ucurl_shutdown (void);
+
+#endif /* UTILS_CURL_H */
+/* vim: set sw=2 sts=2 et fdm=marker : */
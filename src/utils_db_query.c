@@ -25,6 +25,13 @@
 #include "configfile.h"
 #include "utils_db_query.h"
 
+#if HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#endif
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
 /*
  * Data types
  */
@@ -60,7 +67,13 @@ struct udb_result_preparation_area_s /* {{{ */
   size_t *instances_pos;
   size_t *values_pos;
   char  **instances_buffer;
-  char  **values_buffer;
+  /* Formatted instances of non-string columns, DATA_MAX_NAME_LEN bytes
+   * each. */
+  char   *instances_strings;
+  value_t *values;
+
+  /* Fields which are the same for all rows of the result. */
+  value_list_t vl;
 
   struct udb_result_preparation_area_s *next;
 }; /* }}} */
@@ -184,43 +197,17 @@ static int udb_config_set_uint (unsigned int *ret_value, /* {{{ */
  */
 static int udb_result_submit (udb_result_t *r, /* {{{ */
     udb_result_preparation_area_t *r_area,
-    const udb_query_t const *q, udb_query_preparation_area_t *q_area)
+    const udb_query_t *q, udb_query_preparation_area_t *q_area)
 {
-  value_list_t vl = VALUE_LIST_INIT;
-  size_t i;
+  value_list_t vl;
 
   assert (r != NULL);
   assert (r_area->ds != NULL);
   assert (((size_t) r_area->ds->ds_num) == r->values_num);
 
-  vl.values = (value_t *) calloc (r_area->ds->ds_num, sizeof (value_t));
-  if (vl.values == NULL)
-  {
-    ERROR ("db query utils: malloc failed.");
-    return (-1);
-  }
-  vl.values_len = r_area->ds->ds_num;
-
-  for (i = 0; i < r->values_num; i++)
-  {
-    char *value_str = r_area->values_buffer[i];
-
-    if (0 != parse_value (value_str, &vl.values[i], r_area->ds->ds[i].type))
-    {
-      ERROR ("db query utils: udb_result_submit: Parsing `%s' as %s failed.",
-          value_str, DS_TYPE_TO_STRING (r_area->ds->ds[i].type));
-      errno = EINVAL;
-      return (-1);
-    }
-  }
-
-  if (q_area->interval > 0)
-    vl.interval = q_area->interval;
-
-  sstrncpy (vl.host, q_area->host, sizeof (vl.host));
-  sstrncpy (vl.plugin, q_area->plugin, sizeof (vl.plugin));
-  sstrncpy (vl.plugin_instance, q_area->db_name, sizeof (vl.plugin_instance));
-  sstrncpy (vl.type, r->type, sizeof (vl.type));
+  /* plugin_dispatch_values may set the time and interval, so work on a
+   * copy of the prepared value list. */
+  vl = r_area->vl;
 
   /* Set vl.type_instance {{{ */
   if (r->instances_num <= 0)
@@ -255,11 +242,117 @@ static int udb_result_submit (udb_result_t *r, /* {{{ */
 
   plugin_dispatch_values (&vl);
 
-  sfree (vl.values);
   return (0);
 } /* }}} void udb_result_submit */
 
-static void udb_result_finish_result (const udb_result_t const *r, /* {{{ */
+/* Converts a column of the given UDB_COLUMN_* type to a value of the data
+ * source type "ds_type". */
+static int udb_column_to_value (value_t *ret_value, int ds_type, /* {{{ */
+    const char *data, int column_type)
+{
+  uint16_t tmp16;
+  uint32_t tmp32;
+  uint64_t tmp64;
+  int64_t integer;
+  double floating;
+
+  switch (column_type)
+  {
+    case UDB_COLUMN_STRING:
+      return (parse_value (data, ret_value, ds_type));
+
+    case UDB_COLUMN_INT16:
+      memcpy (&tmp16, data, sizeof (tmp16));
+      integer = (int64_t) ((int16_t) ntohs (tmp16));
+      floating = (double) integer;
+      break;
+
+    case UDB_COLUMN_INT32:
+      memcpy (&tmp32, data, sizeof (tmp32));
+      integer = (int64_t) ((int32_t) ntohl (tmp32));
+      floating = (double) integer;
+      break;
+
+    case UDB_COLUMN_INT64:
+      memcpy (&tmp64, data, sizeof (tmp64));
+      integer = (int64_t) ntohll (tmp64);
+      floating = (double) integer;
+      break;
+
+    case UDB_COLUMN_FLOAT:
+    {
+      float f;
+
+      memcpy (&tmp32, data, sizeof (tmp32));
+      tmp32 = ntohl (tmp32);
+      memcpy (&f, &tmp32, sizeof (f));
+      floating = (double) f;
+      integer = isnan (floating) ? 0 : (int64_t) floating;
+      break;
+    }
+
+    case UDB_COLUMN_DOUBLE:
+      memcpy (&tmp64, data, sizeof (tmp64));
+      tmp64 = ntohll (tmp64);
+      memcpy (&floating, &tmp64, sizeof (floating));
+      integer = isnan (floating) ? 0 : (int64_t) floating;
+      break;
+
+    default:
+      return (-1);
+  }
+
+  if (isnan (floating) && (ds_type != DS_TYPE_GAUGE))
+    return (-1);
+
+  switch (ds_type)
+  {
+    case DS_TYPE_COUNTER:
+      ret_value->counter = (counter_t) integer;
+      break;
+    case DS_TYPE_GAUGE:
+      ret_value->gauge = (gauge_t) floating;
+      break;
+    case DS_TYPE_DERIVE:
+      ret_value->derive = (derive_t) integer;
+      break;
+    case DS_TYPE_ABSOLUTE:
+      ret_value->absolute = (absolute_t) integer;
+      break;
+    default:
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int udb_column_to_value */
+
+/* Returns a string representation of a column, using "buffer" for columns
+ * which are not strings. */
+static char *udb_column_to_string (char *buffer, size_t buffer_size, /* {{{ */
+    const char *data, int column_type)
+{
+  value_t value;
+
+  switch (column_type)
+  {
+    case UDB_COLUMN_INT16:
+    case UDB_COLUMN_INT32:
+    case UDB_COLUMN_INT64:
+      udb_column_to_value (&value, DS_TYPE_DERIVE, data, column_type);
+      ssnprintf (buffer, buffer_size, "%"PRIi64, (int64_t) value.derive);
+      return (buffer);
+
+    case UDB_COLUMN_FLOAT:
+    case UDB_COLUMN_DOUBLE:
+      udb_column_to_value (&value, DS_TYPE_GAUGE, data, column_type);
+      ssnprintf (buffer, buffer_size, "%g", (double) value.gauge);
+      return (buffer);
+  }
+
+  return ((char *) data);
+} /* }}} char *udb_column_to_string */
+
+static void udb_result_finish_result (const udb_result_t *r, /* {{{ */
     udb_result_preparation_area_t *prep_area)
 {
   if ((r == NULL) || (prep_area == NULL))
@@ -269,31 +362,80 @@ static void udb_result_finish_result (const udb_result_t const *r, /* {{{ */
   sfree (prep_area->instances_pos);
   sfree (prep_area->values_pos);
   sfree (prep_area->instances_buffer);
-  sfree (prep_area->values_buffer);
+  sfree (prep_area->instances_strings);
+  sfree (prep_area->values);
 } /* }}} void udb_result_finish_result */
 
+/* Returns zero on success, less than zero on failure and greater than zero if
+ * the row has been skipped because one of the result's columns is NULL. */
 static int udb_result_handle_result (udb_result_t *r, /* {{{ */
     udb_query_preparation_area_t *q_area,
     udb_result_preparation_area_t *r_area,
-    const udb_query_t const *q, char **column_values)
+    const udb_query_t *q, char **column_values,
+    const int *column_types)
 {
   size_t i;
 
   assert (r && q_area && r_area);
 
   for (i = 0; i < r->instances_num; i++)
-    r_area->instances_buffer[i] = column_values[r_area->instances_pos[i]];
+  {
+    size_t pos = r_area->instances_pos[i];
+
+    if (column_values[pos] == NULL)
+    {
+      DEBUG ("db query utils: udb_result_handle_result: "
+          "Column `%s' is NULL, skipping the row.", r->instances[i]);
+      return (1);
+    }
+
+    if (column_types == NULL)
+      r_area->instances_buffer[i] = column_values[pos];
+    else
+      r_area->instances_buffer[i] = udb_column_to_string (
+          r_area->instances_strings + i * DATA_MAX_NAME_LEN,
+          DATA_MAX_NAME_LEN, column_values[pos], column_types[pos]);
+  }
 
   for (i = 0; i < r->values_num; i++)
-    r_area->values_buffer[i] = column_values[r_area->values_pos[i]];
+  {
+    size_t pos = r_area->values_pos[i];
+    int type = (column_types == NULL) ? UDB_COLUMN_STRING : column_types[pos];
+    int status;
+
+    if (column_values[pos] == NULL)
+    {
+      DEBUG ("db query utils: udb_result_handle_result: "
+          "Column `%s' is NULL, skipping the row.", r->values[i]);
+      return (1);
+    }
+
+    status = udb_column_to_value (&r_area->values[i],
+        r_area->ds->ds[i].type, column_values[pos], type);
+    if (status != 0)
+    {
+      if (type == UDB_COLUMN_STRING)
+        ERROR ("db query utils: udb_result_handle_result: "
+            "Parsing `%s' as %s failed.", column_values[pos],
+            DS_TYPE_TO_STRING (r_area->ds->ds[i].type));
+      else
+        ERROR ("db query utils: udb_result_handle_result: "
+            "Converting column `%s' to %s failed.", r->values[i],
+            DS_TYPE_TO_STRING (r_area->ds->ds[i].type));
+      errno = EINVAL;
+      return (-1);
+    }
+  }
 
   return udb_result_submit (r, r_area, q, q_area);
 } /* }}} int udb_result_handle_result */
 
-static int udb_result_prepare_result (const udb_result_t const *r, /* {{{ */
+static int udb_result_prepare_result (const udb_result_t *r, /* {{{ */
     udb_result_preparation_area_t *prep_area,
+    const udb_query_preparation_area_t *q_area,
     char **column_names, size_t column_num)
 {
+  value_list_t vl = VALUE_LIST_INIT;
   size_t i;
 
   if ((r == NULL) || (prep_area == NULL))
@@ -304,13 +446,12 @@ static int udb_result_prepare_result (const udb_result_t const *r, /* {{{ */
   sfree (prep_area->instances_pos); \
   sfree (prep_area->values_pos); \
   sfree (prep_area->instances_buffer); \
-  sfree (prep_area->values_buffer); \
+  sfree (prep_area->instances_strings); \
+  sfree (prep_area->values); \
   return (status)
 
   /* Make sure previous preparations are cleaned up. */
   udb_result_finish_result (r, prep_area);
-  prep_area->instances_pos = NULL;
-  prep_area->values_pos = NULL;
 
   /* Read `ds' and check number of values {{{ */
   prep_area->ds = plugin_get_ds (r->type);
@@ -333,8 +474,8 @@ static int udb_result_prepare_result (const udb_result_t const *r, /* {{{ */
   }
   /* }}} */
 
-  /* Allocate r->instances_pos, r->values_pos, r->instances_buffer, and
-   * r->values_buffer {{{ */
+  /* Allocate r->instances_pos, r->values_pos, r->instances_buffer,
+   * r->instances_strings and r->values {{{ */
   if (r->instances_num > 0)
   {
     prep_area->instances_pos
@@ -352,6 +493,14 @@ static int udb_result_prepare_result (const udb_result_t const *r, /* {{{ */
       ERROR ("db query utils: udb_result_prepare_result: malloc failed.");
       BAIL_OUT (-ENOMEM);
     }
+
+    prep_area->instances_strings
+      = (char *) calloc (r->instances_num, DATA_MAX_NAME_LEN);
+    if (prep_area->instances_strings == NULL)
+    {
+      ERROR ("db query utils: udb_result_prepare_result: malloc failed.");
+      BAIL_OUT (-ENOMEM);
+    }
   } /* if (r->instances_num > 0) */
 
   prep_area->values_pos
@@ -362,15 +511,27 @@ static int udb_result_prepare_result (const udb_result_t const *r, /* {{{ */
     BAIL_OUT (-ENOMEM);
   }
 
-  prep_area->values_buffer
-    = (char **) calloc (r->values_num, sizeof (char *));
-  if (prep_area->values_buffer == NULL)
+  prep_area->values
+    = (value_t *) calloc (r->values_num, sizeof (value_t));
+  if (prep_area->values == NULL)
   {
     ERROR ("db query utils: udb_result_prepare_result: malloc failed.");
     BAIL_OUT (-ENOMEM);
   }
   /* }}} */
 
+  /* Fill in the fields shared by all rows {{{ */
+  vl.values = prep_area->values;
+  vl.values_len = r->values_num;
+  if (q_area->interval > 0)
+    vl.interval = q_area->interval;
+  sstrncpy (vl.host, q_area->host, sizeof (vl.host));
+  sstrncpy (vl.plugin, q_area->plugin, sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, q_area->db_name, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, r->type, sizeof (vl.type));
+  prep_area->vl = vl;
+  /* }}} */
+
   /* Determine the position of the instance columns {{{ */
   for (i = 0; i < r->instances_num; i++)
   {
@@ -825,7 +986,7 @@ int udb_query_check_version (udb_query_t *q, unsigned int version) /* {{{ */
   return (1);
 } /* }}} int udb_query_check_version */
 
-void udb_query_finish_result (const udb_query_t const *q, /* {{{ */
+void udb_query_finish_result (const udb_query_t *q, /* {{{ */
     udb_query_preparation_area_t *prep_area)
 {
   udb_result_preparation_area_t *r_area;
@@ -851,25 +1012,16 @@ void udb_query_finish_result (const udb_query_t const *q, /* {{{ */
   }
 } /* }}} void udb_query_finish_result */
 
-int udb_query_handle_result (const udb_query_t const *q, /* {{{ */
-    udb_query_preparation_area_t *prep_area, char **column_values)
+static int udb_query_handle_row (const udb_query_t *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area, char **column_values,
+    const int *column_types)
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
   int success;
+  int failed;
   int status;
 
-  if ((q == NULL) || (prep_area == NULL))
-    return (-EINVAL);
-
-  if ((prep_area->column_num < 1) || (prep_area->host == NULL)
-      || (prep_area->plugin == NULL) || (prep_area->db_name == NULL))
-  {
-    ERROR ("db query utils: Query `%s': Query is not prepared; "
-        "can't handle result.", q->name);
-    return (-EINVAL);
-  }
-
 #if defined(COLLECT_DEBUG) && COLLECT_DEBUG /* {{{ */
   do
   {
@@ -879,22 +1031,29 @@ int udb_query_handle_result (const udb_query_t const *q, /* {{{ */
     {
       DEBUG ("db query utils: udb_query_handle_result (%s, %s): "
           "column[%zu] = %s;",
-          prep_area->db_name, q->name, i, column_values[i]);
+          prep_area->db_name, q->name, i,
+          ((column_types == NULL)
+           || (column_types[i] == UDB_COLUMN_STRING))
+          ? column_values[i] : "(binary)");
     }
   } while (0);
 #endif /* }}} */
 
   success = 0;
+  failed = 0;
   for (r = q->results, r_area = prep_area->result_prep_areas;
       r != NULL; r = r->next, r_area = r_area->next)
   {
     status = udb_result_handle_result (r, prep_area, r_area,
-        q, column_values);
+        q, column_values, column_types);
     if (status == 0)
       success++;
+    else if (status < 0)
+      failed++;
   }
 
-  if (success == 0)
+  /* Results skipped because of NULL values are not an error. */
+  if ((success == 0) && (failed > 0))
   {
     ERROR ("db query utils: udb_query_handle_result (%s, %s): "
         "All results failed.", prep_area->db_name, q->name);
@@ -902,9 +1061,65 @@ int udb_query_handle_result (const udb_query_t const *q, /* {{{ */
   }
 
   return (0);
+} /* }}} int udb_query_handle_row */
+
+static int udb_query_check_prepared (const udb_query_t *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area)
+{
+  if ((q == NULL) || (prep_area == NULL))
+    return (-EINVAL);
+
+  if ((prep_area->column_num < 1) || (prep_area->host == NULL)
+      || (prep_area->plugin == NULL) || (prep_area->db_name == NULL))
+  {
+    ERROR ("db query utils: Query `%s': Query is not prepared; "
+        "can't handle result.", q->name);
+    return (-EINVAL);
+  }
+
+  return (0);
+} /* }}} int udb_query_check_prepared */
+
+int udb_query_handle_result (const udb_query_t *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area, char **column_values)
+{
+  int status;
+
+  status = udb_query_check_prepared (q, prep_area);
+  if (status != 0)
+    return (status);
+
+  return (udb_query_handle_row (q, prep_area, column_values,
+        /* column_types = */ NULL));
 } /* }}} int udb_query_handle_result */
 
-int udb_query_prepare_result (const udb_query_t const *q, /* {{{ */
+int udb_query_handle_results (const udb_query_t *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area, char **column_values,
+    const int *column_types, size_t rows_num)
+{
+  size_t success;
+  size_t i;
+  int status;
+
+  status = udb_query_check_prepared (q, prep_area);
+  if (status != 0)
+    return (status);
+
+  success = 0;
+  for (i = 0; i < rows_num; i++)
+  {
+    status = udb_query_handle_row (q, prep_area,
+        column_values + i * prep_area->column_num, column_types);
+    if (status == 0)
+      success++;
+  }
+
+  if ((rows_num > 0) && (success == 0))
+    return (-1);
+  return (0);
+} /* }}} int udb_query_handle_results */
+
+int udb_query_prepare_result (const udb_query_t *q, /* {{{ */
     udb_query_preparation_area_t *prep_area,
     const char *host, const char *plugin, const char *db_name,
     char **column_names, size_t column_num, cdtime_t interval)
@@ -958,7 +1173,8 @@ int udb_query_prepare_result (const udb_query_t const *q, /* {{{ */
       return (-EINVAL);
     }
 
-    status = udb_result_prepare_result (r, r_area, column_names, column_num);
+    status = udb_result_prepare_result (r, r_area, prep_area,
+        column_names, column_num);
     if (status != 0)
     {
       udb_query_finish_result (q, prep_area);
@@ -1026,7 +1242,8 @@ udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{
     sfree (area->instances_pos);
     sfree (area->values_pos);
     sfree (area->instances_buffer);
-    sfree (area->values_buffer);
+    sfree (area->instances_strings);
+    sfree (area->values);
     free (area);
   }
 
@@ -36,6 +36,15 @@ typedef struct udb_query_preparation_area_s udb_query_preparation_area_t;
 typedef int (*udb_query_create_callback_t) (udb_query_t *q,
     oconfig_item_t *ci);
 
+/* Column types for udb_query_handle_results. Binary columns are in network
+ * byte order, i.e. the way most databases send them over the wire. */
+#define UDB_COLUMN_STRING  0 /* null-terminated string */
+#define UDB_COLUMN_INT16   1
+#define UDB_COLUMN_INT32   2
+#define UDB_COLUMN_INT64   3
+#define UDB_COLUMN_FLOAT   4 /* IEEE 754 single precision */
+#define UDB_COLUMN_DOUBLE  5 /* IEEE 754 double precision */
+
 /* 
  * Public functions
  */
@@ -65,13 +74,26 @@ void *udb_query_get_user_data (udb_query_t *q);
  */
 int udb_query_check_version (udb_query_t *q, unsigned int version);
 
-int udb_query_prepare_result (const udb_query_t const *q,
+int udb_query_prepare_result (const udb_query_t *q,
     udb_query_preparation_area_t *prep_area,
     const char *host, const char *plugin, const char *db_name,
     char **column_names, size_t column_num, cdtime_t interval);
-int udb_query_handle_result (const udb_query_t const *q,
+int udb_query_handle_result (const udb_query_t *q,
     udb_query_preparation_area_t *prep_area, char **column_values);
-void udb_query_finish_result (const udb_query_t const *q,
+/*
+ * udb_query_handle_results
+ *
+ * Handles "rows_num" rows at once. "column_values" holds the values of all
+ * rows one after another, i.e. column "j" of row "i" is found at
+ * column_values[i * column_num + j]. If one of the columns a result uses is
+ * NULL, the result silently skips that row. "column_types" gives the
+ * UDB_COLUMN_* type of each column; if it is NULL, all columns are strings.
+ * Returns zero unless rows failed and none could be handled.
+ */
+int udb_query_handle_results (const udb_query_t *q,
+    udb_query_preparation_area_t *prep_area, char **column_values,
+    const int *column_types, size_t rows_num);
+void udb_query_finish_result (const udb_query_t *q,
     udb_query_preparation_area_t *prep_area);
 
 udb_query_preparation_area_t *
@@ -161,10 +161,6 @@ typedef int (printer)(const char *, ...);
 /*
  * Global variables
  */
-int qtype_counts[T_MAX];
-int opcode_counts[OP_MAX];
-int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 static pcap_t *pcap_obj = NULL;
 #endif
@@ -173,14 +169,6 @@ static ip_list_t *IgnoreList = NULL;
 
 #if HAVE_PCAP_H
 static void (*Callback) (const rfc1035_header_t *) = NULL;
-
-static int query_count_intvl = 0;
-static int query_count_total = 0;
-# ifdef __OpenBSD__
-static struct bpf_timeval last_ts;
-# else
-static struct timeval last_ts;
-# endif /* __OpenBSD__ */
 #endif /* HAVE_PCAP_H */
 
 static int cmp_in6_addr (const struct in6_addr *a,
@@ -290,14 +278,16 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *))
 }
 
 #define RFC1035_MAXLABELSZ 63
+/* "loop_detect" is the number of compression pointers followed so far. It is
+ * passed along instead of being kept in a static variable, so packets can be
+ * handled by several threads at once. */
 static int
-rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
-)
+rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns,
+	int loop_detect)
 {
     off_t no = 0;
     unsigned char c;
     size_t len;
-    static int loop_detect = 0;
     if (loop_detect > 2)
 	return 4;		/* compression loop */
     if (ns <= 0)
@@ -323,9 +313,8 @@ rfc1035NameUnpack(const char *buf, size_t sz, off_t * off, char *name, size_t ns
 		return 2;	/* bad compression ptr */
 	    if (ptr < DNS_MSG_HDR_SZ)
 		return 2;	/* bad compression ptr */
-	    loop_detect++;
-	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no);
-	    loop_detect--;
+	    rc = rfc1035NameUnpack(buf, sz, &ptr, name + no, ns - no,
+		    loop_detect + 1);
 	    return rc;
 	} else if (c > RFC1035_MAXLABELSZ) {
 	    /*
@@ -400,7 +389,8 @@ handle_dns(const char *buf, int len)
 
     offset = DNS_MSG_HDR_SZ;
     memset(qh.qname, '\0', MAX_QNAME_SZ);
-    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ);
+    status = rfc1035NameUnpack(buf, len, &offset, qh.qname, MAX_QNAME_SZ,
+	    /* loop_detect = */ 0);
     if (status != 0)
     {
 	INFO ("utils_dns: handle_dns: rfc1035NameUnpack failed "
@@ -423,11 +413,6 @@ handle_dns(const char *buf, int len)
 
     qh.length = (uint16_t) len;
 
-    /* gather stats */
-    qtype_counts[qh.qtype]++;
-    qclass_counts[qh.qclass]++;
-    opcode_counts[qh.opcode]++;
-
     if (Callback != NULL)
 	    Callback (&qh);
 
@@ -676,53 +661,54 @@ handle_linux_sll (const u_char *pkt, int len)
 /* public function */
 void handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr, const u_char *pkt)
 {
-    int status;
-
     if (hdr->caplen < ETHER_HDR_LEN)
 	return;
 
     switch (pcap_datalink (pcap_obj))
     {
 	case DLT_EN10MB:
-	    status = handle_ether (pkt, hdr->caplen);
+	    handle_ether (pkt, hdr->caplen);
 	    break;
 #if HAVE_NET_IF_PPP_H
 	case DLT_PPP:
-	    status = handle_ppp (pkt, hdr->caplen);
+	    handle_ppp (pkt, hdr->caplen);
 	    break;
 #endif
 #ifdef DLT_LOOP
 	case DLT_LOOP:
-	    status = handle_loop (pkt, hdr->caplen);
+	    handle_loop (pkt, hdr->caplen);
 	    break;
 #endif
 #ifdef DLT_RAW
 	case DLT_RAW:
-	    status = handle_raw (pkt, hdr->caplen);
+	    handle_raw (pkt, hdr->caplen);
 	    break;
 #endif
 #ifdef DLT_LINUX_SLL
 	case DLT_LINUX_SLL:
-	    status = handle_linux_sll (pkt, hdr->caplen);
+	    handle_linux_sll (pkt, hdr->caplen);
 	    break;
 #endif
 	case DLT_NULL:
-	    status = handle_null (pkt, hdr->caplen);
+	    handle_null (pkt, hdr->caplen);
 	    break;
 
 	default:
 	    ERROR ("handle_pcap: unsupported data link type %d",
 		    pcap_datalink(pcap_obj));
-	    status = 0;
 	    break;
     } /* switch (pcap_datalink(pcap_obj)) */
+}
 
-    if (0 == status)
+/* public function */
+void handle_ip_packet (const u_char *pkt, int len)
+{
+    if ((0 > len) || ((unsigned int) len < sizeof (struct ip)))
 	return;
+    if (len > PCAP_SNAPLEN)
+	len = PCAP_SNAPLEN;
 
-    query_count_intvl++;
-    query_count_total++;
-    last_ts = hdr->ts;
+    handle_ip ((struct ip *) pkt, len);
 }
 #endif /* HAVE_PCAP_H */
 
@@ -0,0 +1,263 @@
+/**
+ * collectd - src/utils_hashtable.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils_hashtable.h"
+
+#define C_HT_SIZE_MIN 64
+
+/*
+ * Private data types
+ */
+struct c_ht_node_s;
+typedef struct c_ht_node_s c_ht_node_t;
+struct c_ht_node_s
+{
+	char *key;
+	void *value;
+	unsigned int hash;
+	c_ht_node_t *next;
+};
+
+struct c_hashtable_s
+{
+	c_ht_node_t **buckets;
+	size_t size;
+	size_t num;
+};
+
+/*
+ * Private functions
+ */
+/* FNV-1a */
+static unsigned int c_ht_hash (const char *key)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *key != 0; key++)
+	{
+		hash ^= (unsigned char) *key;
+		hash *= 16777619U;
+	}
+
+	return (hash);
+} /* unsigned int c_ht_hash */
+
+/* Doubles the number of buckets. Failing to grow is not fatal, the chains
+ * just get longer. */
+static void c_ht_grow (c_hashtable_t *t)
+{
+	c_ht_node_t **buckets;
+	size_t size;
+	size_t i;
+
+	size = 2 * t->size;
+	buckets = (c_ht_node_t **) calloc (size, sizeof (*buckets));
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < t->size; i++)
+	{
+		while (t->buckets[i] != NULL)
+		{
+			c_ht_node_t *n = t->buckets[i];
+
+			t->buckets[i] = n->next;
+			n->next = buckets[n->hash % size];
+			buckets[n->hash % size] = n;
+		}
+	}
+
+	free (t->buckets);
+	t->buckets = buckets;
+	t->size = size;
+} /* void c_ht_grow */
+
+static c_ht_node_t **c_ht_search (c_hashtable_t *t, const char *key)
+{
+	c_ht_node_t **prev;
+	unsigned int hash;
+
+	hash = c_ht_hash (key);
+	for (prev = t->buckets + (hash % t->size);
+			*prev != NULL;
+			prev = &(*prev)->next)
+		if (((*prev)->hash == hash) && (strcmp (key, (*prev)->key) == 0))
+			return (prev);
+
+	return (NULL);
+} /* c_ht_node_t **c_ht_search */
+
+/*
+ * Public functions
+ */
+c_hashtable_t *c_ht_create (void)
+{
+	c_hashtable_t *t;
+
+	t = (c_hashtable_t *) malloc (sizeof (*t));
+	if (t == NULL)
+		return (NULL);
+
+	t->buckets = (c_ht_node_t **) calloc (C_HT_SIZE_MIN,
+			sizeof (*t->buckets));
+	if (t->buckets == NULL)
+	{
+		free (t);
+		return (NULL);
+	}
+	t->size = C_HT_SIZE_MIN;
+	t->num = 0;
+
+	return (t);
+} /* c_hashtable_t *c_ht_create */
+
+void c_ht_destroy (c_hashtable_t *t)
+{
+	size_t i;
+
+	if (t == NULL)
+		return;
+
+	for (i = 0; i < t->size; i++)
+	{
+		while (t->buckets[i] != NULL)
+		{
+			c_ht_node_t *n = t->buckets[i];
+
+			t->buckets[i] = n->next;
+			free (n);
+		}
+	}
+
+	free (t->buckets);
+	free (t);
+} /* void c_ht_destroy */
+
+int c_ht_insert (c_hashtable_t *t, char *key, void *value)
+{
+	c_ht_node_t *n;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	if (c_ht_search (t, key) != NULL)
+		return (1);
+
+	n = (c_ht_node_t *) malloc (sizeof (*n));
+	if (n == NULL)
+		return (-1);
+
+	if (t->num >= t->size)
+		c_ht_grow (t);
+
+	n->key = key;
+	n->value = value;
+	n->hash = c_ht_hash (key);
+	n->next = t->buckets[n->hash % t->size];
+	t->buckets[n->hash % t->size] = n;
+	t->num++;
+
+	return (0);
+} /* int c_ht_insert */
+
+int c_ht_get (c_hashtable_t *t, const char *key, void **value)
+{
+	c_ht_node_t **prev;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	prev = c_ht_search (t, key);
+	if (prev == NULL)
+		return (-1);
+
+	if (value != NULL)
+		*value = (*prev)->value;
+
+	return (0);
+} /* int c_ht_get */
+
+int c_ht_remove (c_hashtable_t *t, const char *key,
+		char **rkey, void **rvalue)
+{
+	c_ht_node_t **prev;
+	c_ht_node_t *n;
+
+	if ((t == NULL) || (key == NULL))
+		return (-1);
+
+	prev = c_ht_search (t, key);
+	if (prev == NULL)
+		return (-1);
+
+	n = *prev;
+	*prev = n->next;
+	t->num--;
+
+	if (rkey != NULL)
+		*rkey = n->key;
+	if (rvalue != NULL)
+		*rvalue = n->value;
+	free (n);
+
+	return (0);
+} /* int c_ht_remove */
+
+int c_ht_sweep (c_hashtable_t *t,
+		int (*callback) (char *key, void *value, void *user_data),
+		void *user_data)
+{
+	size_t i;
+	int removed = 0;
+
+	if ((t == NULL) || (callback == NULL))
+		return (0);
+
+	for (i = 0; i < t->size; i++)
+	{
+		c_ht_node_t **prev = t->buckets + i;
+
+		while (*prev != NULL)
+		{
+			c_ht_node_t *n = *prev;
+
+			if ((*callback) (n->key, n->value, user_data) == 0)
+			{
+				prev = &n->next;
+				continue;
+			}
+
+			*prev = n->next;
+			t->num--;
+			free (n);
+			removed++;
+		}
+	}
+
+	return (removed);
+} /* int c_ht_sweep */
+
+int c_ht_size (c_hashtable_t *t)
+{
+	if (t == NULL)
+		return (0);
+	return ((int) t->num);
+} /* int c_ht_size */
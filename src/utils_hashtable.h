@@ -0,0 +1,123 @@
+/**
+ * collectd - src/utils_hashtable.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_HASHTABLE_H
+#define UTILS_HASHTABLE_H 1
+
+/*
+ * A hash table with string keys. Unlike the AVL tree it is unordered, but
+ * lookups are done in constant time, which matters for plugins looking up
+ * thousands of devices per read. Like with the AVL tree, keys and values are
+ * owned by the caller. The table is not thread safe.
+ */
+struct c_hashtable_s;
+typedef struct c_hashtable_s c_hashtable_t;
+
+/*
+ * NAME
+ *   c_ht_create
+ *
+ * DESCRIPTION
+ *   Allocates a new, empty hash table. The table grows as entries are
+ *   inserted.
+ *
+ * RETURN VALUE
+ *   A c_hashtable_t-pointer upon success or NULL upon failure.
+ */
+c_hashtable_t *c_ht_create (void);
+
+/*
+ * NAME
+ *   c_ht_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a hash table. Stored keys and values are NOT freed. Use
+ *   `c_ht_sweep' to free them first.
+ */
+void c_ht_destroy (c_hashtable_t *t);
+
+/*
+ * NAME
+ *   c_ht_insert
+ *
+ * DESCRIPTION
+ *   Stores the key-value-pair in the table. The key is not copied and must
+ *   stay valid until the entry is removed.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise. It's less than zero if an error
+ *   occurred or greater than zero if the key is already stored in the table.
+ */
+int c_ht_insert (c_hashtable_t *t, char *key, void *value);
+
+/*
+ * NAME
+ *   c_ht_get
+ *
+ * DESCRIPTION
+ *   Retrieves the `value' belonging to `key'. `value' may be NULL.
+ *
+ * RETURN VALUE
+ *   If the key was found zero is returned and `value' is set to the stored
+ *   value. If the key was not found, or an error occurred, less than zero is
+ *   returned.
+ */
+int c_ht_get (c_hashtable_t *t, const char *key, void **value);
+
+/*
+ * NAME
+ *   c_ht_remove
+ *
+ * DESCRIPTION
+ *   Removes the entry for `key' from the table and returns the stored key
+ *   and value in `rkey' and `rvalue', so they can be freed. Both may be
+ *   NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success or less than zero if the key isn't stored in the
+ *   table.
+ */
+int c_ht_remove (c_hashtable_t *t, const char *key,
+		char **rkey, void **rvalue);
+
+/*
+ * NAME
+ *   c_ht_sweep
+ *
+ * DESCRIPTION
+ *   Calls `callback' for each entry and removes the entries for which it
+ *   returns non-zero. The callback is responsible for freeing the key and
+ *   value of removed entries. It must not modify the table.
+ *
+ * RETURN VALUE
+ *   The number of entries removed.
+ */
+int c_ht_sweep (c_hashtable_t *t,
+		int (*callback) (char *key, void *value, void *user_data),
+		void *user_data);
+
+/*
+ * NAME
+ *   c_ht_size
+ *
+ * RETURN VALUE
+ *   The number of entries in the table.
+ */
+int c_ht_size (c_hashtable_t *t);
+
+#endif /* UTILS_HASHTABLE_H */
@@ -0,0 +1,112 @@
+/**
+ * collectd - src/utils_latency.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include <math.h>
+#include <string.h>
+
+#include "utils_latency.h"
+
+#ifndef NAN
+# define NAN (0.0 / 0.0)
+#endif
+
+size_t latency_hist_index (uint64_t value)
+{
+	uint64_t tmp;
+	size_t msb;
+
+	if (value < LATENCY_HIST_LINEAR)
+		return ((size_t) value);
+
+	msb = 0;
+	for (tmp = value >> 1; tmp != 0; tmp >>= 1)
+		msb++;
+
+	return (LATENCY_HIST_LINEAR
+			+ (msb - 4) * (1 << LATENCY_HIST_SUB_BITS)
+			+ ((value >> (msb - LATENCY_HIST_SUB_BITS))
+				& ((1 << LATENCY_HIST_SUB_BITS) - 1)));
+} /* size_t latency_hist_index */
+
+double latency_hist_value (size_t index)
+{
+	size_t exp;
+	size_t sub;
+	uint64_t lower;
+	uint64_t width;
+
+	if (index < LATENCY_HIST_LINEAR)
+		return ((double) index);
+
+	exp = ((index - LATENCY_HIST_LINEAR) >> LATENCY_HIST_SUB_BITS) + 4;
+	sub = (index - LATENCY_HIST_LINEAR) & ((1 << LATENCY_HIST_SUB_BITS) - 1);
+
+	width = ((uint64_t) 1) << (exp - LATENCY_HIST_SUB_BITS);
+	lower = ((uint64_t) ((1 << LATENCY_HIST_SUB_BITS) + sub)) * width;
+
+	return (((double) lower) + ((double) width) / 2.0);
+} /* double latency_hist_value */
+
+void latency_hist_reset (latency_histogram_t *h)
+{
+	memset (h, 0, sizeof (*h));
+} /* void latency_hist_reset */
+
+void latency_hist_add (latency_histogram_t *h, uint64_t value)
+{
+	h->buckets[latency_hist_index (value)]++;
+	h->num++;
+} /* void latency_hist_add */
+
+void latency_hist_merge (latency_histogram_t *dst,
+		const latency_histogram_t *src)
+{
+	size_t i;
+
+	if (src->num == 0)
+		return;
+
+	for (i = 0; i < LATENCY_HIST_SIZE; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->num += src->num;
+} /* void latency_hist_merge */
+
+double latency_hist_percentile (const latency_histogram_t *h,
+		double percent)
+{
+	uint64_t rank;
+	uint64_t sum;
+	size_t i;
+
+	if (h->num == 0)
+		return (NAN);
+
+	rank = (uint64_t) ((((double) h->num) * percent / 100.0) + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	sum = 0;
+	for (i = 0; i < LATENCY_HIST_SIZE; i++)
+	{
+		sum += h->buckets[i];
+		if (sum >= rank)
+			return (latency_hist_value (i));
+	}
+
+	return (NAN);
+} /* double latency_hist_percentile */
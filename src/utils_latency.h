@@ -0,0 +1,101 @@
+/**
+ * collectd - src/utils_latency.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_LATENCY_H
+#define UTILS_LATENCY_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A log-linear histogram of latencies. Values below 16 have a bucket of
+ * their own, larger values are sorted into eight buckets per power of two,
+ * so percentiles are accurate to 12.5%. The unit of the values is up to the
+ * caller. Histograms have a fixed size and need no allocation, so they can
+ * be embedded into per-thread structures and merged when reading.
+ */
+#define LATENCY_HIST_LINEAR   16
+#define LATENCY_HIST_SUB_BITS  3
+#define LATENCY_HIST_SIZE     (LATENCY_HIST_LINEAR \
+		+ (64 - 4) * (1 << LATENCY_HIST_SUB_BITS))
+
+struct latency_histogram_s
+{
+	uint64_t num;
+	uint64_t buckets[LATENCY_HIST_SIZE];
+};
+typedef struct latency_histogram_s latency_histogram_t;
+
+/*
+ * NAME
+ *   latency_hist_index
+ *
+ * RETURN VALUE
+ *   The index of the bucket `value' is counted in.
+ */
+size_t latency_hist_index (uint64_t value);
+
+/*
+ * NAME
+ *   latency_hist_value
+ *
+ * RETURN VALUE
+ *   The center of the bucket `index'.
+ */
+double latency_hist_value (size_t index);
+
+/*
+ * NAME
+ *   latency_hist_reset
+ *
+ * DESCRIPTION
+ *   Removes all values from the histogram.
+ */
+void latency_hist_reset (latency_histogram_t *h);
+
+/*
+ * NAME
+ *   latency_hist_add
+ *
+ * DESCRIPTION
+ *   Counts `value' in the histogram.
+ */
+void latency_hist_add (latency_histogram_t *h, uint64_t value);
+
+/*
+ * NAME
+ *   latency_hist_merge
+ *
+ * DESCRIPTION
+ *   Adds the values counted in `src' to `dst'.
+ */
+void latency_hist_merge (latency_histogram_t *dst,
+		const latency_histogram_t *src);
+
+/*
+ * NAME
+ *   latency_hist_percentile
+ *
+ * RETURN VALUE
+ *   The value below which `percent' percent of the values in the histogram
+ *   are, or NAN if the histogram is empty.
+ */
+double latency_hist_percentile (const latency_histogram_t *h,
+		double percent);
+
+#endif /* UTILS_LATENCY_H */
@@ -0,0 +1,252 @@
+/**
+ * collectd - src/utils_procfs.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "utils_procfs.h"
+
+#define PROCFS_BUFFER_SIZE_MIN 4096
+
+/*
+ * Data types
+ */
+struct procfs_file_s
+{
+  char   *path;
+  int     fd;
+
+  char   *buffer;
+  size_t  buffer_size;
+  size_t  buffer_fill;
+
+  /* Position of the next line returned by procfs_next_line. */
+  size_t  cursor;
+};
+
+/*
+ * Private functions
+ */
+static int procfs_reopen (procfs_file_t *pf) /* {{{ */
+{
+  if (pf->fd >= 0)
+    close (pf->fd);
+
+  pf->fd = open (pf->path, O_RDONLY);
+  if (pf->fd < 0)
+    return (-1);
+
+  return (0);
+} /* }}} int procfs_reopen */
+
+/*
+ * Public functions
+ */
+procfs_file_t *procfs_open (const char *path) /* {{{ */
+{
+  procfs_file_t *pf;
+
+  if (path == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  pf = (procfs_file_t *) malloc (sizeof (*pf));
+  if (pf == NULL)
+    return (NULL);
+  memset (pf, 0, sizeof (*pf));
+  pf->fd = -1;
+
+  pf->path = strdup (path);
+  pf->buffer_size = PROCFS_BUFFER_SIZE_MIN;
+  pf->buffer = (char *) malloc (pf->buffer_size);
+  if ((pf->path == NULL) || (pf->buffer == NULL))
+  {
+    procfs_close (pf);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  if (procfs_reopen (pf) != 0)
+  {
+    int saved_errno = errno;
+    procfs_close (pf);
+    errno = saved_errno;
+    return (NULL);
+  }
+
+  return (pf);
+} /* }}} procfs_file_t *procfs_open */
+
+void procfs_close (procfs_file_t *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return;
+
+  if (pf->fd >= 0)
+    close (pf->fd);
+  free (pf->path);
+  free (pf->buffer);
+  free (pf);
+} /* }}} void procfs_close */
+
+ssize_t procfs_read (procfs_file_t *pf) /* {{{ */
+{
+  _Bool reopened = 0;
+  ssize_t status;
+
+  if (pf == NULL)
+  {
+    errno = EINVAL;
+    return (-1);
+  }
+
+  pf->buffer_fill = 0;
+  pf->cursor = 0;
+
+  while (42)
+  {
+    /* Leave room for the terminating null byte. */
+    if ((pf->buffer_size - pf->buffer_fill) < 2)
+    {
+      char *tmp;
+
+      tmp = (char *) realloc (pf->buffer, 2 * pf->buffer_size);
+      if (tmp == NULL)
+      {
+        errno = ENOMEM;
+        return (-1);
+      }
+      pf->buffer = tmp;
+      pf->buffer_size *= 2;
+    }
+
+    status = pread (pf->fd, pf->buffer + pf->buffer_fill,
+        pf->buffer_size - pf->buffer_fill - 1, (off_t) pf->buffer_fill);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      /* The file may have been replaced, e.g. because a module was
+       * reloaded. Try opening it again, but only once per read. */
+      if (reopened || (procfs_reopen (pf) != 0))
+        return (-1);
+      reopened = 1;
+      pf->buffer_fill = 0;
+      continue;
+    }
+    else if (status == 0)
+      break;
+
+    pf->buffer_fill += (size_t) status;
+  }
+
+  pf->buffer[pf->buffer_fill] = 0;
+  return ((ssize_t) pf->buffer_fill);
+} /* }}} ssize_t procfs_read */
+
+char *procfs_next_line (procfs_file_t *pf) /* {{{ */
+{
+  char *line;
+  char *end;
+
+  if ((pf == NULL) || (pf->cursor >= pf->buffer_fill))
+    return (NULL);
+
+  line = pf->buffer + pf->cursor;
+  end = memchr (line, '\n', pf->buffer_fill - pf->cursor);
+  if (end == NULL)
+  {
+    /* Last line without a trailing newline. */
+    pf->cursor = pf->buffer_fill;
+    return (line);
+  }
+
+  *end = 0;
+  pf->cursor = (size_t) (end - pf->buffer) + 1;
+
+  return (line);
+} /* }}} char *procfs_next_line */
+
+int procfs_split (char *line, char **fields, size_t size) /* {{{ */
+{
+  size_t i = 0;
+  char *ptr = line;
+
+  if ((line == NULL) || (fields == NULL) || (size < 1))
+    return (0);
+
+  while (i < size)
+  {
+    while ((*ptr == ' ') || (*ptr == '\t') || (*ptr == '\r') || (*ptr == '\n'))
+      ptr++;
+    if (*ptr == 0)
+      break;
+
+    fields[i] = ptr;
+    i++;
+
+    while ((*ptr != 0) && (*ptr != ' ') && (*ptr != '\t')
+        && (*ptr != '\r') && (*ptr != '\n'))
+      ptr++;
+    if (*ptr == 0)
+      break;
+
+    *ptr = 0;
+    ptr++;
+  }
+
+  return ((int) i);
+} /* }}} int procfs_split */
+
+uint64_t procfs_atoull (const char *str) /* {{{ */
+{
+  uint64_t ret = 0;
+
+  if (str == NULL)
+    return (0);
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+
+  while ((*str >= '0') && (*str <= '9'))
+  {
+    ret = (10 * ret) + (uint64_t) (*str - '0');
+    str++;
+  }
+
+  return (ret);
+} /* }}} uint64_t procfs_atoull */
+
+int64_t procfs_atoll (const char *str) /* {{{ */
+{
+  if (str == NULL)
+    return (0);
+
+  while ((*str == ' ') || (*str == '\t'))
+    str++;
+
+  if (*str == '-')
+    return (-1 * (int64_t) procfs_atoull (str + 1));
+  else if (*str == '+')
+    str++;
+
+  return ((int64_t) procfs_atoull (str));
+} /* }}} int64_t procfs_atoll */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,90 @@
+/**
+ * collectd - src/utils_procfs.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_PROCFS_H
+#define UTILS_PROCFS_H 1
+
+#include "collectd.h"
+
+/*
+ * Data types
+ */
+struct procfs_file_s;
+typedef struct procfs_file_s procfs_file_t;
+
+/*
+ * Public functions
+ */
+/*
+ * procfs_open
+ *
+ * Opens the file "path", which is usually below /proc or /sys. The file is
+ * kept open and re-read from the beginning by each call to `procfs_read', so
+ * the usual open/read/close sequence is replaced by one pread(2) per
+ * interval. Returns NULL and sets errno on failure.
+ */
+procfs_file_t *procfs_open (const char *path);
+
+/*
+ * procfs_close
+ *
+ * Closes the file and frees the buffer. NULL is ignored.
+ */
+void procfs_close (procfs_file_t *pf);
+
+/*
+ * procfs_read
+ *
+ * Reads the complete file into the object's buffer, which is grown as
+ * needed and reused by later calls. Resets the line cursor used by
+ * `procfs_next_line'. Returns the number of bytes read or less than zero
+ * and sets errno on failure.
+ */
+ssize_t procfs_read (procfs_file_t *pf);
+
+/*
+ * procfs_next_line
+ *
+ * Returns the next line of the data read by the last `procfs_read', with
+ * the newline replaced by a null byte, or NULL at the end of the data. The
+ * line may be modified, e.g. by `procfs_split', but is overwritten by the
+ * next `procfs_read'.
+ */
+char *procfs_next_line (procfs_file_t *pf);
+
+/*
+ * procfs_split
+ *
+ * Splits "line" at blanks in place and stores up to "size" pointers to the
+ * fields in "fields". Behaves like `strsplit' without the overhead of
+ * strtok_r(3). Returns the number of fields.
+ */
+int procfs_split (char *line, char **fields, size_t size);
+
+/*
+ * procfs_atoull, procfs_atoll
+ *
+ * Parse a decimal integer, skipping leading blanks. Parsing stops at the
+ * first character that is not a digit; no locale or overflow checks are
+ * done. These replace atoll(3) in the tight loops of the read plugins.
+ */
+uint64_t procfs_atoull (const char *str);
+int64_t procfs_atoll (const char *str);
+
+#endif /* UTILS_PROCFS_H */
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,312 @@
+/**
+ * collectd - src/utils_stats.c
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_stats.h"
+
+#include <pthread.h>
+
+/*
+ * Private data types
+ */
+struct ustats_name_s
+{
+  char type[DATA_MAX_NAME_LEN];
+  char name[DATA_MAX_NAME_LEN];
+};
+typedef struct ustats_name_s ustats_name_t;
+
+/* The counters of one thread. "lock" is only ever contended while the
+ * statistics are being read. */
+struct ustats_slot_s;
+typedef struct ustats_slot_s ustats_slot_t;
+struct ustats_slot_s
+{
+  pthread_mutex_t lock;
+  ustats_counter_t *counters;
+  size_t counters_num;
+
+  ustats_slot_t *next;
+};
+
+/*
+ * Private variables
+ */
+_Bool ustats_enabled = 0;
+
+/* Protects the names, the list of slots and the retired counters. */
+static pthread_mutex_t ustats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ustats_name_t *ustats_names = NULL;
+static size_t ustats_names_num = 0;
+
+static ustats_slot_t *ustats_slots = NULL;
+
+/* Counters of threads which have exited. */
+static ustats_counter_t *ustats_retired = NULL;
+static size_t ustats_retired_num = 0;
+
+static pthread_key_t ustats_key;
+static pthread_once_t ustats_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Private functions
+ */
+/* Makes sure "*counters" has room for at least "num" counters. */
+static int ustats_counters_grow (ustats_counter_t **counters, /* {{{ */
+    size_t *counters_num, size_t num)
+{
+  ustats_counter_t *tmp;
+
+  if (*counters_num >= num)
+    return (0);
+
+  tmp = realloc (*counters, num * sizeof (*tmp));
+  if (tmp == NULL)
+    return (ENOMEM);
+  memset (tmp + *counters_num, 0, (num - *counters_num) * sizeof (*tmp));
+
+  *counters = tmp;
+  *counters_num = num;
+  return (0);
+} /* }}} int ustats_counters_grow */
+
+static void ustats_counters_add (ustats_counter_t *dst, /* {{{ */
+    const ustats_counter_t *src, size_t num)
+{
+  size_t i;
+
+  for (i = 0; i < num; i++)
+  {
+    dst[i].calls += src[i].calls;
+    dst[i].failures += src[i].failures;
+    dst[i].time += src[i].time;
+  }
+} /* }}} void ustats_counters_add */
+
+/* Called when a thread exits: Keeps the thread's counters, so the totals
+ * don't decrease, and frees the slot. */
+static void ustats_slot_destroy (void *arg) /* {{{ */
+{
+  ustats_slot_t *slot = arg;
+  ustats_slot_t *prev;
+
+  pthread_mutex_lock (&ustats_lock);
+
+  if (ustats_slots == slot)
+    ustats_slots = slot->next;
+  else
+  {
+    for (prev = ustats_slots; prev != NULL; prev = prev->next)
+    {
+      if (prev->next == slot)
+      {
+        prev->next = slot->next;
+        break;
+      }
+    }
+  }
+
+  if (ustats_counters_grow (&ustats_retired, &ustats_retired_num,
+        slot->counters_num) == 0)
+    ustats_counters_add (ustats_retired, slot->counters, slot->counters_num);
+
+  pthread_mutex_unlock (&ustats_lock);
+
+  pthread_mutex_destroy (&slot->lock);
+  sfree (slot->counters);
+  sfree (slot);
+} /* }}} void ustats_slot_destroy */
+
+static void ustats_key_create (void) /* {{{ */
+{
+  pthread_key_create (&ustats_key, ustats_slot_destroy);
+} /* }}} void ustats_key_create */
+
+static ustats_slot_t *ustats_get_slot (void) /* {{{ */
+{
+  ustats_slot_t *slot;
+
+  pthread_once (&ustats_key_once, ustats_key_create);
+
+  slot = pthread_getspecific (ustats_key);
+  if (slot != NULL)
+    return (slot);
+
+  slot = calloc (1, sizeof (*slot));
+  if (slot == NULL)
+    return (NULL);
+  pthread_mutex_init (&slot->lock, /* attr = */ NULL);
+
+  if (pthread_setspecific (ustats_key, slot) != 0)
+  {
+    pthread_mutex_destroy (&slot->lock);
+    sfree (slot);
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&ustats_lock);
+  slot->next = ustats_slots;
+  ustats_slots = slot;
+  pthread_mutex_unlock (&ustats_lock);
+
+  return (slot);
+} /* }}} ustats_slot_t *ustats_get_slot */
+
+/*
+ * Public functions
+ */
+int ustats_register (const char *type, const char *name) /* {{{ */
+{
+  ustats_name_t *tmp;
+  size_t i;
+  int id;
+
+  if ((type == NULL) || (name == NULL))
+    return (-1);
+
+  pthread_mutex_lock (&ustats_lock);
+
+  for (i = 0; i < ustats_names_num; i++)
+  {
+    if ((strcmp (type, ustats_names[i].type) == 0)
+        && (strcmp (name, ustats_names[i].name) == 0))
+    {
+      pthread_mutex_unlock (&ustats_lock);
+      return ((int) (i + 1));
+    }
+  }
+
+  tmp = realloc (ustats_names, (ustats_names_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+  {
+    pthread_mutex_unlock (&ustats_lock);
+    ERROR ("ustats_register: realloc failed.");
+    return (-1);
+  }
+  ustats_names = tmp;
+
+  tmp = ustats_names + ustats_names_num;
+  sstrncpy (tmp->type, type, sizeof (tmp->type));
+  sstrncpy (tmp->name, name, sizeof (tmp->name));
+  ustats_names_num++;
+  id = (int) ustats_names_num;
+
+  pthread_mutex_unlock (&ustats_lock);
+  return (id);
+} /* }}} int ustats_register */
+
+void ustats_enable (void) /* {{{ */
+{
+  ustats_enabled = 1;
+} /* }}} void ustats_enable */
+
+void ustats_add (int id, cdtime_t time, _Bool failed) /* {{{ */
+{
+  ustats_slot_t *slot;
+  ustats_counter_t *c;
+
+  if (!ustats_enabled || (id <= 0))
+    return;
+
+  slot = ustats_get_slot ();
+  if (slot == NULL)
+    return;
+
+  pthread_mutex_lock (&slot->lock);
+
+  /* Grow in steps, so threads don't resize their slot for every new
+   * counter. */
+  if (ustats_counters_grow (&slot->counters, &slot->counters_num,
+        (size_t) (id + 15) & ~((size_t) 15)) != 0)
+  {
+    pthread_mutex_unlock (&slot->lock);
+    return;
+  }
+
+  c = slot->counters + (id - 1);
+  c->calls++;
+  if (failed)
+    c->failures++;
+  c->time += time;
+
+  pthread_mutex_unlock (&slot->lock);
+} /* }}} void ustats_add */
+
+int ustats_read (ustats_callback_t callback, void *user_data) /* {{{ */
+{
+  ustats_name_t *names;
+  ustats_counter_t *sums;
+  ustats_slot_t *slot;
+  size_t names_num;
+  size_t i;
+
+  if (callback == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&ustats_lock);
+
+  names_num = ustats_names_num;
+  if (names_num == 0)
+  {
+    pthread_mutex_unlock (&ustats_lock);
+    return (0);
+  }
+
+  names = malloc (names_num * sizeof (*names));
+  sums = calloc (names_num, sizeof (*sums));
+  if ((names == NULL) || (sums == NULL))
+  {
+    pthread_mutex_unlock (&ustats_lock);
+    sfree (names);
+    sfree (sums);
+    ERROR ("ustats_read: malloc failed.");
+    return (ENOMEM);
+  }
+  memcpy (names, ustats_names, names_num * sizeof (*names));
+
+  ustats_counters_add (sums, ustats_retired,
+      (ustats_retired_num < names_num) ? ustats_retired_num : names_num);
+
+  for (slot = ustats_slots; slot != NULL; slot = slot->next)
+  {
+    pthread_mutex_lock (&slot->lock);
+    ustats_counters_add (sums, slot->counters,
+        (slot->counters_num < names_num) ? slot->counters_num : names_num);
+    pthread_mutex_unlock (&slot->lock);
+  }
+
+  pthread_mutex_unlock (&ustats_lock);
+
+  /* The callback may dispatch values, which in turn records statistics, so
+   * it must be called without holding "ustats_lock". */
+  for (i = 0; i < names_num; i++)
+  {
+    if (sums[i].calls == 0)
+      continue;
+    (*callback) (names[i].type, names[i].name, sums + i, user_data);
+  }
+
+  sfree (names);
+  sfree (sums);
+  return (0);
+} /* }}} int ustats_read */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,88 @@
+/**
+ * collectd - src/utils_stats.h
+ * Copyright (C) 2012  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_STATS_H
+#define UTILS_STATS_H 1
+
+#include "collectd.h"
+#include "utils_time.h"
+
+/*
+ * Internal statistics of the daemon, such as the time spent in each read and
+ * write callback. Every thread accumulates its counters in a slot of its own,
+ * so recording a measurement doesn't contend with other threads. The slots
+ * are only summed up when the statistics are read.
+ */
+
+/*
+ * Data types
+ */
+struct ustats_counter_s
+{
+  uint64_t calls;
+  uint64_t failures;
+  cdtime_t time;
+};
+typedef struct ustats_counter_s ustats_counter_t;
+
+typedef int (*ustats_callback_t) (const char *type, const char *name,
+    const ustats_counter_t *counter, void *user_data);
+
+/* Recording is disabled until ustats_enable() is called. Callers check this
+ * before taking any timestamps. */
+extern _Bool ustats_enabled;
+
+/*
+ * Public functions
+ */
+/*
+ * ustats_register
+ *
+ * Returns the ID of the counter identified by "type" and "name", for example
+ * "write" and "rrdtool", creating it if necessary. IDs are greater than zero.
+ * Registering the same counter twice returns the same ID. Returns -1 on
+ * failure.
+ */
+int ustats_register (const char *type, const char *name);
+
+/*
+ * ustats_enable
+ *
+ * Starts recording measurements. Called by the plugin reporting the
+ * statistics.
+ */
+void ustats_enable (void);
+
+/*
+ * ustats_add
+ *
+ * Adds one call taking "time" to the counter "id". Does nothing if recording
+ * is disabled or "id" is not a valid ID.
+ */
+void ustats_add (int id, cdtime_t time, _Bool failed);
+
+/*
+ * ustats_read
+ *
+ * Sums up the slots of all threads and calls "callback" for each counter
+ * which has been used at least once. The callback may dispatch values.
+ */
+int ustats_read (ustats_callback_t callback, void *user_data);
+
+#endif /* UTILS_STATS_H */
+/* vim: set sw=2 sts=2 et fdm=marker : */
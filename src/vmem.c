@@ -24,6 +24,8 @@
 #include "plugin.h"
 
 #if KERNEL_LINUX
+# include "utils_procfs.h"
+
 static const char *config_keys[] =
 {
   "Verbose"
@@ -31,6 +33,8 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int verbose_output = 0;
+
+static procfs_file_t *pf_vmstat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -105,42 +109,49 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  char *line;
+
+  if ((pf_vmstat == NULL)
+      && ((pf_vmstat = procfs_open ("/proc/vmstat")) == NULL))
+  {
+    char errbuf[1024];
+    ERROR ("vmem plugin: procfs_open (/proc/vmstat) failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  if (procfs_read (pf_vmstat) < 0)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
+    ERROR ("vmem plugin: procfs_read (/proc/vmstat) failed: %s",
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while ((line = procfs_next_line (pf_vmstat)) != NULL)
   {
     char *fields[4];
     int fields_num;
     char *key;
-    char *endptr;
+    char *value_str;
     derive_t counter;
     gauge_t gauge;
 
-    fields_num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+    fields_num = procfs_split (line, fields, STATIC_ARRAY_SIZE (fields));
     if (fields_num != 2)
       continue;
 
     key = fields[0];
 
-    endptr = NULL;
-    counter = strtoll (fields[1], &endptr, 10);
-    if (fields[1] == endptr)
+    /* All values in this file are integers. */
+    value_str = fields[1];
+    if (*value_str == '-')
+      value_str++;
+    if ((*value_str < '0') || (*value_str > '9'))
       continue;
 
-    endptr = NULL;
-    gauge = strtod (fields[1], &endptr);
-    if (fields[1] == endptr)
-      continue;
+    counter = procfs_atoll (fields[1]);
+    gauge = (gauge_t) counter;
 
     /* 
      * Number of pages
@@ -254,10 +265,7 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose (fh);
-  fh = NULL;
+  } /* while (procfs_next_line) */
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);